@@ -0,0 +1,156 @@
+#include "RippleAutoTune.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#ifndef M_SQRT2
+#define M_SQRT2 1.41421356237309504880
+#endif
+
+constexpr int RippleAutoTuner::candidateSamples[];
+
+void RippleAutoTuner::prepare(double newSampleRate, int maxSamples) {
+  sampleRate = newSampleRate;
+  for (int c = 0; c < numCandidates; c++) {
+    filterBanks[c].prepare(sampleRate);
+    // Partial windows at block ends add a few more values
+    const size_t capacity = (size_t)maxSamples / candidateSamples[c] * 2 + 64;
+    rmsValues[c].clear();
+    rmsValues[c].reserve(capacity);
+  }
+  running = false;
+}
+
+void RippleAutoTuner::start(bool newFilterBankEnabled) {
+  // A previous run's results not yet taken are superseded
+  resultsReady.store(false, std::memory_order_release);
+  filterBankEnabled = newFilterBankEnabled;
+  for (int c = 0; c < numCandidates; c++) {
+    filterBanks[c].reset();
+    rmsValues[c].clear();
+    costSeconds[c] = 0.0;
+  }
+  blockSeconds = 0.0;
+  running = sampleRate > 0.0;
+}
+
+void RippleAutoTuner::pushBlock(const float *const *channels, int numChannels,
+                                int numSamples) {
+  if (!running || numSamples <= 0)
+    return;
+  blockSeconds += numSamples / sampleRate;
+
+  for (int c = 0; c < numCandidates; c++) {
+    // Windows are cut at the block end, as in processWindows()
+    const int windowSamples = std::min(candidateSamples[c], numSamples);
+    std::vector<double> &values = rmsValues[c];
+    double otherSums = 0.0;
+
+    const auto begin = std::chrono::steady_clock::now();
+    for (int start = 0; start < numSamples; start += windowSamples) {
+      const int count = std::min(windowSamples, numSamples - start);
+
+      double rms;
+      if (filterBankEnabled) {
+        rms = filterBanks[c].processWindow(channels[0] + start, count)
+                  .rippleRms;
+      } else {
+        double sum = 0.0;
+        for (int t = 0; t < count; t++)
+          sum += channels[0][start + t] * channels[0][start + t];
+        rms = std::sqrt(sum / count);
+      }
+      for (int ch = 1; ch < numChannels; ch++) {
+        double sum = 0.0;
+        for (int t = 0; t < count; t++)
+          sum += channels[ch][start + t] * channels[ch][start + t];
+        otherSums += sum;
+      }
+
+      // Stops growing at the reserved size rather than allocate
+      if (values.size() < values.capacity())
+        values.push_back(rms);
+    }
+    costSeconds[c] += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - begin)
+                          .count();
+
+    // Keeps the reference sums from being optimised away
+    if (otherSums < 0.0)
+      costSeconds[c] = 0.0;
+  }
+}
+
+void RippleAutoTuner::finish(double rippleSds, int timeThresholdSamples,
+                             double cpuBudget, double falsePerMinuteTarget) {
+  if (!running)
+    return;
+  running = false;
+
+  chosen = -1;
+  for (int c = 0; c < numCandidates; c++) {
+    RippleTuneCandidate &result = results[c];
+    std::vector<double> &values = rmsValues[c];
+    const int windowSamples = candidateSamples[c];
+
+    result = RippleTuneCandidate();
+    result.windowSamples = windowSamples;
+    result.costFraction =
+        blockSeconds > 0.0 ? costSeconds[c] / blockSeconds : 0.0;
+    if (values.size() < 2)
+      continue;
+
+    // Baseline as in finishCalibration()
+    double sum = 0.0;
+    for (double value : values)
+      sum += value;
+    result.rmsMean = sum / values.size();
+    double squares = 0.0;
+    for (double value : values)
+      squares += (value - result.rmsMean) * (value - result.rmsMean);
+    result.rmsStdDev = std::sqrt(squares / (values.size() - 1.0));
+
+    // Chance crossings of the noise alone. Its spread is taken from the
+    // median absolute deviation, which the ripples in the calibration barely
+    // move, and consecutive windows are taken as independent
+    const double threshold = result.rmsMean + rippleSds * result.rmsStdDev;
+    const size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    const double median = values[middle];
+    for (double &value : values)
+      value = std::fabs(value - median);
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    const double noiseStdDev = 1.4826 * values[middle];
+
+    const int windows = timeThresholdSamples / windowSamples + 1;
+    const double exceedance =
+        noiseStdDev > 0.0
+            ? 0.5 * std::erfc((threshold - median) / (noiseStdDev * M_SQRT2))
+            : (threshold > median ? 0.0 : 1.0);
+    result.falsePerMinute = 60.0 * sampleRate / windowSamples *
+                            std::pow(exceedance, windows) *
+                            (1.0 - exceedance);
+
+    // A detection is known at the end of the window that crosses the time
+    // threshold
+    result.latencyMs = 1000.0 * windows * windowSamples / sampleRate;
+
+    result.meetsBudget = result.costFraction <= cpuBudget;
+    result.meetsFalseTarget = result.falsePerMinute <= falsePerMinuteTarget;
+    // Ties go to the longer window, which has fewer windows to evaluate
+    if (result.meetsBudget && result.meetsFalseTarget &&
+        (chosen < 0 || result.latencyMs <= results[chosen].latencyMs))
+      chosen = c;
+  }
+
+  resultsReady.store(true, std::memory_order_release);
+}
+
+bool RippleAutoTuner::takeResults(std::vector<RippleTuneCandidate> &candidates,
+                                  int &chosenIndex) {
+  if (!resultsReady.exchange(false, std::memory_order_acquire))
+    return false;
+  candidates.assign(results, results + numCandidates);
+  chosenIndex = chosen;
+  return true;
+}
@@ -0,0 +1,83 @@
+#ifndef __RIPPLE_AUTO_TUNE_H
+#define __RIPPLE_AUTO_TUNE_H
+
+#include "RippleFilterBank.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/** Measurements of one candidate RMS window length */
+struct RippleTuneCandidate {
+  int windowSamples{0};
+  double costFraction{0.0};   // Feature pass time over the block duration
+  double rmsMean{0.0};        // Baseline of the window RMS
+  double rmsStdDev{0.0};
+  double falsePerMinute{0.0}; // Detections expected from the noise alone
+  double latencyMs{0.0};      // Time threshold rounded up to whole windows
+  bool meetsBudget{false};
+  bool meetsFalseTarget{false};
+};
+
+/**
+  Window length auto-tuner, run alongside a calibration.
+
+  Every calibration block is passed through the window feature loop once per
+  candidate length: the sum of squares of the ripple input (or of its ripple
+  band, with the filter bank on) and of the reference channels. Each pass is
+  timed. The candidates' ripple RMS values
+  are kept, and once the calibration ends they give the candidate's
+  threshold, as well as the spread of its noise. From that spread follows
+  how often the noise alone would stay above the threshold for longer than
+  the time threshold. The chosen length is the one with the lowest detection
+  latency whose feature pass fits the CPU budget and whose false detection
+  rate stays under the target.
+
+  RMS windows do not overlap, so the hop always equals the window.
+**/
+class RippleAutoTuner {
+public:
+  static constexpr int numCandidates = 6;
+  static constexpr int candidateSamples[numCandidates] = {32,  64,  128,
+                                                          256, 512, 1024};
+
+  /** Allocates room for the RMS values of a calibration of up to
+   * maxSamples samples. Message thread, with the audio thread stopped */
+  void prepare(double sampleRate, int maxSamples);
+
+  /** Starts a new tuning run. Audio thread */
+  void start(bool filterBankEnabled);
+
+  bool isRunning() const { return running; }
+
+  /** Runs every candidate on a calibration block. channels[0] is the ripple
+   * input, followed by the other channels the detector reads per window.
+   * Audio thread */
+  void pushBlock(const float *const *channels, int numChannels,
+                 int numSamples);
+
+  /** Ends the run and picks a window length. cpuBudget is the largest
+   * fraction of real time the feature pass may take. Audio thread */
+  void finish(double rippleSds, int timeThresholdSamples, double cpuBudget,
+              double falsePerMinuteTarget);
+
+  /** Copies the results of a finished run. Returns true once per run.
+   * Message thread */
+  bool takeResults(std::vector<RippleTuneCandidate> &candidates,
+                   int &chosen);
+
+private:
+  double sampleRate{0.0};
+  bool running{false};
+  bool filterBankEnabled{false};
+
+  RippleFilterBank filterBanks[numCandidates];
+  std::vector<double> rmsValues[numCandidates];
+  double costSeconds[numCandidates]{};
+  double blockSeconds{0.0};
+
+  RippleTuneCandidate results[numCandidates];
+  int chosen{-1};
+  std::atomic<bool> resultsReady{false};
+};
+
+#endif
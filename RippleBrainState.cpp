@@ -0,0 +1,62 @@
+#include "RippleBrainState.h"
+#include <algorithm>
+#include <cmath>
+
+void RippleBrainState::prepare(double sampleRate) {
+  decimation = std::max(1, (int)std::lround(sampleRate / decimatedRate));
+  const double rate = sampleRate / decimation;
+
+  antiAlias = Biquad::lowPass(sampleRate, std::min(broadbandHigh, 0.4 * rate));
+  delta.design(rate, deltaLow, deltaHigh);
+  theta.design(rate, thetaLow, thetaHigh);
+  broadband.design(rate, deltaLow, broadbandHigh);
+
+  smoothing = 1.0 - exp(-1.0 / (timeConstant * rate));
+  warmupSamples = (int)std::ceil(timeConstant * rate);
+  reset();
+}
+
+void RippleBrainState::reset() {
+  antiAlias.reset();
+  delta.reset();
+  theta.reset();
+  broadband.reset();
+  decimationCount = 0;
+  decimationSum = 0.0;
+  deltaPower = 0.0;
+  thetaPower = 0.0;
+  broadbandPower = 0.0;
+  numSamples = 0;
+}
+
+void RippleBrainState::process(const float *data, int count) {
+  for (int i = 0; i < count; i++) {
+    decimationSum += antiAlias.process(data[i]);
+    if (++decimationCount < decimation)
+      continue;
+
+    const double x = decimationSum / decimation;
+    decimationSum = 0.0;
+    decimationCount = 0;
+
+    const double d = delta.process(x);
+    const double t = theta.process(x);
+    const double b = broadband.process(x);
+    deltaPower += smoothing * (d * d - deltaPower);
+    thetaPower += smoothing * (t * t - thetaPower);
+    broadbandPower += smoothing * (b * b - broadbandPower);
+    if (numSamples < warmupSamples)
+      numSamples++;
+  }
+}
+
+BrainState RippleBrainState::classify(double thetaRatio,
+                                      double deltaFraction) const {
+  if (numSamples < warmupSamples || broadbandPower <= 0.0)
+    return BrainState::UNKNOWN;
+  if (thetaPower > thetaRatio * deltaPower)
+    return BrainState::THETA;
+  if (deltaPower > deltaFraction * broadbandPower)
+    return BrainState::NREM;
+  return BrainState::QUIET;
+}
@@ -0,0 +1,87 @@
+#ifndef __RIPPLE_BRAIN_STATE_H
+#define __RIPPLE_BRAIN_STATE_H
+
+#include "RippleFilterBank.h"
+
+/** Brain state inferred from the LFP power spectrum */
+enum class BrainState {
+  UNKNOWN = 0, // Not enough data yet
+  QUIET = 1,   // Neither theta nor delta dominates (quiet wake)
+  NREM = 2,    // Delta dominates the broadband power
+  THETA = 3    // Theta dominates delta (running, REM)
+};
+
+/** Brain states in which the gate lets detections through */
+enum class StateGateMode { OFF, NON_THETA, NREM };
+
+/** Whether the gate lets detections through in the given state. It stays
+ * open until the power averages have settled */
+inline bool isStateGateOpen(StateGateMode mode, BrainState state) {
+  switch (mode) {
+  case StateGateMode::NON_THETA:
+    return state != BrainState::THETA;
+  case StateGateMode::NREM:
+    return state == BrainState::NREM || state == BrainState::UNKNOWN;
+  default:
+    return true;
+  }
+}
+
+/**
+  Delta / theta power tracker for gating detection by brain state.
+
+  The input is low-passed and decimated to about 250 Hz by block averaging,
+  which costs one filter and one add per input sample. Delta (1-4 Hz), theta
+  (6-10 Hz) and broadband (1-40 Hz) band-passes run at the decimated rate,
+  and their squared outputs feed exponential averages with a time constant
+  of a few seconds, matching how slowly sleep and wake states change.
+**/
+class RippleBrainState {
+public:
+  static constexpr double decimatedRate = 250.0; // Approximate
+  static constexpr double deltaLow = 1.0;
+  static constexpr double deltaHigh = 4.0;
+  static constexpr double thetaLow = 6.0;
+  static constexpr double thetaHigh = 10.0;
+  static constexpr double broadbandHigh = 40.0;
+  static constexpr double timeConstant = 2.0; // Power averaging (s)
+
+  /** Designs the filters for the given sample rate and clears the state */
+  void prepare(double sampleRate);
+
+  /** Clears the filters and the power averages */
+  void reset();
+
+  /** Feeds samples of the state channel */
+  void process(const float *data, int numSamples);
+
+  /** Classifies the current powers. Theta wins when its power exceeds
+   * thetaRatio times the delta power, and NREM when delta makes up more than
+   * deltaFraction of the broadband power */
+  BrainState classify(double thetaRatio, double deltaFraction) const;
+
+  double getThetaDeltaRatio() const {
+    return deltaPower > 0.0 ? thetaPower / deltaPower : 0.0;
+  }
+  double getDeltaFraction() const {
+    return broadbandPower > 0.0 ? deltaPower / broadbandPower : 0.0;
+  }
+
+private:
+  Biquad antiAlias;
+  int decimation{1};
+  int decimationCount{0};
+  double decimationSum{0.0};
+
+  BandPass delta;
+  BandPass theta;
+  BandPass broadband;
+  double smoothing{1.0}; // Weight of the newest decimated sample
+  double deltaPower{0.0};
+  double thetaPower{0.0};
+  double broadbandPower{0.0};
+  int warmupSamples{0}; // Decimated samples before the powers are usable
+  int numSamples{0};
+};
+
+#endif
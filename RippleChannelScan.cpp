@@ -0,0 +1,265 @@
+#include "RippleChannelScan.h"
+#include "RippleFilterBank.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Values of the filter state block of a lane group
+enum { HP_Z1, HP_Z2, LP_Z1, LP_Z2, SUM_SQUARES, NUM_STATE_VALUES };
+
+void RippleChannelScan::prepare(int newNumChannels, double sampleRate) {
+  release();
+  if (newNumChannels <= 0 || sampleRate <= 0)
+    return;
+
+  numChannels = newNumChannels;
+  paddedChannels = (numChannels + lanes - 1) / lanes * lanes;
+  windowSamples = std::max(1, (int)std::lround(sampleRate * windowSeconds));
+  maxWindows = (int)(maxScanSeconds / windowSeconds);
+
+  // Same band as the filter bank, in single precision so twice as many
+  // channels fit in a vector
+  BandPass band;
+  band.design(sampleRate, RippleFilterBank::rippleLow,
+              RippleFilterBank::rippleHigh);
+  const Biquad *sections[2] = {&band.highPass, &band.lowPass};
+  float *coefficients[2] = {hp, lp};
+  for (int idx = 0; idx < 2; idx++) {
+    coefficients[idx][0] = (float)sections[idx]->b0;
+    coefficients[idx][1] = (float)sections[idx]->b1;
+    coefficients[idx][2] = (float)sections[idx]->b2;
+    coefficients[idx][3] = (float)sections[idx]->a1;
+    coefficients[idx][4] = (float)sections[idx]->a2;
+  }
+
+  state.assign((size_t)paddedChannels * NUM_STATE_VALUES, 0.0f);
+  windowRms.assign((size_t)paddedChannels * maxWindows, 0.0f);
+  // Padding channels stay zero
+  for (Slot &slot : slots) {
+    slot.data.assign((size_t)slotSamples * paddedChannels, 0.0f);
+    slot.numSamples = 0;
+    slot.generation = 0;
+  }
+  published = 0;
+  generation = 0;
+  finishing = false;
+  reportedGeneration = 0;
+  skippedBlocks = 0;
+
+  // Whole lane groups per worker, leaving cores for the rest of the chain
+  const int numGroups = paddedChannels / lanes;
+  const int hardwareThreads = (int)std::thread::hardware_concurrency();
+  const int numWorkers =
+      std::min({numGroups, maxWorkers, std::max(1, hardwareThreads / 2)});
+  running = true;
+  for (int idx = 0; idx < numWorkers; idx++) {
+    auto worker = std::make_unique<Worker>();
+    worker->firstChannel = numGroups * idx / numWorkers * lanes;
+    worker->endChannel = numGroups * (idx + 1) / numWorkers * lanes;
+    workers.push_back(std::move(worker));
+  }
+  for (auto &worker : workers)
+    worker->thread = std::thread(&RippleChannelScan::run, this,
+                                 std::ref(*worker));
+}
+
+void RippleChannelScan::release() {
+  running = false;
+  for (auto &worker : workers)
+    if (worker->thread.joinable())
+      worker->thread.join();
+  workers.clear();
+  numChannels = 0;
+}
+
+void RippleChannelScan::start() {
+  finishing.store(false, std::memory_order_relaxed);
+  generation.store(generation.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+}
+
+void RippleChannelScan::pushBlock(const float *const *channels,
+                                  int numSamples) {
+  const uint32_t currentGeneration =
+      generation.load(std::memory_order_relaxed);
+  if (workers.empty() || currentGeneration == 0 ||
+      finishing.load(std::memory_order_relaxed))
+    return;
+
+  for (int offset = 0; offset < numSamples; offset += slotSamples) {
+    // A slot is free once every worker is done with it
+    const uint64_t next = published.load(std::memory_order_relaxed);
+    uint64_t done = next;
+    for (auto &worker : workers)
+      done = std::min(done, worker->processed.load(std::memory_order_acquire));
+    if (next - done >= numSlots) {
+      skippedBlocks.store(skippedBlocks.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+      return;
+    }
+
+    // Transpose one lane group at a time, so each time step is written as
+    // a whole cache line
+    Slot &slot = slots[next % numSlots];
+    const int count = std::min(slotSamples, numSamples - offset);
+    for (int group = 0; group < numChannels; group += lanes) {
+      const int groupChannels = std::min(lanes, numChannels - group);
+      const float *src[lanes];
+      for (int lane = 0; lane < groupChannels; lane++)
+        src[lane] = channels[group + lane] + offset;
+      float *dst = slot.data.data() + group;
+      for (int t = 0; t < count; t++, dst += paddedChannels)
+        for (int lane = 0; lane < groupChannels; lane++)
+          dst[lane] = src[lane][t];
+    }
+    slot.numSamples = count;
+    slot.generation = currentGeneration;
+    published.store(next + 1, std::memory_order_release);
+  }
+}
+
+void RippleChannelScan::finish() {
+  finishing.store(true, std::memory_order_release);
+}
+
+bool RippleChannelScan::takeResults(std::vector<RippleChannelScore> &scores) {
+  const uint32_t currentGeneration =
+      generation.load(std::memory_order_acquire);
+  if (workers.empty() || currentGeneration == 0 ||
+      !finishing.load(std::memory_order_acquire) ||
+      reportedGeneration.load(std::memory_order_relaxed) == currentGeneration)
+    return false;
+
+  // Wait until the queued slots have all been filtered
+  const uint64_t queued = published.load(std::memory_order_acquire);
+  for (auto &worker : workers)
+    if (worker->processed.load(std::memory_order_acquire) < queued)
+      return false;
+  reportedGeneration.store(currentGeneration, std::memory_order_relaxed);
+
+  const Worker &first = *workers.front();
+  const int numWindows = first.generation == currentGeneration
+                             ? std::min(first.numWindows, maxWindows)
+                             : 0;
+  if (numWindows < 2)
+    return false;
+
+  scores.resize(numChannels);
+  std::vector<float> values(numWindows);
+  for (int ch = 0; ch < numChannels; ch++) {
+    const float *rms = windowRms.data() + (size_t)ch * maxWindows;
+    std::copy(rms, rms + numWindows, values.begin());
+
+    RippleChannelScore &score = scores[ch];
+    score.channel = ch;
+
+    double sum = 0.0;
+    for (float value : values)
+      sum += value;
+    score.rippleRmsMean = sum / numWindows;
+    double squares = 0.0;
+    for (float value : values)
+      squares += (value - score.rippleRmsMean) * (value - score.rippleRmsMean);
+    score.rippleRmsStdDev = std::sqrt(squares / (numWindows - 1));
+
+    auto median = values.begin() + numWindows / 2;
+    std::nth_element(values.begin(), median, values.end());
+    score.rippleRmsMedian = *median;
+    auto peak = values.begin() + (int)(0.99 * (numWindows - 1));
+    std::nth_element(values.begin(), peak, values.end());
+    score.rippleRmsPeak = *peak;
+    score.snr = score.rippleRmsMedian > 0.0
+                    ? score.rippleRmsPeak / score.rippleRmsMedian
+                    : 0.0;
+  }
+
+  std::stable_sort(scores.begin(), scores.end(),
+                   [](const RippleChannelScore &a,
+                      const RippleChannelScore &b) { return a.snr > b.snr; });
+
+  // A scan restarted meanwhile may have overwritten some windows
+  return generation.load(std::memory_order_acquire) == currentGeneration;
+}
+
+void RippleChannelScan::run(Worker &worker) {
+  while (running.load(std::memory_order_acquire)) {
+    const uint64_t next = worker.processed.load(std::memory_order_relaxed);
+    if (next < published.load(std::memory_order_acquire)) {
+      processSlot(worker, slots[next % numSlots]);
+      worker.processed.store(next + 1, std::memory_order_release);
+      continue;
+    }
+    // Poll often while a scan is running, so the slots come free quickly
+    const bool scanning = generation.load(std::memory_order_relaxed) !=
+                              reportedGeneration.load(
+                                  std::memory_order_relaxed) &&
+                          !finishing.load(std::memory_order_relaxed);
+    std::this_thread::sleep_for(std::chrono::milliseconds(scanning ? 1 : 20));
+  }
+}
+
+void RippleChannelScan::processSlot(Worker &worker, const Slot &slot) {
+  // The first slot of a scan starts every filter from rest
+  if (slot.generation != worker.generation) {
+    std::fill(state.begin() + (size_t)worker.firstChannel * NUM_STATE_VALUES,
+              state.begin() + (size_t)worker.endChannel * NUM_STATE_VALUES,
+              0.0f);
+    worker.generation = slot.generation;
+    worker.windowPosition = 0;
+    worker.numWindows = 0;
+  }
+
+  int windowPosition = worker.windowPosition;
+  int numWindows = worker.numWindows;
+
+  for (int group = worker.firstChannel; group < worker.endChannel;
+       group += lanes) {
+    float *groupState = state.data() + (size_t)group * NUM_STATE_VALUES;
+    float hpZ1[lanes], hpZ2[lanes], lpZ1[lanes], lpZ2[lanes], sum[lanes];
+    for (int lane = 0; lane < lanes; lane++) {
+      hpZ1[lane] = groupState[HP_Z1 * lanes + lane];
+      hpZ2[lane] = groupState[HP_Z2 * lanes + lane];
+      lpZ1[lane] = groupState[LP_Z1 * lanes + lane];
+      lpZ2[lane] = groupState[LP_Z2 * lanes + lane];
+      sum[lane] = groupState[SUM_SQUARES * lanes + lane];
+    }
+
+    windowPosition = worker.windowPosition;
+    numWindows = worker.numWindows;
+    for (int t = 0; t < slot.numSamples; t++) {
+      const float *x = slot.data.data() + (size_t)t * paddedChannels + group;
+      for (int lane = 0; lane < lanes; lane++) {
+        const float h = hp[0] * x[lane] + hpZ1[lane];
+        hpZ1[lane] = hp[1] * x[lane] - hp[3] * h + hpZ2[lane];
+        hpZ2[lane] = hp[2] * x[lane] - hp[4] * h;
+        const float y = lp[0] * h + lpZ1[lane];
+        lpZ1[lane] = lp[1] * h - lp[3] * y + lpZ2[lane];
+        lpZ2[lane] = lp[2] * h - lp[4] * y;
+        sum[lane] += y * y;
+      }
+
+      if (++windowPosition == windowSamples) {
+        if (numWindows < maxWindows) {
+          for (int lane = 0; lane < lanes; lane++)
+            windowRms[(size_t)(group + lane) * maxWindows + numWindows] =
+                std::sqrt(sum[lane] / windowSamples);
+        }
+        for (int lane = 0; lane < lanes; lane++)
+          sum[lane] = 0.0f;
+        numWindows++;
+        windowPosition = 0;
+      }
+    }
+
+    for (int lane = 0; lane < lanes; lane++) {
+      groupState[HP_Z1 * lanes + lane] = hpZ1[lane];
+      groupState[HP_Z2 * lanes + lane] = hpZ2[lane];
+      groupState[LP_Z1 * lanes + lane] = lpZ1[lane];
+      groupState[LP_Z2 * lanes + lane] = lpZ2[lane];
+      groupState[SUM_SQUARES * lanes + lane] = sum[lane];
+    }
+  }
+
+  worker.windowPosition = windowPosition;
+  worker.numWindows = numWindows;
+}
@@ -0,0 +1,116 @@
+#ifndef __RIPPLE_CHANNEL_SCAN_H
+#define __RIPPLE_CHANNEL_SCAN_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/** Ripple-band statistics of one scanned channel */
+struct RippleChannelScore {
+  int channel{0};              // Index in the scanned channel list
+  double rippleRmsMean{0.0};   // Ripple-band RMS of the analysis windows
+  double rippleRmsStdDev{0.0};
+  double rippleRmsMedian{0.0}; // Baseline level
+  double rippleRmsPeak{0.0};   // 99th percentile, where ripples show up
+  double snr{0.0};             // Peak over median
+};
+
+/**
+  Ripple-band scan of every channel of a stream during calibration.
+
+  The audio thread copies each calibration block into a free slot of a ring,
+  transposed so the samples of all channels at one time step sit together.
+  Worker threads each own a contiguous group of channels and run the
+  150-250 Hz band-pass across the group one time step at a time, so the
+  filters vectorize across channels. If every slot is still in use the block
+  is left out of the scan instead of stalling the audio thread. Once the
+  calibration ends, the message thread ranks the channels by how far their
+  ripple-band peaks stand above their baseline.
+**/
+class RippleChannelScan {
+public:
+  static constexpr double windowSeconds = 0.01;  // Analysis window
+  static constexpr double maxScanSeconds = 20.0; // Windows kept per scan
+  static constexpr int slotSamples = 1024;
+  static constexpr int numSlots = 16;
+  static constexpr int lanes = 16; // Channels filtered together
+  static constexpr int maxWorkers = 8;
+
+  ~RippleChannelScan() { release(); }
+
+  /** Allocates the buffers and starts the workers. Message thread, with the
+   * audio thread stopped */
+  void prepare(int numChannels, double sampleRate);
+
+  /** Stops the workers and frees the buffers */
+  void release();
+
+  bool isPrepared() const { return !workers.empty(); }
+
+  /** Starts a new scan. Audio thread */
+  void start();
+
+  /** Adds a block of every scanned channel. Audio thread */
+  void pushBlock(const float *const *channels, int numSamples);
+
+  /** Ends the scan; the workers finish the blocks already queued. Audio
+   * thread */
+  void finish();
+
+  /** Ranks the channels of a finished scan, best first. Returns true once
+   * per scan, when its results are ready. Message thread */
+  bool takeResults(std::vector<RippleChannelScore> &scores);
+
+  /** Blocks left out of scans because the workers fell behind */
+  uint64_t getSkippedBlocks() const {
+    return skippedBlocks.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot {
+    std::vector<float> data; // [sample][channel]
+    int numSamples{0};
+    uint32_t generation{0};
+  };
+
+  /** State of one worker, which owns channels [firstChannel, endChannel) */
+  struct Worker {
+    int firstChannel{0};
+    int endChannel{0};
+    std::atomic<uint64_t> processed{0}; // Slots done
+    uint32_t generation{0};
+    int windowPosition{0};
+    int numWindows{0};
+    std::thread thread;
+  };
+
+  void run(Worker &worker);
+  void processSlot(Worker &worker, const Slot &slot);
+
+  int numChannels{0};
+  int paddedChannels{0}; // Rounded up to whole lanes
+  int windowSamples{1};
+  int maxWindows{0};
+
+  float hp[5]{}; // b0, b1, b2, a1, a2 of the 150 Hz high-pass
+  float lp[5]{}; // and of the 250 Hz low-pass
+
+  // Filter state and window sum of each channel: hpZ1, hpZ2, lpZ1, lpZ2 and
+  // sumSquares, each as one lane-wide block per lane group
+  std::vector<float> state;
+  std::vector<float> windowRms; // [channel][window]
+
+  Slot slots[numSlots];
+  std::atomic<uint64_t> published{0}; // Slots handed to the workers
+  std::atomic<uint32_t> generation{0};
+  std::atomic<bool> finishing{false};
+  std::atomic<uint32_t> reportedGeneration{0};
+  std::atomic<uint64_t> skippedBlocks{0};
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<bool> running{false};
+};
+
+#endif
@@ -0,0 +1,370 @@
+#include "RippleCnn.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+// Kernels are picked at compile time: AVX2 when the build enables it, else
+// the SSE2 baseline of x86-64, NEON on ARM, and plain loops elsewhere
+#if defined(__AVX2__)
+#define RIPPLE_CNN_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) ||                                  \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RIPPLE_CNN_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define RIPPLE_CNN_NEON
+#include <arm_neon.h>
+#endif
+
+static const char fileMagic[8] = {'R', 'P', 'L', 'C', 'N', 'N', '0', '1'};
+static constexpr uint32_t fileVersion = 1;
+
+// Sanity limits for the header fields of a weights file
+static constexpr uint32_t maxLayers = 64;
+static constexpr uint32_t maxChannels = 1024;
+static constexpr uint32_t maxLength = 1 << 16;
+
+#if defined(RIPPLE_CNN_AVX2) || defined(RIPPLE_CNN_SSE2)
+static inline float horizontalSum(__m128 v) {
+  __m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+  __m128 sums = _mm_add_ps(v, shuffled);
+  shuffled = _mm_movehl_ps(shuffled, sums);
+  return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+static inline int32_t horizontalSum(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+#endif
+
+// Dot product of two float vectors
+static float dotFloat(const float *a, const float *b, int n) {
+  int i = 0;
+  float sum = 0.0f;
+#if defined(RIPPLE_CNN_AVX2)
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8)
+    acc = _mm256_add_ps(
+        acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  sum = horizontalSum(_mm_add_ps(_mm256_castps256_ps128(acc),
+                                 _mm256_extractf128_ps(acc, 1)));
+#elif defined(RIPPLE_CNN_SSE2)
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  sum = horizontalSum(acc);
+#elif defined(RIPPLE_CNN_NEON)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  for (; i + 4 <= n; i += 4)
+    acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+  sum = vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1) +
+        vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3);
+#endif
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+// Dot product of two int8 vectors, accumulated in 32 bits. Products are
+// widened to 16 bits first, which cannot overflow for int8 inputs
+static int32_t dotInt8(const int8_t *a, const int8_t *b, int n) {
+  int i = 0;
+  int32_t sum = 0;
+#if defined(RIPPLE_CNN_AVX2)
+  __m256i acc = _mm256_setzero_si256();
+  for (; i + 16 <= n; i += 16) {
+    __m256i a16 = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+    __m256i b16 = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a16, b16));
+  }
+  sum = horizontalSum(_mm_add_epi32(_mm256_castsi256_si128(acc),
+                                    _mm256_extracti128_si256(acc, 1)));
+#elif defined(RIPPLE_CNN_SSE2)
+  __m128i acc = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i a8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i b8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    // Sign-extend by placing each byte in the high half and shifting down
+    __m128i aLow = _mm_srai_epi16(_mm_unpacklo_epi8(a8, a8), 8);
+    __m128i aHigh = _mm_srai_epi16(_mm_unpackhi_epi8(a8, a8), 8);
+    __m128i bLow = _mm_srai_epi16(_mm_unpacklo_epi8(b8, b8), 8);
+    __m128i bHigh = _mm_srai_epi16(_mm_unpackhi_epi8(b8, b8), 8);
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(aLow, bLow));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(aHigh, bHigh));
+  }
+  sum = horizontalSum(acc);
+#elif defined(RIPPLE_CNN_NEON)
+  int32x4_t acc = vdupq_n_s32(0);
+  for (; i + 8 <= n; i += 8)
+    acc = vpadalq_s16(acc, vmull_s8(vld1_s8(a + i), vld1_s8(b + i)));
+  sum = vgetq_lane_s32(acc, 0) + vgetq_lane_s32(acc, 1) +
+        vgetq_lane_s32(acc, 2) + vgetq_lane_s32(acc, 3);
+#endif
+  for (; i < n; i++)
+    sum += (int32_t)a[i] * b[i];
+  return sum;
+}
+
+// Rounds x / scale to the nearest int8 step, saturating at +-127
+static void quantize(const float *x, int8_t *q, int n, float inverseScale) {
+  int i = 0;
+#if defined(RIPPLE_CNN_AVX2) || defined(RIPPLE_CNN_SSE2)
+  const __m128 scale = _mm_set1_ps(inverseScale);
+  const __m128 upper = _mm_set1_ps(127.0f);
+  const __m128 lower = _mm_set1_ps(-127.0f);
+  for (; i + 16 <= n; i += 16) {
+    __m128i words[4];
+    for (int part = 0; part < 4; part++) {
+      __m128 v = _mm_mul_ps(_mm_loadu_ps(x + i + 4 * part), scale);
+      v = _mm_min_ps(_mm_max_ps(v, lower), upper);
+      words[part] = _mm_cvtps_epi32(v);
+    }
+    __m128i low = _mm_packs_epi32(words[0], words[1]);
+    __m128i high = _mm_packs_epi32(words[2], words[3]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(q + i),
+                     _mm_packs_epi16(low, high));
+  }
+#endif
+  for (; i < n; i++) {
+    const float v = std::min(127.0f, std::max(-127.0f, x[i] * inverseScale));
+    q[i] = (int8_t)lrintf(v);
+  }
+}
+
+const char *RippleCnn::getKernelName() {
+#if defined(RIPPLE_CNN_AVX2)
+  return "AVX2";
+#elif defined(RIPPLE_CNN_SSE2)
+  return "SSE2";
+#elif defined(RIPPLE_CNN_NEON)
+  return "NEON";
+#else
+  return "scalar";
+#endif
+}
+
+template <typename T> static bool readValue(std::ifstream &file, T &value) {
+  return (bool)file.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool readArray(std::ifstream &file, std::vector<T> &values,
+                      size_t count) {
+  values.resize(count);
+  return count == 0 || (bool)file.read(reinterpret_cast<char *>(values.data()),
+                                       count * sizeof(T));
+}
+
+std::shared_ptr<const RippleCnnModel>
+RippleCnnModel::load(const std::string &path, std::string &error) {
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    error = "Cannot open " + path;
+    return nullptr;
+  }
+
+  char magic[8];
+  uint32_t version, inputLength, inputChannels, numLayers;
+  auto model = std::make_shared<RippleCnnModel>();
+  if (!file.read(magic, sizeof(magic)) ||
+      memcmp(magic, fileMagic, sizeof(magic)) != 0) {
+    error = path + " is not a ripple CNN weights file";
+    return nullptr;
+  }
+  if (!readValue(file, version) || version != fileVersion) {
+    error = "Unsupported weights file version in " + path;
+    return nullptr;
+  }
+  if (!readValue(file, model->sampleRate) || !readValue(file, inputLength) ||
+      !readValue(file, inputChannels) || !readValue(file, model->inputScale) ||
+      !readValue(file, numLayers)) {
+    error = "Truncated header in " + path;
+    return nullptr;
+  }
+  if (!(model->sampleRate > 0.0f) || inputLength == 0 ||
+      inputLength > maxLength || inputChannels == 0 ||
+      inputChannels > maxChannels || numLayers == 0 ||
+      numLayers > maxLayers) {
+    error = "Invalid network dimensions in " + path;
+    return nullptr;
+  }
+  model->path = path;
+  model->inputLength = inputLength;
+  model->inputChannels = inputChannels;
+  model->maxActivationSize = inputLength * inputChannels;
+
+  int channels = inputChannels;
+  int length = inputLength;
+  for (uint32_t idx = 0; idx < numLayers; idx++) {
+    uint32_t type, outChannels, kernelSize, stride, relu;
+    RippleCnnLayer layer;
+    if (!readValue(file, type) || !readValue(file, outChannels) ||
+        !readValue(file, kernelSize) || !readValue(file, stride) ||
+        !readValue(file, relu) || !readValue(file, layer.inputScale)) {
+      error = "Truncated layer header in " + path;
+      return nullptr;
+    }
+    if (type > 1 || outChannels == 0 || outChannels > maxChannels ||
+        kernelSize == 0 || kernelSize > (uint32_t)length || stride == 0 ||
+        (type == 1 && !(layer.inputScale > 0.0f))) {
+      error = "Invalid layer " + std::to_string(idx) + " in " + path;
+      return nullptr;
+    }
+
+    layer.quantized = type == 1;
+    layer.relu = relu != 0;
+    layer.inChannels = channels;
+    layer.outChannels = outChannels;
+    layer.kernelSize = kernelSize;
+    layer.stride = stride;
+    layer.inputLength = length;
+    layer.outputLength = (length - (int)kernelSize) / (int)stride + 1;
+
+    const size_t numWeights = (size_t)outChannels * kernelSize * channels;
+    bool ok = readArray(file, layer.bias, outChannels);
+    if (layer.quantized)
+      ok = ok && readArray(file, layer.weightScale, outChannels) &&
+           readArray(file, layer.qweights, numWeights);
+    else
+      ok = ok && readArray(file, layer.weights, numWeights);
+    if (!ok) {
+      error = "Truncated weights in " + path;
+      return nullptr;
+    }
+
+    channels = layer.outChannels;
+    length = layer.outputLength;
+    model->maxActivationSize =
+        std::max(model->maxActivationSize, length * channels);
+    model->layers.push_back(std::move(layer));
+  }
+
+  if (channels != 1 || length != 1) {
+    error = "The last layer of " + path + " must output a single value";
+    return nullptr;
+  }
+
+  return model;
+}
+
+bool RippleCnn::prepare(std::shared_ptr<const RippleCnnModel> newModel,
+                        double sampleRate, std::string &error) {
+
+  if (newModel->inputChannels != 1) {
+    error = "The network expects " + std::to_string(newModel->inputChannels) +
+            " input channels, but only the ripple input is available";
+    return false;
+  }
+
+  // Only integer decimation is supported; allow 1% of rate mismatch
+  decimation = std::max(1, (int)lround(sampleRate / newModel->sampleRate));
+  if (std::abs(sampleRate / decimation - newModel->sampleRate) >
+      0.01 * newModel->sampleRate) {
+    error = "The network expects " +
+            std::to_string((int)newModel->sampleRate) +
+            " Hz input, which cannot be decimated from " +
+            std::to_string((int)sampleRate) + " Hz";
+    return false;
+  }
+
+  model = std::move(newModel);
+
+  // Two cascaded sections below the model's Nyquist frequency
+  for (Biquad &section : antiAlias)
+    section = decimation > 1
+                  ? Biquad::lowPass(sampleRate, 0.4 * model->sampleRate)
+                  : Biquad();
+
+  history.assign(2 * model->inputLength, 0.0f);
+  activations[0].assign(model->maxActivationSize, 0.0f);
+  activations[1].assign(model->maxActivationSize, 0.0f);
+  quantizedInput.assign(model->maxActivationSize, 0);
+
+  reset();
+  return true;
+}
+
+void RippleCnn::reset() {
+  for (Biquad &section : antiAlias)
+    section.reset();
+  std::fill(history.begin(), history.end(), 0.0f);
+  decimationPhase = 0;
+  writeIndex = 0;
+  newSamples = 0;
+  filledSamples = 0;
+  probability = 0.0f;
+}
+
+float RippleCnn::processWindow(const float *data, int numSamples) {
+
+  const int inputLength = model->inputLength;
+  for (int idx = 0; idx < numSamples; idx++) {
+    const double filtered =
+        antiAlias[1].process(antiAlias[0].process(data[idx]));
+    if (++decimationPhase < decimation)
+      continue;
+    decimationPhase = 0;
+
+    history[writeIndex] = (float)filtered;
+    history[writeIndex + inputLength] = (float)filtered;
+    if (++writeIndex == inputLength)
+      writeIndex = 0;
+    newSamples++;
+    if (filledSamples < inputLength)
+      filledSamples++;
+  }
+
+  if (newSamples > 0 && filledSamples == inputLength) {
+    probability = evaluate();
+    newSamples = 0;
+  }
+  return probability;
+}
+
+float RippleCnn::evaluate() {
+
+  // Oldest sample first
+  const float *window = history.data() + writeIndex;
+  float *input = activations[0].data();
+  for (int idx = 0; idx < model->inputLength; idx++)
+    input[idx] = window[idx] * model->inputScale;
+
+  int current = 0;
+  for (const RippleCnnLayer &layer : model->layers) {
+    const float *in = activations[current].data();
+    float *out = activations[1 - current].data();
+    const int rowLength = layer.kernelSize * layer.inChannels;
+    const int rowStep = layer.stride * layer.inChannels;
+
+    if (layer.quantized)
+      quantize(in, quantizedInput.data(),
+               layer.inputLength * layer.inChannels, 1.0f / layer.inputScale);
+
+    for (int t = 0; t < layer.outputLength; t++) {
+      for (int oc = 0; oc < layer.outChannels; oc++) {
+        float value;
+        if (layer.quantized)
+          value = dotInt8(layer.qweights.data() + oc * rowLength,
+                          quantizedInput.data() + t * rowStep, rowLength) *
+                  (layer.weightScale[oc] * layer.inputScale);
+        else
+          value = dotFloat(layer.weights.data() + oc * rowLength,
+                           in + t * rowStep, rowLength);
+        value += layer.bias[oc];
+        if (layer.relu)
+          value = std::max(0.0f, value);
+        out[t * layer.outChannels + oc] = value;
+      }
+    }
+    current = 1 - current;
+  }
+
+  return 1.0f / (1.0f + std::exp(-activations[current][0]));
+}
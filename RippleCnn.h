@@ -0,0 +1,110 @@
+#ifndef __RIPPLE_CNN_H
+#define __RIPPLE_CNN_H
+
+#include "RippleFilterBank.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+  One 1D convolution of a RippleCnnModel.
+
+  Activations are stored time-major (all channels of a time step next to each
+  other), and the weights of each output channel are ordered [kernel][input
+  channel] to match, so every output value is a single contiguous dot
+  product of length kernelSize * inChannels.
+**/
+struct RippleCnnLayer {
+  bool quantized{false}; // int8 weights and inputs, otherwise float
+  bool relu{false};
+  int inChannels{0};
+  int outChannels{0};
+  int kernelSize{0};
+  int stride{1};
+  int inputLength{0};  // Time steps in / out, derived when loading
+  int outputLength{0};
+  float inputScale{1.0f}; // int8 layers: value of one input quantization step
+
+  std::vector<float> bias;          // [outChannels]
+  std::vector<float> weightScale;   // int8 layers: [outChannels]
+  std::vector<float> weights;       // float layers: [out][kernel][in]
+  std::vector<int8_t> qweights;     // int8 layers: [out][kernel][in]
+};
+
+/**
+  Pretrained 1D convolutional network read from a weights file.
+
+  The file is little-endian binary: the magic "RPLCNN01", then
+  uint32 version, float sampleRate, uint32 inputLength, uint32 inputChannels,
+  float inputScale and uint32 numLayers. Each layer follows as uint32 type
+  (0 float, 1 int8), outChannels, kernelSize, stride and relu, float
+  inputScale, float bias[outChannels], for int8 layers float
+  weightScale[outChannels], and the weights ([out][kernel][in], float or
+  int8). The last layer must produce a single value, the logit of a ripple
+  in the input window.
+**/
+class RippleCnnModel {
+public:
+  /** Reads a weights file. Returns nullptr and sets error on failure */
+  static std::shared_ptr<const RippleCnnModel> load(const std::string &path,
+                                                    std::string &error);
+
+  std::string path;       // Weights file the model was read from
+  float sampleRate{0.0f}; // Rate the network expects its input at (Hz)
+  int inputLength{0};     // Samples in the input window
+  int inputChannels{1};
+  float inputScale{1.0f}; // Applied to the input (microvolts) first
+  std::vector<RippleCnnLayer> layers;
+  int maxActivationSize{0}; // Largest layer input or output, in values
+};
+
+/**
+  Streaming runner for a RippleCnnModel on a single channel.
+
+  The input is low-passed and decimated to the model's rate into a rolling
+  window, and the network is re-evaluated whenever a window of the detector
+  brings in new decimated samples. All buffers are allocated in prepare(),
+  so processWindow() is safe to call on the audio thread.
+**/
+class RippleCnn {
+public:
+  /** Allocates the buffers for a model and a stream sample rate. Returns
+   * false and sets error if the rates are incompatible */
+  bool prepare(std::shared_ptr<const RippleCnnModel> newModel,
+               double sampleRate, std::string &error);
+
+  /** Clears the input window and the filters */
+  void reset();
+
+  /** Feeds data[0..numSamples) and returns the ripple probability of the
+   * most recent input window */
+  float processWindow(const float *data, int numSamples);
+
+  /** Returns the weights file in use */
+  const std::string &getModelPath() const { return model->path; }
+
+  /** Name of the kernels compiled into this build (e.g. "AVX2") */
+  static const char *getKernelName();
+
+private:
+  /** Runs the network over the current input window */
+  float evaluate();
+
+  std::shared_ptr<const RippleCnnModel> model;
+  int decimation{1};
+  int decimationPhase{0};
+  Biquad antiAlias[2];
+
+  std::vector<float> history; // Input window, written twice so the latest
+                              // inputLength samples are always contiguous
+  int writeIndex{0};
+  int newSamples{0};          // Decimated samples since the last evaluation
+  int filledSamples{0};
+
+  std::vector<float> activations[2];
+  std::vector<int8_t> quantizedInput;
+  float probability{0.0f};
+};
+
+#endif
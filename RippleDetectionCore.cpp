@@ -0,0 +1,784 @@
+#include "RippleDetectionCore.h"
+#include "RippleHealth.h"
+#include <algorithm>
+#include <cmath>
+
+// Seconds per second that the fusion offset may fall by, well above the
+// drift between an acquisition board's clock and the system clock
+static constexpr double fusionOffsetSlew = 0.001;
+
+// Calculate the sum of squares of several channels from position initIndex
+// (included) to endIndex (not included) in a single pass. Samples are taken
+// in fixed-width lanes across all channels so the inner loops vectorize
+static void calculateSumSquares(const float *const *channels, int numChannels,
+                                int initIndex, int endIndex, double *sums) {
+  constexpr int lanes = 8;
+  float acc[RippleDetectorConfig::maxReferenceChannels + 1][lanes] = {};
+
+  int idx = initIndex;
+  for (; idx + lanes <= endIndex; idx += lanes) {
+    for (int ch = 0; ch < numChannels; ch++) {
+      const float *x = channels[ch] + idx;
+      for (int lane = 0; lane < lanes; lane++)
+        acc[ch][lane] += x[lane] * x[lane];
+    }
+  }
+
+  for (int ch = 0; ch < numChannels; ch++) {
+    double sum = 0.0;
+    for (int lane = 0; lane < lanes; lane++)
+      sum += acc[ch][lane];
+    for (int tail = idx; tail < endIndex; tail++)
+      sum += channels[ch][tail] * channels[ch][tail];
+    sums[ch] = sum;
+  }
+}
+
+// Calculate the modulus of the accelerometer vector for each sample
+static void calculateAccelMod(const RippleDetectionBlock &block,
+                              const std::vector<int> &axisChannels,
+                              float *magnitude) {
+  const int numSamples = block.numSamples;
+  for (int p = 0; p < numSamples; p++)
+    magnitude[p] = 0.0f;
+  for (int axisChannel : axisChannels) {
+    const float *axis = block.getChannel(axisChannel);
+    for (int p = 0; axis != nullptr && p < numSamples; p++)
+      magnitude[p] += axis[p] * axis[p];
+  }
+  for (int p = 0; p < numSamples; p++)
+    magnitude[p] = sqrt(magnitude[p]);
+}
+
+// Divide the accumulated sum of a calibration into its mean, and return the
+// sample standard deviation around it
+static double finishStatistics(const std::vector<double> &values,
+                               double &mean) {
+  mean = mean / (double)values.size();
+  double sum = 0.0;
+  for (double value : values)
+    sum += pow(value - mean, 2.0);
+  return sqrt(sum / ((double)values.size() - 1.0));
+}
+
+void RippleWindowFeatures::clear() {
+  numSamples.clear();
+  rms.clear();
+  refRms.clear();
+  movRms.clear();
+  classes.clear();
+  cnn.clear();
+}
+
+RippleDetectionCore::RippleDetectionCore()
+    : windowProcessor(&RippleDetectionCore::processWindows<MovementMode::OFF>) {
+}
+
+void RippleDetectionCore::prepare(double sampleRate, RippleFusion *fusion_,
+                                  int fusionIndex_) {
+  fusion = fusion_;
+  fusionIndex = fusionIndex_;
+
+  state.rmsMean = 0;
+  state.rmsStdDev = 0;
+  state.movRmsMean = 0;
+  state.movRmsStdDev = 0;
+  state.threshold = 0;
+  state.movThreshold = 0;
+  state.counterAboveThresh = 0;
+  state.counterMovUpThresh = 0;
+  state.counterMovDownThresh = 0;
+  state.pointsProcessed = 0;
+  rmsAverage = 0;
+
+  // Replaced by the mode of the first snapshot applied
+  movementMode = MovementMode::OFF;
+  windowProcessor = &RippleDetectionCore::processWindows<MovementMode::OFF>;
+
+  calibrationRmsValues.clear();
+  calibrationMovRmsValues.clear();
+  calibrationArtefactValues.clear();
+  calibrationRefRmsValues.clear();
+
+  filterBank.prepare(sampleRate);
+  brainState.prepare(sampleRate);
+  state.stateGateActive = false;
+  currentBrainState = BrainState::UNKNOWN;
+}
+
+void RippleDetectionCore::applyConfig(const RippleDetectorConfig &newConfig,
+                                      RippleCnn *cnnRunner, bool restoring) {
+  config = &newConfig;
+
+  // Start the filter bank from rest when it is switched on
+  if (newConfig.filterBankEnabled != state.filterBankActive) {
+    filterBank.reset();
+    state.artefactHoldCounter = 0;
+    state.filterBankActive = newConfig.filterBankEnabled;
+  }
+
+  // The brain state is tracked from scratch when the gate is switched on
+  const bool stateGateEnabled = newConfig.stateGate != StateGateMode::OFF;
+  if (stateGateEnabled != state.stateGateActive) {
+    brainState.reset();
+    currentBrainState = BrainState::UNKNOWN;
+    state.stateGateActive = stateGateEnabled;
+  }
+
+  // The CNN replaces the RMS test only once a weights file has loaded. A
+  // runner that was not in use starts from an empty input window
+  RippleCnn *runner =
+      newConfig.detectorMode == DetectorMode::CNN ? cnnRunner : nullptr;
+  if (runner != nullptr && runner != cnn)
+    runner->reset();
+  cnn = runner;
+
+  // Pick the window loop for the movement signal that is actually available
+  movementMode = newConfig.movementMode;
+  if ((movementMode == MovementMode::EMG &&
+       newConfig.movementInputChannel < 0) ||
+      (movementMode == MovementMode::ACC &&
+       newConfig.auxChannelIndices.empty()))
+    movementMode = MovementMode::OFF;
+  switch (movementMode) {
+  case MovementMode::ACC:
+    windowProcessor = &RippleDetectionCore::processWindows<MovementMode::ACC>;
+    break;
+  case MovementMode::EMG:
+    windowProcessor = &RippleDetectionCore::processWindows<MovementMode::EMG>;
+    break;
+  default:
+    windowProcessor = &RippleDetectionCore::processWindows<MovementMode::OFF>;
+  }
+
+  // The calibration accumulates into these, so leave them alone until it
+  // ends. A restored state already holds them
+  if (restoring || state.isCalibrating)
+    return;
+
+  // A snapshot compiled before the last calibration was written back still
+  // holds the previous baseline, and must not replace the calibrated one
+  if (newConfig.baselineCurrent) {
+    state.rmsMean = newConfig.rmsMean;
+    state.rmsStdDev = newConfig.rmsStdDev;
+    if (rmsAverage == 0)
+      rmsAverage = newConfig.rmsMean;
+  }
+  state.threshold = state.rmsMean + newConfig.rippleSds * state.rmsStdDev;
+  state.movThreshold =
+      state.movRmsMean + newConfig.movSds * state.movRmsStdDev;
+  state.artefactThreshold =
+      state.artefactMean + newConfig.artefactSds * state.artefactStdDev;
+  state.refThreshold =
+      state.refRmsMean + newConfig.refSds * state.refRmsStdDev;
+}
+
+bool RippleDetectionCore::process(const RippleDetectionBlock &block,
+                                  RippleDetectionListener &listener) {
+
+  if (config == nullptr ||
+      block.getChannel(config->rippleInputChannel) == nullptr ||
+      !beginBlock(block, listener))
+    return false;
+
+  // Check if the number of samples to calculate the RMS is not larger than
+  // the total number of samples provided in this cycle and adjust if
+  // necessary
+  const int rmsSamples = std::min(config->rmsSamples, block.numSamples);
+
+  // With the clock fixed for the block, a block that lies entirely in the
+  // refractory period is known before its windows are computed
+  lazyWindows = canDeferWindows(block);
+
+  // RMS window features of this block, specialised for the movement mode
+  (this->*windowProcessor)(block, rmsSamples, listener);
+
+  // Brain state of this block, tracked during calibration too so it has
+  // settled by the time detection starts
+  if (config->stateGate != StateGateMode::OFF) {
+    const float *stateData = block.getChannel(config->stateInputChannel);
+    if (stateData != nullptr) {
+      brainState.process(stateData, block.numSamples);
+      currentBrainState =
+          brainState.classify(config->thetaRatio, config->deltaFraction);
+    }
+  }
+
+  return finishBlock(block, listener);
+}
+
+bool RippleDetectionCore::processFeatures(const RippleDetectionBlock &block,
+                                          RippleDetectionListener &listener) {
+
+  if (config == nullptr || !beginBlock(block, listener) ||
+      state.isCalibrating)
+    return false;
+
+  lazyWindows = false;
+  return finishBlock(block, listener);
+}
+
+bool RippleDetectionCore::beginBlock(const RippleDetectionBlock &block,
+                                     RippleDetectionListener &listener) {
+
+  counts = RippleBlockCounts();
+
+  if (config->rippleInputChannel < 0 || block.numSamples <= 0)
+    return false;
+
+  const int64_t first = block.firstSampleNumber;
+  const int numSamples = block.numSamples;
+
+  // Fusion compares detections on the wall clock. The last sample of each
+  // block arrived before now, so every block bounds the offset of the
+  // stream's sample clock from below, and the block delivered soonest bounds
+  // it best. The offset follows the largest bound of recent blocks, letting
+  // go of it slowly so it can follow a drift between the two clocks
+  const double blockOffset = (first + numSamples) / config->sampleRate -
+                             block.wallClockMs / 1000.0;
+  if (!state.fusionOffsetSet) {
+    state.fusionOffset = blockOffset;
+    state.fusionOffsetSet = true;
+  } else {
+    const double release = fusionOffsetSlew * numSamples / config->sampleRate;
+    state.fusionOffset = std::max(blockOffset, state.fusionOffset - release);
+  }
+
+  // Enable detection again if the mov. detector channel is "-" or if
+  // calibration button was clicked
+  if (!state.pluginEnabled &&
+      (movementMode == MovementMode::OFF || block.calibrate)) {
+    state.pluginEnabled = true;
+    listener.ttlEvent(config->movementOutputChannel, first, false, 0);
+  }
+
+  // Lower the combined TTL once its duration has elapsed
+  if (state.fusedTtlOn && state.fusedTtlOffSample < first + numSamples) {
+    const int64_t offSample = std::max(state.fusedTtlOffSample, first);
+    listener.ttlEvent(state.fusedTtlLine, offSample, false,
+                      (int)(offSample - first));
+    state.fusedTtlOn = false;
+  }
+
+  // Check if need to calibrate: on request, when the snapshot asks for a new
+  // baseline of this stream, or when the movement input has changed
+  if (block.calibrate ||
+      state.calibrationGeneration != config->calibrationGeneration ||
+      (state.movChannelGeneration != config->movChannelGeneration &&
+       config->movementInputChannel > 0)) {
+    state.isCalibrating = true;
+    state.calibrationGeneration = config->calibrationGeneration;
+    state.movChannelGeneration = config->movChannelGeneration;
+
+    state.pointsProcessed = 0;
+    state.rmsMean = 0;
+    state.rmsStdDev = 0;
+    state.movRmsMean = 0;
+    state.movRmsStdDev = 0;
+    state.artefactMean = 0;
+    state.artefactStdDev = 0;
+    state.refRmsMean = 0;
+    state.refRmsStdDev = 0;
+
+    calibrationRmsValues.clear();
+    calibrationMovRmsValues.clear();
+    calibrationArtefactValues.clear();
+    calibrationRefRmsValues.clear();
+
+    listener.calibrationStarted();
+  }
+
+  return true;
+}
+
+// Everything that reads every window keeps the full computation: the CNN,
+// the filter bank, and whatever the caller attached to the windows
+bool RippleDetectionCore::canDeferWindows(
+    const RippleDetectionBlock &block) const {
+  return !state.isCalibrating && state.onRefractoryTime &&
+         block.wallClockMs - state.refractoryTimeStart <
+             config->refractoryTime &&
+         cnn == nullptr && !config->filterBankEnabled && block.deferrable;
+}
+
+// Compute the RMS window features of one block. Instantiated once per
+// movement mode so the window loop carries no mode tests
+template <MovementMode Mode>
+void RippleDetectionCore::processWindows(const RippleDetectionBlock &block,
+                                         int rmsSamples,
+                                         RippleDetectionListener &listener) {
+
+  const int numSamples = block.numSamples;
+  const float *rippleData = block.getChannel(config->rippleInputChannel);
+
+  // Movement signal for the block: the accelerometer magnitude or the EMG
+  // channel itself
+  const float *movData = nullptr;
+  if constexpr (Mode == MovementMode::ACC) {
+    // Only grows when a larger block than any before arrives
+    if (accMagnitude.size() < (size_t)numSamples)
+      accMagnitude.resize(numSamples);
+    calculateAccelMod(block, config->auxChannelIndices, accMagnitude.data());
+    movData = accMagnitude.data();
+  } else if constexpr (Mode == MovementMode::EMG) {
+    movData = block.getChannel(config->movementInputChannel);
+  }
+
+  // The ripple channel (unless the filter bank reads it) and the
+  // reference channels share a single pass over each window. Blocks that
+  // cannot produce a detection leave both to detectRipplesLazily()
+  const bool lazy = lazyWindows;
+  const float *rmsChannels[RippleDetectorConfig::maxReferenceChannels + 1];
+  int numRmsChannels = 0;
+  if (!config->filterBankEnabled && !lazy)
+    rmsChannels[numRmsChannels++] = rippleData;
+  const int firstRefChannel = numRmsChannels;
+  if (!lazy)
+    for (int refChannel : config->referenceChannels)
+      if (const float *refData = block.getChannel(refChannel))
+        rmsChannels[numRmsChannels++] = refData;
+  const int numRefChannels = numRmsChannels - firstRefChannel;
+
+  windows.clear();
+
+  for (int rmsStartIdx = 0; rmsStartIdx < numSamples;
+       rmsStartIdx += rmsSamples) {
+    const int rmsEndIdx = std::min(rmsStartIdx + rmsSamples, numSamples);
+    const int windowSamples = rmsEndIdx - rmsStartIdx;
+    double sumSquares[RippleDetectorConfig::maxReferenceChannels + 1];
+    if (numRmsChannels > 0)
+      calculateSumSquares(rmsChannels, numRmsChannels, rmsStartIdx, rmsEndIdx,
+                          sumSquares);
+
+    // The filter bank replaces the broadband RMS with the ripple-band RMS
+    // and extracts the rejection features in the same pass
+    double rms = 0;
+    RippleBandFeatures features;
+    if (config->filterBankEnabled) {
+      features =
+          filterBank.processWindow(rippleData + rmsStartIdx, windowSamples);
+      rms = features.rippleRms;
+    } else if (!lazy) {
+      rms = sqrt(sumSquares[0] / windowSamples);
+    }
+
+    // Ripple probability of the input window ending here
+    if (cnn != nullptr)
+      windows.cnn.push_back(
+          cnn->processWindow(rippleData + rmsStartIdx, windowSamples));
+
+    // The window is still in cache, so feed the spectral monitor here
+    if (config->spectrumEnabled)
+      listener.windowSamples(rippleData + rmsStartIdx, windowSamples);
+
+    // Pooled RMS over all reference channels
+    double refRms = 0;
+    if (numRefChannels > 0) {
+      double refSumSquares = 0;
+      for (int ch = firstRefChannel; ch < numRmsChannels; ch++)
+        refSumSquares += sumSquares[ch];
+      refRms = sqrt(refSumSquares / ((double)windowSamples * numRefChannels));
+    }
+
+    double movRms = 0;
+    if constexpr (Mode != MovementMode::OFF) {
+      if (movData != nullptr) {
+        double movSumSquares;
+        calculateSumSquares(&movData, 1, rmsStartIdx, rmsEndIdx,
+                            &movSumSquares);
+        movRms = sqrt(movSumSquares / windowSamples);
+      }
+    }
+
+    if (state.isCalibrating) {
+      calibrationRmsValues.push_back(rms);
+      state.rmsMean += rms;
+
+      if constexpr (Mode != MovementMode::OFF) {
+        calibrationMovRmsValues.push_back(movRms);
+        state.movRmsMean += movRms;
+      }
+
+      if (config->filterBankEnabled) {
+        calibrationArtefactValues.push_back(features.maxSlope);
+        state.artefactMean += features.maxSlope;
+      }
+
+      if (numRefChannels > 0) {
+        calibrationRefRmsValues.push_back(refRms);
+        state.refRmsMean += refRms;
+      }
+    } else {
+      if (!lazy)
+        windows.rms.push_back(rms);
+      windows.numSamples.push_back(windowSamples);
+
+      if constexpr (Mode != MovementMode::OFF)
+        windows.movRms.push_back(movRms);
+
+      if (config->filterBankEnabled)
+        windows.classes.push_back(classifyWindow(features));
+
+      if (numRefChannels > 0)
+        windows.refRms.push_back(refRms);
+    }
+  }
+}
+
+bool RippleDetectionCore::finishBlock(const RippleDetectionBlock &block,
+                                      RippleDetectionListener &listener) {
+
+  if (state.isCalibrating) {
+    listener.calibrationBlock();
+    state.pointsProcessed += block.numSamples;
+    if (state.pointsProcessed >= config->calibrationPoints) {
+      finishCalibration();
+      listener.calibrationFinished();
+    }
+    return false;
+  }
+
+  if (lazyWindows)
+    detectRipplesLazily(block, listener);
+  else
+    detectRipples(block, listener);
+  if (movementMode != MovementMode::OFF)
+    evalMovement(block, listener);
+  return true;
+}
+
+// Called when calibration step is over
+void RippleDetectionCore::finishCalibration() {
+
+  // Set flag to false to end the calibration period
+  state.isCalibrating = false;
+
+  // Calculate RMS mean and standard deviation and the final amplitude
+  // threshold
+  state.rmsStdDev = finishStatistics(calibrationRmsValues, state.rmsMean);
+  state.threshold = state.rmsMean + config->rippleSds * state.rmsStdDev;
+
+  // The drift of the running RMS is measured from the new baseline
+  rmsAverage = state.rmsMean;
+
+  // Calculate EMR/ACC RMS mean and standard deviation if the switching
+  // mechanism is enabled
+  if (movementMode != MovementMode::OFF) {
+    state.movRmsStdDev =
+        finishStatistics(calibrationMovRmsValues, state.movRmsMean);
+    state.movThreshold =
+        state.movRmsMean + config->movSds * state.movRmsStdDev;
+  }
+
+  // Calculate the slope statistics used to reject spike artefacts
+  if (config->filterBankEnabled) {
+    state.artefactStdDev =
+        finishStatistics(calibrationArtefactValues, state.artefactMean);
+    state.artefactThreshold =
+        state.artefactMean + config->artefactSds * state.artefactStdDev;
+  }
+
+  // Calculate the reference RMS mean and standard deviation for the
+  // common-mode veto
+  if (!config->referenceChannels.empty()) {
+    state.refRmsStdDev =
+        finishStatistics(calibrationRefRmsValues, state.refRmsMean);
+    state.refThreshold =
+        state.refRmsMean + config->refSds * state.refRmsStdDev;
+  }
+}
+
+// Classify a window from the filter bank features: steep slopes are spike
+// artefacts, and windows dominated by the 250-500 Hz band are fast ripples
+RippleWindowClass
+RippleDetectionCore::classifyWindow(const RippleBandFeatures &features) const {
+  if (features.maxSlope > state.artefactThreshold)
+    return RippleWindowClass::ARTEFACT;
+  if (features.fastRippleRms > config->fastRippleRatio * features.rippleRms)
+    return RippleWindowClass::FAST_RIPPLE;
+  return RippleWindowClass::RIPPLE;
+}
+
+// Evaluate EMG/ACC signal to enable or disable ripple detection
+void RippleDetectionCore::evalMovement(const RippleDetectionBlock &block,
+                                       RippleDetectionListener &listener) {
+
+  // Iterate over RMS blocks inside buffer
+  for (size_t rmsIdx = 0; rmsIdx < windows.movRms.size(); rmsIdx++) {
+    const double rms = windows.movRms[rmsIdx];
+    const int samples = windows.numSamples[rmsIdx];
+
+    // Counter: acumulate time above or below threshold
+    if (rms > state.movThreshold) {
+      state.counterMovUpThresh += samples;
+      state.flagMovMinTimeDown = false;
+    } else {
+      state.counterMovDownThresh += samples;
+      state.flagMovMinTimeUp = false;
+      state.counterMovUpThresh = 0;
+    }
+
+    // Set flags when minimum time above or below threshold is achieved
+    if (state.counterMovUpThresh >
+        (unsigned int)config->minMovSamplesAboveThresh) {
+      state.flagMovMinTimeUp = true;
+      // Reset counterMovDownThresh only when there is movement for enough
+      // time
+      state.counterMovDownThresh = 0;
+    }
+    if (state.counterMovDownThresh >
+        (unsigned int)config->minMovSamplesBelowThresh)
+      state.flagMovMinTimeDown = true;
+
+    // Disable plugin...
+    if (state.pluginEnabled && state.flagMovMinTimeUp) {
+      state.pluginEnabled = false;
+      listener.ttlEvent(config->movementOutputChannel,
+                        block.firstSampleNumber + rmsIdx, true, (int)rmsIdx);
+    }
+    // ... or enable plugin
+    if (!state.pluginEnabled && state.flagMovMinTimeDown) {
+      state.pluginEnabled = true;
+      listener.ttlEvent(config->movementOutputChannel,
+                        block.firstSampleNumber + rmsIdx, false, (int)rmsIdx);
+    }
+  }
+}
+
+// Detection over a block that lies entirely in the refractory period. Only
+// the TTL timing, the health counts and the run of windows above threshold
+// at the end of the block carry over to later blocks, so the RMS is computed
+// walking back from the last window until one is below threshold. Crossings
+// that end earlier in the block are not counted as rejected, and the running
+// RMS average only sees the windows computed
+void RippleDetectionCore::detectRipplesLazily(
+    const RippleDetectionBlock &block, RippleDetectionListener &listener) {
+
+  const std::vector<int> &rmsNumSamples = windows.numSamples;
+  const int numSamples = block.numSamples;
+  const int64_t now = block.wallClockMs;
+
+  // As in detectRipples(), where the clock does not change within a block
+  if (state.rippleDetected && state.pluginEnabled &&
+      now - state.rippleStartTime > config->ttlDuration &&
+      state.randomNumber <= config->ttlPercent) {
+    listener.ttlEvent(config->rippleOutputChannel, block.firstSampleNumber,
+                      false, 0);
+    state.rippleDetected = false;
+  }
+
+  const bool stateGateOpen =
+      isStateGateOpen(config->stateGate, currentBrainState);
+
+  // Same channels and window bounds as processWindows(), so the sums round
+  // exactly as they would have there
+  const float *rmsChannels[RippleDetectorConfig::maxReferenceChannels + 1];
+  int numRmsChannels = 0;
+  rmsChannels[numRmsChannels++] = block.getChannel(config->rippleInputChannel);
+  for (int refChannel : config->referenceChannels)
+    if (const float *refData = block.getChannel(refChannel))
+      rmsChannels[numRmsChannels++] = refData;
+  const int numRefChannels = numRmsChannels - 1;
+
+  unsigned int run = 0;
+  bool runFromStart = stateGateOpen;
+  int windowEnd = numSamples;
+  for (int rmsIdx = (int)rmsNumSamples.size() - 1;
+       rmsIdx >= 0 && runFromStart; rmsIdx--) {
+    const int samples = rmsNumSamples[rmsIdx];
+    const int windowStart = windowEnd - samples;
+    double sumSquares[RippleDetectorConfig::maxReferenceChannels + 1];
+    calculateSumSquares(rmsChannels, numRmsChannels, windowStart, windowEnd,
+                        sumSquares);
+
+    const double rms = sqrt(sumSquares[0] / samples);
+    rmsAverage += RippleHealthCounters::rmsAverageWeight * (rms - rmsAverage);
+    bool aboveThreshold = rms > state.threshold;
+    if (numRefChannels > 0) {
+      double refSumSquares = 0;
+      for (int ch = 1; ch < numRmsChannels; ch++)
+        refSumSquares += sumSquares[ch];
+      if (sqrt(refSumSquares / ((double)samples * numRefChannels)) >
+          state.refThreshold)
+        aboveThreshold = false;
+    }
+
+    if (!aboveThreshold)
+      runFromStart = false;
+    else
+      run += samples;
+    windowEnd = windowStart;
+  }
+
+  // A run that covers the block continues the previous block's one
+  if (runFromStart) {
+    state.counterAboveThresh += run;
+  } else if (!rmsNumSamples.empty()) {
+    state.counterAboveThresh = run;
+    state.flagTimeThreshold = false;
+  }
+  if (state.counterAboveThresh >
+      (unsigned int)config->numSamplesTimeThreshold)
+    state.flagTimeThreshold = true;
+
+  if (!state.pluginEnabled)
+    counts.blockedSamples += numSamples;
+  counts.refractorySamples += numSamples;
+  if (!stateGateOpen)
+    counts.gatedSamples += numSamples;
+}
+
+void RippleDetectionCore::detectRipples(const RippleDetectionBlock &block,
+                                        RippleDetectionListener &listener) {
+
+  const int64_t first = block.firstSampleNumber;
+  const int64_t now = block.wallClockMs;
+
+  // The brain state is updated once per block
+  const bool stateGateOpen =
+      isStateGateOpen(config->stateGate, currentBrainState);
+
+  // Iterate over RMS blocks inside buffer
+  RippleWindowResult window;
+  window.stateGateOpen = stateGateOpen;
+  for (size_t rmsIdx = 0; rmsIdx < windows.numSamples.size();
+       window.start += window.numSamples, rmsIdx++) {
+    window.index = (int)rmsIdx;
+    window.numSamples = windows.numSamples[rmsIdx];
+    window.rms = windows.rms[rmsIdx];
+    window.cnn = cnn != nullptr ? windows.cnn[rmsIdx] : 0.0;
+    window.detected = window.propagated = window.blocked = false;
+    const int samples = window.numSamples;
+
+    rmsAverage +=
+        RippleHealthCounters::rmsAverageWeight * (window.rms - rmsAverage);
+    if (!state.pluginEnabled)
+      counts.blockedSamples += samples;
+    if (state.onRefractoryTime)
+      counts.refractorySamples += samples;
+
+    // Reset TTL if ripple was detected during the last iteration
+    if (state.rippleDetected && state.pluginEnabled &&
+        now - state.rippleStartTime > config->ttlDuration &&
+        state.randomNumber <= config->ttlPercent) {
+      listener.ttlEvent(config->rippleOutputChannel, first, false, 0);
+      state.rippleDetected = false;
+    }
+
+    // With the CNN detector the window's ripple probability is tested instead
+    bool aboveThreshold = cnn != nullptr ? window.cnn > config->cnnThreshold
+                                         : window.rms > state.threshold;
+    bool vetoed = false;
+
+    // Fast ripples and spike artefacts are vetoed before any TTL is emitted.
+    // Artefacts also hold the veto for a while, as they ring through the
+    // band-pass filters
+    if (config->filterBankEnabled) {
+      const RippleWindowClass windowClass = windows.classes[rmsIdx];
+      if (windowClass == RippleWindowClass::ARTEFACT)
+        state.artefactHoldCounter = config->artefactHoldSamples + samples;
+      state.artefactHoldCounter =
+          std::max(0, state.artefactHoldCounter - samples);
+
+      if (windowClass != RippleWindowClass::RIPPLE ||
+          state.artefactHoldCounter > 0)
+        vetoed = true;
+    }
+
+    // Chewing, licking and cable artefacts also push the reference channels
+    // over their own threshold, while ripples stay local
+    if (!windows.refRms.empty() &&
+        windows.refRms[rmsIdx] > state.refThreshold)
+      vetoed = true;
+
+    // Ripples outside the selected brain states are not reported
+    if (!stateGateOpen) {
+      vetoed = true;
+      counts.gatedSamples += samples;
+    }
+    if (vetoed)
+      aboveThreshold = false;
+    window.vetoed = vetoed;
+    window.aboveThreshold = aboveThreshold;
+
+    // Counter: acumulate time above threshold
+    if (aboveThreshold) {
+      state.counterAboveThresh += samples;
+    } else {
+      if (state.counterAboveThresh > 0 && !state.flagTimeThreshold)
+        counts.rejectedCrossings++;
+      state.counterAboveThresh = 0;
+      state.flagTimeThreshold = false;
+    }
+
+    // Set flag to indicate that time threshold was achieved
+    if (state.counterAboveThresh >
+        (unsigned int)config->numSamplesTimeThreshold)
+      state.flagTimeThreshold = true;
+
+    // Send TTL if ripple is detected and it is not on refractory period
+    if (state.flagTimeThreshold && !state.onRefractoryTime) {
+
+      if (state.pluginEnabled) {
+        state.rippleStartTime = now;
+        listener.ttlEvent(config->ttlReportChannel, first, true, 0);
+        state.randomNumber = listener.drawPercent();
+        window.detected = true;
+        // only create a ttl event on the output line if chance dictates...
+        window.propagated = state.randomNumber <= config->ttlPercent;
+        if (window.propagated) {
+          listener.ttlEvent(config->rippleOutputChannel, first, true, 0);
+          counts.detections++;
+        }
+
+        // The detection becomes known at the end of this window
+        fuseDetection(block, window.start + samples - 1, listener);
+      } else {
+        window.blocked = true;
+        counts.blockedDetections++;
+      }
+      listener.detection(window);
+
+      state.rippleDetected = true;
+
+      // Start refractory period
+      state.onRefractoryTime = true;
+      state.refractoryTimeStart = now;
+    }
+
+    // Check and reset refractory time
+    if (state.onRefractoryTime &&
+        now - state.refractoryTimeStart >= config->refractoryTime)
+      state.onRefractoryTime = false;
+
+    listener.windowDone(window);
+  }
+}
+
+// Pass a detection to the cross-stream fusion stage and raise the combined
+// TTL when it decides to fire
+void RippleDetectionCore::fuseDetection(const RippleDetectionBlock &block,
+                                        int sampleIndex,
+                                        RippleDetectionListener &listener) {
+
+  const RippleFusionConfig *fusionConfig = block.fusionConfig;
+  if (fusion == nullptr || fusionConfig == nullptr ||
+      fusionConfig->mode == FusionMode::OFF)
+    return;
+
+  const int64_t sampleNumber = block.firstSampleNumber + sampleIndex;
+  const double time =
+      sampleNumber / config->sampleRate - state.fusionOffset;
+
+  if (!fusion->addDetection(fusionIndex, time, *fusionConfig))
+    return;
+
+  listener.ttlEvent(fusionConfig->outputChannel, sampleNumber, true,
+                    sampleIndex);
+
+  state.fusedTtlOn = true;
+  state.fusedTtlLine = fusionConfig->outputChannel;
+  state.fusedTtlOffSample =
+      sampleNumber + std::max(config->ttlDurationSamples, 1);
+  counts.fusedDetections++;
+}
@@ -0,0 +1,226 @@
+#ifndef __RIPPLE_DETECTION_CORE_H
+#define __RIPPLE_DETECTION_CORE_H
+
+#include "RippleBrainState.h"
+#include "RippleCnn.h"
+#include "RippleDetectorConfig.h"
+#include "RippleFilterBank.h"
+#include "RippleFusion.h"
+#include "RippleTrace.h"
+#include <cstdint>
+#include <vector>
+
+/** One block of one stream, as seen by RippleDetectionCore::process() */
+struct RippleDetectionBlock {
+  const float *const *channels{nullptr}; // By global channel index, nullptr
+                                         // where a channel is not available
+  int numChannels{0};
+  int64_t firstSampleNumber{0};
+  int numSamples{0};
+  int64_t wallClockMs{0}; // Clock of the refractory period and TTL duration
+  bool calibrate{false};  // Calibration was requested for this block
+  bool deferrable{true};  // Nothing outside the core reads its windows
+  const RippleFusionConfig *fusionConfig{nullptr}; // nullptr without fusion
+
+  /** Returns the samples of a global channel, or nullptr */
+  const float *getChannel(int index) const {
+    return index >= 0 && index < numChannels ? channels[index] : nullptr;
+  }
+};
+
+/** Features of the windows of the current block, one entry per window */
+struct RippleWindowFeatures {
+  std::vector<int> numSamples;
+  std::vector<double> rms; // Left empty for a deferred block
+  std::vector<double> refRms;
+  std::vector<double> movRms;
+  std::vector<RippleWindowClass> classes;
+  std::vector<double> cnn;
+
+  void clear();
+};
+
+/** Outcome of one window of a block */
+struct RippleWindowResult {
+  int index{0};      // Window within the block
+  int start{0};      // First sample, within the block
+  int numSamples{0};
+  double rms{0.0};
+  double cnn{0.0};            // Ripple probability with the CNN detector
+  bool aboveThreshold{false}; // After the vetoes
+  bool vetoed{false};         // By the filter bank, reference or state gate
+  bool stateGateOpen{true};
+  bool detected{false};   // A detection raised the report TTL
+  bool propagated{false}; // ... and the output TTL
+  bool blocked{false};    // A detection was made with the outputs disabled
+};
+
+/** Detection counts of the last block, for the health monitor */
+struct RippleBlockCounts {
+  uint64_t detections{0}; // Raised the output TTL, after ttl_percent
+  uint64_t blockedDetections{0};
+  uint64_t rejectedCrossings{0};
+  uint64_t blockedSamples{0};
+  uint64_t refractorySamples{0};
+  uint64_t gatedSamples{0};
+  uint64_t fusedDetections{0};
+};
+
+/**
+  Receives what a RippleDetectionCore does with a block, as it does it. Only
+  the TTL events and the ttl_percent draws are needed; the rest lets the
+  plugin attach its monitors without a second pass over the windows.
+**/
+class RippleDetectionListener {
+public:
+  virtual ~RippleDetectionListener() {}
+
+  /** A TTL line changes state. sampleIndex is the offset into the block
+   * the event is added at */
+  virtual void ttlEvent(int line, int64_t sampleNumber, bool state,
+                        int sampleIndex) = 0;
+
+  /** Draws the number, from 1 to 100, a detection compares with
+   * ttl_percent */
+  virtual double drawPercent() = 0;
+
+  /** A window of the ripple input, while it is still in cache */
+  virtual void windowSamples(const float * /*data*/, int /*numSamples*/) {}
+
+  /** A detection was made on a window, detected or blocked */
+  virtual void detection(const RippleWindowResult & /*window*/) {}
+
+  /** A window has been through detection */
+  virtual void windowDone(const RippleWindowResult & /*window*/) {}
+
+  /** A calibration starts with the current block */
+  virtual void calibrationStarted() {}
+
+  /** The current block is part of the calibration, which ends with it if
+   * calibrationFinished() follows */
+  virtual void calibrationBlock() {}
+
+  /** The baseline has been measured */
+  virtual void calibrationFinished() {}
+};
+
+/**
+  Window, calibration and detection state machine of one stream.
+
+  This is the detection logic of RippleDetector::process(), without JUCE, so
+  the plugin, the trace replayer, the sidecar, the Python bindings and the
+  sweep all run the same code. Each block is cut into RMS windows, which
+  either add to the calibration or go through the thresholds, vetoes, time
+  threshold, refractory period and movement detector, and the resulting TTL
+  events are handed to a listener. The snapshot passed to applyConfig() must
+  stay valid until the next call. Never allocates once the window buffers
+  have grown to the largest block.
+**/
+class RippleDetectionCore {
+public:
+  RippleDetectionCore();
+
+  /** Resets the baseline and counters for a stream of the given rate.
+   * fusion is the stage shared by the streams, if any */
+  void prepare(double sampleRate, RippleFusion *fusion, int fusionIndex);
+
+  /** Picks up a new snapshot. cnnRunner is the runner of its weights file,
+   * if one is loaded. With restoring set the state was taken with this
+   * snapshot already applied, and only what it does not hold is derived */
+  void applyConfig(const RippleDetectorConfig &config, RippleCnn *cnnRunner,
+                   bool restoring = false);
+
+  /** Processes one block. Returns true if it went through detection, false
+   * if it was part of a calibration or could not be processed */
+  bool process(const RippleDetectionBlock &block,
+               RippleDetectionListener &listener);
+
+  /** As process(), on window features the caller has filled into
+   * getWindows(). The block's samples are not read and no calibration is
+   * run */
+  bool processFeatures(const RippleDetectionBlock &block,
+                       RippleDetectionListener &listener);
+
+  /** Filter bank class of a window, against the calibrated slope threshold */
+  RippleWindowClass classifyWindow(const RippleBandFeatures &features) const;
+
+  /** Detector state, as recorded in a trace */
+  RippleTraceState &getState() { return state; }
+  const RippleTraceState &getState() const { return state; }
+
+  RippleWindowFeatures &getWindows() { return windows; }
+  const RippleBlockCounts &getCounts() const { return counts; }
+  BrainState getBrainState() const { return currentBrainState; }
+  MovementMode getMovementMode() const { return movementMode; }
+  bool usesCnn() const { return cnn != nullptr; }
+  double getRmsAverage() const { return rmsAverage; }
+  size_t getNumCalibrationWindows() const {
+    return calibrationRmsValues.size();
+  }
+
+private:
+  /** Handles everything before the windows of a block. Returns false if
+   * the block cannot be processed */
+  bool beginBlock(const RippleDetectionBlock &block,
+                  RippleDetectionListener &listener);
+
+  /** Whether no detection can result from the block, so its ripple and
+   * reference RMS need not be computed for every window */
+  bool canDeferWindows(const RippleDetectionBlock &block) const;
+
+  /** RMS window loop, instantiated once per movement mode */
+  template <MovementMode Mode>
+  void processWindows(const RippleDetectionBlock &block, int rmsSamples,
+                      RippleDetectionListener &listener);
+
+  /** Ends the calibration, or runs detection and movement over the
+   * windows */
+  bool finishBlock(const RippleDetectionBlock &block,
+                   RippleDetectionListener &listener);
+
+  void finishCalibration();
+  void detectRipples(const RippleDetectionBlock &block,
+                     RippleDetectionListener &listener);
+
+  /** Brings the state through a block for which canDeferWindows() held,
+   * computing only the windows that matter */
+  void detectRipplesLazily(const RippleDetectionBlock &block,
+                           RippleDetectionListener &listener);
+  void evalMovement(const RippleDetectionBlock &block,
+                    RippleDetectionListener &listener);
+  void fuseDetection(const RippleDetectionBlock &block, int sampleIndex,
+                     RippleDetectionListener &listener);
+
+  typedef void (RippleDetectionCore::*WindowProcessor)(
+      const RippleDetectionBlock &block, int rmsSamples,
+      RippleDetectionListener &listener);
+
+  const RippleDetectorConfig *config{nullptr};
+  RippleTraceState state;
+  RippleBlockCounts counts;
+
+  // Block processing variant for the active movement mode, selected when
+  // the snapshot changes rather than tested for every window
+  MovementMode movementMode{MovementMode::OFF};
+  WindowProcessor windowProcessor;
+  std::vector<float> accMagnitude; // Accelerometer magnitude of the block
+
+  RippleFilterBank filterBank;
+  RippleBrainState brainState;
+  BrainState currentBrainState{BrainState::UNKNOWN};
+  RippleCnn *cnn{nullptr}; // Runner in use while the CNN detector is on
+
+  RippleFusion *fusion{nullptr};
+  int fusionIndex{-1};
+
+  bool lazyWindows{false}; // The block lies in the refractory period
+  double rmsAverage{0.0};  // Running average of the window RMS
+
+  RippleWindowFeatures windows;
+  std::vector<double> calibrationRmsValues;
+  std::vector<double> calibrationMovRmsValues;
+  std::vector<double> calibrationArtefactValues;
+  std::vector<double> calibrationRefRmsValues;
+};
+
+#endif
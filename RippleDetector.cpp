@@ -7,6 +7,7 @@
 #include <vector>
 
 #define CALIBRATION_DURATION_SECONDS 10
+#define ARTEFACT_HOLD_MILLISECONDS 20
 // random number generator for ttl event percent output
 std::random_device os_seed;
 const uint_least32_t seed = os_seed();
@@ -23,6 +24,15 @@ TTLEventPtr RippleDetectorSettings::createEvent(int64 outputLine,
                                   state);
 }
 
+BinaryEventPtr
+RippleDetectorSettings::createEpisodeEvent(int64 sample_number,
+                                           const RippleEpisode &episode) {
+
+  return BinaryEvent::createBinaryEvent(episodeChannel, sample_number,
+                                        (const uint8 *)&episode,
+                                        sizeof(RippleEpisode));
+}
+
 RippleDetector::RippleDetector() : GenericProcessor("Ripple Detector") {
 
   /* Ripple Detection Settings */
@@ -47,6 +57,12 @@ RippleDetector::RippleDetector() : GenericProcessor("Ripple Detector") {
   addFloatParameter(Parameter::STREAM_SCOPE, "time_thresh",
                     "time threshold value", 10, 0, 9999, 1);
 
+  addFloatParameter(Parameter::STREAM_SCOPE, "offset_std",
+                    "Number of standard deviations above the average where "
+                    "a detected ripple starts and ends, for the episode "
+                    "events",
+                    2, 0, 9999, 0.5);
+
   addFloatParameter(Parameter::STREAM_SCOPE, "refr_time", "refractory value",
                     140, 0, 999999, 1);
 
@@ -72,6 +88,145 @@ RippleDetector::RippleDetector() : GenericProcessor("Ripple Detector") {
   addFloatParameter(Parameter::STREAM_SCOPE, "rms_samples", "rms samples value",
                     128, 1, 2048, 1);
 
+  /* CNN Detector Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "detector",
+                          "Detect ripples with the RMS threshold or with a "
+                          "pretrained 1D convolutional network",
+                          {"RMS", "CNN"}, 0);
+
+  addStringParameter(Parameter::STREAM_SCOPE, "cnn_model",
+                     "Path to the CNN weights file", "");
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "cnn_thresh",
+                    "Ripple probability above which a CNN window counts as "
+                    "above threshold",
+                    0.5, 0, 1, 0.01);
+
+  /* Filter Bank Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "filter_bank",
+                          "Band-pass the input internally (150-250 Hz, "
+                          "4th-order Butterworth, -3 dB edges) and reject "
+                          "fast ripples and spike artefacts",
+                          {"OFF", "ON"}, 0);
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "fr_ratio",
+                    "Fast-ripple (250-500 Hz) to ripple (150-250 Hz) RMS "
+                    "ratio above which an event is rejected as a fast "
+                    "ripple. The bands cross at 250 Hz, where it is 1",
+                    1.5, 0, 100, 0.1);
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "artefact_std",
+                    "Number of standard deviations above the average slope to "
+                    "reject a window as a spike artefact",
+                    10, 0, 9999, 1);
+
+  /* Spectral Monitor Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "spectrum",
+                          "Show live 100-600 Hz power of the ripple input",
+                          {"OFF", "ON"}, 0);
+
+  /* Ripple-Triggered Average Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "event_avg",
+                          "Average the ripple input and reference channels "
+                          "around every detection, with a spectrogram of "
+                          "the ripple input",
+                          {"OFF", "ON"}, 0);
+
+  /* Brain-State Gate Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "state_gate",
+                          "Only detect ripples in the selected brain states, "
+                          "classified from delta and theta power",
+                          {"OFF", "NON-THETA", "NREM"}, 0);
+
+  addSelectedChannelsParameter(Parameter::STREAM_SCOPE, "state_input",
+                               "Channel whose delta and theta power classify "
+                               "the brain state (default: the ripple input)",
+                               1);
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "theta_ratio",
+                    "Theta over delta power above which the state counts as "
+                    "theta (running or REM)",
+                    1, 0, 9999, 0.1);
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "delta_frac",
+                    "Share of the 1-40 Hz power in the delta band above which "
+                    "the state counts as NREM",
+                    0.5, 0, 1, 0.05);
+
+  /* Shadow Detector Settings */
+  addStringParameter(Parameter::STREAM_SCOPE, "shadow_sets",
+                     "Alternative ripple_std:time_thresh pairs, separated "
+                     "by commas (e.g. 4:20, 6:30), counted next to the live "
+                     "detector without emitting events",
+                     "");
+
+  /* Window Auto-Tuning Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "auto_tune",
+                          "Time candidate RMS window lengths during "
+                          "calibration and switch rms_samples to the "
+                          "fastest one within the budgets",
+                          {"OFF", "ON"}, 0);
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "tune_cpu",
+                    "CPU budget of the window feature pass (% of real time)",
+                    5, 0.1, 100, 0.1);
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "tune_fp",
+                    "Baseline detections per minute allowed for a tuned "
+                    "window length",
+                    1, 0, 9999, 0.1);
+
+  /* Envelope Output Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "envelope_out",
+                          "Add continuous channels with the detection "
+                          "envelope, its threshold and the detector state",
+                          {"OFF", "ON"}, 0, true);
+
+  /* Channel Auto-Selection Settings */
+  addCategoricalParameter(Parameter::STREAM_SCOPE, "auto_select",
+                          "Rank every channel by ripple-band activity during "
+                          "calibration, and optionally switch the ripple "
+                          "input to the best one",
+                          {"OFF", "RANK", "PICK"}, 0, true);
+
+  /* Reference Channel (Common-Mode Veto) Settings */
+  addSelectedChannelsParameter(
+      Parameter::STREAM_SCOPE, "ref_input",
+      "Reference channels (e.g. cortical) used to veto common-mode events",
+      RippleDetectorConfig::maxReferenceChannels);
+
+  addFloatParameter(Parameter::STREAM_SCOPE, "ref_std",
+                    "Number of standard deviations above the average to be the "
+                    "amplitude threshold for the reference channels",
+                    5, 0, 9999, 1);
+
+  /* Cross-Stream Fusion Settings */
+  addCategoricalParameter(Parameter::GLOBAL_SCOPE, "fusion_mode",
+                          "Combine detections across streams: fire on any "
+                          "stream, or only when streams coincide",
+                          {"OFF", "ANY", "COINCIDENT"}, 0);
+
+  addFloatParameter(Parameter::GLOBAL_SCOPE, "fusion_window",
+                    "Coincidence window between streams (ms). Streams are "
+                    "aligned to within a few ms",
+                    20, 0, 1000, 1);
+
+  addIntParameter(Parameter::GLOBAL_SCOPE, "fusion_out",
+                  "The output TTL line for combined detections", 4, 1, 16);
+
+  /* Block Trace Settings */
+  addStringParameter(Parameter::GLOBAL_SCOPE, "trace_file",
+                     "Record every block the detector processes to this "
+                     "file, for offline replay (empty: off)",
+                     "", true);
+
+  /* Ripple Episodes */
+  addStringParameter(Parameter::GLOBAL_SCOPE, "episode_file",
+                     "Also write the episode events to this file, as text "
+                     "for .csv or .txt and as binary records otherwise "
+                     "(empty: off)",
+                     "", true);
+
   /* EMG / ACC Movement Detection Settings */
   addCategoricalParameter(Parameter::STREAM_SCOPE, "mov_detect",
                           "Use movement to supress ripple detection",
@@ -108,62 +263,34 @@ void RippleDetector::updateSettings() {
 
   settings.update(getDataStreams());
 
+  int fusionIndex = 0;
   for (auto stream : getDataStreams()) {
 
-    settings[stream->getStreamId()]->rmsEndIdx = 0;
-    settings[stream->getStreamId()]->rmsMean = 0;
-    settings[stream->getStreamId()]->rmsStdDev = 0;
-    settings[stream->getStreamId()]->movRmsMean = 0;
-    settings[stream->getStreamId()]->movRmsStdDev = 0;
-    settings[stream->getStreamId()]->threshold = 0;
-    settings[stream->getStreamId()]->movThreshold = 0;
+    settings[stream->getStreamId()]->fusionIndex = fusionIndex++;
 
-    settings[stream->getStreamId()]->rippleSds = 0.0;
-    settings[stream->getStreamId()]->timeThreshold = 0;
-    settings[stream->getStreamId()]->refractoryTime = 0;
-    settings[stream->getStreamId()]->rmsSamples = 0;
-    settings[stream->getStreamId()]->movSds = 0.0;
-    settings[stream->getStreamId()]->minTimeWoMov = 0;
-    settings[stream->getStreamId()]->minTimeWMov = 0;
+    settings[stream->getStreamId()]->detector.prepare(
+        stream->getSampleRate(), &rippleFusion,
+        settings[stream->getStreamId()]->fusionIndex);
 
-    settings[stream->getStreamId()]->counterAboveThresh = 0;
-    settings[stream->getStreamId()]->counterMovUpThresh = 0;
-    settings[stream->getStreamId()]->counterMovDownThresh = 0;
+    settings[stream->getStreamId()]->health.reset();
+    settings[stream->getStreamId()]->lastInputSample = 0;
 
-    settings[stream->getStreamId()]->pointsProcessed = 0;
+    settings[stream->getStreamId()]->spectrum.prepare(
+        stream->getSampleRate());
 
-    calibrationRmsValues[stream->getStreamId()].clear();
-    calibrationMovRmsValues[stream->getStreamId()].clear();
+    RippleDetectorSettings &streamSettings = *settings[stream->getStreamId()];
+    streamSettings.eventAverage.prepare(stream->getSampleRate());
+    streamSettings.eventAverageBuffer.forEachSlot(
+        [&](RippleEventAverageSnapshot &snapshot) {
+          streamSettings.eventAverage.prepareSnapshot(snapshot);
+          streamSettings.eventAverage.fillSnapshot(snapshot);
+        });
+    streamSettings.eventAverageActive = false;
 
-    settings[stream->getStreamId()]->calibrationPoints =
-        stream->getSampleRate() * CALIBRATION_DURATION_SECONDS;
-
-    parameterValueChanged(stream->getParameter("Ripple_Input"));
-    parameterValueChanged(stream->getParameter("Ripple_Out"));
-    parameterValueChanged(stream->getParameter("ripple_std"));
-    parameterValueChanged(stream->getParameter("time_thresh"));
-    parameterValueChanged(stream->getParameter("refr_time"));
-    parameterValueChanged(stream->getParameter("rms_samples"));
-    parameterValueChanged(stream->getParameter("mov_detect"));
-    parameterValueChanged(stream->getParameter("mov_input"));
-    parameterValueChanged(stream->getParameter("mov_out"));
-    parameterValueChanged(stream->getParameter("mov_std"));
-    parameterValueChanged(stream->getParameter("min_time_st"));
-    parameterValueChanged(stream->getParameter("min_time_mov"));
-    parameterValueChanged(stream->getParameter("Ripple_save"));
-    parameterValueChanged(stream->getParameter("ttl_percent"));
-    parameterValueChanged(stream->getParameter("ttl_duration"));
-    parameterValueChanged(stream->getParameter("RMS_mean"));
-    parameterValueChanged(stream->getParameter("RMS_std"));
-
-    // Add AUX channels to use for accelerometer data
-    settings[stream->getStreamId()]->auxChannelIndices.clear();
-    for (auto &channel : stream->getContinuousChannels()) {
-      if (channel->getChannelType() == ContinuousChannel::Type::AUX) {
-        settings[stream->getStreamId()]->auxChannelIndices.push_back(
-            channel->getLocalIndex());
-      }
-    }
+    streamSettings.autoTuner.prepare(
+        stream->getSampleRate(),
+        (int)(stream->getSampleRate() * CALIBRATION_DURATION_SECONDS));
+    streamSettings.skipNextTune = false;
 
     // Add event channels to use for detection data
     EventChannel::Settings s{
@@ -173,7 +300,61 @@ void RippleDetector::updateSettings() {
     eventChannels.add(new EventChannel(s));
     eventChannels.getLast()->addProcessor(processorInfo.get());
     settings[stream->getStreamId()]->eventChannel = eventChannels.getLast();
+
+    // Each detected ripple's onset, peak and offset, once it has ended
+    EventChannel::Settings episodeSettings{
+        EventChannel::Type::CUSTOM, "Ripple episodes",
+        "Onset, detection, peak and offset of each detected ripple, as a "
+        "48-byte RippleEpisode record",
+        "dataderived.ripple.episode", getDataStream(stream->getStreamId())};
+    episodeSettings.binaryDataType = EventChannel::BinaryDataType::UINT8_ARRAY;
+    episodeSettings.length = sizeof(RippleEpisode);
+    eventChannels.add(new EventChannel(episodeSettings));
+    eventChannels.getLast()->addProcessor(processorInfo.get());
+    settings[stream->getStreamId()]->episodeChannel = eventChannels.getLast();
+
+    // Add the envelope outputs after the stream's input channels. ADC type
+    // keeps them out of the accelerometer channels
+    settings[stream->getStreamId()]->envelopeLocalIndex = -1;
+    if (((CategoricalParameter *)stream->getParameter("envelope_out"))
+            ->getValueAsString()
+            .equalsIgnoreCase("ON")) {
+      settings[stream->getStreamId()]->envelopeLocalIndex =
+          stream->getChannelCount();
+      const char *names[] = {"Ripple envelope", "Ripple threshold",
+                             "Ripple state"};
+      const char *descriptions[] = {
+          "RMS (or CNN probability) of each detection window",
+          "Threshold the envelope is compared with",
+          "Detector state: -1 blocked, 0 below, 1 above threshold, 2 ripple"};
+      const char *identifiers[] = {"dataderived.ripple.envelope",
+                                   "dataderived.ripple.threshold",
+                                   "dataderived.ripple.state"};
+      for (int idx = 0; idx < 3; idx++) {
+        ContinuousChannel::Settings c{ContinuousChannel::Type::ADC,
+                                      names[idx],
+                                      descriptions[idx],
+                                      identifiers[idx],
+                                      1.0f,
+                                      getDataStream(stream->getStreamId())};
+        continuousChannels.add(new ContinuousChannel(c));
+        continuousChannels.getLast()->addProcessor(processorInfo.get());
+      }
+    }
+
+    prepareChannelScan(stream);
+
+    // Apply the side effects of these parameters (unique TTL lines, ACC
+    // availability); every call also publishes a fresh snapshot
+    parameterValueChanged(stream->getParameter("Ripple_Out"));
+    parameterValueChanged(stream->getParameter("Ripple_save"));
+    parameterValueChanged(stream->getParameter("mov_out"));
+    parameterValueChanged(stream->getParameter("mov_detect"));
+    parameterValueChanged(stream->getParameter("cnn_model"));
   }
+
+  rippleFusion.prepare(fusionIndex);
+  publishFusionConfig();
 }
 
 // Create and return editor
@@ -213,60 +394,63 @@ void RippleDetector::makeParamValuesUnique(Parameter *param1,
 void RippleDetector::parameterValueChanged(Parameter *param) {
 
   String paramName = param->getName();
+
+  if (paramName.equalsIgnoreCase("fusion_mode") ||
+      paramName.equalsIgnoreCase("fusion_window") ||
+      paramName.equalsIgnoreCase("fusion_out")) {
+    // The combined line must differ from every stream's output lines
+    if (paramName.equalsIgnoreCase("fusion_out")) {
+      for (auto stream : getDataStreams()) {
+        makeParamValuesUnique(param, stream->getParameter("Ripple_Out"));
+        makeParamValuesUnique(param, stream->getParameter("Ripple_save"));
+        makeParamValuesUnique(param, stream->getParameter("mov_out"));
+      }
+    }
+    publishFusionConfig();
+    return;
+  }
+
+  // Read when acquisition starts
+  if (paramName.equalsIgnoreCase("trace_file") ||
+      paramName.equalsIgnoreCase("episode_file"))
+    return;
+
   int streamId = param->getStreamId();
+  auto stream = getDataStream(streamId);
 
-  if (paramName.equalsIgnoreCase("Ripple_Input")) {
-    Array<var> *array = param->getValue().getArray();
+  if (paramName.equalsIgnoreCase("auto_select"))
+    prepareChannelScan(stream);
 
-    if (array->size() > 0) {
-      int localIndex = int(array->getFirst());
-      int globalIndex = getDataStream(param->getStreamId())
-                            ->getContinuousChannels()[localIndex]
-                            ->getGlobalIndex();
-      settings[streamId]->rippleInputChannel = globalIndex;
-    } else {
-      settings[streamId]->rippleInputChannel = -1;
-    }
-  } else if (paramName.equalsIgnoreCase("Ripple_Out")) {
-    settings[streamId]->rippleOutputChannel = (int)param->getValue() - 1;
-    auto stream = getDataStream(streamId);
-    auto param1 = stream->getParameter("Ripple_save");
-    makeParamValuesUnique(param, param1);
-  } else if (paramName.equalsIgnoreCase("ripple_std")) {
-    settings[streamId]->rippleSds = (float)param->getValue();
-  } else if (paramName.equalsIgnoreCase("Time_Thresh")) {
-    settings[streamId]->timeThreshold = (int)param->getValue();
-    settings[streamId]->numSamplesTimeThreshold =
-        ceil(getDataStream(streamId)->getSampleRate() *
-             settings[streamId]->timeThreshold / 1000);
-  } else if (paramName.equalsIgnoreCase("Refr_Time")) {
-    settings[streamId]->refractoryTime = (int)param->getValue();
-  } else if (paramName.equalsIgnoreCase("ttl_duration")) {
-    settings[streamId]->ttl_duration = (double)param->getValue();
-  } else if (paramName.equalsIgnoreCase("ttl_percent")) {
-    settings[streamId]->ttl_percent = (double)param->getValue();
-  } else if (paramName.equalsIgnoreCase("RMS_mean")) {
-    settings[streamId]->rmsMean = (double)param->getValue();
-    // param->setNextValue(settings[streamId]->rmsMean);
-  } else if (paramName.equalsIgnoreCase("RMS_std")) {
-    settings[streamId]->rmsStdDev = (double)param->getValue();
+  // Adding or removing channels rebuilds the stream, and updateSettings()
+  // publishes the new snapshot
+  if (paramName.equalsIgnoreCase("envelope_out")) {
+    CoreServices::updateSignalChain(getEditor());
+    return;
+  }
+
+  // Only a few parameters need more than a new snapshot
+  if (paramName.equalsIgnoreCase("Ripple_Out")) {
+    makeParamValuesUnique(param, stream->getParameter("Ripple_save"));
+    makeParamValuesUnique(param, getParameter("fusion_out"));
   } else if (paramName.equalsIgnoreCase("Ripple_save")) {
-    // Ensure this value is different from settings->rippleOutputChannel
-    settings[streamId]->ttlReportChannel = (int)param->getValue() - 1;
-    auto stream = getDataStream(streamId);
-    auto param1 = stream->getParameter("Ripple_Out");
-    makeParamValuesUnique(param, param1);
-  } else if (paramName.equalsIgnoreCase("RMS_Samples")) {
-    settings[streamId]->rmsSamples = (int)param->getValue();
+    // Ensure this value is different from the ripple output line
+    makeParamValuesUnique(param, stream->getParameter("Ripple_Out"));
+    makeParamValuesUnique(param, getParameter("fusion_out"));
+  } else if (paramName.equalsIgnoreCase("mov_out")) {
+    makeParamValuesUnique(param, stream->getParameter("Ripple_Out"));
+    makeParamValuesUnique(param, stream->getParameter("Ripple_save"));
+    makeParamValuesUnique(param, getParameter("fusion_out"));
   } else if (paramName.equalsIgnoreCase("mov_detect")) {
-    settings[streamId]->movSwitch =
-        ((CategoricalParameter *)param)->getValueAsString();
-
     // Check if ACC was chosen and how many AUX channels are available
-    if (settings[streamId]->movSwitch.equalsIgnoreCase("ACC")) {
-      int auxChannelCount = settings[streamId]->auxChannelIndices.size();
+    if (((CategoricalParameter *)param)
+            ->getValueAsString()
+            .equalsIgnoreCase("ACC")) {
+      int auxChannelCount = 0;
+      for (auto channel : stream->getContinuousChannels())
+        if (channel->getChannelType() == ContinuousChannel::Type::AUX)
+          auxChannelCount++;
+
       if (!auxChannelCount) {
-        settings[streamId]->movSwitch = "OFF";
         ((CategoricalParameter *)param)->setNextValue("OFF");
         AlertWindow::showMessageBoxAsync(
             AlertWindow::WarningIcon, "WARNING",
@@ -280,47 +464,731 @@ void RippleDetector::parameterValueChanged(Parameter *param) {
         AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon, "INFO", msg);
       }
     }
-    settings[streamId]->movSwitchEnabled =
-        !(settings[streamId]->movSwitch).equalsIgnoreCase("OFF");
-    settings[streamId]->movChannChanged = true;
+    settings[streamId]->nextMovChannelGeneration++;
   } else if (paramName.equalsIgnoreCase("mov_input")) {
-    Array<var> *array = param->getValue().getArray();
-
-    if (array->size() > 0) {
-      int localIndex = int(array->getFirst());
-      int globalIndex = getDataStream(param->getStreamId())
-                            ->getContinuousChannels()[localIndex]
-                            ->getGlobalIndex();
-      settings[streamId]->movementInputChannel = globalIndex;
+    settings[streamId]->nextMovChannelGeneration++;
+  } else if (paramName.equalsIgnoreCase("filter_bank")) {
+    // The baseline switches between broadband and ripple-band RMS. The
+    // snapshot published below carries the request, so the stream cannot
+    // recalibrate under the previous setting
+    settings[streamId]->nextCalibrationGeneration++;
+  } else if (paramName.equalsIgnoreCase("cnn_model")) {
+    loadCnnModel(stream);
+  } else if (paramName.equalsIgnoreCase("ref_input")) {
+    // The reference channels need their own baseline, measured with the
+    // snapshot that reads them
+    settings[streamId]->nextCalibrationGeneration++;
+  }
+
+  publishConfig(stream);
+}
+
+bool RippleDetector::startAcquisition() {
+
+  // Global channel indices are only final once the whole signal chain has
+  // been updated, and the envelope outputs shift those of later streams
+  for (auto stream : getDataStreams()) {
+    publishConfig(stream);
+    settings[stream->getStreamId()]->detector.getState().fusionOffsetSet =
+        false;
+  }
+
+  std::string error;
+  const String episodePath =
+      getParameter("episode_file")->getValue().toString().trim();
+  if (episodePath.isNotEmpty()) {
+    if (episodeWriter.open(episodePath.toStdString(), error))
+      LOGC("Writing ripple episodes to ", episodePath);
+    else
+      AlertWindow::showMessageBoxAsync(
+          AlertWindow::WarningIcon, "WARNING",
+          String(error) + ". No ripple episodes are written.");
+  }
+
+  const String path = getParameter("trace_file")->getValue().toString().trim();
+  if (path.isEmpty())
+    return true;
+
+  if (!traceWriter.open(path.toStdString(), error)) {
+    AlertWindow::showMessageBoxAsync(
+        AlertWindow::WarningIcon, "WARNING",
+        String(error) + ". No block trace is recorded.");
+    return true;
+  }
+
+  // Process() is not running yet, so this thread can still write records
+  for (auto stream : getDataStreams()) {
+    RippleTraceStream traced;
+    traced.streamId = stream->getStreamId();
+    traced.fusionIndex = settings[stream->getStreamId()]->fusionIndex;
+    traced.sampleRate = stream->getSampleRate();
+    traced.name = stream->getName().toStdString();
+    traceWriter.writeStream(traced);
+    settings[stream->getStreamId()]->tracePending = true;
+  }
+  traceFusionPending = true;
+
+  LOGC("Recording block trace to ", path);
+  return true;
+}
+
+bool RippleDetector::stopAcquisition() {
+
+  if (episodeWriter.isOpen()) {
+    const uint64_t dropped = episodeWriter.getDroppedEpisodes();
+    episodeWriter.close();
+    if (dropped > 0)
+      LOGC("Lost ", (int64)dropped,
+           " ripple episodes; the disk could not keep up");
+  }
+
+  if (traceWriter.isOpen()) {
+    const uint64_t dropped = traceWriter.getDroppedRecords();
+    traceWriter.close();
+    if (dropped > 0)
+      LOGC("Block trace lost ", (int64)dropped,
+           " records; the disk could not keep up");
+  }
+
+  // Combined detections are counted on the audio thread and reported here
+  for (auto stream : getDataStreams()) {
+    const uint64_t fused =
+        settings[stream->getStreamId()]->health.fusedDetections.load(
+            std::memory_order_relaxed);
+    if (fused > 0)
+      LOGC(stream->getName(), ": ", (int64)fused, " combined detections");
+  }
+
+  // What the shadow parameter sets would have done over the session
+  for (auto stream : getDataStreams()) {
+    const RippleShadowSample sample =
+        settings[stream->getStreamId()]->shadows.read();
+    for (int idx = 0; idx < sample.numShadows; idx++)
+      LOGC(stream->getName(), " shadow ", sample.rippleSds[idx], " SD / ",
+           sample.timeThreshold[idx], " ms: ", (int64)sample.detections[idx],
+           " detections, ", (int64)sample.shared[idx], " of them shared with ",
+           (int64)sample.liveDetections, " live detections, ",
+           (int64)sample.blocked[idx], " blocked by movement");
+  }
+  return true;
+}
+
+bool RippleDetector::getSpectrum(uint16 streamId,
+                                 RippleSpectrumSnapshot &snapshot) {
+
+  for (auto stream : getDataStreams()) {
+    if (stream->getStreamId() == streamId) {
+      settings[streamId]->spectrumBuffer.acquire();
+      snapshot = settings[streamId]->spectrumBuffer.read();
+      return snapshot.valid;
+    }
+  }
+  return false;
+}
+
+bool RippleDetector::getEventAverage(uint16 streamId,
+                                     RippleEventAverageSnapshot &snapshot) {
+
+  for (auto stream : getDataStreams()) {
+    if (stream->getStreamId() == streamId) {
+      settings[streamId]->eventAverageBuffer.acquire();
+      snapshot = settings[streamId]->eventAverageBuffer.read();
+      return snapshot.valid;
+    }
+  }
+  return false;
+}
+
+bool RippleDetector::exportEventAverage(uint16 streamId, const File &file,
+                                        String &error) {
+
+  RippleEventAverageSnapshot snapshot;
+  if (!getEventAverage(streamId, snapshot)) {
+    error = "No ripple-triggered average to export yet";
+    return false;
+  }
+
+  std::vector<std::string> names;
+  for (int ch = 0; ch < snapshot.numChannels; ch++) {
+    String name = String(snapshot.channels[ch]);
+    for (auto channel : getDataStream(streamId)->getContinuousChannels())
+      if (channel->getGlobalIndex() == snapshot.channels[ch])
+        name = channel->getName();
+    names.push_back(name.toStdString());
+  }
+
+  std::string message;
+  if (!snapshot.writeCsv(file.getFullPathName().toStdString(), names,
+                         message)) {
+    error = message;
+    return false;
+  }
+  LOGC("Exported the averages of ", (int64)snapshot.numEvents,
+       " ripples to ", file.getFullPathName());
+  return true;
+}
+
+bool RippleDetector::getShadows(uint16 streamId, RippleShadowSample &sample) {
+
+  for (auto stream : getDataStreams()) {
+    if (stream->getStreamId() == streamId) {
+      sample = settings[streamId]->shadows.read();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RippleDetector::getHealth(uint16 streamId, RippleHealthSample &sample) {
+
+  for (auto stream : getDataStreams()) {
+    if (stream->getStreamId() == streamId) {
+      sample = settings[streamId]->health.read();
+      return true;
+    }
+  }
+  return false;
+}
+
+void RippleDetector::prepareChannelScan(const DataStream *stream) {
+
+  RippleDetectorSettings &s = *settings[stream->getStreamId()];
+
+  s.scanLocalIndices.clear();
+  if (((CategoricalParameter *)stream->getParameter("auto_select"))
+          ->getValueAsString()
+          .equalsIgnoreCase("OFF")) {
+    s.channelScan.release();
+    s.scanInputs.clear();
+    return;
+  }
+
+  // Only recording electrodes can carry ripples
+  for (auto channel : stream->getContinuousChannels())
+    if (channel->getChannelType() == ContinuousChannel::Type::ELECTRODE)
+      s.scanLocalIndices.push_back(channel->getLocalIndex());
+  s.scanInputs.assign(s.scanLocalIndices.size(), nullptr);
+  s.channelScan.prepare((int)s.scanLocalIndices.size(),
+                        stream->getSampleRate());
+}
+
+void RippleDetector::checkChannelScans() {
+
+  for (auto stream : getDataStreams()) {
+    const uint16 streamId = stream->getStreamId();
+    RippleDetectorSettings &s = *settings[streamId];
+
+    std::vector<RippleChannelScore> scores;
+    if (!s.channelScan.takeResults(scores))
+      continue;
+
+    auto channels = stream->getContinuousChannels();
+    String report = "Ripple-band ranking of " + stream->getName() + ":\n";
+    for (int idx = 0; idx < (int)scores.size() && idx < 5; idx++) {
+      const RippleChannelScore &score = scores[idx];
+      report += channels[s.scanLocalIndices[score.channel]]->getName() +
+                ": peak/median " + String(score.snr, 2) + ", median " +
+                String(score.rippleRmsMedian, 1) + " uV\n";
+    }
+    if (s.channelScan.getSkippedBlocks() > 0)
+      report += String((int64)s.channelScan.getSkippedBlocks()) +
+                " blocks were left out of the scan.\n";
+
+    // Switch only for a clear improvement, so a tie between two channels
+    // cannot make every calibration switch again
+    if (((CategoricalParameter *)stream->getParameter("auto_select"))
+            ->getValueAsString()
+            .equalsIgnoreCase("PICK")) {
+      Array<var> *selected =
+          stream->getParameter("Ripple_Input")->getValue().getArray();
+      const int current = selected->size() > 0 ? int(selected->getFirst()) : -1;
+      double currentSnr = 0.0;
+      for (const RippleChannelScore &score : scores)
+        if (s.scanLocalIndices[score.channel] == current)
+          currentSnr = score.snr;
+
+      const int best = s.scanLocalIndices[scores.front().channel];
+      if (best != current && scores.front().snr > 1.1 * currentSnr) {
+        Array<var> bestChannel;
+        bestChannel.add(best);
+        stream->getParameter("Ripple_Input")->setNextValue(bestChannel);
+        shouldCalibrate = true;
+        report += "Ripple input switched to " + channels[best]->getName() +
+                  ", recalibrating.";
+      }
+    }
+
+    LOGC(report);
+    AlertWindow::showMessageBoxAsync(AlertWindow::InfoIcon, "INFO", report);
+  }
+}
+
+void RippleDetector::checkAutoTune() {
+
+  for (auto stream : getDataStreams()) {
+    const uint16 streamId = stream->getStreamId();
+    RippleDetectorSettings &s = *settings[streamId];
+
+    std::vector<RippleTuneCandidate> candidates;
+    int chosen = -1;
+    if (!s.autoTuner.takeResults(candidates, chosen))
+      continue;
+
+    String report = "Window auto-tuning of " + stream->getName() + ":\n";
+    for (int idx = 0; idx < (int)candidates.size(); idx++) {
+      const RippleTuneCandidate &candidate = candidates[idx];
+      report += String(candidate.windowSamples) + " samples: " +
+                String(100.0 * candidate.costFraction, 2) + "% CPU, " +
+                String(candidate.falsePerMinute, 1) + " false/min, " +
+                String(candidate.latencyMs, 1) + " ms" +
+                (idx == chosen ? " <- chosen" : "") + "\n";
+    }
+
+    const int current = (int)(*stream)["rms_samples"];
+    if (chosen < 0) {
+      report += "No window length meets both targets, keeping " +
+                String(current) + " samples.";
+    } else if (candidates[chosen].windowSamples == current) {
+      report += "Keeping " + String(current) + " samples.";
     } else {
-      settings[streamId]->movementInputChannel = -1;
+      // Only this stream recalibrates, with the snapshot that holds the new
+      // window length
+      s.skipNextTune = true;
+      s.nextCalibrationGeneration++;
+      stream->getParameter("rms_samples")
+          ->setNextValue(candidates[chosen].windowSamples);
+      report += "rms_samples set to " +
+                String(candidates[chosen].windowSamples) +
+                ", recalibrating.";
     }
-    settings[streamId]->movChannChanged = true;
-  } else if (paramName.equalsIgnoreCase("mov_out")) {
-    settings[streamId]->movementOutputChannel = (int)param->getValue() - 1;
-    auto stream = getDataStream(streamId);
-    auto param1 = stream->getParameter("Ripple_Out");
-    makeParamValuesUnique(param, param1);
-    auto param2 = stream->getParameter("Ripple_save");
-    makeParamValuesUnique(param, param2);
-  } else if (paramName.equalsIgnoreCase("mov_std")) {
-    settings[streamId]->movSds = (float)param->getValue();
-  } else if (paramName.equalsIgnoreCase("min_time_st")) {
-    settings[streamId]->minTimeWoMov = (int)param->getValue();
-    settings[streamId]->minMovSamplesBelowThresh =
-        ceil(getDataStream(streamId)->getSampleRate() *
-             settings[streamId]->minTimeWoMov / 1000);
-  } else if (paramName.equalsIgnoreCase("min_time_mov")) {
-    settings[streamId]->minTimeWMov = (int)param->getValue();
-    settings[streamId]->minMovSamplesAboveThresh =
-        ceil(getDataStream(streamId)->getSampleRate() *
-             settings[streamId]->minTimeWMov / 1000);
+
+    // Every calibration tunes again, so the report goes to the log rather
+    // than a dialog
+    LOGC(report);
+  }
+}
+
+void RippleDetector::checkCalibrations() {
+
+  for (auto stream : getDataStreams()) {
+    RippleDetectorSettings &s = *settings[stream->getStreamId()];
+    if (!s.calibrationBuffer.acquire())
+      continue;
+
+    // Each value publishes a snapshot, and the first one still has the other
+    // value from before the calibration, so both go out marked as stale
+    const RippleCalibrationResult &result = s.calibrationBuffer.read();
+    stream->getParameter("RMS_mean")->setNextValue(result.rmsMean);
+    stream->getParameter("RMS_std")->setNextValue(result.rmsStdDev);
+    s.calibrationsWrittenBack = result.calibration;
+    publishConfig(stream);
+  }
+}
+
+void RippleDetector::loadCnnModel(const DataStream *stream) {
+
+  const String path =
+      stream->getParameter("cnn_model")->getValue().toString().trim();
+
+  std::shared_ptr<RippleCnn> cnn;
+  if (path.isNotEmpty()) {
+    std::string error;
+    auto model = RippleCnnModel::load(path.toStdString(), error);
+    if (model) {
+      cnn = std::make_shared<RippleCnn>();
+      if (!cnn->prepare(model, stream->getSampleRate(), error))
+        cnn.reset();
+    }
+
+    if (cnn)
+      LOGC("Loaded CNN weights ", path, " (", RippleCnn::getKernelName(),
+           " kernels)");
+    else
+      AlertWindow::showMessageBoxAsync(
+          AlertWindow::WarningIcon, "WARNING",
+          String(error) + ". The RMS detector stays in use.");
+  }
+
+  settings[stream->getStreamId()]->nextCnn = cnn;
+}
+
+// Returns the global index of the first channel selected in a
+// SelectedChannelsParameter, or -1 if none is selected
+static int getSelectedGlobalIndex(const DataStream *stream,
+                                  const String &paramName) {
+  Array<var> *array = stream->getParameter(paramName)->getValue().getArray();
+
+  if (array->size() > 0) {
+    int localIndex = int(array->getFirst());
+    return stream->getContinuousChannels()[localIndex]->getGlobalIndex();
+  }
+  return -1;
+}
+
+void RippleDetector::publishConfig(const DataStream *stream) {
+
+  const uint16 streamId = stream->getStreamId();
+  const float sampleRate = stream->getSampleRate();
+
+  RippleDetectorConfig &config = settings[streamId]->configBuffer.beginWrite();
+
+  config.rippleInputChannel = getSelectedGlobalIndex(stream, "Ripple_Input");
+  config.movementInputChannel = getSelectedGlobalIndex(stream, "mov_input");
+
+  // Samples within one step of the int16 range count as clipped
+  config.clipLevel = 0.0f;
+  for (auto channel : stream->getContinuousChannels()) {
+    if (channel->getGlobalIndex() == config.rippleInputChannel)
+      config.clipLevel = 32766.0f * channel->getBitVolts();
+  }
+
+  config.envelopeOutputChannel = -1;
+  config.thresholdOutputChannel = -1;
+  config.stateOutputChannel = -1;
+  const int envelopeIndex = settings[streamId]->envelopeLocalIndex;
+  if (envelopeIndex >= 0) {
+    auto channels = stream->getContinuousChannels();
+    config.envelopeOutputChannel = channels[envelopeIndex]->getGlobalIndex();
+    config.thresholdOutputChannel =
+        channels[envelopeIndex + 1]->getGlobalIndex();
+    config.stateOutputChannel = channels[envelopeIndex + 2]->getGlobalIndex();
+  }
+
+  config.scanChannels.clear();
+  for (int localIndex : settings[streamId]->scanLocalIndices)
+    config.scanChannels.push_back(
+        stream->getContinuousChannels()[localIndex]->getGlobalIndex());
+
+  config.auxChannelIndices.clear();
+  for (auto channel : stream->getContinuousChannels()) {
+    if (channel->getChannelType() == ContinuousChannel::Type::AUX)
+      config.auxChannelIndices.push_back(channel->getGlobalIndex());
+  }
+
+  config.referenceChannels.clear();
+  Array<var> *refArray =
+      stream->getParameter("ref_input")->getValue().getArray();
+  for (int i = 0; i < refArray->size() &&
+                  i < RippleDetectorConfig::maxReferenceChannels;
+       i++) {
+    int localIndex = int((*refArray)[i]);
+    config.referenceChannels.push_back(
+        stream->getContinuousChannels()[localIndex]->getGlobalIndex());
+  }
+
+  config.rippleOutputChannel = (int)(*stream)["Ripple_Out"] - 1;
+  config.ttlReportChannel = (int)(*stream)["Ripple_save"] - 1;
+  config.movementOutputChannel = (int)(*stream)["mov_out"] - 1;
+
+  config.rippleSds = (float)(*stream)["ripple_std"];
+  config.offsetSds = (float)(*stream)["offset_std"];
+  config.refractoryTime = (int)(*stream)["refr_time"];
+  config.rmsSamples = (int)(*stream)["rms_samples"];
+  config.ttlDuration = (double)(*stream)["ttl_duration"];
+  config.ttlPercent = (double)(*stream)["ttl_percent"];
+  config.ttlDurationSamples = ceil(sampleRate * config.ttlDuration / 1000);
+  config.filterBankEnabled =
+      ((CategoricalParameter *)stream->getParameter("filter_bank"))
+          ->getValueAsString()
+          .equalsIgnoreCase("ON");
+  config.detectorMode =
+      ((CategoricalParameter *)stream->getParameter("detector"))
+              ->getValueAsString()
+              .equalsIgnoreCase("CNN")
+          ? DetectorMode::CNN
+          : DetectorMode::RMS;
+  config.cnn = settings[streamId]->nextCnn;
+  config.cnnThreshold = (float)(*stream)["cnn_thresh"];
+  config.fastRippleRatio = (float)(*stream)["fr_ratio"];
+  config.artefactSds = (float)(*stream)["artefact_std"];
+  config.artefactHoldSamples =
+      ceil(sampleRate * ARTEFACT_HOLD_MILLISECONDS / 1000);
+  config.refSds = (float)(*stream)["ref_std"];
+  config.spectrumEnabled =
+      ((CategoricalParameter *)stream->getParameter("spectrum"))
+          ->getValueAsString()
+          .equalsIgnoreCase("ON");
+
+  config.eventAverageEnabled =
+      ((CategoricalParameter *)stream->getParameter("event_avg"))
+          ->getValueAsString()
+          .equalsIgnoreCase("ON");
+
+  String stateGate =
+      ((CategoricalParameter *)stream->getParameter("state_gate"))
+          ->getValueAsString();
+  if (stateGate.equalsIgnoreCase("NON-THETA"))
+    config.stateGate = StateGateMode::NON_THETA;
+  else if (stateGate.equalsIgnoreCase("NREM"))
+    config.stateGate = StateGateMode::NREM;
+  else
+    config.stateGate = StateGateMode::OFF;
+  config.stateInputChannel = getSelectedGlobalIndex(stream, "state_input");
+  if (config.stateInputChannel < 0)
+    config.stateInputChannel = config.rippleInputChannel;
+  config.thetaRatio = (float)(*stream)["theta_ratio"];
+  config.deltaFraction = (float)(*stream)["delta_frac"];
+
+  // Entries that do not parse are left out
+  config.shadowSets.clear();
+  StringArray shadowEntries = StringArray::fromTokens(
+      stream->getParameter("shadow_sets")->getValue().toString(), ",;", "");
+  for (const String &entry : shadowEntries) {
+    if (!entry.containsChar(':') ||
+        (int)config.shadowSets.size() == RippleShadowDetectors::maxShadows)
+      continue;
+    RippleShadowSet set;
+    set.rippleSds = entry.upToFirstOccurrenceOf(":", false, false)
+                        .trim()
+                        .getDoubleValue();
+    set.timeThreshold = entry.fromFirstOccurrenceOf(":", false, false)
+                            .trim()
+                            .getDoubleValue();
+    if (set.rippleSds <= 0 || set.timeThreshold < 0)
+      continue;
+    set.numSamplesTimeThreshold = ceil(sampleRate * set.timeThreshold / 1000);
+    set.refractoryTime = config.refractoryTime;
+    config.shadowSets.push_back(set);
+  }
+
+  config.autoTuneEnabled =
+      ((CategoricalParameter *)stream->getParameter("auto_tune"))
+          ->getValueAsString()
+          .equalsIgnoreCase("ON");
+  config.tuneCpuBudget = (float)(*stream)["tune_cpu"] / 100.0;
+  config.tuneFalsePerMinute = (float)(*stream)["tune_fp"];
+
+  config.rmsMean = (double)(*stream)["RMS_mean"];
+  config.rmsStdDev = (double)(*stream)["RMS_std"];
+  config.baselineCurrent =
+      settings[streamId]->calibrationsWrittenBack ==
+      settings[streamId]->calibrationsFinished.load(std::memory_order_acquire);
+  config.calibrationGeneration = settings[streamId]->nextCalibrationGeneration;
+
+  String movSwitch =
+      ((CategoricalParameter *)stream->getParameter("mov_detect"))
+          ->getValueAsString();
+  if (movSwitch.equalsIgnoreCase("ACC"))
+    config.movementMode = MovementMode::ACC;
+  else if (movSwitch.equalsIgnoreCase("EMG"))
+    config.movementMode = MovementMode::EMG;
+  else
+    config.movementMode = MovementMode::OFF;
+  config.movSds = (float)(*stream)["mov_std"];
+  config.movChannelGeneration = settings[streamId]->nextMovChannelGeneration;
+
+  config.sampleRate = sampleRate;
+  config.numSamplesTimeThreshold =
+      ceil(sampleRate * (int)(*stream)["time_thresh"] / 1000);
+  config.minMovSamplesBelowThresh =
+      ceil(sampleRate * (int)(*stream)["min_time_st"] / 1000);
+  config.minMovSamplesAboveThresh =
+      ceil(sampleRate * (int)(*stream)["min_time_mov"] / 1000);
+  config.calibrationPoints = sampleRate * CALIBRATION_DURATION_SECONDS;
+  config.threshold = config.rmsMean + config.rippleSds * config.rmsStdDev;
+
+  settings[streamId]->configBuffer.publish();
+}
+
+void RippleDetector::publishFusionConfig() {
+
+  RippleFusionConfig &config = fusionConfigBuffer.beginWrite();
+
+  String mode = ((CategoricalParameter *)getParameter("fusion_mode"))
+                    ->getValueAsString();
+  if (mode.equalsIgnoreCase("ANY"))
+    config.mode = FusionMode::ANY;
+  else if (mode.equalsIgnoreCase("COINCIDENT"))
+    config.mode = FusionMode::COINCIDENT;
+  else
+    config.mode = FusionMode::OFF;
+
+  config.window = (float)getParameter("fusion_window")->getValue() / 1000.0;
+  config.outputChannel = (int)getParameter("fusion_out")->getValue() - 1;
+
+  fusionConfigBuffer.publish();
+}
+
+// Hands what the detector does with a block to the stream's TTL events,
+// episodes, monitors and envelope outputs
+class RippleDetector::BlockListener : public RippleDetectionListener {
+public:
+  BlockListener(RippleDetector &processor_, uint64 streamId_,
+                AudioBuffer<float> &buffer_, int64 firstSampleNumber_,
+                int numSamples_, int64 timeNow_)
+      : processor(processor_), streamId(streamId_),
+        s(*processor_.settings[streamId_]), config(s.getConfig()),
+        buffer(buffer_), firstSampleNumber(firstSampleNumber_),
+        numSamples(numSamples_), timeNow(timeNow_) {}
+
+  void ttlEvent(int line, int64_t sampleNumber, bool state,
+                int sampleIndex) override {
+    processor.addTtlEvent(streamId, line, sampleNumber, state, sampleIndex);
+  }
+
+  double drawPercent() override {
+    const double value = distribute(generator);
+    if (processor.traceWriter.isOpen())
+      processor.traceWriter.writeRandom(streamId, value);
+    return value;
+  }
+
+  void windowSamples(const float *data, int windowSamples) override {
+    if (s.spectrum.process(data, windowSamples)) {
+      s.spectrum.fillSnapshot(s.spectrumBuffer.beginWrite());
+      s.spectrumBuffer.publish();
+    }
+  }
+
+  void detection(const RippleWindowResult &window) override {
+    if (window.blocked) {
+      LOGC("Ripple detected on stream", streamId,
+           "but TTL event was blocked by movement detection.\n");
+      return;
+    }
+    if (window.propagated)
+      LOGC("Ripple detected and propagated on stream: ", streamId);
+    else
+      LOGC("Ripple detected but blocked by chance");
+
+    // The detection becomes known at the end of this window
+    const int64 sampleNumber =
+        firstSampleNumber + window.start + window.numSamples - 1;
+    if (config.eventAverageEnabled)
+      s.eventAverage.addDetection(sampleNumber);
+    if (s.shadows.isActive())
+      s.shadows.addLiveDetection(sampleNumber);
+  }
+
+  void windowDone(const RippleWindowResult &window) override {
+    const RippleTraceState &state = s.detector.getState();
+
+    // Detected ripples start and end where the RMS crosses this lower
+    // threshold
+    const double offsetThreshold = std::min(
+        state.threshold, state.rmsMean + config.offsetSds * state.rmsStdDev);
+
+    // Detected ripples are followed to their end and reported as episodes
+    RippleEpisode episode;
+    if (s.episodes.addWindow(window.rms, offsetThreshold, state.rmsMean,
+                             state.rmsStdDev, firstSampleNumber + window.start,
+                             window.numSamples, window.detected,
+                             window.propagated, episode))
+      processor.addEpisodeEvent(streamId, episode,
+                                window.start + window.numSamples - 1);
+
+    // The shadow sets see the windows the live set could have detected on
+    if (s.shadows.isActive())
+      s.shadows.processWindow(
+          window.rms, state.rmsMean, state.rmsStdDev, !window.vetoed,
+          !state.pluginEnabled,
+          firstSampleNumber + window.start + window.numSamples - 1,
+          window.numSamples, timeNow);
+
+    // Hold this window's values on the envelope outputs
+    if (s.envelopeOut != nullptr) {
+      const bool useCnn = s.detector.usesCnn();
+      RippleEnvelopeState envelopeState = RippleEnvelopeState::BELOW;
+      if (!state.pluginEnabled || !window.stateGateOpen)
+        envelopeState = RippleEnvelopeState::BLOCKED;
+      else if (state.flagTimeThreshold)
+        envelopeState = RippleEnvelopeState::DETECTED;
+      else if (window.aboveThreshold)
+        envelopeState = RippleEnvelopeState::ABOVE;
+      FloatVectorOperations::fill(s.envelopeOut + window.start,
+                                  useCnn ? window.cnn : window.rms,
+                                  window.numSamples);
+      FloatVectorOperations::fill(s.thresholdOut + window.start,
+                                  useCnn ? config.cnnThreshold
+                                         : state.threshold,
+                                  window.numSamples);
+      FloatVectorOperations::fill(s.stateOut + window.start,
+                                  (float)envelopeState, window.numSamples);
+    }
+  }
+
+  void calibrationStarted() override { processor.startCalibration(streamId); }
+
+  void calibrationBlock() override {
+    processor.addCalibrationBlock(streamId, buffer, numSamples);
+  }
+
+  void calibrationFinished() override {
+    processor.finishCalibration(streamId);
+  }
+
+private:
+  RippleDetector &processor;
+  const uint64 streamId;
+  RippleDetectorSettings &s;
+  const RippleDetectorConfig &config;
+  AudioBuffer<float> &buffer;
+  const int64 firstSampleNumber;
+  const int numSamples;
+  const int64 timeNow; // Wall clock of the block (ms)
+};
+
+// Called on the audio thread when a new snapshot has been picked up
+void RippleDetector::applyConfig(uint64 streamId) {
+
+  const RippleDetectorConfig &config = settings[streamId]->getConfig();
+  RippleDetectionCore &detector = settings[streamId]->detector;
+
+  // Clear the editor's view when the monitor is switched off
+  if (!config.spectrumEnabled) {
+    settings[streamId]->spectrum.reset();
+    settings[streamId]->spectrum.fillSnapshot(
+        settings[streamId]->spectrumBuffer.beginWrite());
+    settings[streamId]->spectrumBuffer.publish();
+  }
+
+  // Averages start over when they are switched on, and are kept for the
+  // editor while they are off
+  if (config.eventAverageEnabled != settings[streamId]->eventAverageActive) {
+    if (config.eventAverageEnabled) {
+      settings[streamId]->eventAverage.reset();
+      settings[streamId]->eventAverage.fillSnapshot(
+          settings[streamId]->eventAverageBuffer.beginWrite());
+      settings[streamId]->eventAverageBuffer.publish();
+    }
+    settings[streamId]->eventAverageActive = config.eventAverageEnabled;
+  }
+
+  settings[streamId]->shadows.configure(config.shadowSets, config.sampleRate);
+  settings[streamId]->episodes.configure((uint16_t)streamId, config.sampleRate);
+
+  // The brain state is tracked from scratch when the gate is switched on
+  const bool stateGateActive = detector.getState().stateGateActive;
+  detector.applyConfig(config, config.cnn.get());
+  if (detector.getState().stateGateActive != stateGateActive)
+    settings[streamId]->health.brainState.store(0, std::memory_order_relaxed);
+
+  if (!detector.getState().isCalibrating && config.baselineCurrent) {
+    settings[streamId]->health.rmsMean = config.rmsMean;
+    settings[streamId]->health.rmsStdDev = config.rmsStdDev;
   }
 }
 
 // Data acquisition and manipulation loop
 void RippleDetector::process(AudioBuffer<float> &buffer) {
 
+  // Global parameters and the calibration request apply to every stream
+  const bool fusionChanged = fusionConfigBuffer.acquire();
+  const bool calibrateStreams = shouldCalibrate.exchange(false);
+
+  // Detection reads the clock once per call, the time the trace records
+  const std::chrono::milliseconds timeNow =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch());
+
+  if (traceWriter.isOpen()) {
+    traceWriter.writeProcess({timeNow.count(), calibrateStreams});
+    if (fusionChanged || traceFusionPending) {
+      traceWriter.writeFusion(fusionConfigBuffer.read());
+      traceFusionPending = false;
+    }
+  }
+
   for (auto stream : getDataStreams()) {
     if ((*stream)["enable_stream"]) {
 
@@ -328,230 +1196,156 @@ void RippleDetector::process(AudioBuffer<float> &buffer) {
       const int64 firstSampleInBlock = getFirstSampleNumberForBlock(streamId);
       const uint32 numSamplesInBlock = getNumSamplesInBlock(streamId);
 
-      if (settings[streamId]->rippleInputChannel < 0)
-        return;
-
-      float sampleRate = stream->getSampleRate();
+      // Pick up parameter changes at the block boundary
+      const bool configChanged = settings[streamId]->configBuffer.acquire();
+      if (configChanged)
+        applyConfig(streamId);
+      const RippleDetectorConfig &config = settings[streamId]->getConfig();
 
-      if (!numSamplesInBlock)
-        return;
-      // Enable detection again if the mov. detector channel is "-" or if
-      // calibration button was clicked
-      if (!settings[streamId]->pluginEnabled &&
-          (!settings[streamId]->movSwitchEnabled || shouldCalibrate)) {
-        settings[streamId]->pluginEnabled = true;
-        TTLEventPtr event = settings[streamId]->createEvent(
-            settings[streamId]->movementOutputChannel, firstSampleInBlock,
-            false);
-        addEvent(event, 0);
-      }
+      if (traceWriter.isOpen())
+        traceBlock(streamId, buffer, firstSampleInBlock, numSamplesInBlock,
+                   configChanged);
 
-      settings[streamId]->numSamplesTimeThreshold =
-          ceil(sampleRate * settings[streamId]->timeThreshold / 1000);
-      settings[streamId]->minMovSamplesBelowThresh =
-          ceil(sampleRate * settings[streamId]->minTimeWoMov / 1000);
-      settings[streamId]->minMovSamplesAboveThresh =
-          ceil(sampleRate * settings[streamId]->minTimeWMov / 1000);
-
-      settings[streamId]->threshold =
-          settings[streamId]->rmsMean +
-          settings[streamId]->rippleSds * settings[streamId]->rmsStdDev;
-      settings[streamId]->movThreshold =
-          settings[streamId]->movRmsMean +
-          settings[streamId]->movSds * settings[streamId]->movRmsStdDev;
-
-      // Check if the number of samples to calculate the RMS is not
-      // larger than the total number of samples provided in this cycle and
-      // adjust if necessary
-      if (settings[streamId]->rmsSamples > numSamplesInBlock)
-        settings[streamId]->rmsSamples = numSamplesInBlock;
-
-      // Check if need to calibrate
-      if (shouldCalibrate || (settings[streamId]->movChannChanged &&
-                              settings[streamId]->movementInputChannel > 0)) {
-        LOGC("Calibrating...");
-        settings[streamId]->isCalibrating = true;
-        settings[streamId]->movChannChanged = false;
-
-        settings[streamId]->pointsProcessed = 0;
-
-        calibrationRmsValues[streamId].clear();
-        calibrationMovRmsValues[streamId].clear();
-
-        shouldCalibrate = false;
-        LOGC("Finished calibrating...");
-      }
+      prepareEnvelopeOutputs(streamId, buffer, numSamplesInBlock);
 
-      const float *rippleData =
-          buffer.getReadPointer(settings[streamId]->rippleInputChannel, 0);
-      std::vector<float> emgData{};
-      std::vector<std::vector<float>> accelData{};
-      std::vector<float> accMagnit;
-      accMagnit.clear();
-      if (settings[streamId]->movSwitchEnabled) {
-        if (settings[streamId]->movSwitch.equalsIgnoreCase("ACC")) {
-          for (int i = 0; i < settings[streamId]->auxChannelIndices.size();
-               i++) {
-            auto p = buffer.getReadPointer(
-                settings[streamId]->auxChannelIndices[i], 0);
-            std::vector<float> v(p, p + numSamplesInBlock);
-            accelData.push_back(v);
-          }
-          accMagnit = calculateAccelMod(accelData, numSamplesInBlock);
-        } else // EMG
-        {
-          emgData[0] = *const_cast<float *>(buffer.getReadPointer(
-              settings[streamId]->movementInputChannel, 0));
-        }
-      }
-      rmsValuesArray[streamId].clear();
-      movRmsValuesArray[streamId].clear();
-      rmsNumSamplesArray[streamId].clear();
-      movRmsNumSamplesArray[streamId].clear();
-
-      for (int rmsStartIdx = 0; rmsStartIdx < numSamplesInBlock;
-           rmsStartIdx += settings[streamId]->rmsSamples) {
-        if (rmsStartIdx + settings[streamId]->rmsSamples > numSamplesInBlock)
-          settings[streamId]->rmsEndIdx = numSamplesInBlock;
-        else
-          settings[streamId]->rmsEndIdx =
-              rmsStartIdx + settings[streamId]->rmsSamples;
-        // LOGC("before calculateRms");
-        double rms = calculateRms(rippleData, rmsStartIdx,
-                                  settings[streamId]->rmsEndIdx);
-
-        double movRms = 0;
-        if (settings[streamId]->movSwitchEnabled) {
-          if (settings[streamId]->movSwitch.equalsIgnoreCase("ACC"))
-            movRms = calculateRms(accMagnit, rmsStartIdx,
-                                  settings[streamId]->rmsEndIdx);
-          else // EMG
-            movRms = calculateRms(emgData, rmsStartIdx,
-                                  settings[streamId]->rmsEndIdx);
-        }
-
-        if (settings[streamId]->isCalibrating) {
-          calibrationRmsValues[streamId].push_back(rms);
-          settings[streamId]->rmsMean += rms;
-
-          if (settings[streamId]->movSwitchEnabled) {
-            calibrationMovRmsValues[streamId].push_back(movRms);
-            settings[streamId]->movRmsMean += movRms;
-          }
-        } else {
-          rmsValuesArray[streamId].push_back(rms);
-          rmsNumSamplesArray[streamId].push_back(settings[streamId]->rmsEndIdx -
-                                                 rmsStartIdx);
-
-          if (settings[streamId]->movSwitchEnabled) {
-            movRmsValuesArray[streamId].push_back(movRms);
-            movRmsNumSamplesArray[streamId].push_back(
-                settings[streamId]->rmsEndIdx - rmsStartIdx);
-          }
-        }
-      }
+      if (config.rippleInputChannel < 0)
+        continue;
 
-      if (settings[streamId]->isCalibrating) {
-        settings[streamId]->pointsProcessed += numSamplesInBlock;
-        if (settings[streamId]->pointsProcessed >=
-            settings[streamId]->calibrationPoints) {
-          finishCalibration(streamId);
-          // Update the relevant text boxes
-          auto param = stream->getParameter("RMS_mean");
-          param->setNextValue(settings[streamId]->rmsMean);
-          param = stream->getParameter("RMS_std");
-          param->setNextValue(settings[streamId]->rmsStdDev);
-        }
-      } else {
-        detectRipples(streamId);
-        if (settings[streamId]->movSwitchEnabled)
-          evalMovement(streamId);
+      if (!numSamplesInBlock)
+        continue;
+
+      // History for the peri-event windows, kept during calibration too so
+      // the first detections after it have their pre-event samples
+      if (config.eventAverageEnabled)
+        updateEventAverage(streamId, buffer, firstSampleInBlock,
+                           numSamplesInBlock);
+
+      RippleDetectionBlock block;
+      block.channels = buffer.getArrayOfReadPointers();
+      block.numChannels = buffer.getNumChannels();
+      block.firstSampleNumber = firstSampleInBlock;
+      block.numSamples = numSamplesInBlock;
+      block.wallClockMs = timeNow.count();
+      block.calibrate = calibrateStreams;
+      block.fusionConfig = &fusionConfigBuffer.read();
+
+      // The envelope outputs and shadow sets read every window, and so does
+      // a detected ripple until its episode has ended
+      block.deferrable = settings[streamId]->envelopeOut == nullptr &&
+                         !settings[streamId]->shadows.isActive() &&
+                         !settings[streamId]->episodes.isFollowing();
+
+      RippleDetectionCore &detector = settings[streamId]->detector;
+      BlockListener listener(*this, streamId, buffer, firstSampleInBlock,
+                             numSamplesInBlock, timeNow.count());
+      const bool detected = detector.process(block, listener);
+
+      RippleHealthCounters &health = settings[streamId]->health;
+      if (config.stateGate != StateGateMode::OFF &&
+          config.stateInputChannel >= 0)
+        health.brainState.store((int)detector.getBrainState(),
+                                std::memory_order_relaxed);
+      health.calibrating.store(!detected, std::memory_order_relaxed);
+
+      if (detected) {
+        const RippleBlockCounts &counts = detector.getCounts();
+        RippleHealthCounters::add(health.detections, counts.detections);
+        RippleHealthCounters::add(health.blockedDetections,
+                                  counts.blockedDetections);
+        RippleHealthCounters::add(health.rejectedCrossings,
+                                  counts.rejectedCrossings);
+        RippleHealthCounters::add(health.blockedSamples, counts.blockedSamples);
+        RippleHealthCounters::add(health.refractorySamples,
+                                  counts.refractorySamples);
+        RippleHealthCounters::add(health.gatedSamples, counts.gatedSamples);
+        RippleHealthCounters::add(health.fusedDetections,
+                                  counts.fusedDetections);
+        health.rmsAverage.store(detector.getRmsAverage(),
+                                std::memory_order_relaxed);
+        updateInputHealth(
+            streamId, buffer.getReadPointer(config.rippleInputChannel, 0),
+            numSamplesInBlock);
       }
-      // LOGC("at end");
     }
   }
 }
 
-// Calculate the RMS of inputData data from position initIndex (included) to
-// endIndex (not included)
-double RippleDetector::calculateRms(const float *data, int initIndex,
-                                    int endIndex) {
-  double sum = 0.0;
-  for (int idx = initIndex; idx < endIndex; idx++) {
-    sum += pow(data[idx], 2.0);
-  }
+// Called when a calibration starts on a stream
+void RippleDetector::startCalibration(uint64 streamId) {
+  LOGC("Calibrating...");
 
-  return sqrt(sum / (endIndex - initIndex));
-}
-double RippleDetector::calculateRms(std::vector<float> data, int initIndex,
-                                    int endIndex) {
-  double sum = 0.0;
-  for (int idx = initIndex; idx < endIndex; idx++) {
-    sum += pow(data[idx], 2.0);
-  }
+  const RippleDetectorConfig &config = settings[streamId]->getConfig();
+
+  if (!config.scanChannels.empty())
+    settings[streamId]->channelScan.start();
 
-  return sqrt(sum / (endIndex - initIndex));
+  // Shadow and live counts are compared over the same baseline
+  settings[streamId]->shadows.reset();
+
+  // The recalibration that applies a tuned window does not tune again
+  if (config.autoTuneEnabled &&
+      !settings[streamId]->skipNextTune.exchange(false))
+    settings[streamId]->autoTuner.start(config.filterBankEnabled);
 }
 
-// Calculate the modulus of the accelerometer vector
-std::vector<float>
-RippleDetector::calculateAccelMod(std::vector<std::vector<float>> axis,
-                                  int numberOfSamples) {
-  std::vector<float> modArr;
-  for (int p = 0; p < numberOfSamples; p++) {
-    modArr.push_back(sqrt(pow(axis[0][p], 2.0) + pow(axis[1][p], 2.0) +
-                          pow(axis[2][p], 2.0)));
+void RippleDetector::addCalibrationBlock(uint64 streamId,
+                                         AudioBuffer<float> &buffer,
+                                         int numSamples) {
+
+  const RippleDetectorConfig &config = settings[streamId]->getConfig();
+
+  // Hand the block over to the channel scan workers
+  std::vector<const float *> &scanInputs = settings[streamId]->scanInputs;
+  if (!config.scanChannels.empty() &&
+      config.scanChannels.size() == scanInputs.size()) {
+    for (size_t idx = 0; idx < scanInputs.size(); idx++)
+      scanInputs[idx] = buffer.getReadPointer(config.scanChannels[idx], 0);
+    settings[streamId]->channelScan.pushBlock(scanInputs.data(), numSamples);
+  }
+
+  // Candidate window lengths, on the channels read per window
+  if (settings[streamId]->autoTuner.isRunning()) {
+    const float *tuneInputs[1 + RippleDetectorConfig::maxReferenceChannels];
+    int numTuneInputs = 0;
+    tuneInputs[numTuneInputs++] =
+        buffer.getReadPointer(config.rippleInputChannel, 0);
+    for (int channel : config.referenceChannels)
+      if (numTuneInputs < 1 + RippleDetectorConfig::maxReferenceChannels)
+        tuneInputs[numTuneInputs++] = buffer.getReadPointer(channel, 0);
+    settings[streamId]->autoTuner.pushBlock(tuneInputs, numTuneInputs,
+                                            numSamples);
   }
-  return modArr;
 }
 
 // Called when calibration step is over
 void RippleDetector::finishCalibration(uint64 streamId) {
   LOGD("Calibration finished!");
 
-  // Set flag to false to end the calibration period
-  settings[streamId]->isCalibrating = false;
-
-  // Calculate RMS mean and standard deviation and the final amplitude threshold
-  int numCalibrationPoints = calibrationRmsValues[streamId].size();
-  printf("Got	%d calibration points\n", numCalibrationPoints);
-  printf("RMS mean before: %f\n", settings[streamId]->rmsMean);
-  settings[streamId]->rmsMean =
-      settings[streamId]->rmsMean / (double)numCalibrationPoints;
-  printf("RMS mean after: %f\n", settings[streamId]->rmsMean);
-  for (unsigned int idx = 0; idx < numCalibrationPoints; idx++) {
-    settings[streamId]->rmsStdDev += pow(
-        calibrationRmsValues[streamId][idx] - settings[streamId]->rmsMean, 2.0);
-  }
-  settings[streamId]->rmsStdDev = sqrt(settings[streamId]->rmsStdDev /
-                                       ((double)numCalibrationPoints - 1.0));
-  settings[streamId]->threshold =
-      settings[streamId]->rmsMean +
-      settings[streamId]->rippleSds * settings[streamId]->rmsStdDev;
-
-  // Calculate EMR/ACC RMS mean and standard deviation if the switching
-  // mechanism is enabled
-  if (settings[streamId]->movSwitchEnabled) {
-    int numMovCalibrationPoints = calibrationMovRmsValues[streamId].size();
-    settings[streamId]->movRmsMean =
-        settings[streamId]->movRmsMean / (double)numMovCalibrationPoints;
-    for (unsigned int idx = 0; idx < numMovCalibrationPoints; idx++) {
-      settings[streamId]->movRmsStdDev +=
-          pow(calibrationMovRmsValues[streamId][idx] -
-                  settings[streamId]->movRmsMean,
-              2.0);
-    }
-    settings[streamId]->movRmsStdDev =
-        sqrt(settings[streamId]->movRmsStdDev /
-             ((double)numMovCalibrationPoints - 1.0));
-    settings[streamId]->movThreshold =
-        settings[streamId]->movRmsMean +
-        settings[streamId]->movSds * settings[streamId]->movRmsStdDev;
-  }
+  const RippleDetectorConfig &config = settings[streamId]->getConfig();
+  const RippleTraceState &state = settings[streamId]->detector.getState();
+
+  settings[streamId]->channelScan.finish();
+  settings[streamId]->autoTuner.finish(
+      config.rippleSds, config.numSamplesTimeThreshold, config.tuneCpuBudget,
+      config.tuneFalsePerMinute);
+
+  settings[streamId]->health.rmsMean = state.rmsMean;
+  settings[streamId]->health.rmsStdDev = state.rmsStdDev;
+
+  if (config.filterBankEnabled)
+    LOGD("Filter bank -> slope mean: ", state.artefactMean,
+         ", std: ", state.artefactStdDev,
+         ", artefact threshold: ", state.artefactThreshold);
+
+  if (!config.referenceChannels.empty())
+    LOGD("Reference channels -> RMS mean: ", state.refRmsMean,
+         ", std: ", state.refRmsStdDev, ", threshold: ", state.refThreshold);
 
   // Print calculated statistics
-  if (settings[streamId]->movSwitchEnabled) {
-    if (settings[streamId]->movSwitch.equalsIgnoreCase("EMG")) {
+  const MovementMode movementMode =
+      settings[streamId]->detector.getMovementMode();
+  if (movementMode != MovementMode::OFF) {
+    if (movementMode == MovementMode::EMG) {
       printf("Ripple channel -> RMS mean: %f\n"
              "Ripple channel -> RMS std: %f\n"
              "Ripple channel -> threshold amplifier: %f\n"
@@ -560,10 +1354,9 @@ void RippleDetector::finishCalibration(uint64 streamId) {
              "EMG RMS std: %f\n"
              "EMG threshold amplifier: %f\n"
              "EMG final RMS threshold: %f\n",
-             settings[streamId]->rmsMean, settings[streamId]->rmsStdDev,
-             settings[streamId]->rippleSds, settings[streamId]->threshold,
-             settings[streamId]->movRmsMean, settings[streamId]->movRmsStdDev,
-             settings[streamId]->movSds, settings[streamId]->movThreshold);
+             state.rmsMean, state.rmsStdDev, config.rippleSds,
+             state.threshold, state.movRmsMean, state.movRmsStdDev,
+             config.movSds, state.movThreshold);
     } else {
       printf("Ripple channel -> RMS mean: %f\n"
              "Ripple channel -> RMS std: %f\n"
@@ -573,170 +1366,176 @@ void RippleDetector::finishCalibration(uint64 streamId) {
              "Accel. magnit. RMS std: %f\n"
              "Accel. magnit. threshold amplifier: %f\n"
              "Accel. magnit. final RMS threshold: %f\n",
-             settings[streamId]->rmsMean, settings[streamId]->rmsStdDev,
-             settings[streamId]->rippleSds, settings[streamId]->threshold,
-             settings[streamId]->movRmsMean, settings[streamId]->movRmsStdDev,
-             settings[streamId]->movSds, settings[streamId]->movThreshold);
+             state.rmsMean, state.rmsStdDev, config.rippleSds,
+             state.threshold, state.movRmsMean, state.movRmsStdDev,
+             config.movSds, state.movThreshold);
     }
   } else {
     printf("Ripple channel -> RMS mean: %f\n"
            "Ripple channel -> RMS std: %f\n"
            "Ripple channel -> threshold amplifier: %f\n"
            "Ripple channel -> final RMS threshold: %f\n",
-           settings[streamId]->rmsMean, settings[streamId]->rmsStdDev,
-           settings[streamId]->rippleSds, settings[streamId]->threshold);
+           state.rmsMean, state.rmsStdDev, config.rippleSds, state.threshold);
   }
+
+  // The message thread updates the text boxes, and the parameters they
+  // hold, from this
+  const uint32_t calibration =
+      settings[streamId]->calibrationsFinished.load(
+          std::memory_order_relaxed) +
+      1;
+  RippleCalibrationResult &result =
+      settings[streamId]->calibrationBuffer.beginWrite();
+  result.calibration = calibration;
+  result.rmsMean = state.rmsMean;
+  result.rmsStdDev = state.rmsStdDev;
+  settings[streamId]->calibrationBuffer.publish();
+  settings[streamId]->calibrationsFinished.store(calibration,
+                                                 std::memory_order_release);
 }
 
-// Evaluate EMG/ACC signal to enable or disable ripple detection
-void RippleDetector::evalMovement(uint64 streamId) {
+// Count the input samples at the ADC rails or repeating the previous one.
+// Either is a sign of a saturated or disconnected ripple channel
+void RippleDetector::updateInputHealth(uint64 streamId, const float *data,
+                                       int numSamples) {
 
-  // Iterate over RMS blocks inside buffer
-  for (unsigned int rmsIdx = 0; rmsIdx < movRmsValuesArray[streamId].size();
-       rmsIdx++) {
-    double rms = movRmsValuesArray[streamId][rmsIdx];
-    int samples = movRmsNumSamplesArray[streamId][rmsIdx];
+  const float clipLevel = settings[streamId]->getConfig().clipLevel;
 
-    // Counter: acumulate time above or below threshold
-    if (rms > settings[streamId]->movThreshold) {
-      settings[streamId]->counterMovUpThresh += samples;
-      settings[streamId]->flagMovMinTimeDown = false;
-    } else {
-      settings[streamId]->counterMovDownThresh += samples;
-      settings[streamId]->flagMovMinTimeUp = false;
-      settings[streamId]->counterMovUpThresh = 0;
-    }
+  uint64_t clipped = 0, flat = 0;
+  float previous = settings[streamId]->lastInputSample;
+  for (int idx = 0; idx < numSamples; idx++) {
+    const float value = data[idx];
+    clipped += clipLevel > 0.0f && std::abs(value) >= clipLevel;
+    flat += value == previous;
+    previous = value;
+  }
+  if (numSamples > 0)
+    settings[streamId]->lastInputSample = previous;
 
-    // Set flags when minimum time above or below threshold is achieved
-    if (settings[streamId]->counterMovUpThresh >
-        settings[streamId]->minMovSamplesAboveThresh) {
-      settings[streamId]->flagMovMinTimeUp = true;
-      settings[streamId]->counterMovDownThresh =
-          0; // Reset counterMovDownThresh only when there is movement for
-             // enough time
-    }
-    if (settings[streamId]->counterMovDownThresh >
-        settings[streamId]->minMovSamplesBelowThresh) {
-      settings[streamId]->flagMovMinTimeDown = true;
-    }
+  RippleHealthCounters &health = settings[streamId]->health;
+  RippleHealthCounters::add(health.samples, numSamples);
+  RippleHealthCounters::add(health.clippedSamples, clipped);
+  RippleHealthCounters::add(health.flatSamples, flat);
+}
 
-    // Disable plugin...
-    if (settings[streamId]->pluginEnabled &&
-        settings[streamId]->flagMovMinTimeUp) {
-      settings[streamId]->pluginEnabled = false;
-      TTLEventPtr event = settings[streamId]->createEvent(
-          settings[streamId]->movementOutputChannel,
-          getFirstSampleNumberForBlock(streamId) + rmsIdx, 1);
-      addEvent(event, rmsIdx);
-    }
-    // ... or enable plugin
-    if (!settings[streamId]->pluginEnabled &&
-        settings[streamId]->flagMovMinTimeDown) {
-      settings[streamId]->pluginEnabled = true;
-      TTLEventPtr event = settings[streamId]->createEvent(
-          settings[streamId]->movementOutputChannel,
-          getFirstSampleNumberForBlock(streamId) + rmsIdx, 0);
-      addEvent(event, rmsIdx);
-    }
+void RippleDetector::updateEventAverage(uint64 streamId,
+                                        AudioBuffer<float> &buffer,
+                                        int64 firstSampleNumber,
+                                        int numSamples) {
+
+  const RippleDetectorConfig &config = settings[streamId]->getConfig();
+  RippleEventAverage &eventAverage = settings[streamId]->eventAverage;
+
+  int channels[RippleEventAverage::maxChannels];
+  const float *data[RippleEventAverage::maxChannels];
+  int numChannels = 0;
+  channels[numChannels++] = config.rippleInputChannel;
+  for (int channel : config.referenceChannels)
+    if (numChannels < RippleEventAverage::maxChannels)
+      channels[numChannels++] = channel;
+  for (int idx = 0; idx < numChannels; idx++)
+    data[idx] = buffer.getReadPointer(channels[idx], 0);
+
+  // A new selection clears the editor's view as well
+  bool changed = eventAverage.setChannels(channels, numChannels);
+  changed |= eventAverage.process(data, firstSampleNumber, numSamples);
+  if (changed) {
+    SnapshotBuffer<RippleEventAverageSnapshot> &snapshots =
+        settings[streamId]->eventAverageBuffer;
+    eventAverage.fillSnapshot(snapshots.beginWrite());
+    snapshots.publish();
+  }
+}
 
-    // printf("plugin %d, flagUp %d, flagDown %d, Up %d, Down %d, rms %f,
-    // thresh %f\n", pluginEnabled, flagMovMinTimeUp, flagMovMinTimeDown,
-    // counterMovUpThresh, counterMovDownThresh, rms, movThreshold);
-  }
-}
-void RippleDetector::detectRipples(uint64 streamId) {
-
-  std::vector<double> &rmsValues = rmsValuesArray[streamId];
-  std::vector<int> &rmsNumSamples = rmsNumSamplesArray[streamId];
-
-  // Iterate over RMS blocks inside buffer
-  for (unsigned int rmsIdx = 0; rmsIdx < rmsValues.size(); rmsIdx++) {
-    double rms = rmsValues[rmsIdx];
-    int samples = rmsNumSamples[rmsIdx];
-
-    // Reset TTL if ripple was detected during the last iteration
-    if (settings[streamId]->rippleDetected) {
-
-      if (settings[streamId]->pluginEnabled) {
-        auto time_now = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch());
-        auto time_elapsed = time_now - settings[streamId]->rippleStartTime;
-        if (time_elapsed.count() > settings[streamId]->ttl_duration) {
-          if (settings[streamId]->random_number <=
-              settings[streamId]->ttl_percent) {
-            TTLEventPtr event = settings[streamId]->createEvent(
-                settings[streamId]->rippleOutputChannel,
-                getFirstSampleNumberForBlock(streamId), false);
-            addEvent(event, 0);
-            settings[streamId]->rippleDetected = false;
-          }
-        }
-      }
-    }
+// The envelope outputs read zero wherever detectRipples() does not fill them,
+// e.g. while calibrating
+void RippleDetector::prepareEnvelopeOutputs(uint64 streamId,
+                                            AudioBuffer<float> &buffer,
+                                            int numSamples) {
 
-    // Counter: acumulate time above threshold
-    if (rms > settings[streamId]->threshold) {
-      settings[streamId]->counterAboveThresh += samples;
-    } else {
-      settings[streamId]->counterAboveThresh = 0;
-      settings[streamId]->flagTimeThreshold = false;
-    }
+  const RippleDetectorConfig &config = settings[streamId]->getConfig();
 
-    // Set flag to indicate that time threshold was achieved
-    if (settings[streamId]->counterAboveThresh >
-        settings[streamId]->numSamplesTimeThreshold) {
-      settings[streamId]->flagTimeThreshold = true;
-    }
+  if (config.envelopeOutputChannel < 0) {
+    settings[streamId]->envelopeOut = nullptr;
+    return;
+  }
 
-    // Send TTL if ripple is detected and it is not on refractory period
-    if (settings[streamId]->flagTimeThreshold &&
-        !settings[streamId]->onRefractoryTime) {
-
-      if (settings[streamId]->pluginEnabled) {
-        settings[streamId]->rippleStartTime =
-            std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::system_clock::now().time_since_epoch());
-        TTLEventPtr event = settings[streamId]->createEvent(
-            settings[streamId]->ttlReportChannel,
-            getFirstSampleNumberForBlock(streamId), true);
-        addEvent(event, 0);
-        settings[streamId]->random_number = distribute(generator);
-        // only create a ttl event on the output line if chance dictates...
-        if (settings[streamId]->random_number <=
-            settings[streamId]->ttl_percent) {
-          TTLEventPtr event_1 = settings[streamId]->createEvent(
-              settings[streamId]->rippleOutputChannel,
-              getFirstSampleNumberForBlock(streamId), true);
-          addEvent(event_1, 0);
-          LOGC("Ripple detected and propagated on stream: ", streamId);
-        } else {
-          LOGC("Ripple detected but blocked by chance");
-        }
+  settings[streamId]->envelopeOut =
+      buffer.getWritePointer(config.envelopeOutputChannel, 0);
+  settings[streamId]->thresholdOut =
+      buffer.getWritePointer(config.thresholdOutputChannel, 0);
+  settings[streamId]->stateOut =
+      buffer.getWritePointer(config.stateOutputChannel, 0);
+  FloatVectorOperations::clear(settings[streamId]->envelopeOut, numSamples);
+  FloatVectorOperations::clear(settings[streamId]->thresholdOut, numSamples);
+  FloatVectorOperations::clear(settings[streamId]->stateOut, numSamples);
+}
 
-      } else {
-        LOGC("Ripple detected on stream", streamId,
-             "but TTL event was blocked by movement detection.\n");
-      }
+// Emit a TTL event on a stream, recording it in the trace if there is one
+void RippleDetector::addTtlEvent(uint64 streamId, int line,
+                                 int64 sampleNumber, bool state,
+                                 int sampleIndex) {
+  TTLEventPtr event =
+      settings[streamId]->createEvent(line, sampleNumber, state);
+  addEvent(event, sampleIndex);
 
-      settings[streamId]->rippleDetected = true;
+  if (traceWriter.isOpen())
+    traceWriter.writeEvent({(uint16_t)streamId, sampleNumber, line, state});
+}
 
-      // Start refractory period
-      settings[streamId]->onRefractoryTime = true;
-      settings[streamId]->refractoryTimeStart =
-          std::chrono::duration_cast<std::chrono::milliseconds>(
-              std::chrono::system_clock::now().time_since_epoch());
-    }
+// The episode is known at the end of the window that closed it
+void RippleDetector::addEpisodeEvent(uint64 streamId,
+                                     const RippleEpisode &episode,
+                                     int sampleIndex) {
+  BinaryEventPtr event = settings[streamId]->createEpisodeEvent(
+      getFirstSampleNumberForBlock(streamId) + sampleIndex, episode);
+  addEvent(event, sampleIndex);
 
-    // Check and reset refractory time
-    if (settings[streamId]->onRefractoryTime) {
-      settings[streamId]->timeNow =
-          std::chrono::duration_cast<std::chrono::milliseconds>(
-              std::chrono::system_clock::now().time_since_epoch());
-      if (settings[streamId]->timeNow.count() -
-              settings[streamId]->refractoryTimeStart.count() >=
-          settings[streamId]->refractoryTime) {
-        settings[streamId]->onRefractoryTime = false;
-      }
-    }
+  if (episodeWriter.isOpen())
+    episodeWriter.write(episode);
+}
+
+// Record the input of a block. Before the first traced block the stream's
+// detector state and snapshot are recorded too, so a replay starts from them
+void RippleDetector::traceBlock(uint64 streamId, AudioBuffer<float> &buffer,
+                                int64 firstSampleNumber, int numSamples,
+                                bool configChanged) {
+
+  const RippleDetectorConfig &config = settings[streamId]->getConfig();
+
+  if (settings[streamId]->tracePending)
+    traceWriter.writeState(streamId, settings[streamId]->detector.getState());
+
+  if (configChanged || settings[streamId]->tracePending) {
+    static const std::string noModel;
+    traceWriter.writeConfig(
+        streamId, config,
+        config.cnn != nullptr ? config.cnn->getModelPath() : noModel);
+    settings[streamId]->tracePending = false;
   }
+
+  // Every channel the snapshot can read, each once
+  constexpr int maxChannels = 64;
+  int channels[maxChannels];
+  const float *data[maxChannels];
+  int numChannels = 0;
+  auto addChannel = [&](int channel) {
+    if (channel < 0 || numChannels == maxChannels)
+      return;
+    for (int idx = 0; idx < numChannels; idx++)
+      if (channels[idx] == channel)
+        return;
+    channels[numChannels] = channel;
+    data[numChannels++] = buffer.getReadPointer(channel, 0);
+  };
+  addChannel(config.rippleInputChannel);
+  addChannel(config.movementInputChannel);
+  for (int channel : config.auxChannelIndices)
+    addChannel(channel);
+  for (int channel : config.referenceChannels)
+    addChannel(channel);
+  addChannel(config.stateInputChannel);
+
+  traceWriter.writeBlock(streamId, firstSampleNumber, numSamples, channels,
+                         data, numChannels);
 }
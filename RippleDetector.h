@@ -2,6 +2,20 @@
 #ifndef __RIPPLE_DETECTOR_H
 #define __RIPPLE_DETECTOR_H
 
+#include "RippleAutoTune.h"
+#include "RippleBrainState.h"
+#include "RippleChannelScan.h"
+#include "RippleCnn.h"
+#include "RippleDetectionCore.h"
+#include "RippleDetectorConfig.h"
+#include "RippleEpisode.h"
+#include "RippleEventAverage.h"
+#include "RippleFilterBank.h"
+#include "RippleFusion.h"
+#include "RippleHealth.h"
+#include "RippleShadow.h"
+#include "RippleSpectrum.h"
+#include "RippleTrace.h"
 #include <ProcessorHeaders.h>
 #include <chrono>
 #include <iostream>
@@ -10,6 +24,14 @@
 #include <vector>
 
 class RippleDetectorEditor;
+class RippleDetector;
+
+/** Ripple baseline measured by a calibration */
+struct RippleCalibrationResult {
+  uint32_t calibration{0}; // Value of calibrationsFinished it was taken at
+  double rmsMean{0.0};
+  double rmsStdDev{0.0};
+};
 
 class RippleDetectorSettings {
 public:
@@ -22,91 +44,73 @@ public:
   /** Creates an event associated with ripple detection */
   TTLEventPtr createEvent(int64 outputLine, int64 sample_number, bool state);
 
-  // Time-related variables
-  std::chrono::milliseconds refractoryTimeStart;
-  std::chrono::milliseconds timeNow;
-  std::chrono::milliseconds rippleStartTime;
-
-  // Interface corresponding parameters
-  int rippleInputChannel;    // Input channel
-  int rippleOutputChannel;   // Output TTL channel
-  int movementInputChannel;  // Movement detection channel
-  int movementOutputChannel; // Movement detection output TTL channel
-  int ttlReportChannel; // all TTL events are sent to this channel - must be
-                        // different to the ones above
-  double rippleSds;  // Number of standard deviations above average to compose
-                     // the amplitude threshold
-  int timeThreshold; // Time threshold (milliseconds)
-  unsigned int refractoryTime; // Refractory time in milliseconds
-  int rmsSamples;   // Number of samples in each buffer subdivision for
-                    // calculating the RMS
-  String movSwitch; // Movement detection switch (on/off)
-  double movSds;    // Number of standard deviations above average for EMG/ACC
-  int minTimeWoMov; // Minimum time that EMG RMS must be below threshold to
-                    // enable detection
-  int minTimeWMov;  // Minimum time that EMG RMS must be above threshold to
-                    // disable detection
-
-  // Internal auxiliary variables
-  int numSamplesTimeThreshold;     // Number of samples corresponding to time
-                                   // threshold according to the sample rate
-  int minMovSamplesBelowThresh;    // Number of samples corresponding to EMG/ACC
-                                   // minimum time below threshold to enable
-                                   // detection
-  int minMovSamplesAboveThresh;    // Number of samples corresponding to EMG
-                                   // minimum time above threshold to disable
-                                   // detection
-  unsigned int counterAboveThresh; // Accumulate the number of samples when RMS
-                                   // values are above threshold
-  int bufferSize;          // Number of pre-allocated samples in each buffer
-  int realNumberOfSamples; // Real number of samples in the buffer (usually
-                           // lesser than buffer size, at least for File Reader
-                           // tests)
-  int pointsProcessed;     // Total number of points processed during the
-                           // calibration step
-  int calibrationPoints; // Total number of points that defines the calibration
-                         // duration
-  unsigned int counterMovUpThresh; // Accumulate the number of samples when RMS
-                                   // values for EMG/ACC are above threshold
-  unsigned int
-      counterMovDownThresh; // Accumulate the number of samples when RMS values
-                            // for EMG/ACC are below threshold
-  std::vector<int>
-      auxChannelIndices; // Contains the indices of aux channels. Useful for
-                         // movement detector when "ACCEL" is selected
-
-  // RMS variables
-  int rmsEndIdx;        // The end index for RMS calculation windows
-  double rmsMean = 0;   // Baseline RMS mean for ripple detection
-  double rmsStdDev = 0; // Baseline RMS standard deviation for ripple detection
-  double movRmsMean;    // Baseline RMS mean for EMG/ACC signal
-  double movRmsStdDev;  // Baseline RMS standard deviation for EMG signal
-  double threshold;     // Final threshold for ripple detection
-  double movThreshold;  // Final EMG/ACC threshold for movement detector
-
-  // Event flags
-  bool isCalibrating{true};     // Is in the calibration step
-  bool pluginEnabled{true};     // Plugin is enabled to send TTL events
-  bool onRefractoryTime{false}; // On refractory time (ripples cannot be
-                                // detected during the refractory time)
-  bool rippleDetected{false};   // Indicates that a ripple was detected
-  bool flagTimeThreshold{
-      false}; // Indicates that the time threshold was achieved
-  bool movSwitchEnabled{false};   // EMG switching mechanism is enabled
-  bool movChannChanged{false};    // User selected new EMG/ACC channel
-  bool calibrate{false};          // Indicates the need to recalibrate
-  bool flagMovMinTimeUp{false};   // Indicates that the minimum time of EMG/ACC
-                                  // above threshold was achieved
-  bool flagMovMinTimeDown{false}; // Indicates that the minimum time of EMG/ACC
-                                  // below threshold was achieved
-  bool accelerometerSelected{
-      false}; // True when accelerometer is selected to movement detector
-  double ttl_duration; // the minimum length in ms of the TTL output
-  double ttl_percent;  // the percentage of the time that a TTL output is
-                       // produced following ripple detection
-  double random_number;
+  /** Creates an event carrying a closed ripple episode */
+  BinaryEventPtr createEpisodeEvent(int64 sample_number,
+                                    const RippleEpisode &episode);
+
+  /** Returns the parameter snapshot in use for the current block */
+  const RippleDetectorConfig &getConfig() const { return configBuffer.read(); }
+
+  // Parameter snapshots compiled on the message thread
+  SnapshotBuffer<RippleDetectorConfig> configBuffer;
+  unsigned int nextMovChannelGeneration{0};  // Message thread only
+  unsigned int nextCalibrationGeneration{0}; // Message thread only
+  std::shared_ptr<RippleCnn> nextCnn;        // Message thread only
+
+  // Baselines of finished calibrations, written back to RMS_mean and RMS_std
+  // by the message thread
+  SnapshotBuffer<RippleCalibrationResult> calibrationBuffer;
+  std::atomic<uint32_t> calibrationsFinished{0}; // Audio thread writes
+  uint32_t calibrationsWrittenBack{0};           // Message thread only
+
+  // Window, calibration and detection state machine of the stream
+  RippleDetectionCore detector;
+
+  // Spectral monitor of the ripple input, published to the editor
+  RippleSpectrum spectrum;
+  SnapshotBuffer<RippleSpectrumSnapshot> spectrumBuffer;
+
+  // Ripple-triggered averages, published to the editor
+  RippleEventAverage eventAverage;
+  SnapshotBuffer<RippleEventAverageSnapshot> eventAverageBuffer;
+  bool eventAverageActive{false}; // Averages are being updated
+
+  // Index of this stream in the fusion stage
+  int fusionIndex{-1};
+
+  // Alternative parameter sets run on the same window RMS values
+  RippleShadowDetectors shadows;
+
+  // Onset, peak and offset of the ripple being detected
+  RippleEpisodeTracker episodes;
+
+  // Signal-health counters, read by the editor
+  RippleHealthCounters health;
+  float lastInputSample{0}; // Last ripple input sample, for flat-line checks
+
+  // The detector state and snapshot still have to be written to the trace
+  bool tracePending{false};
+
+  // Envelope output channels
+  int envelopeLocalIndex{-1};  // First added channel in the stream, -1 if off
+  float *envelopeOut{nullptr}; // Write pointers for the current block
+  float *thresholdOut{nullptr};
+  float *stateOut{nullptr};
+
+  // Ripple-band ranking of every channel, run alongside the calibration
+  RippleChannelScan channelScan;
+  std::vector<int> scanLocalIndices;      // Channels scanned, message thread
+  std::vector<const float *> scanInputs;  // Their data for the current block
+
+  // Window length tuning, run alongside the calibration
+  RippleAutoTuner autoTuner;
+  std::atomic<bool> skipNextTune{false}; // Set with a tuned rms_samples
+
   // TTL event channel
   EventChannel *eventChannel;
+
+  // Binary event channel, one RippleEpisode per event
+  EventChannel *episodeChannel;
 };
 
 class RippleDetector : public GenericProcessor {
@@ -129,31 +133,114 @@ public:
   /** Called when a parameter is updated */
   void parameterValueChanged(Parameter *param) override;
 
+  /** Opens the block trace, if one is configured, and republishes the
+   * snapshots with the final channel indices */
+  bool startAcquisition() override;
+
+  /** Closes the block trace */
+  bool stopAcquisition() override;
+
   std::atomic<bool> shouldCalibrate{true};
 
   void makeParamValuesUnique(Parameter *param1, Parameter *param2);
 
+  /** Copies the latest spectrum of a stream; returns false if there is none.
+   * Message thread only */
+  bool getSpectrum(uint16 streamId, RippleSpectrumSnapshot &snapshot);
+
+  /** Copies the latest ripple-triggered averages of a stream; returns false
+   * if no detection has been averaged yet. Message thread only */
+  bool getEventAverage(uint16 streamId, RippleEventAverageSnapshot &snapshot);
+
+  /** Writes the latest ripple-triggered averages of a stream to a CSV file,
+   * and the spectrogram next to it. Message thread only */
+  bool exportEventAverage(uint16 streamId, const File &file, String &error);
+
+  /** Copies the health counters of a stream; returns false if the stream
+   * does not exist. Any thread */
+  bool getHealth(uint16 streamId, RippleHealthSample &sample);
+
+  /** Copies the shadow detector counters of a stream; returns false if the
+   * stream does not exist. Any thread */
+  bool getShadows(uint16 streamId, RippleShadowSample &sample);
+
+  /** Reports the channel rankings of finished calibrations and, if asked
+   * to, switches the ripple input to the best channel. Message thread */
+  void checkChannelScans();
+
+  /** Reports the window lengths tuned by finished calibrations and applies
+   * the chosen one, recalibrating with it. Message thread */
+  void checkAutoTune();
+
+  /** Writes the baselines of finished calibrations back to the RMS_mean and
+   * RMS_std parameters. Message thread */
+  void checkCalibrations();
+
 private:
+  /** Compiles the stream's parameters into a snapshot for the audio thread */
+  void publishConfig(const DataStream *stream);
+
+  /** Loads the stream's CNN weights file into a runner for the next
+   * snapshot. Message thread only */
+  void loadCnnModel(const DataStream *stream);
+
+  /** Starts or stops the stream's channel scan workers to match its
+   * auto_select parameter. Message thread, with the audio thread stopped */
+  void prepareChannelScan(const DataStream *stream);
+
+  /** Compiles the global fusion parameters into a snapshot */
+  void publishFusionConfig();
+
   RippleDetectorEditor *ed;
 
   StreamSettings<RippleDetectorSettings> settings;
 
-  std::map<uint64, std::vector<double>> rmsValuesArray;
-  std::map<uint64, std::vector<int>> rmsNumSamplesArray;
-  std::map<uint64, std::vector<double>> movRmsValuesArray;
-  std::map<uint64, std::vector<int>> movRmsNumSamplesArray;
-  std::map<uint64, std::vector<double>> calibrationRmsValues;
-  std::map<uint64, std::vector<double>> calibrationMovRmsValues;
+  SnapshotBuffer<RippleFusionConfig> fusionConfigBuffer;
+  RippleFusion rippleFusion;
+
+  // Block trace for offline replay
+  RippleTraceWriter traceWriter;
+  bool traceFusionPending{false};
+
+  // Optional file copy of the episode events
+  RippleEpisodeWriter episodeWriter;
+
+  /** Hands what the detector does with a block to the stream's events,
+   * monitors and outputs */
+  class BlockListener;
+
+  void applyConfig(uint64 streamId);
+
+  /** Starts the channel scan, shadow sets and auto-tuning alongside a
+   * calibration */
+  void startCalibration(uint64 streamId);
+
+  /** Hands a calibration block over to the channel scan and auto-tuning */
+  void addCalibrationBlock(uint64 streamId, AudioBuffer<float> &buffer,
+                           int numSamples);
 
-  // Ripple-specific functions
+  /** Finishes the channel scan and auto-tuning and publishes the baseline */
   void finishCalibration(uint64 streamId);
-  void detectRipples(uint64 streamId);
-  void evalMovement(uint64 streamId);
 
-  double calculateRms(const float *data, int initIndex, int endIndexOpen);
-  double calculateRms(std::vector<float> data, int initIndex, int endIndex);
-  std::vector<float> calculateAccelMod(std::vector<std::vector<float>> axis,
-                                       int numberOfSamples);
+  void addTtlEvent(uint64 streamId, int line, int64 sampleNumber, bool state,
+                   int sampleIndex);
+
+  /** Sends a closed episode downstream, and to the episode file if one is
+   * open */
+  void addEpisodeEvent(uint64 streamId, const RippleEpisode &episode,
+                       int sampleIndex);
+  void traceBlock(uint64 streamId, AudioBuffer<float> &buffer,
+                  int64 firstSampleNumber, int numSamples,
+                  bool configChanged);
+  void updateInputHealth(uint64 streamId, const float *data, int numSamples);
+
+  /** Adds the block to the stream's ripple-triggered averages */
+  void updateEventAverage(uint64 streamId, AudioBuffer<float> &buffer,
+                          int64 firstSampleNumber, int numSamples);
+
+  /** Points the stream's envelope outputs at the block and clears them */
+  void prepareEnvelopeOutputs(uint64 streamId, AudioBuffer<float> &buffer,
+                              int numSamples);
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RippleDetector);
 };
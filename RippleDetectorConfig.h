@@ -0,0 +1,175 @@
+#ifndef __RIPPLE_DETECTOR_CONFIG_H
+#define __RIPPLE_DETECTOR_CONFIG_H
+
+#include "RippleBrainState.h"
+#include "RippleShadow.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class RippleCnn;
+
+/**
+  Single-producer / single-consumer triple buffer.
+
+  The writer fills the back slot returned by beginWrite() and calls publish();
+  the reader calls acquire() once per block and then uses read(). Neither side
+  ever blocks or allocates, and the reader always sees a complete snapshot.
+**/
+template <typename T> class SnapshotBuffer {
+public:
+  /** Returns the slot owned by the writer */
+  T &beginWrite() { return slots[backIndex]; }
+
+  /** Hands the slot filled since beginWrite() over to the reader */
+  void publish() {
+    backIndex =
+        state.exchange(backIndex | dirtyBit, std::memory_order_acq_rel) &
+        indexMask;
+  }
+
+  /** Picks up the most recently published slot, if any. Returns true when
+   * read() changed */
+  bool acquire() {
+    if (!(state.load(std::memory_order_acquire) & dirtyBit))
+      return false;
+    frontIndex = state.exchange(frontIndex, std::memory_order_acq_rel) &
+                 indexMask;
+    return true;
+  }
+
+  /** Returns the slot owned by the reader */
+  const T &read() const { return slots[frontIndex]; }
+
+  /** Calls fn on every slot, e.g. to preallocate them. Only while neither
+   * side is using the buffer */
+  template <typename Fn> void forEachSlot(Fn fn) {
+    for (T &slot : slots)
+      fn(slot);
+  }
+
+private:
+  static constexpr int dirtyBit = 4;
+  static constexpr int indexMask = 3;
+
+  T slots[3];
+  std::atomic<int> state{1}; // Middle slot index, plus dirtyBit when unread
+  int backIndex{0};
+  int frontIndex{2};
+};
+
+/** Test deciding whether an RMS window is above threshold */
+enum class DetectorMode { RMS, CNN };
+
+/** Signal used to block detection during movement */
+enum class MovementMode { OFF, ACC, EMG };
+
+/** Values written to the detector state output channel */
+enum class RippleEnvelopeState {
+  BLOCKED = -1, // Detection disabled by movement or brain state
+  BELOW = 0,    // Below threshold, vetoed or calibrating
+  ABOVE = 1,    // Above threshold, time threshold not reached yet
+  DETECTED = 2  // Time threshold reached
+};
+
+/**
+  Immutable parameter snapshot for one stream.
+
+  Compiled on the message thread whenever a parameter changes, with every
+  value the audio thread needs already converted to samples, and published
+  through a SnapshotBuffer so process() never reads half-updated settings.
+**/
+struct RippleDetectorConfig {
+  static constexpr int maxReferenceChannels = 8;
+
+  // Channels (global indices into the AudioBuffer, -1 if none)
+  int rippleInputChannel{-1};
+  int movementInputChannel{-1};
+  std::vector<int> auxChannelIndices; // Channels used for the accelerometer
+  std::vector<int> referenceChannels; // Common-mode reference channels
+  float clipLevel{0.0f}; // Ripple input magnitude counted as clipped (0 if
+                         // the channel has no known ADC range)
+
+  // Continuous outputs added by the plugin (global indices, -1 if disabled)
+  int envelopeOutputChannel{-1};  // Detection statistic of each window
+  int thresholdOutputChannel{-1}; // Threshold it is compared with
+  int stateOutputChannel{-1};     // Detector state, see RippleEnvelopeState
+  std::vector<int> scanChannels;  // Channels ranked during calibration
+
+  // Output TTL lines (zero-based)
+  int rippleOutputChannel{0};
+  int ttlReportChannel{1};
+  int movementOutputChannel{2};
+
+  // Ripple detection
+  double rippleSds{0.0};          // Standard deviations above the RMS mean
+  double offsetSds{2.0}; // The same, where a detected ripple starts and ends
+  unsigned int refractoryTime{0}; // Refractory time in milliseconds
+  int rmsSamples{1};              // Samples in each RMS window
+  double ttlDuration{0.0};        // Minimum TTL output duration (ms)
+  double ttlPercent{100.0}; // Percentage of detections sent to the output
+
+  // Detector selection
+  DetectorMode detectorMode{DetectorMode::RMS};
+  std::shared_ptr<RippleCnn> cnn; // Runner for the loaded weights file, owned
+                                  // by the snapshot (null if none is loaded)
+  double cnnThreshold{0.5};       // Ripple probability threshold of the CNN
+
+  // Filter bank: ripple-band RMS with fast-ripple and artefact rejection
+  bool filterBankEnabled{false};
+  double fastRippleRatio{1.5}; // Windows whose fast-ripple RMS exceeds this
+                               // fraction of the ripple RMS are fast ripples
+  double artefactSds{10.0};    // Standard deviations above the mean slope
+  int artefactHoldSamples{0};  // Samples vetoed after an artefact
+
+  // Spectral monitor
+  bool spectrumEnabled{false};
+
+  // Ripple-triggered averages of the ripple input and reference channels
+  bool eventAverageEnabled{false};
+
+  // Brain-state gate
+  StateGateMode stateGate{StateGateMode::OFF};
+  int stateInputChannel{-1}; // Channel classified (global index, defaults to
+                             // the ripple input)
+  double thetaRatio{1.0};    // Theta over delta power above which the state
+                             // is theta
+  double deltaFraction{0.5}; // Delta share of the 1-40 Hz power above which
+                             // the state is NREM
+
+  // Shadow detectors, evaluated without emitting events
+  std::vector<RippleShadowSet> shadowSets;
+
+  // Window length auto-tuning during calibration
+  bool autoTuneEnabled{false};
+  double tuneCpuBudget{0.05};     // Fraction of real time for the feature pass
+  double tuneFalsePerMinute{1.0}; // Baseline detections per minute allowed
+
+  // Common-mode veto
+  double refSds{5.0}; // Standard deviations above the reference RMS mean
+
+  // Baseline entered by the user or written back after calibration
+  double rmsMean{0.0};
+  double rmsStdDev{0.0};
+  bool baselineCurrent{true}; // False while a finished calibration has not
+                              // been written back to the two values above
+  unsigned int calibrationGeneration{0}; // Bumped whenever the stream's
+                                         // baseline must be measured again
+
+  // Movement detection
+  MovementMode movementMode{MovementMode::OFF};
+  double movSds{0.0};
+  unsigned int movChannelGeneration{0}; // Bumped whenever the movement input
+                                        // changes, to request recalibration
+
+  // Precomputed from the values above and the stream sample rate
+  double sampleRate{0.0};
+  int ttlDurationSamples{0};
+  int numSamplesTimeThreshold{0};
+  int minMovSamplesBelowThresh{0};
+  int minMovSamplesAboveThresh{0};
+  int calibrationPoints{0};
+  double threshold{0.0}; // rmsMean + rippleSds * rmsStdDev
+};
+
+#endif
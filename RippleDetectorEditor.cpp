@@ -72,9 +72,10 @@ RippleDetectorEditor::RippleDetectorEditor(GenericProcessor *parentNode)
 
   rippleDetector = (RippleDetector *)parentNode;
 
-  desiredWidth = 555; // Plugin's desired width`
+  desiredWidth = 650; // Plugin's desired width`
 
   /* Ripple Detection Settings */
+  int first = parameterEditors.size();
   addSelectedChannelsParameterEditor("Ripple_Input", 10, 25);
 
   addComboBoxParameterEditor("Ripple_Out", 10, 50);
@@ -119,6 +120,110 @@ RippleDetectorEditor::RippleDetectorEditor(GenericProcessor *parentNode)
 
   param = getProcessor()->getParameter("Ripple_save");
   addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 435, 50);
+  addToPage(DETECTION_PAGE, first);
+
+  /* Filter Bank Settings */
+  first = parameterEditors.size();
+  addComboBoxParameterEditor("filter_bank", 10, 20);
+
+  param = getProcessor()->getParameter("fr_ratio");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 25);
+
+  param = getProcessor()->getParameter("artefact_std");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 50);
+
+  /* Reference Channel Settings */
+  addSelectedChannelsParameterEditor("ref_input", 10, 65);
+
+  param = getProcessor()->getParameter("ref_std");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 75);
+
+  /* Brain-State Gate */
+  addComboBoxParameterEditor("state_gate", 230, 20);
+  addSelectedChannelsParameterEditor("state_input", 230, 65);
+
+  param = getProcessor()->getParameter("theta_ratio");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 315, 25);
+
+  param = getProcessor()->getParameter("delta_frac");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 315, 50);
+  addToPage(VETO_PAGE, first);
+
+  /* Cross-Stream Fusion Settings */
+  first = parameterEditors.size();
+  addComboBoxParameterEditor("fusion_mode", 10, 20);
+
+  param = getProcessor()->getParameter("fusion_window");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 25);
+
+  param = getProcessor()->getParameter("fusion_out");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 50);
+
+  /* Envelope Outputs */
+  addComboBoxParameterEditor("envelope_out", 230, 20);
+
+  /* Block Trace */
+  param = getProcessor()->getParameter("trace_file");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 315, 25);
+
+  /* Ripple Episodes */
+  param = getProcessor()->getParameter("episode_file");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 315, 50);
+
+  param = getProcessor()->getParameter("offset_std");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 315, 75);
+  addToPage(OUTPUT_PAGE, first);
+
+  /* CNN Detector Settings */
+  first = parameterEditors.size();
+  addComboBoxParameterEditor("detector", 10, 20);
+
+  param = getProcessor()->getParameter("cnn_thresh");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 25);
+
+  param = getProcessor()->getParameter("cnn_model");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 50);
+
+  /* Channel Auto-Selection */
+  addComboBoxParameterEditor("auto_select", 435, 65);
+
+  /* Shadow Detectors */
+  param = getProcessor()->getParameter("shadow_sets");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 95, 75);
+
+  /* Window Auto-Tuning */
+  addComboBoxParameterEditor("auto_tune", 230, 20);
+
+  param = getProcessor()->getParameter("tune_cpu");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 315, 25);
+
+  param = getProcessor()->getParameter("tune_fp");
+  addCustomParameterEditor(new CustomTextBoxParameterEditor(param), 315, 50);
+
+  /* Spectral Monitor and Ripple-Triggered Averages */
+  addComboBoxParameterEditor("spectrum", 230, 65);
+  addComboBoxParameterEditor("event_avg", 435, 20);
+  addToPage(TUNING_PAGE, first);
+
+  /* Settings Pages */
+  pageSelector = std::make_unique<ComboBox>("Settings page");
+  pageSelector->addItem("Detection", DETECTION_PAGE + 1);
+  pageSelector->addItem("Vetoes", VETO_PAGE + 1);
+  pageSelector->addItem("Outputs", OUTPUT_PAGE + 1);
+  pageSelector->addItem("Tuning", TUNING_PAGE + 1);
+  pageSelector->setSelectedId(DETECTION_PAGE + 1, dontSendNotification);
+  pageSelector->addListener(this);
+  pageSelector->setBounds(560, 25, 80, 20);
+  addAndMakeVisible(pageSelector.get());
+  showPage();
+
+  /* Monitor Button */
+  monitorButton = std::make_unique<UtilityButton>("Monitor", titleFont);
+  monitorButton->addListener(this);
+  monitorButton->setRadius(3.0f);
+  monitorButton->setBounds(560, 100, 80, 25);
+  addAndMakeVisible(monitorButton.get());
+
   /* Calibration Button */
   calibrateButton = std::make_unique<UtilityButton>("Calibrate", titleFont);
   calibrateButton->addListener(this);
@@ -127,10 +232,354 @@ RippleDetectorEditor::RippleDetectorEditor(GenericProcessor *parentNode)
   addAndMakeVisible(calibrateButton.get());
 }
 
-void RippleDetectorEditor::buttonClicked(Button *) {
+void RippleDetectorEditor::addToPage(SettingsPage page, int first) {
+  for (int idx = first; idx < parameterEditors.size(); idx++)
+    pages[page].push_back(parameterEditors[idx]);
+}
+
+void RippleDetectorEditor::showPage() {
+  for (int page = 0; page < numPages; page++)
+    for (Component *editor : pages[page])
+      editor->setVisible(page == currentPage);
+}
+
+void RippleDetectorEditor::buttonClicked(Button *button) {
+  if (button == monitorButton.get()) {
+    if (monitorPanel != nullptr)
+      return;
+    auto panel = std::make_unique<RippleMonitorPanel>(rippleDetector);
+    panel->refresh(getCurrentStream(), healthStatus);
+    monitorPanel = panel.get();
+    CallOutBox::launchAsynchronously(std::move(panel),
+                                     monitorButton->getScreenBounds(),
+                                     nullptr);
+    return;
+  }
+
   /* Calibration button was clicked */
   rippleDetector->shouldCalibrate = true;
 }
 
+void RippleDetectorEditor::comboBoxChanged(ComboBox *comboBox) {
+  currentPage = (SettingsPage)(comboBox->getSelectedId() - 1);
+  showPage();
+}
+
+void RippleDetectorEditor::collapsedStateChanged() {
+  // Expanding makes every child visible again
+  showPage();
+}
+
 // Called when settings are updated
 void RippleDetectorEditor::updateSettings() {}
+
+void RippleDetectorEditor::startAcquisition() {
+  healthMonitor.reset();
+  startTimer(100);
+}
+
+void RippleDetectorEditor::stopAcquisition() { stopTimer(); }
+
+void RippleDetectorEditor::timerCallback() {
+  rippleDetector->checkChannelScans();
+  rippleDetector->checkAutoTune();
+  rippleDetector->checkCalibrations();
+
+  // Rates are taken over the history of a single stream, so they are
+  // tracked whether or not the monitor is open
+  if (getCurrentStream() != healthStreamId) {
+    healthStreamId = getCurrentStream();
+    healthMonitor.reset();
+  }
+  RippleHealthSample sample;
+  if (rippleDetector->getHealth(healthStreamId, sample)) {
+    sample.time = Time::getMillisecondCounterHiRes() / 1000.0;
+    healthStatus = healthMonitor.update(sample);
+  } else {
+    healthStatus = RippleHealthStatus();
+  }
+
+  if (monitorPanel != nullptr)
+    monitorPanel->refresh(healthStreamId, healthStatus);
+}
+
+RippleMonitorPanel::RippleMonitorPanel(RippleDetector *rippleDetector_)
+    : rippleDetector(rippleDetector_) {
+
+  /* Spectral Monitor */
+  spectrumDisplay = std::make_unique<RippleSpectrumDisplay>();
+  spectrumDisplay->setBounds(10, 10, 160, 100);
+  addAndMakeVisible(spectrumDisplay.get());
+
+  /* Signal Health */
+  healthDisplay = std::make_unique<RippleHealthDisplay>();
+  healthDisplay->setBounds(180, 10, 130, 100);
+  addAndMakeVisible(healthDisplay.get());
+
+  /* Shadow Detectors */
+  shadowDisplay = std::make_unique<RippleShadowDisplay>();
+  shadowDisplay->setBounds(320, 10, 150, 100);
+  addAndMakeVisible(shadowDisplay.get());
+
+  /* Ripple-Triggered Averages */
+  eventAverageDisplay = std::make_unique<RippleEventAverageDisplay>();
+  eventAverageDisplay->setBounds(480, 10, 240, 100);
+  addAndMakeVisible(eventAverageDisplay.get());
+
+  Font buttonFont = Font("Silkscreen", "Regular", 10);
+  exportAverageButton = std::make_unique<UtilityButton>("Export", buttonFont);
+  exportAverageButton->addListener(this);
+  exportAverageButton->setRadius(3.0f);
+  exportAverageButton->setBounds(640, 115, 80, 20);
+  addAndMakeVisible(exportAverageButton.get());
+
+  setSize(730, 145);
+}
+
+void RippleMonitorPanel::refresh(uint16 streamId_,
+                                 const RippleHealthStatus &health) {
+  streamId = streamId_;
+
+  RippleSpectrumSnapshot snapshot;
+  rippleDetector->getSpectrum(streamId, snapshot);
+  spectrumDisplay->setSnapshot(snapshot);
+
+  RippleEventAverageSnapshot average;
+  rippleDetector->getEventAverage(streamId, average);
+  eventAverageDisplay->setSnapshot(average);
+
+  RippleShadowSample shadows;
+  rippleDetector->getShadows(streamId, shadows);
+  shadowDisplay->setSample(shadows);
+
+  healthDisplay->setStatus(health);
+}
+
+void RippleMonitorPanel::buttonClicked(Button *) {
+  /* Export button was clicked */
+  FileChooser chooser("Export ripple-triggered averages",
+                      File::getSpecialLocation(File::userDocumentsDirectory),
+                      "*.csv");
+  if (!chooser.browseForFileToSave(true))
+    return;
+  String error;
+  if (!rippleDetector->exportEventAverage(streamId, chooser.getResult(),
+                                          error))
+    AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon, "WARNING",
+                                     error);
+}
+
+void RippleSpectrumDisplay::setSnapshot(
+    const RippleSpectrumSnapshot &newSnapshot) {
+  snapshot = newSnapshot;
+  repaint();
+}
+
+void RippleSpectrumDisplay::paint(Graphics &g) {
+  g.fillAll(Colour(30, 30, 30));
+
+  if (!snapshot.valid) {
+    g.setColour(Colours::grey);
+    g.setFont(Font("CP Mono", "Plain", 10));
+    g.drawText("NO SPECTRUM", 0, 0, getWidth(), getHeight(),
+               Justification::centred);
+    return;
+  }
+
+  // Bars on a 40 dB scale relative to the strongest bin
+  float maxPower = 0.0f;
+  for (int k = 0; k < RippleSpectrumSnapshot::numBins; k++)
+    maxPower = std::max(maxPower, snapshot.power[k]);
+
+  const int labelHeight = 12;
+  const float plotHeight = getHeight() - labelHeight;
+  const float barWidth = (float)getWidth() / RippleSpectrumSnapshot::numBins;
+
+  for (int k = 0; k < RippleSpectrumSnapshot::numBins; k++) {
+    float level = 0.0f;
+    if (maxPower > 0.0f && snapshot.power[k] > 0.0f)
+      level = 1.0f + 10.0f * log10(snapshot.power[k] / maxPower) / 40.0f;
+    level = jlimit(0.0f, 1.0f, level);
+
+    const bool rippleBin =
+        snapshot.frequency[k] >= RippleFilterBank::rippleLow &&
+        snapshot.frequency[k] <= RippleFilterBank::rippleHigh;
+    g.setColour(rippleBin ? Colours::orange : Colours::lightgrey);
+    g.fillRect(k * barWidth + 1.0f, labelHeight + plotHeight * (1.0f - level),
+               barWidth - 2.0f, plotHeight * level);
+  }
+
+  g.setColour(Colours::white);
+  g.setFont(Font("CP Mono", "Plain", 10));
+  g.drawText("R/N " + String(snapshot.rippleRatio, 2), 0, 0, getWidth(),
+             labelHeight, Justification::centredLeft);
+}
+
+void RippleEventAverageDisplay::setSnapshot(
+    const RippleEventAverageSnapshot &newSnapshot) {
+  snapshot = newSnapshot;
+  repaint();
+}
+
+void RippleEventAverageDisplay::paint(Graphics &g) {
+  g.fillAll(Colour(30, 30, 30));
+  g.setFont(Font("CP Mono", "Plain", 10));
+
+  if (!snapshot.valid) {
+    g.setColour(Colours::grey);
+    g.drawText("NO AVERAGE", 0, 0, getWidth(), getHeight(),
+               Justification::centred);
+    return;
+  }
+
+  const int labelHeight = 12;
+  const float plotHeight = getHeight() - labelHeight;
+  const float panelWidth = getWidth() / 2 - 2.0f;
+
+  // Average ripple input, scaled to its own range, with the detection marked
+  const float *average = snapshot.average.data();
+  const int numSamples = snapshot.windowSamples;
+  float low = average[0], high = average[0];
+  for (int t = 1; t < numSamples; t++) {
+    low = std::min(low, average[t]);
+    high = std::max(high, average[t]);
+  }
+  const float range = high > low ? high - low : 1.0f;
+
+  g.setColour(Colours::darkgrey);
+  const float detectionX = panelWidth * snapshot.preSamples / numSamples;
+  g.drawVerticalLine((int)detectionX, (float)labelHeight, (float)getHeight());
+
+  Path trace;
+  const int step = std::max(1, numSamples / (int)panelWidth);
+  for (int t = 0; t < numSamples; t += step) {
+    const float x = panelWidth * t / numSamples;
+    const float y = labelHeight + plotHeight * (high - average[t]) / range;
+    if (t == 0)
+      trace.startNewSubPath(x, y);
+    else
+      trace.lineTo(x, y);
+  }
+  g.setColour(Colours::orange);
+  g.strokePath(trace, PathStrokeType(1.0f));
+
+  // Spectrogram in dB from each frequency's mean over the window, so the
+  // ripple band lights up around the detection whatever the 1/f slope
+  const int numBins = RippleEventAverageSnapshot::numTimeBins;
+  const int numFrequencies = RippleEventAverageSnapshot::numFrequencies;
+  const float left = getWidth() - panelWidth;
+  const float cellWidth = panelWidth / numBins;
+  const float cellHeight = plotHeight / numFrequencies;
+  for (int k = 0; k < numFrequencies; k++) {
+    float mean = 0.0f;
+    for (int b = 0; b < numBins; b++)
+      mean += snapshot.power[b][k];
+    mean /= numBins;
+    for (int b = 0; b < numBins; b++) {
+      float level = 0.5f;
+      if (mean > 0.0f && snapshot.power[b][k] > 0.0f)
+        level += 10.0f * log10(snapshot.power[b][k] / mean) / 12.0f;
+      level = jlimit(0.0f, 1.0f, level);
+      g.setColour(Colours::darkblue.interpolatedWith(Colours::yellow, level));
+      g.fillRect(left + b * cellWidth,
+                 getHeight() - (k + 1) * cellHeight, cellWidth + 0.5f,
+                 cellHeight + 0.5f);
+    }
+  }
+
+  g.setColour(Colours::white);
+  g.drawText("N " + String((int64)snapshot.numEvents), 0, 0, (int)panelWidth,
+             labelHeight, Justification::centredLeft);
+  g.drawText(String((int)snapshot.frequency[0]) + "-" +
+                 String((int)snapshot.frequency[numFrequencies - 1]) + " Hz",
+             (int)left, 0, (int)panelWidth, labelHeight,
+             Justification::centredLeft);
+}
+
+void RippleShadowDisplay::setSample(const RippleShadowSample &newSample) {
+  sample = newSample;
+  repaint();
+}
+
+void RippleShadowDisplay::paint(Graphics &g) {
+  g.fillAll(Colour(30, 30, 30));
+  g.setFont(Font("CP Mono", "Plain", 10));
+
+  if (sample.numShadows == 0) {
+    g.setColour(Colours::grey);
+    g.drawText("NO SHADOW SETS", 0, 0, getWidth(), getHeight(),
+               Justification::centred);
+    return;
+  }
+
+  const int lineHeight = 13;
+  g.setColour(Colours::white);
+  g.drawText("LIVE " + String((int64)sample.liveDetections), 4, 2,
+             getWidth() - 8, lineHeight, Justification::centredLeft);
+
+  // Detections of each set, with those the live set also made in brackets,
+  // then the crossings the movement detector blocked
+  for (int idx = 0; idx < sample.numShadows; idx++) {
+    g.setColour(Colours::lightgrey);
+    g.drawText(String(sample.rippleSds[idx], 1) + "/" +
+                   String(sample.timeThreshold[idx], 0) + " " +
+                   String((int64)sample.detections[idx]) + " (" +
+                   String((int64)sample.shared[idx]) + ") B" +
+                   String((int64)sample.blocked[idx]),
+               4, 2 + (idx + 1) * lineHeight, getWidth() - 8, lineHeight,
+               Justification::centredLeft);
+  }
+}
+
+void RippleHealthDisplay::setStatus(const RippleHealthStatus &newStatus) {
+  status = newStatus;
+  repaint();
+}
+
+void RippleHealthDisplay::paint(Graphics &g) {
+  g.fillAll(Colour(30, 30, 30));
+  g.setFont(Font("CP Mono", "Plain", 10));
+
+  if (!status.valid) {
+    g.setColour(Colours::grey);
+    g.drawText(status.calibrating ? "CALIBRATING" : "NO HEALTH DATA", 0, 0,
+               getWidth(), getHeight(), Justification::centred);
+    return;
+  }
+
+  struct Line {
+    String text;
+    bool alarm;
+  };
+  // Indexed by BrainState
+  const char *stateNames[] = {"", "QUIET", "NREM", "THETA"};
+  const Line lines[] = {
+      {"DET/MIN " + String(status.detectionsPerMinute, 1), false},
+      {"REJ/MIN " + String(status.rejectedPerMinute, 1), false},
+      {"BLOCKED " + String(100.0 * status.blockedFraction, 1) + "%",
+       (status.alarms & RippleHealthStatus::STUCK_VETO) != 0},
+      {"REFRACT " + String(100.0 * status.refractoryFraction, 1) + "%", false},
+      {"CLIP " + String(100.0 * status.clippedFraction, 2) + "%",
+       (status.alarms & RippleHealthStatus::CLIPPING) != 0},
+      {"FLAT " + String(100.0 * status.flatFraction, 1) + "%",
+       (status.alarms & RippleHealthStatus::FLAT_LINE) != 0},
+      {"DRIFT " + String(status.drift, 1) + " SD",
+       (status.alarms & RippleHealthStatus::DRIFT) != 0},
+      {"GATED " + String(100.0 * status.gatedFraction, 1) + "% " +
+           stateNames[status.brainState],
+       false}};
+
+  const int lineHeight = 12;
+  int y = 2;
+  for (const Line &line : lines) {
+    g.setColour(line.alarm ? Colours::red : Colours::white);
+    g.drawText(line.text, 4, y, getWidth() - 8, lineHeight,
+               Justification::centredLeft);
+    y += lineHeight;
+  }
+
+  if (status.alarms != 0) {
+    g.setColour(Colours::red);
+    g.drawRect(getLocalBounds(), 2);
+  }
+}
@@ -34,7 +34,108 @@ private:
   int finalWidth;
 };
 
-class RippleDetectorEditor : public GenericEditor, public Button::Listener {
+class RippleSpectrumDisplay : public Component {
+public:
+  /** Constructor */
+  RippleSpectrumDisplay() {}
+
+  /** Destructor */
+  virtual ~RippleSpectrumDisplay() {}
+
+  /** Shows a new spectrum */
+  void setSnapshot(const RippleSpectrumSnapshot &newSnapshot);
+
+  /** Draws the bins, highlighting the ripple band */
+  void paint(Graphics &g) override;
+
+private:
+  RippleSpectrumSnapshot snapshot;
+};
+
+class RippleEventAverageDisplay : public Component {
+public:
+  /** Constructor */
+  RippleEventAverageDisplay() {}
+
+  /** Destructor */
+  virtual ~RippleEventAverageDisplay() {}
+
+  /** Shows new averages */
+  void setSnapshot(const RippleEventAverageSnapshot &newSnapshot);
+
+  /** Draws the average ripple input and its spectrogram side by side */
+  void paint(Graphics &g) override;
+
+private:
+  RippleEventAverageSnapshot snapshot;
+};
+
+class RippleHealthDisplay : public Component {
+public:
+  /** Constructor */
+  RippleHealthDisplay() {}
+
+  /** Destructor */
+  virtual ~RippleHealthDisplay() {}
+
+  /** Shows new rates and alarms */
+  void setStatus(const RippleHealthStatus &newStatus);
+
+  /** Draws one line per metric, alarmed ones in red */
+  void paint(Graphics &g) override;
+
+private:
+  RippleHealthStatus status;
+};
+
+class RippleShadowDisplay : public Component {
+public:
+  /** Constructor */
+  RippleShadowDisplay() {}
+
+  /** Destructor */
+  virtual ~RippleShadowDisplay() {}
+
+  /** Shows new counts */
+  void setSample(const RippleShadowSample &newSample);
+
+  /** Draws the live count and one line per shadow set */
+  void paint(Graphics &g) override;
+
+private:
+  RippleShadowSample sample;
+};
+
+class RippleMonitorPanel : public Component, public Button::Listener {
+public:
+  /** Constructor */
+  RippleMonitorPanel(RippleDetector *rippleDetector);
+
+  /** Destructor */
+  virtual ~RippleMonitorPanel() {}
+
+  /** Pulls the latest spectrum, averages and shadow counters of a stream
+   * from the processor, and shows its health status */
+  void refresh(uint16 streamId, const RippleHealthStatus &health);
+
+  /** Exports the averages of the stream last shown */
+  void buttonClicked(Button *button) override;
+
+private:
+  RippleDetector *rippleDetector;
+  uint16 streamId{0};
+
+  std::unique_ptr<RippleSpectrumDisplay> spectrumDisplay;
+  std::unique_ptr<RippleHealthDisplay> healthDisplay;
+  std::unique_ptr<RippleShadowDisplay> shadowDisplay;
+  std::unique_ptr<RippleEventAverageDisplay> eventAverageDisplay;
+  std::unique_ptr<UtilityButton> exportAverageButton;
+};
+
+class RippleDetectorEditor : public GenericEditor,
+                             public Button::Listener,
+                             public ComboBox::Listener,
+                             public Timer {
 public:
   RippleDetectorEditor(GenericProcessor *parentNode);
   virtual ~RippleDetectorEditor() {}
@@ -42,10 +143,44 @@ public:
   void buttonClicked(Button *);
   void updateSettings() override;
 
+  /** Shows the settings page picked in the page selector */
+  void comboBoxChanged(ComboBox *comboBox) override;
+
+  /** Hides the other settings pages again once the editor is expanded */
+  void collapsedStateChanged() override;
+
+  /** Starts / stops polling the processor for live data */
+  void startAcquisition() override;
+  void stopAcquisition() override;
+
+  /** Tracks the health of the current stream and refreshes the monitor, if
+   * it is open */
+  void timerCallback() override;
+
 private:
+  enum SettingsPage { DETECTION_PAGE, VETO_PAGE, OUTPUT_PAGE, TUNING_PAGE };
+  static constexpr int numPages = 4;
+
+  /** Puts the parameter editors added since the first on a page */
+  void addToPage(SettingsPage page, int first);
+
+  /** Makes the parameter editors of the current page visible */
+  void showPage();
+
   RippleDetector *rippleDetector;
 
   std::unique_ptr<UtilityButton> calibrateButton;
+  std::unique_ptr<UtilityButton> monitorButton;
+  std::unique_ptr<ComboBox> pageSelector;
+  std::vector<Component *> pages[numPages];
+  SettingsPage currentPage{DETECTION_PAGE};
+
+  // The monitor is owned by its call-out box, and closes with it
+  Component::SafePointer<RippleMonitorPanel> monitorPanel;
+
+  RippleHealthMonitor healthMonitor;
+  RippleHealthStatus healthStatus;
+  uint16 healthStreamId{0};
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RippleDetectorEditor);
 };
@@ -0,0 +1,193 @@
+#include "RippleEpisode.h"
+#include <cctype>
+#include <chrono>
+#include <cmath>
+
+static const char fileMagic[8] = {'R', 'P', 'L', 'E', 'P', 'I', '0', '1'};
+static constexpr uint32_t fileVersion = 1;
+
+// How long the writer thread sleeps between checks of the pool
+static constexpr int writerSleepMilliseconds = 20;
+
+void RippleEpisodeTracker::configure(uint16_t newStreamId,
+                                     double newSampleRate) {
+  streamId = newStreamId;
+  if (newSampleRate == sampleRate)
+    return;
+  sampleRate = newSampleRate;
+  maxSamples = (int64_t)std::lround(sampleRate * maxSeconds);
+  reset();
+}
+
+void RippleEpisodeTracker::reset() {
+  open = false;
+  saturated = false;
+  nextSample = -1;
+}
+
+bool RippleEpisodeTracker::addWindow(double rms, double offsetThreshold,
+                                     double rmsMean, double rmsStdDev,
+                                     int64_t firstSample, int samples,
+                                     bool windowDetected, bool propagated,
+                                     RippleEpisode &episode) {
+  // An episode cannot span a gap in the sample numbers
+  if (firstSample != nextSample)
+    reset();
+  nextSample = firstSample + samples;
+
+  // The CNN detector can fire on a window whose RMS is below the offset
+  // threshold, which then belongs to the ripple all the same
+  if (rms <= offsetThreshold && !windowDetected) {
+    saturated = false;
+    if (!open)
+      return false;
+    open = false;
+    if (!detected)
+      return false;
+    close(firstSample, flags, episode);
+    return true;
+  }
+
+  if (saturated)
+    return false;
+
+  if (!open) {
+    open = true;
+    detected = false;
+    flags = 0;
+    onsetSample = firstSample;
+    peakRms = -1.0;
+  }
+  if (rms > peakRms) {
+    peakRms = rms;
+    peakSample = firstSample + samples / 2;
+    peakSds = rmsStdDev > 0 ? (rms - rmsMean) / rmsStdDev : 0.0;
+  }
+  if (windowDetected && !detected) {
+    detected = true;
+    detectionSample = firstSample + samples - 1;
+    if (propagated)
+      flags |= EPISODE_PROPAGATED;
+  }
+
+  // Noise that never falls back is cut short, and ignored until it does
+  if (nextSample - onsetSample < maxSamples)
+    return false;
+  open = false;
+  saturated = true;
+  if (!detected)
+    return false;
+  close(nextSample, flags | EPISODE_TRUNCATED, episode);
+  return true;
+}
+
+void RippleEpisodeTracker::close(int64_t endSample, uint8_t episodeFlags,
+                                 RippleEpisode &episode) {
+  episode.onsetSample = onsetSample;
+  episode.detectionSample = detectionSample;
+  episode.peakSample = peakSample;
+  episode.offsetSample = endSample;
+  episode.peakRms = (float)peakRms;
+  episode.peakSds = (float)peakSds;
+  episode.durationMs =
+      sampleRate > 0 ? (float)(1000.0 * (endSample - onsetSample) / sampleRate)
+                     : 0.0f;
+  episode.streamId = streamId;
+  episode.flags = episodeFlags;
+  episode.reserved = 0;
+}
+
+bool RippleEpisodeWriter::open(const std::string &path, std::string &error,
+                               int capacity) {
+  close();
+
+  const size_t dot = path.find_last_of('.');
+  std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+  for (char &c : extension)
+    c = (char)tolower((unsigned char)c);
+  text = extension == ".csv" || extension == ".txt";
+
+  file = fopen(path.c_str(), text ? "w" : "wb");
+  if (!file) {
+    error = "Cannot create " + path;
+    return false;
+  }
+  if (text) {
+    fputs("stream,onset_sample,detection_sample,peak_sample,offset_sample,"
+          "duration_ms,peak_rms,peak_sd,propagated,truncated\n",
+          file);
+  } else {
+    const uint32_t version = fileVersion;
+    fwrite(fileMagic, 1, sizeof(fileMagic), file);
+    fwrite(&version, sizeof(version), 1, file);
+  }
+
+  // Power-of-two capacity, so positions wrap with a mask
+  size_t size = 1;
+  while (size < (size_t)capacity)
+    size <<= 1;
+  pool.assign(size, RippleEpisode());
+  mask = size - 1;
+  head = 0;
+  tail = 0;
+  droppedEpisodes = 0;
+
+  running.store(true, std::memory_order_release);
+  thread = std::thread(&RippleEpisodeWriter::run, this);
+  return true;
+}
+
+void RippleEpisodeWriter::close() {
+  if (!running.exchange(false))
+    return;
+  thread.join();
+  drain();
+  fclose(file);
+  file = nullptr;
+  pool.clear();
+  pool.shrink_to_fit();
+}
+
+void RippleEpisodeWriter::write(const RippleEpisode &episode) {
+  const uint64_t queued = head.load(std::memory_order_relaxed);
+  if (queued - tail.load(std::memory_order_acquire) >= pool.size()) {
+    droppedEpisodes.store(droppedEpisodes.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+    return;
+  }
+  pool[queued & mask] = episode;
+  head.store(queued + 1, std::memory_order_release);
+}
+
+void RippleEpisodeWriter::run() {
+  while (running.load(std::memory_order_acquire)) {
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(writerSleepMilliseconds));
+    drain();
+  }
+}
+
+void RippleEpisodeWriter::drain() {
+  const uint64_t end = head.load(std::memory_order_acquire);
+  const uint64_t start = tail.load(std::memory_order_relaxed);
+  uint64_t position = start;
+  for (; position < end; position++) {
+    const RippleEpisode &episode = pool[position & mask];
+    if (!text) {
+      fwrite(&episode, sizeof(episode), 1, file);
+      continue;
+    }
+    fprintf(file, "%u,%lld,%lld,%lld,%lld,%.3f,%.6g,%.3f,%d,%d\n",
+            (unsigned)episode.streamId, (long long)episode.onsetSample,
+            (long long)episode.detectionSample, (long long)episode.peakSample,
+            (long long)episode.offsetSample, episode.durationMs,
+            episode.peakRms, episode.peakSds,
+            (episode.flags & EPISODE_PROPAGATED) != 0,
+            (episode.flags & EPISODE_TRUNCATED) != 0);
+  }
+  tail.store(position, std::memory_order_release);
+
+  // Episodes are few, so recorders reading the file see them right away
+  if (position != start)
+    fflush(file);
+}
@@ -0,0 +1,139 @@
+#ifndef __RIPPLE_EPISODE_H
+#define __RIPPLE_EPISODE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum RippleEpisodeFlags : uint8_t {
+  EPISODE_PROPAGATED = 1, // The detection reached the ripple output line
+  EPISODE_TRUNCATED = 2   // Closed at the maximum duration, not at its end
+};
+
+/**
+  Life cycle of one detected ripple.
+
+  Episode events carry one of these records as they are laid out here, all
+  little-endian. Episode files written in binary start with the magic
+  "RPLEPI01" and a uint32 version, followed by the same records.
+**/
+struct RippleEpisode {
+  int64_t onsetSample{0};     // First sample of the first window above the
+                              // offset threshold
+  int64_t detectionSample{0}; // Sample at which the detection was made
+  int64_t peakSample{0};      // Centre of the window of highest RMS
+  int64_t offsetSample{0};    // First sample after the ripple
+  float peakRms{0.0f};        // RMS of that window (input units)
+  float peakSds{0.0f};        // The same, in standard deviations above the
+                              // baseline
+  float durationMs{0.0f};
+  uint16_t streamId{0};
+  uint8_t flags{0}; // RippleEpisodeFlags
+  uint8_t reserved{0};
+};
+
+static_assert(sizeof(RippleEpisode) == 48, "Episode records are 48 bytes");
+
+/**
+  Follows the RMS windows of a stream with two thresholds. An episode opens
+  on the first window above the offset threshold and closes on the first
+  window back below it, so it spans the whole ripple around the detection,
+  which needs the higher detection threshold. Only episodes with a detection
+  are reported. Audio thread only, and never allocates.
+**/
+class RippleEpisodeTracker {
+public:
+  static constexpr double maxSeconds = 1.0; // Longest episode reported
+
+  /** Sets the stream and its sample rate. Clears an open episode if the
+   * rate changed */
+  void configure(uint16_t streamId, double sampleRate);
+
+  /** Drops the open episode */
+  void reset();
+
+  /** Whether an episode with a detection is still open, so the next
+   * windows are needed to find its end */
+  bool isFollowing() const { return open && detected; }
+
+  /** Adds the next RMS window. offsetThreshold is the lower threshold,
+   * rmsMean and rmsStdDev the baseline. windowDetected is set on the window
+   * the detector fired on, and propagated if that detection reached the
+   * output line. Returns true when a reported episode ended, and fills
+   * episode with it */
+  bool addWindow(double rms, double offsetThreshold, double rmsMean,
+                 double rmsStdDev, int64_t firstSample, int samples,
+                 bool windowDetected, bool propagated,
+                 RippleEpisode &episode);
+
+private:
+  /** Fills episode from the open one, ending before endSample */
+  void close(int64_t endSample, uint8_t flags, RippleEpisode &episode);
+
+  uint16_t streamId{0};
+  double sampleRate{0.0};
+  int64_t maxSamples{0};
+
+  bool open{false};
+  bool saturated{false}; // Truncated, waiting for the RMS to fall back
+  bool detected{false};
+  uint8_t flags{0};
+  int64_t nextSample{-1}; // Expected first sample of the next window
+  int64_t onsetSample{0};
+  int64_t detectionSample{0};
+  int64_t peakSample{0};
+  double peakRms{0.0};
+  double peakSds{0.0};
+};
+
+/**
+  Writes episodes to a file without blocking the audio thread.
+
+  Episodes are copied into a preallocated single-producer / single-consumer
+  pool and a background thread writes them out, as binary records or, for
+  paths ending in .csv or .txt, as one line of text each. When the pool is
+  full, episodes are dropped rather than waited for.
+**/
+class RippleEpisodeWriter {
+public:
+  static constexpr int defaultCapacity = 4096;
+
+  ~RippleEpisodeWriter() { close(); }
+
+  /** Creates the file and starts the writer thread */
+  bool open(const std::string &path, std::string &error,
+            int capacity = defaultCapacity);
+
+  /** Writes out the queued episodes and closes the file */
+  void close();
+
+  bool isOpen() const { return running.load(std::memory_order_acquire); }
+
+  /** Episodes lost so far */
+  uint64_t getDroppedEpisodes() const {
+    return droppedEpisodes.load(std::memory_order_relaxed);
+  }
+
+  /** Queues an episode. Audio thread */
+  void write(const RippleEpisode &episode);
+
+private:
+  void run();
+  void drain();
+
+  std::vector<RippleEpisode> pool;
+  uint64_t mask{0};
+  std::atomic<uint64_t> head{0}; // Episodes queued by the producer
+  std::atomic<uint64_t> tail{0}; // Episodes written out
+  std::atomic<uint64_t> droppedEpisodes{0};
+
+  bool text{false};
+  FILE *file{nullptr};
+  std::thread thread;
+  std::atomic<bool> running{false};
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "RippleEventAverage.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+bool RippleEventAverageSnapshot::writeCsv(
+    const std::string &path, const std::vector<std::string> &channelNames,
+    std::string &error) const {
+
+  std::ofstream out(path);
+  if (!out) {
+    error = "Cannot write " + path;
+    return false;
+  }
+  out << "# " << numEvents << " detections\n";
+  out << "time_ms";
+  for (int ch = 0; ch < numChannels; ch++)
+    out << ","
+        << (ch < (int)channelNames.size() ? channelNames[ch]
+                                          : std::to_string(channels[ch]));
+  out << "\n";
+  for (int t = 0; t < windowSamples; t++) {
+    out << 1000.0 * (t - preSamples) / sampleRate;
+    for (int ch = 0; ch < numChannels; ch++)
+      out << "," << average[(size_t)ch * windowSamples + t];
+    out << "\n";
+  }
+  if (!out) {
+    error = "Cannot write " + path;
+    return false;
+  }
+
+  // Same name with the suffix before the extension, if there is one
+  std::string spectrogramPath = path;
+  const size_t dot = path.find_last_of('.');
+  const size_t slash = path.find_last_of("/\\");
+  if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+    spectrogramPath.insert(dot, "_spectrogram");
+  else
+    spectrogramPath += "_spectrogram";
+
+  std::ofstream spectrogram(spectrogramPath);
+  if (!spectrogram) {
+    error = "Cannot write " + spectrogramPath;
+    return false;
+  }
+  spectrogram << "# " << numEvents << " detections\n";
+  spectrogram << "time_ms";
+  for (int k = 0; k < numFrequencies; k++)
+    spectrogram << "," << frequency[k] << "Hz";
+  spectrogram << "\n";
+  for (int b = 0; b < numTimeBins; b++) {
+    spectrogram << 1000.0 * binTime[b];
+    for (int k = 0; k < numFrequencies; k++)
+      spectrogram << "," << power[b][k];
+    spectrogram << "\n";
+  }
+  if (!spectrogram) {
+    error = "Cannot write " + spectrogramPath;
+    return false;
+  }
+  return true;
+}
+
+void RippleEventAverage::prepare(double newSampleRate) {
+  sampleRate = newSampleRate;
+  preSamples = std::max(1, (int)std::lround(sampleRate * preSeconds));
+  windowSamples =
+      preSamples + std::max(1, (int)std::lround(sampleRate * postSeconds));
+  segmentSamples = std::max(
+      1, std::min(windowSamples,
+                  (int)std::lround(sampleRate * segmentSeconds)));
+  hopSamples = (double)(windowSamples - segmentSamples) / (numTimeBins - 1);
+
+  // Room for one window plus a block chunk of at least the same length
+  capacity = 1;
+  while (capacity < 2 * windowSamples)
+    capacity *= 2;
+  ring.assign((size_t)maxChannels * capacity, 0.0f);
+
+  sums.assign((size_t)maxChannels * windowSamples, 0.0);
+  segment.assign(windowSamples, 0.0);
+  prefixReal.assign(windowSamples + 1, 0.0);
+  prefixImag.assign(windowSamples + 1, 0.0);
+  numChannels = 0;
+  reset();
+}
+
+void RippleEventAverage::prepareSnapshot(
+    RippleEventAverageSnapshot &snapshot) const {
+  snapshot.average.assign((size_t)maxChannels * windowSamples, 0.0f);
+}
+
+void RippleEventAverage::reset() {
+  std::fill(sums.begin(), sums.end(), 0.0);
+  for (int b = 0; b < numTimeBins; b++)
+    for (int k = 0; k < numFrequencies; k++)
+      powerSums[b][k] = 0.0;
+  numEvents = 0;
+  ringFill = 0;
+  numPending = 0;
+}
+
+bool RippleEventAverage::setChannels(const int *newChannels,
+                                     int newNumChannels) {
+  newNumChannels = std::min(newNumChannels, maxChannels);
+  if (newNumChannels == numChannels &&
+      std::equal(newChannels, newChannels + newNumChannels, channels))
+    return false;
+
+  std::copy(newChannels, newChannels + newNumChannels, channels);
+  numChannels = newNumChannels;
+  reset();
+  return true;
+}
+
+void RippleEventAverage::addDetection(int64_t sampleNumber) {
+  if (numPending < maxPending)
+    pending[numPending++] = sampleNumber;
+}
+
+bool RippleEventAverage::process(const float *const *data,
+                                 int64_t firstSampleNumber, int numSamples) {
+  if (ring.empty() || numChannels == 0)
+    return false;
+
+  // Windows cannot span a gap in the sample numbers
+  if (ringFill > 0 && firstSampleNumber != ringEnd) {
+    ringFill = 0;
+    numPending = 0;
+  }
+  ringEnd = firstSampleNumber;
+
+  const int mask = capacity - 1;
+  const int maxChunk = capacity - windowSamples;
+  bool changed = false;
+
+  for (int offset = 0; offset < numSamples; offset += maxChunk) {
+    const int count = std::min(maxChunk, numSamples - offset);
+    for (int ch = 0; ch < numChannels; ch++) {
+      float *dst = ring.data() + (size_t)ch * capacity;
+      const float *src = data[ch] + offset;
+      for (int t = 0; t < count; t++)
+        dst[(ringEnd + t) & mask] = src[t];
+    }
+    ringEnd += count;
+    ringFill = std::min(capacity, ringFill + count);
+
+    // Average the detections whose window has fully arrived, checking after
+    // each chunk so their first samples are still in the ring
+    int kept = 0;
+    for (int idx = 0; idx < numPending; idx++) {
+      const int64_t first = pending[idx] - preSamples;
+      if (first + windowSamples > ringEnd) {
+        pending[kept++] = pending[idx];
+      } else if (first >= ringEnd - ringFill) {
+        addWindow(first);
+        changed = true;
+      }
+    }
+    numPending = kept;
+  }
+  return changed;
+}
+
+void RippleEventAverage::addWindow(int64_t firstSample) {
+  const int mask = capacity - 1;
+  const int start = (int)(firstSample & mask);
+
+  for (int ch = 0; ch < numChannels; ch++) {
+    const float *src = ring.data() + (size_t)ch * capacity;
+    double *dst = sums.data() + (size_t)ch * windowSamples;
+    for (int t = 0; t < windowSamples; t++)
+      dst[t] += src[(start + t) & mask];
+  }
+
+  // Spectrogram of the ripple input, without its offset so the DC term
+  // cannot leak into the lowest bins
+  const float *src = ring.data();
+  double mean = 0.0;
+  for (int t = 0; t < windowSamples; t++) {
+    segment[t] = src[(start + t) & mask];
+    mean += segment[t];
+  }
+  mean /= windowSamples;
+  for (int t = 0; t < windowSamples; t++)
+    segment[t] -= mean;
+
+  for (int k = 0; k < numFrequencies; k++) {
+    const double w = 2.0 * M_PI * (firstFrequency + k * frequencyStep) /
+                     sampleRate;
+    const double stepReal = std::cos(w), stepImag = -std::sin(w);
+    double phaseReal = 1.0, phaseImag = 0.0;
+    double real = 0.0, imag = 0.0;
+    for (int t = 0; t < windowSamples; t++) {
+      real += segment[t] * phaseReal;
+      imag += segment[t] * phaseImag;
+      prefixReal[t + 1] = real;
+      prefixImag[t + 1] = imag;
+      const double next = phaseReal * stepReal - phaseImag * stepImag;
+      phaseImag = phaseReal * stepImag + phaseImag * stepReal;
+      phaseReal = next;
+    }
+
+    // Twice the squared mean of the demodulated segment is the mean square
+    // of a sinusoid at this frequency
+    for (int b = 0; b < numTimeBins; b++) {
+      const int first = std::min(windowSamples - segmentSamples,
+                                 (int)std::lround(b * hopSamples));
+      const int last = first + segmentSamples;
+      const double segmentReal =
+          (prefixReal[last] - prefixReal[first]) / segmentSamples;
+      const double segmentImag =
+          (prefixImag[last] - prefixImag[first]) / segmentSamples;
+      powerSums[b][k] +=
+          2.0 * (segmentReal * segmentReal + segmentImag * segmentImag);
+    }
+  }
+
+  numEvents++;
+}
+
+void RippleEventAverage::fillSnapshot(
+    RippleEventAverageSnapshot &snapshot) const {
+  snapshot.valid = numEvents > 0;
+  snapshot.sampleRate = sampleRate;
+  snapshot.preSamples = preSamples;
+  snapshot.windowSamples = windowSamples;
+  snapshot.numChannels = numChannels;
+  std::copy(channels, channels + numChannels, snapshot.channels);
+  snapshot.numEvents = numEvents;
+
+  const double scale = numEvents > 0 ? 1.0 / numEvents : 0.0;
+  const size_t count = std::min(snapshot.average.size(),
+                                (size_t)numChannels * windowSamples);
+  for (size_t idx = 0; idx < count; idx++)
+    snapshot.average[idx] = (float)(sums[idx] * scale);
+
+  for (int k = 0; k < numFrequencies; k++)
+    snapshot.frequency[k] = (float)(firstFrequency + k * frequencyStep);
+  for (int b = 0; b < numTimeBins; b++) {
+    const int first = std::min(windowSamples - segmentSamples,
+                               (int)std::lround(b * hopSamples));
+    snapshot.binTime[b] =
+        (float)((first + 0.5 * segmentSamples - preSamples) / sampleRate);
+    for (int k = 0; k < numFrequencies; k++)
+      snapshot.power[b][k] = (float)(powerSums[b][k] * scale);
+  }
+}
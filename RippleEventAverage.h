@@ -0,0 +1,115 @@
+#ifndef __RIPPLE_EVENT_AVERAGE_H
+#define __RIPPLE_EVENT_AVERAGE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** Ripple-triggered averages of a stream, as published to the editor */
+struct RippleEventAverageSnapshot {
+  static constexpr int maxChannels = 9; // Ripple input and 8 references
+  static constexpr int numFrequencies = 21;
+  static constexpr int numTimeBins = 37;
+
+  bool valid{false}; // At least one detection has been averaged
+  double sampleRate{0.0};
+  int preSamples{0};    // Samples before the detection in each window
+  int windowSamples{0}; // Samples in each window
+  int numChannels{0};
+  int channels[maxChannels]{}; // Global channel indices, ripple input first
+  uint64_t numEvents{0};
+
+  std::vector<float> average; // [channel][sample], sized by prepareSnapshot()
+
+  float frequency[numFrequencies]{}; // Spectrogram bin frequencies (Hz)
+  float binTime[numTimeBins]{};      // Bin centres from the detection (s)
+  float power[numTimeBins][numFrequencies]{}; // Mean power of the ripple
+                                              // input (input units squared)
+
+  /** Writes the averages to path and the spectrogram next to it, with
+   * "_spectrogram" before the extension. Returns false on I/O errors */
+  bool writeCsv(const std::string &path,
+                const std::vector<std::string> &channelNames,
+                std::string &error) const;
+};
+
+/**
+  Running ripple-triggered average LFP and spectrogram.
+
+  The input channels are kept in a ring long enough to hold one peri-event
+  window. Each detection is queued until the samples after it have arrived,
+  then its window is added to per-channel running sums, so every event costs
+  O(window) work no matter how many came before. The ripple input of the
+  window is also demodulated at each spectrogram frequency, and prefix sums
+  of the result give the power of every overlapping segment in one pass.
+**/
+class RippleEventAverage {
+public:
+  static constexpr int maxChannels = RippleEventAverageSnapshot::maxChannels;
+  static constexpr int numFrequencies =
+      RippleEventAverageSnapshot::numFrequencies;
+  static constexpr int numTimeBins = RippleEventAverageSnapshot::numTimeBins;
+  static constexpr double preSeconds = 0.1;  // Window before the detection
+  static constexpr double postSeconds = 0.1; // Window after the detection
+  static constexpr double segmentSeconds = 0.02; // Spectrogram segment
+  static constexpr double firstFrequency = 100.0;
+  static constexpr double frequencyStep = 20.0;
+  static constexpr int maxPending = 16; // Detections awaiting their window
+
+  /** Allocates the ring and the sums for the given sample rate. Message
+   * thread, with the audio thread stopped */
+  void prepare(double sampleRate);
+
+  /** Sizes a snapshot so fillSnapshot() never allocates */
+  void prepareSnapshot(RippleEventAverageSnapshot &snapshot) const;
+
+  /** Clears the averages, the history and the queued detections */
+  void reset();
+
+  /** Selects the averaged channels (global indices, ripple input first).
+   * A different selection starts the averages over; returns true if so */
+  bool setChannels(const int *channels, int numChannels);
+
+  /** Queues a detection at the given sample number, already passed to
+   * process() */
+  void addDetection(int64_t sampleNumber);
+
+  /** Adds a block of the selected channels to the history and averages the
+   * detections whose window is complete. Returns true when the averages
+   * changed */
+  bool process(const float *const *data, int64_t firstSampleNumber,
+               int numSamples);
+
+  /** Copies the averages into a snapshot */
+  void fillSnapshot(RippleEventAverageSnapshot &snapshot) const;
+
+private:
+  void addWindow(int64_t firstSample);
+
+  double sampleRate{0.0};
+  int preSamples{0};
+  int windowSamples{0};
+  int segmentSamples{1};
+  double hopSamples{1.0}; // Between spectrogram segments
+
+  int numChannels{0};
+  int channels[maxChannels]{};
+
+  // History of the selected channels
+  std::vector<float> ring; // [channel][capacity]
+  int capacity{0};         // Power of two
+  int64_t ringEnd{0};      // Sample number after the newest one
+  int ringFill{0};         // Valid samples, up to capacity
+
+  int64_t pending[maxPending];
+  int numPending{0};
+
+  std::vector<double> sums;        // [channel][sample]
+  std::vector<double> segment;     // Ripple input of the current window
+  std::vector<double> prefixReal;  // Prefix sums of the demodulated segment
+  std::vector<double> prefixImag;
+  double powerSums[numTimeBins][numFrequencies];
+  uint64_t numEvents{0};
+};
+
+#endif
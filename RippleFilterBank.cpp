@@ -0,0 +1,106 @@
+#include "RippleFilterBank.h"
+#include <algorithm>
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Quality factors of the two sections of a fourth-order Butterworth filter
+static constexpr double butterworth4Q[2] = {0.54119610014619698,
+                                            1.30656296487637653};
+
+Biquad Biquad::lowPass(double sampleRate, double cutoff, double q) {
+  const double w0 = 2.0 * M_PI * cutoff / sampleRate;
+  const double alpha = sin(w0) / (2.0 * q);
+  const double cosW0 = cos(w0);
+  const double a0 = 1.0 + alpha;
+
+  Biquad f;
+  f.b0 = (1.0 - cosW0) / 2.0 / a0;
+  f.b1 = (1.0 - cosW0) / a0;
+  f.b2 = f.b0;
+  f.a1 = -2.0 * cosW0 / a0;
+  f.a2 = (1.0 - alpha) / a0;
+  return f;
+}
+
+Biquad Biquad::highPass(double sampleRate, double cutoff, double q) {
+  const double w0 = 2.0 * M_PI * cutoff / sampleRate;
+  const double alpha = sin(w0) / (2.0 * q);
+  const double cosW0 = cos(w0);
+  const double a0 = 1.0 + alpha;
+
+  Biquad f;
+  f.b0 = (1.0 + cosW0) / 2.0 / a0;
+  f.b1 = -(1.0 + cosW0) / a0;
+  f.b2 = f.b0;
+  f.a1 = -2.0 * cosW0 / a0;
+  f.a2 = (1.0 - alpha) / a0;
+  return f;
+}
+
+void BandPass::design(double sampleRate, double lowCut, double highCut) {
+  // Keep the upper edge below Nyquist for low sample rates
+  highCut = std::min(highCut, 0.45 * sampleRate);
+  lowCut = std::min(lowCut, 0.9 * highCut);
+
+  highPass = Biquad::highPass(sampleRate, lowCut);
+  lowPass = Biquad::lowPass(sampleRate, highCut);
+}
+
+void SteepBandPass::design(double sampleRate, double lowCut,
+                           double highCut) {
+  highCut = std::min(highCut, 0.45 * sampleRate);
+  lowCut = std::min(lowCut, 0.9 * highCut);
+
+  for (int idx = 0; idx < 2; idx++) {
+    highPass[idx] = Biquad::highPass(sampleRate, lowCut, butterworth4Q[idx]);
+    lowPass[idx] = Biquad::lowPass(sampleRate, highCut, butterworth4Q[idx]);
+  }
+}
+
+void RippleFilterBank::prepare(double sampleRate) {
+  rippleBand.design(sampleRate, rippleLow, rippleHigh);
+  fastRippleBand.design(sampleRate, fastRippleLow, fastRippleHigh);
+  reset();
+}
+
+void RippleFilterBank::reset() {
+  rippleBand.reset();
+  fastRippleBand.reset();
+  hasLastSample = false;
+}
+
+RippleBandFeatures RippleFilterBank::processWindow(const float *data,
+                                                   int numSamples) {
+  RippleBandFeatures features;
+
+  if (numSamples <= 0)
+    return features;
+
+  double rippleSum = 0.0;
+  double fastRippleSum = 0.0;
+  float maxSlope = 0.0f;
+  float previous = hasLastSample ? lastSample : data[0];
+
+  for (int idx = 0; idx < numSamples; idx++) {
+    const float x = data[idx];
+
+    const double ripple = rippleBand.process(x);
+    const double fastRipple = fastRippleBand.process(x);
+    rippleSum += ripple * ripple;
+    fastRippleSum += fastRipple * fastRipple;
+
+    maxSlope = std::max(maxSlope, std::abs(x - previous));
+    previous = x;
+  }
+
+  lastSample = previous;
+  hasLastSample = true;
+
+  features.rippleRms = sqrt(rippleSum / numSamples);
+  features.fastRippleRms = sqrt(fastRippleSum / numSamples);
+  features.maxSlope = maxSlope;
+  return features;
+}
@@ -0,0 +1,106 @@
+#ifndef __RIPPLE_FILTER_BANK_H
+#define __RIPPLE_FILTER_BANK_H
+
+/** Second-order IIR section (transposed direct form II) */
+struct Biquad {
+  double b0{1.0}, b1{0.0}, b2{0.0}, a1{0.0}, a2{0.0};
+  double z1{0.0}, z2{0.0};
+
+  static constexpr double butterworthQ = 0.70710678118654752;
+
+  /** Low-pass / high-pass sections (RBJ cookbook), Butterworth by default */
+  static Biquad lowPass(double sampleRate, double cutoff,
+                        double q = butterworthQ);
+  static Biquad highPass(double sampleRate, double cutoff,
+                         double q = butterworthQ);
+
+  void reset() { z1 = z2 = 0.0; }
+
+  inline double process(double x) {
+    double y = b0 * x + z1;
+    z1 = b1 * x - a1 * y + z2;
+    z2 = b2 * x - a2 * y;
+    return y;
+  }
+};
+
+/** High-pass followed by low-pass section */
+struct BandPass {
+  Biquad highPass;
+  Biquad lowPass;
+
+  void design(double sampleRate, double lowCut, double highCut);
+  void reset() {
+    highPass.reset();
+    lowPass.reset();
+  }
+
+  inline double process(double x) {
+    return lowPass.process(highPass.process(x));
+  }
+};
+
+/** Fourth-order Butterworth high-pass followed by a fourth-order
+ * Butterworth low-pass, each as two cascaded sections */
+struct SteepBandPass {
+  Biquad highPass[2];
+  Biquad lowPass[2];
+
+  void design(double sampleRate, double lowCut, double highCut);
+  void reset() {
+    for (int idx = 0; idx < 2; idx++) {
+      highPass[idx].reset();
+      lowPass[idx].reset();
+    }
+  }
+
+  inline double process(double x) {
+    x = highPass[1].process(highPass[0].process(x));
+    return lowPass[1].process(lowPass[0].process(x));
+  }
+};
+
+/** Features extracted from one RMS window */
+struct RippleBandFeatures {
+  double rippleRms{0.0};     // RMS in the ripple band (150-250 Hz)
+  double fastRippleRms{0.0}; // RMS in the fast-ripple band (250-500 Hz)
+  double maxSlope{0.0};      // Largest sample-to-sample step of the raw input
+};
+
+/** Classification of an RMS window when the filter bank is enabled */
+enum class RippleWindowClass { RIPPLE, FAST_RIPPLE, ARTEFACT };
+
+/**
+  Shared filter bank for the ripple input channel.
+
+  A single pass over each RMS window feeds the ripple band, the fast-ripple
+  band and a slope (first derivative) artefact detector, so the detector no
+  longer needs separate filter plugins upstream. Both bands roll off at
+  24 dB/octave and are 3 dB down at their edges, so they cross at 250 Hz
+  and a tone 20 Hz inside either band is attenuated by less than 2 dB while
+  the other band rejects it by 4 dB more.
+**/
+class RippleFilterBank {
+public:
+  static constexpr double rippleLow = 150.0;
+  static constexpr double rippleHigh = 250.0;
+  static constexpr double fastRippleLow = 250.0;
+  static constexpr double fastRippleHigh = 500.0;
+
+  /** Designs the filters for the given sample rate and clears their state */
+  void prepare(double sampleRate);
+
+  /** Clears the filter state */
+  void reset();
+
+  /** Filters data[0..numSamples) and returns the window features */
+  RippleBandFeatures processWindow(const float *data, int numSamples);
+
+private:
+  SteepBandPass rippleBand;
+  SteepBandPass fastRippleBand;
+  float lastSample{0.0f};
+  bool hasLastSample{false};
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "RippleFusion.h"
+#include <cmath>
+
+void RippleFusion::prepare(int numStreams) {
+  histories.assign(numStreams, History());
+  reset();
+}
+
+void RippleFusion::reset() {
+  for (auto &h : histories) {
+    h.next = 0;
+    h.count = 0;
+  }
+  hasFused = false;
+}
+
+bool RippleFusion::hasDetectionNear(const History &h, double time,
+                                    double window) const {
+  for (int i = 0; i < h.count; i++) {
+    if (std::abs(h.times[i] - time) <= window)
+      return true;
+  }
+  return false;
+}
+
+bool RippleFusion::addDetection(int streamIndex, double time,
+                                const RippleFusionConfig &config) {
+  if (config.mode == FusionMode::OFF || streamIndex < 0 ||
+      streamIndex >= (int)histories.size())
+    return false;
+
+  History &own = histories[streamIndex];
+  own.times[own.next] = time;
+  own.next = (own.next + 1) % historySize;
+  if (own.count < historySize)
+    own.count++;
+
+  // One combined event per cluster of detections
+  if (hasFused && std::abs(time - lastFusedTime) <= config.window)
+    return false;
+
+  if (config.mode == FusionMode::COINCIDENT) {
+    int coincident = 1;
+    for (int idx = 0; idx < (int)histories.size(); idx++) {
+      if (idx != streamIndex &&
+          hasDetectionNear(histories[idx], time, config.window))
+        coincident++;
+    }
+    if (coincident < minCoincidentStreams)
+      return false;
+  }
+
+  lastFusedTime = time;
+  hasFused = true;
+  return true;
+}
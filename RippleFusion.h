@@ -0,0 +1,62 @@
+#ifndef __RIPPLE_FUSION_H
+#define __RIPPLE_FUSION_H
+
+#include <vector>
+
+/** How detections from several streams are combined */
+enum class FusionMode { OFF, ANY, COINCIDENT };
+
+/** Global fusion settings, published to the audio thread as a snapshot */
+struct RippleFusionConfig {
+  FusionMode mode{FusionMode::OFF};
+  double window{0.02};  // Coincidence window (seconds)
+  int outputChannel{3}; // Output TTL line (zero-based)
+};
+
+/**
+  Combines ripple detections from several data streams (e.g. bilateral
+  hippocampal recordings).
+
+  Detections are stamped in seconds on the wall clock: each stream's sample
+  numbers are converted with its own sample rate and shifted by the offset
+  between its sample clock and the wall clock. The offset is taken from the
+  block of recent ones that reached process() soonest after its last sample
+  (see RippleDetectionCore), so the 10-30 ms jitter of block delivery drops
+  out. Streams whose sample numbers start at different times, or that run at
+  different rates, line up to within a few milliseconds: the resolution of
+  the wall clock, plus any difference in the shortest delivery latency of
+  their devices, which no timestamp can reveal. Each stream keeps a short
+  fixed-size history, which makes the coincidence test independent of the
+  order in which the streams' blocks are processed.
+**/
+class RippleFusion {
+public:
+  static constexpr int historySize = 16;
+  static constexpr int minCoincidentStreams = 2;
+
+  /** Allocates the per-stream histories; call before acquisition starts */
+  void prepare(int numStreams);
+
+  /** Forgets all previous detections */
+  void reset();
+
+  /** Records a detection and returns true when a combined event should be
+   * emitted for it */
+  bool addDetection(int streamIndex, double time,
+                    const RippleFusionConfig &config);
+
+private:
+  struct History {
+    double times[historySize];
+    int next{0};
+    int count{0};
+  };
+
+  bool hasDetectionNear(const History &h, double time, double window) const;
+
+  std::vector<History> histories;
+  double lastFusedTime{0.0};
+  bool hasFused{false};
+};
+
+#endif
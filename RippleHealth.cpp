@@ -0,0 +1,97 @@
+#include "RippleHealth.h"
+#include <cmath>
+
+void RippleHealthCounters::reset() {
+  samples = 0;
+  detections = 0;
+  blockedDetections = 0;
+  blockedSamples = 0;
+  refractorySamples = 0;
+  rejectedCrossings = 0;
+  clippedSamples = 0;
+  flatSamples = 0;
+  gatedSamples = 0;
+  fusedDetections = 0;
+  rmsAverage = 0.0;
+  rmsMean = 0.0;
+  rmsStdDev = 0.0;
+  brainState = 0;
+  calibrating = false;
+}
+
+RippleHealthSample RippleHealthCounters::read() const {
+  RippleHealthSample sample;
+  sample.samples = samples.load(std::memory_order_relaxed);
+  sample.detections = detections.load(std::memory_order_relaxed);
+  sample.blockedDetections = blockedDetections.load(std::memory_order_relaxed);
+  sample.blockedSamples = blockedSamples.load(std::memory_order_relaxed);
+  sample.refractorySamples = refractorySamples.load(std::memory_order_relaxed);
+  sample.rejectedCrossings = rejectedCrossings.load(std::memory_order_relaxed);
+  sample.clippedSamples = clippedSamples.load(std::memory_order_relaxed);
+  sample.flatSamples = flatSamples.load(std::memory_order_relaxed);
+  sample.gatedSamples = gatedSamples.load(std::memory_order_relaxed);
+  sample.fusedDetections = fusedDetections.load(std::memory_order_relaxed);
+  sample.rmsAverage = rmsAverage.load(std::memory_order_relaxed);
+  sample.rmsMean = rmsMean.load(std::memory_order_relaxed);
+  sample.rmsStdDev = rmsStdDev.load(std::memory_order_relaxed);
+  sample.brainState = brainState.load(std::memory_order_relaxed);
+  sample.calibrating = calibrating.load(std::memory_order_relaxed);
+  return sample;
+}
+
+void RippleHealthMonitor::reset() { history.clear(); }
+
+RippleHealthStatus
+RippleHealthMonitor::update(const RippleHealthSample &sample) {
+
+  // Counters restart when the processor's settings are updated
+  if (!history.empty() && sample.samples < history.back().samples)
+    history.clear();
+
+  history.push_back(sample);
+  while (history.size() > 2 &&
+         sample.time - history[1].time >= windowSeconds)
+    history.pop_front();
+
+  RippleHealthStatus status;
+  status.calibrating = sample.calibrating;
+  status.brainState = sample.brainState;
+
+  const RippleHealthSample &first = history.front();
+  const double elapsed = sample.time - first.time;
+  const double samples = (double)(sample.samples - first.samples);
+  if (elapsed <= 0.0 || samples <= 0.0)
+    return status;
+
+  status.valid = true;
+  const double perMinute = 60.0 / elapsed;
+  status.detectionsPerMinute =
+      (sample.detections - first.detections) * perMinute;
+  status.rejectedPerMinute =
+      (sample.rejectedCrossings - first.rejectedCrossings) * perMinute;
+  status.blockedFraction =
+      (sample.blockedSamples - first.blockedSamples) / samples;
+  status.refractoryFraction =
+      (sample.refractorySamples - first.refractorySamples) / samples;
+  status.clippedFraction =
+      (sample.clippedSamples - first.clippedSamples) / samples;
+  status.flatFraction = (sample.flatSamples - first.flatSamples) / samples;
+  status.gatedFraction =
+      (sample.gatedSamples - first.gatedSamples) / samples;
+  if (sample.rmsStdDev > 0.0)
+    status.drift = (sample.rmsAverage - sample.rmsMean) / sample.rmsStdDev;
+
+  if (status.flatFraction >= flatAlarmFraction)
+    status.alarms |= RippleHealthStatus::FLAT_LINE;
+  if (status.clippedFraction >= clippingAlarmFraction)
+    status.alarms |= RippleHealthStatus::CLIPPING;
+  if (std::abs(status.drift) >= driftAlarmSds)
+    status.alarms |= RippleHealthStatus::DRIFT;
+
+  // Only a veto that has lasted a whole window counts as stuck
+  if (elapsed >= windowSeconds * 0.95 &&
+      status.blockedFraction >= stuckVetoFraction)
+    status.alarms |= RippleHealthStatus::STUCK_VETO;
+
+  return status;
+}
@@ -0,0 +1,118 @@
+#ifndef __RIPPLE_HEALTH_H
+#define __RIPPLE_HEALTH_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+
+/** Copy of a stream's health counters, taken by the editor */
+struct RippleHealthSample {
+  double time{0.0}; // When the copy was taken (seconds, message thread clock)
+
+  uint64_t samples{0};           // Samples analysed outside calibration
+  uint64_t detections{0};        // Detections that raised the output TTL
+  uint64_t blockedDetections{0}; // Detections blocked by movement
+  uint64_t blockedSamples{0};    // Samples with the movement veto active
+  uint64_t refractorySamples{0}; // Samples in the refractory period
+  uint64_t rejectedCrossings{0}; // Threshold crossings shorter than
+                                 // time_thresh
+  uint64_t clippedSamples{0};    // Input samples at the ADC rails
+  uint64_t flatSamples{0};       // Input samples equal to the previous one
+  uint64_t gatedSamples{0};      // Samples closed by the brain-state gate
+  uint64_t fusedDetections{0};   // Combined detections raised on this stream
+
+  double rmsAverage{0.0}; // Slow running average of the window RMS
+  double rmsMean{0.0};    // Baseline in use
+  double rmsStdDev{0.0};
+  int brainState{0}; // Latest BrainState of the state gate
+  bool calibrating{false};
+};
+
+/**
+  Health counters of one stream.
+
+  Written by the audio thread only and read by the editor's timer. Every
+  field is a relaxed atomic and the single writer never needs a locked
+  read-modify-write, so an update costs no more than a plain store.
+**/
+class RippleHealthCounters {
+public:
+  /** Weight of the newest window in the running RMS average */
+  static constexpr double rmsAverageWeight = 0.001;
+
+  /** Clears every counter; call while the audio thread is stopped */
+  void reset();
+
+  /** Adds to a counter. Audio thread only */
+  static inline void add(std::atomic<uint64_t> &counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount,
+                  std::memory_order_relaxed);
+  }
+
+  /** Copies the counters. Any thread */
+  RippleHealthSample read() const;
+
+  std::atomic<uint64_t> samples{0};
+  std::atomic<uint64_t> detections{0};
+  std::atomic<uint64_t> blockedDetections{0};
+  std::atomic<uint64_t> blockedSamples{0};
+  std::atomic<uint64_t> refractorySamples{0};
+  std::atomic<uint64_t> rejectedCrossings{0};
+  std::atomic<uint64_t> clippedSamples{0};
+  std::atomic<uint64_t> flatSamples{0};
+  std::atomic<uint64_t> gatedSamples{0};
+  std::atomic<uint64_t> fusedDetections{0};
+
+  std::atomic<double> rmsAverage{0.0};
+  std::atomic<double> rmsMean{0.0};
+  std::atomic<double> rmsStdDev{0.0};
+  std::atomic<int> brainState{0};
+  std::atomic<bool> calibrating{false};
+};
+
+/** Rolling rates and alarms of one stream */
+struct RippleHealthStatus {
+  enum Alarm {
+    FLAT_LINE = 1,  // Input mostly constant: dead or disconnected channel
+    CLIPPING = 2,   // Input saturating the ADC
+    DRIFT = 4,      // RMS has drifted away from the calibrated baseline
+    STUCK_VETO = 8  // Movement veto active for the whole window
+  };
+
+  bool valid{false};
+  bool calibrating{false};
+  double detectionsPerMinute{0.0};
+  double rejectedPerMinute{0.0}; // Crossings rejected by time_thresh
+  double blockedFraction{0.0};
+  double refractoryFraction{0.0};
+  double clippedFraction{0.0};
+  double flatFraction{0.0};
+  double gatedFraction{0.0}; // Closed by the brain-state gate
+  int brainState{0};
+  double drift{0.0}; // (running RMS - baseline mean) / baseline std
+  int alarms{0};
+};
+
+/**
+  Turns successive counter samples into rates over the last minute and
+  raises alarms. Message thread only.
+**/
+class RippleHealthMonitor {
+public:
+  static constexpr double windowSeconds = 60.0;
+  static constexpr double flatAlarmFraction = 0.5;
+  static constexpr double clippingAlarmFraction = 0.001;
+  static constexpr double driftAlarmSds = 3.0;
+  static constexpr double stuckVetoFraction = 0.99;
+
+  /** Forgets the history, e.g. when another stream is shown */
+  void reset();
+
+  /** Adds a sample and returns the status over the last minute */
+  RippleHealthStatus update(const RippleHealthSample &sample);
+
+private:
+  std::deque<RippleHealthSample> history;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "RippleShadow.h"
+#include <algorithm>
+#include <cmath>
+
+// Single writer, see RippleHealthCounters::add
+static inline void increment(std::atomic<uint64_t> &counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+}
+
+void RippleShadowDetectors::configure(const std::vector<RippleShadowSet> &sets,
+                                      double sampleRate) {
+  matchSamples = (int64_t)std::lround(matchSeconds * sampleRate);
+
+  const int count = std::min((int)sets.size(), maxShadows);
+  bool changed = count != numShadows;
+  for (int idx = 0; idx < count && !changed; idx++)
+    changed = sets[idx].rippleSds != shadows[idx].set.rippleSds ||
+              sets[idx].numSamplesTimeThreshold !=
+                  shadows[idx].set.numSamplesTimeThreshold ||
+              sets[idx].refractoryTime != shadows[idx].set.refractoryTime;
+  if (!changed)
+    return;
+
+  numShadows = count;
+  for (int idx = 0; idx < count; idx++) {
+    shadows[idx].set = sets[idx];
+    rippleSds[idx].store(sets[idx].rippleSds, std::memory_order_relaxed);
+    timeThreshold[idx].store(sets[idx].timeThreshold,
+                             std::memory_order_relaxed);
+  }
+  publishedShadows.store(count, std::memory_order_relaxed);
+  reset();
+}
+
+void RippleShadowDetectors::reset() {
+  for (int idx = 0; idx < maxShadows; idx++) {
+    State &state = shadows[idx];
+    state.counterAboveThresh = 0;
+    state.flagTimeThreshold = false;
+    state.onRefractoryTime = false;
+    state.lastDetection = -1;
+    state.pairedLive = -1;
+    detections[idx].store(0, std::memory_order_relaxed);
+    shared[idx].store(0, std::memory_order_relaxed);
+    blocked[idx].store(0, std::memory_order_relaxed);
+  }
+  lastLive = -1;
+  liveDetections.store(0, std::memory_order_relaxed);
+}
+
+void RippleShadowDetectors::processWindow(double rms, double rmsMean,
+                                          double rmsStdDev, bool eligible,
+                                          bool isBlocked, int64_t lastSample,
+                                          int samples, int64_t timeNow) {
+  for (int idx = 0; idx < numShadows; idx++) {
+    State &state = shadows[idx];
+
+    if (eligible && rms > rmsMean + state.set.rippleSds * rmsStdDev) {
+      state.counterAboveThresh += samples;
+    } else {
+      state.counterAboveThresh = 0;
+      state.flagTimeThreshold = false;
+    }
+    if (state.counterAboveThresh > state.set.numSamplesTimeThreshold)
+      state.flagTimeThreshold = true;
+
+    if (state.flagTimeThreshold && !state.onRefractoryTime) {
+      if (isBlocked) {
+        increment(blocked[idx]);
+      } else {
+        increment(detections[idx]);
+        state.lastDetection = lastSample;
+        if (lastLive >= 0 && lastSample - lastLive <= matchSamples)
+          match(idx, lastLive);
+      }
+      state.onRefractoryTime = true;
+      state.refractoryTimeStart = timeNow;
+    }
+
+    if (state.onRefractoryTime &&
+        timeNow - state.refractoryTimeStart >= state.set.refractoryTime)
+      state.onRefractoryTime = false;
+  }
+}
+
+void RippleShadowDetectors::addLiveDetection(int64_t sampleNumber) {
+  increment(liveDetections);
+  lastLive = sampleNumber;
+  for (int idx = 0; idx < numShadows; idx++)
+    if (shadows[idx].lastDetection >= 0 &&
+        sampleNumber - shadows[idx].lastDetection <= matchSamples)
+      match(idx, sampleNumber);
+}
+
+void RippleShadowDetectors::match(int shadow, int64_t liveSample) {
+  if (shadows[shadow].pairedLive == liveSample)
+    return;
+  shadows[shadow].pairedLive = liveSample;
+  increment(shared[shadow]);
+}
+
+RippleShadowSample RippleShadowDetectors::read() const {
+  RippleShadowSample sample;
+  sample.numShadows = publishedShadows.load(std::memory_order_relaxed);
+  for (int idx = 0; idx < sample.numShadows; idx++) {
+    sample.rippleSds[idx] = rippleSds[idx].load(std::memory_order_relaxed);
+    sample.timeThreshold[idx] =
+        timeThreshold[idx].load(std::memory_order_relaxed);
+    sample.detections[idx] = detections[idx].load(std::memory_order_relaxed);
+    sample.shared[idx] = shared[idx].load(std::memory_order_relaxed);
+    sample.blocked[idx] = blocked[idx].load(std::memory_order_relaxed);
+  }
+  sample.liveDetections = liveDetections.load(std::memory_order_relaxed);
+  return sample;
+}
@@ -0,0 +1,105 @@
+#ifndef __RIPPLE_SHADOW_H
+#define __RIPPLE_SHADOW_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/** Alternative detection parameters evaluated next to the live ones */
+struct RippleShadowSet {
+  double rippleSds{0.0};           // Standard deviations above the RMS mean
+  double timeThreshold{0.0};       // Minimum time above threshold (ms)
+  int numSamplesTimeThreshold{0};  // The same in samples
+  unsigned int refractoryTime{0};  // Refractory time in milliseconds
+};
+
+/** Copy of a stream's shadow counters, taken by the editor */
+struct RippleShadowSample {
+  static constexpr int maxShadows = 4;
+
+  int numShadows{0};
+  double rippleSds[maxShadows]{};
+  double timeThreshold[maxShadows]{};
+  uint64_t detections[maxShadows]{}; // Detections the set would have made
+  uint64_t shared[maxShadows]{};     // Of these, also made by the live set
+  uint64_t blocked[maxShadows]{};    // Crossings the movement detector
+                                     // blocked
+  uint64_t liveDetections{0};        // Live detections over the same period
+};
+
+/**
+  Shadow detectors of one stream.
+
+  Each shadow parameter set runs the threshold / time-threshold / refractory
+  state machine of detectRipples() on the window RMS values the live detector
+  already computed, after the same vetoes, so an extra set costs a compare
+  and a few counter updates per window. As for the live set, a crossing the
+  movement detector blocks is counted apart but still starts a refractory
+  period, and refractory periods follow the wall clock of the block. With
+  the CNN detector the shadows still threshold the window RMS, so they
+  compare RMS settings with the live CNN.
+
+  Shadows never emit events; they only count what they would have detected
+  and how many of those detections the live parameters made as well. The
+  audio thread is the only writer and the counters are relaxed atomics, as
+  for the health counters.
+**/
+class RippleShadowDetectors {
+public:
+  static constexpr int maxShadows = RippleShadowSample::maxShadows;
+  static constexpr double matchSeconds = 0.05; // Live and shadow detections
+                                               // this close are the same
+
+  /** Takes over new parameter sets, starting the counts over if they
+   * differ from the current ones. Audio thread */
+  void configure(const std::vector<RippleShadowSet> &sets, double sampleRate);
+
+  /** Clears the state machines and counters. Audio thread, or with the audio
+   * thread stopped */
+  void reset();
+
+  bool isActive() const { return numShadows > 0; }
+
+  /** Runs every set on one window. eligible is false when a veto or the
+   * state gate blocks the window, and blocked is true while the movement
+   * detector blocks detections. lastSample is the sample number of its last
+   * sample and timeNow the wall clock of its block, in milliseconds */
+  void processWindow(double rms, double rmsMean, double rmsStdDev,
+                     bool eligible, bool blocked, int64_t lastSample,
+                     int samples, int64_t timeNow);
+
+  /** Records a detection of the live parameters */
+  void addLiveDetection(int64_t sampleNumber);
+
+  /** Copies the counters. Any thread */
+  RippleShadowSample read() const;
+
+private:
+  /** Counts a live / shadow pair once */
+  void match(int shadow, int64_t liveSample);
+
+  struct State {
+    RippleShadowSet set;
+    int counterAboveThresh{0};
+    bool flagTimeThreshold{false};
+    bool onRefractoryTime{false};
+    int64_t refractoryTimeStart{0};
+    int64_t lastDetection{-1};
+    int64_t pairedLive{-1}; // Live detection already matched to this set
+  };
+
+  State shadows[maxShadows];
+  int numShadows{0};
+  int64_t matchSamples{0};
+  int64_t lastLive{-1};
+
+  std::atomic<int> publishedShadows{0};
+  std::atomic<double> rippleSds[maxShadows]{};
+  std::atomic<double> timeThreshold[maxShadows]{};
+  std::atomic<uint64_t> detections[maxShadows]{};
+  std::atomic<uint64_t> shared[maxShadows]{};
+  std::atomic<uint64_t> blocked[maxShadows]{};
+  std::atomic<uint64_t> liveDetections{0};
+};
+
+#endif
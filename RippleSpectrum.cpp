@@ -0,0 +1,88 @@
+#include "RippleSpectrum.h"
+#include "RippleFilterBank.h"
+#include <algorithm>
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void RippleSpectrum::prepare(double sampleRate) {
+  frameLength = std::max(1, (int)std::lround(sampleRate / binSpacing));
+
+  for (int k = 0; k < numBins; k++) {
+    frequency[k] = firstBinFrequency + k * binSpacing;
+    coeff[k] = 2.0 * cos(2.0 * M_PI * frequency[k] / sampleRate);
+  }
+  reset();
+}
+
+void RippleSpectrum::reset() {
+  for (int k = 0; k < numBins; k++) {
+    s1[k] = 0.0;
+    s2[k] = 0.0;
+    smoothed[k] = 0.0;
+  }
+  frameCount = 0;
+  hasFrame = false;
+}
+
+bool RippleSpectrum::process(const float *data, int numSamples) {
+  bool frameCompleted = false;
+
+  for (int idx = 0; idx < numSamples; idx++) {
+    const double x = data[idx];
+    for (int k = 0; k < numBins; k++) {
+      const double s0 = x + coeff[k] * s1[k] - s2[k];
+      s2[k] = s1[k];
+      s1[k] = s0;
+    }
+
+    if (++frameCount == frameLength) {
+      finishFrame();
+      frameCompleted = true;
+    }
+  }
+  return frameCompleted;
+}
+
+void RippleSpectrum::finishFrame() {
+  // A sinusoid of amplitude A gives |X|^2 = (A * N / 2)^2
+  const double scale = 4.0 / ((double)frameLength * frameLength);
+
+  for (int k = 0; k < numBins; k++) {
+    const double power =
+        (s1[k] * s1[k] + s2[k] * s2[k] - coeff[k] * s1[k] * s2[k]) * scale;
+    smoothed[k] =
+        hasFrame ? smoothed[k] + smoothing * (power - smoothed[k]) : power;
+    s1[k] = 0.0;
+    s2[k] = 0.0;
+  }
+  frameCount = 0;
+  hasFrame = true;
+}
+
+void RippleSpectrum::fillSnapshot(RippleSpectrumSnapshot &snapshot) const {
+  double ripplePower = 0.0, neighbourPower = 0.0;
+  int rippleBins = 0, neighbourBins = 0;
+
+  for (int k = 0; k < numBins; k++) {
+    snapshot.frequency[k] = frequency[k];
+    snapshot.power[k] = smoothed[k];
+
+    if (frequency[k] >= RippleFilterBank::rippleLow &&
+        frequency[k] <= RippleFilterBank::rippleHigh) {
+      ripplePower += smoothed[k];
+      rippleBins++;
+    } else {
+      neighbourPower += smoothed[k];
+      neighbourBins++;
+    }
+  }
+
+  ripplePower /= std::max(rippleBins, 1);
+  neighbourPower /= std::max(neighbourBins, 1);
+  snapshot.rippleRatio =
+      neighbourPower > 0.0 ? ripplePower / neighbourPower : 0.0;
+  snapshot.valid = hasFrame;
+}
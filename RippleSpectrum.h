@@ -0,0 +1,57 @@
+#ifndef __RIPPLE_SPECTRUM_H
+#define __RIPPLE_SPECTRUM_H
+
+/** Latest spectrum of a stream, as published to the editor */
+struct RippleSpectrumSnapshot {
+  static constexpr int numBins = 11;
+
+  float frequency[numBins]; // Bin centre frequencies (Hz)
+  float power[numBins];     // Smoothed power per bin (input units squared)
+  float rippleRatio{0.0f};  // Mean ripple-band power over the mean power of
+                            // the neighbouring bins
+  bool valid{false};
+};
+
+/**
+  Incremental spectral monitor for the 100-600 Hz range.
+
+  Runs one Goertzel resonator per bin over consecutive analysis frames, so
+  each sample costs a single multiply-add per bin. Frame powers are
+  exponentially smoothed to give a steady live view of ripple-band power
+  against the neighbouring bands.
+**/
+class RippleSpectrum {
+public:
+  static constexpr int numBins = RippleSpectrumSnapshot::numBins;
+  static constexpr double firstBinFrequency = 100.0;
+  static constexpr double binSpacing = 50.0;
+  static constexpr double smoothing = 0.2; // Weight of the newest frame
+
+  /** Sets the frame length (one bin spacing of resolution) and the bin
+   * coefficients for the given sample rate */
+  void prepare(double sampleRate);
+
+  /** Clears the resonators and the smoothed spectrum */
+  void reset();
+
+  /** Feeds samples to the resonators. Returns true when at least one
+   * analysis frame completed during this call */
+  bool process(const float *data, int numSamples);
+
+  /** Copies the smoothed spectrum into a snapshot */
+  void fillSnapshot(RippleSpectrumSnapshot &snapshot) const;
+
+private:
+  void finishFrame();
+
+  double coeff[numBins];
+  double s1[numBins];
+  double s2[numBins];
+  double smoothed[numBins];
+  double frequency[numBins];
+  int frameLength{1};
+  int frameCount{0};
+  bool hasFrame{false};
+};
+
+#endif
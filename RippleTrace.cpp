@@ -0,0 +1,607 @@
+#include "RippleTrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <type_traits>
+
+static const char fileMagic[8] = {'R', 'P', 'L', 'T', 'R', 'C', '0', '1'};
+static constexpr uint32_t fileVersion = 5;
+static constexpr size_t recordHeaderBytes = sizeof(uint8_t) + sizeof(uint32_t);
+
+// Largest payload the reader accepts, to reject damaged size fields
+static constexpr uint32_t maxPayloadBytes = 1u << 30;
+
+// How long the writer thread sleeps when the ring is empty
+static constexpr int writerSleepMilliseconds = 5;
+
+/** Feeds the fields of a record to put(data, bytes). Enums are stored as
+ * int32, vectors and strings with a uint32 count. Vectors of structs go
+ * through records(), which stores each element field by field */
+template <typename Put> struct TraceEncoder {
+  Put put;
+
+  template <typename T> void operator()(const T &value) {
+    if constexpr (std::is_enum<T>::value) {
+      const int32_t stored = (int32_t)value;
+      put(&stored, sizeof(stored));
+    } else {
+      put(&value, sizeof(T));
+    }
+  }
+
+  template <typename T> void vector(const std::vector<T> &values) {
+    const uint32_t count = values.size();
+    put(&count, sizeof(count));
+    if (count)
+      put(values.data(), count * sizeof(T));
+  }
+
+  template <typename T, typename Visit>
+  void records(const std::vector<T> &values, Visit visit) {
+    const uint32_t count = values.size();
+    put(&count, sizeof(count));
+    for (const T &value : values)
+      visit(*this, value);
+  }
+
+  void string(const std::string &text) {
+    const uint32_t count = text.size();
+    put(&count, sizeof(count));
+    if (count)
+      put(text.data(), count);
+  }
+};
+
+template <typename Put> static TraceEncoder<Put> makeEncoder(Put put) {
+  return TraceEncoder<Put>{put};
+}
+
+/** Reads back what TraceEncoder wrote, failing on truncated payloads and
+ * on payloads with bytes left over, so a record whose layout differs from
+ * the reader's is rejected rather than misread */
+class TraceDecoder {
+public:
+  TraceDecoder(const std::vector<uint8_t> &payload)
+      : data(payload.data()), size(payload.size()) {}
+
+  template <typename T> void operator()(T &value) {
+    if constexpr (std::is_enum<T>::value) {
+      int32_t stored = 0;
+      read(&stored, sizeof(stored));
+      value = (T)stored;
+    } else {
+      read(&value, sizeof(T));
+    }
+  }
+
+  template <typename T> void vector(std::vector<T> &values) {
+    uint32_t count = 0;
+    read(&count, sizeof(count));
+    if (!ok || count > (size - position) / sizeof(T)) {
+      ok = false;
+      return;
+    }
+    values.resize(count);
+    if (count)
+      read(values.data(), count * sizeof(T));
+  }
+
+  template <typename T, typename Visit>
+  void records(std::vector<T> &values, Visit visit) {
+    uint32_t count = 0;
+    read(&count, sizeof(count));
+    if (!ok || count > size - position) {
+      ok = false;
+      return;
+    }
+    values.resize(count);
+    for (T &value : values)
+      visit(*this, value);
+  }
+
+  void string(std::string &text) {
+    uint32_t count = 0;
+    read(&count, sizeof(count));
+    if (!ok || count > size - position) {
+      ok = false;
+      return;
+    }
+    text.assign((const char *)data + position, count);
+    position += count;
+  }
+
+  void read(void *value, size_t bytes) {
+    if (!ok || bytes > size - position) {
+      ok = false;
+      return;
+    }
+    memcpy(value, data + position, bytes);
+    position += bytes;
+  }
+
+  /** True if every field read so far was present */
+  bool intact() const { return ok; }
+
+  /** True if every field was present and the whole payload was read */
+  bool finished() const { return ok && position == size; }
+
+private:
+  const uint8_t *data;
+  size_t size;
+  size_t position{0};
+  bool ok{true};
+};
+
+// Field lists shared by the encoder and the decoder. Config is const when
+// writing and mutable when reading
+template <typename Archive, typename Set>
+static void visitShadowSet(Archive &ar, Set &s) {
+  ar(s.rippleSds);
+  ar(s.timeThreshold);
+  ar(s.numSamplesTimeThreshold);
+  ar(s.refractoryTime);
+}
+
+template <typename Archive, typename Config>
+static void visitConfig(Archive &ar, Config &c) {
+  ar(c.rippleInputChannel);
+  ar(c.movementInputChannel);
+  ar.vector(c.auxChannelIndices);
+  ar.vector(c.referenceChannels);
+  ar(c.clipLevel);
+  ar(c.envelopeOutputChannel);
+  ar(c.thresholdOutputChannel);
+  ar(c.stateOutputChannel);
+  ar.vector(c.scanChannels);
+  ar(c.rippleOutputChannel);
+  ar(c.ttlReportChannel);
+  ar(c.movementOutputChannel);
+  ar(c.rippleSds);
+  ar(c.offsetSds);
+  ar(c.refractoryTime);
+  ar(c.rmsSamples);
+  ar(c.ttlDuration);
+  ar(c.ttlPercent);
+  ar(c.detectorMode);
+  ar(c.cnnThreshold);
+  ar(c.filterBankEnabled);
+  ar(c.fastRippleRatio);
+  ar(c.artefactSds);
+  ar(c.artefactHoldSamples);
+  ar(c.spectrumEnabled);
+  ar(c.eventAverageEnabled);
+  ar(c.stateGate);
+  ar(c.stateInputChannel);
+  ar(c.thetaRatio);
+  ar(c.deltaFraction);
+  ar.records(c.shadowSets,
+             [](auto &archive, auto &set) { visitShadowSet(archive, set); });
+  ar(c.autoTuneEnabled);
+  ar(c.tuneCpuBudget);
+  ar(c.tuneFalsePerMinute);
+  ar(c.refSds);
+  ar(c.rmsMean);
+  ar(c.rmsStdDev);
+  ar(c.baselineCurrent);
+  ar(c.calibrationGeneration);
+  ar(c.movementMode);
+  ar(c.movSds);
+  ar(c.movChannelGeneration);
+  ar(c.sampleRate);
+  ar(c.ttlDurationSamples);
+  ar(c.numSamplesTimeThreshold);
+  ar(c.minMovSamplesBelowThresh);
+  ar(c.minMovSamplesAboveThresh);
+  ar(c.calibrationPoints);
+  ar(c.threshold);
+}
+
+template <typename Archive, typename State>
+static void visitState(Archive &ar, State &s) {
+  ar(s.isCalibrating);
+  ar(s.pluginEnabled);
+  ar(s.onRefractoryTime);
+  ar(s.rippleDetected);
+  ar(s.flagTimeThreshold);
+  ar(s.flagMovMinTimeUp);
+  ar(s.flagMovMinTimeDown);
+  ar(s.filterBankActive);
+  ar(s.stateGateActive);
+  ar(s.fusedTtlOn);
+  ar(s.pointsProcessed);
+  ar(s.counterAboveThresh);
+  ar(s.counterMovUpThresh);
+  ar(s.counterMovDownThresh);
+  ar(s.movChannelGeneration);
+  ar(s.calibrationGeneration);
+  ar(s.artefactHoldCounter);
+  ar(s.fusedTtlLine);
+  ar(s.fusedTtlOffSample);
+  ar(s.fusionOffsetSet);
+  ar(s.fusionOffset);
+  ar(s.refractoryTimeStart);
+  ar(s.rippleStartTime);
+  ar(s.randomNumber);
+  ar(s.rmsMean);
+  ar(s.rmsStdDev);
+  ar(s.threshold);
+  ar(s.movRmsMean);
+  ar(s.movRmsStdDev);
+  ar(s.movThreshold);
+  ar(s.artefactMean);
+  ar(s.artefactStdDev);
+  ar(s.artefactThreshold);
+  ar(s.refRmsMean);
+  ar(s.refRmsStdDev);
+  ar(s.refThreshold);
+}
+
+template <typename Archive, typename Fusion>
+static void visitFusion(Archive &ar, Fusion &f) {
+  ar(f.mode);
+  ar(f.window);
+  ar(f.outputChannel);
+}
+
+const float *RippleTraceBlock::getChannel(int globalIndex) const {
+  for (size_t idx = 0; idx < channels.size(); idx++) {
+    if (channels[idx] == globalIndex)
+      return samples.data() + idx * numSamples;
+  }
+  return nullptr;
+}
+
+bool RippleTraceWriter::open(const std::string &path, std::string &error,
+                             size_t bufferBytes) {
+  close();
+
+  file = fopen(path.c_str(), "wb");
+  if (!file) {
+    error = "Cannot create " + path;
+    return false;
+  }
+  const uint32_t version = fileVersion;
+  fwrite(fileMagic, 1, sizeof(fileMagic), file);
+  fwrite(&version, sizeof(version), 1, file);
+
+  // Power-of-two capacity, so positions wrap with a mask
+  size_t capacity = 1;
+  while (capacity < bufferBytes)
+    capacity <<= 1;
+  ring.assign(capacity, 0);
+  mask = capacity - 1;
+  head = 0;
+  tail = 0;
+  writePosition = 0;
+  droppedRecords = 0;
+  reportedDrops = 0;
+
+  running.store(true, std::memory_order_release);
+  thread = std::thread(&RippleTraceWriter::run, this);
+  return true;
+}
+
+void RippleTraceWriter::close() {
+  if (!running.exchange(false))
+    return;
+  thread.join();
+  drain();
+  fclose(file);
+  file = nullptr;
+  ring.clear();
+  ring.shrink_to_fit();
+}
+
+bool RippleTraceWriter::beginRecord(TraceRecord type, size_t payloadBytes) {
+  const uint64_t committed = head.load(std::memory_order_relaxed);
+  const uint64_t free =
+      ring.size() - (committed - tail.load(std::memory_order_acquire));
+  if (recordHeaderBytes + payloadBytes > free) {
+    droppedRecords.store(droppedRecords.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    return false;
+  }
+
+  writePosition = committed;
+  append((uint8_t)type);
+  append((uint32_t)payloadBytes);
+  return true;
+}
+
+void RippleTraceWriter::append(const void *data, size_t bytes) {
+  const size_t start = writePosition & mask;
+  const size_t first = std::min(bytes, ring.size() - start);
+  memcpy(ring.data() + start, data, first);
+  memcpy(ring.data(), (const uint8_t *)data + first, bytes - first);
+  writePosition += bytes;
+}
+
+void RippleTraceWriter::commitRecord() {
+  head.store(writePosition, std::memory_order_release);
+}
+
+void RippleTraceWriter::writeStream(const RippleTraceStream &stream) {
+  size_t bytes = 0;
+  auto size = makeEncoder([&](const void *, size_t n) { bytes += n; });
+  auto write = makeEncoder([&](const void *d, size_t n) { append(d, n); });
+
+  const int32_t fusionIndex = stream.fusionIndex;
+  size(stream.streamId);
+  size(fusionIndex);
+  size(stream.sampleRate);
+  size.string(stream.name);
+  if (!beginRecord(TraceRecord::STREAM, bytes))
+    return;
+  write(stream.streamId);
+  write(fusionIndex);
+  write(stream.sampleRate);
+  write.string(stream.name);
+  commitRecord();
+}
+
+void RippleTraceWriter::writeProcess(const RippleTraceProcess &process) {
+  if (!beginRecord(TraceRecord::PROCESS, sizeof(int64_t) + sizeof(uint8_t)))
+    return;
+  append(process.wallClockMs);
+  append((uint8_t)process.calibrate);
+  commitRecord();
+}
+
+void RippleTraceWriter::writeState(uint16_t streamId,
+                                   const RippleTraceState &state) {
+  size_t bytes = 0;
+  auto size = makeEncoder([&](const void *, size_t n) { bytes += n; });
+  auto write = makeEncoder([&](const void *d, size_t n) { append(d, n); });
+
+  size(streamId);
+  visitState(size, state);
+  if (!beginRecord(TraceRecord::STATE, bytes))
+    return;
+  write(streamId);
+  visitState(write, state);
+  commitRecord();
+}
+
+void RippleTraceWriter::writeConfig(uint16_t streamId,
+                                    const RippleDetectorConfig &config,
+                                    const std::string &cnnModelPath) {
+  size_t bytes = 0;
+  auto size = makeEncoder([&](const void *, size_t n) { bytes += n; });
+  auto write = makeEncoder([&](const void *d, size_t n) { append(d, n); });
+
+  size(streamId);
+  visitConfig(size, config);
+  size.string(cnnModelPath);
+  if (!beginRecord(TraceRecord::CONFIG, bytes))
+    return;
+  write(streamId);
+  visitConfig(write, config);
+  write.string(cnnModelPath);
+  commitRecord();
+}
+
+void RippleTraceWriter::writeFusion(const RippleFusionConfig &config) {
+  size_t bytes = 0;
+  auto size = makeEncoder([&](const void *, size_t n) { bytes += n; });
+  auto write = makeEncoder([&](const void *d, size_t n) { append(d, n); });
+
+  visitFusion(size, config);
+  if (!beginRecord(TraceRecord::FUSION, bytes))
+    return;
+  visitFusion(write, config);
+  commitRecord();
+}
+
+void RippleTraceWriter::writeBlock(uint16_t streamId,
+                                   int64_t firstSampleNumber, int numSamples,
+                                   const int *channels,
+                                   const float *const *data,
+                                   int numChannels) {
+  const size_t bytes = sizeof(uint16_t) + sizeof(int64_t) +
+                       sizeof(uint32_t) + sizeof(uint16_t) +
+                       numChannels * sizeof(int32_t) +
+                       (size_t)numChannels * numSamples * sizeof(float);
+  if (!beginRecord(TraceRecord::BLOCK, bytes))
+    return;
+  append(streamId);
+  append(firstSampleNumber);
+  append((uint32_t)numSamples);
+  append((uint16_t)numChannels);
+  for (int ch = 0; ch < numChannels; ch++)
+    append((int32_t)channels[ch]);
+  for (int ch = 0; ch < numChannels; ch++)
+    append(data[ch], numSamples * sizeof(float));
+  commitRecord();
+}
+
+void RippleTraceWriter::writeEvent(const RippleTraceEvent &event) {
+  if (!beginRecord(TraceRecord::EVENT, sizeof(uint16_t) + sizeof(int64_t) +
+                                           sizeof(int32_t) + sizeof(uint8_t)))
+    return;
+  append(event.streamId);
+  append(event.sampleNumber);
+  append((int32_t)event.line);
+  append((uint8_t)event.state);
+  commitRecord();
+}
+
+void RippleTraceWriter::writeRandom(uint16_t streamId, double value) {
+  if (!beginRecord(TraceRecord::RANDOM, sizeof(uint16_t) + sizeof(double)))
+    return;
+  append(streamId);
+  append(value);
+  commitRecord();
+}
+
+void RippleTraceWriter::run() {
+  while (running.load(std::memory_order_acquire)) {
+    if (head.load(std::memory_order_acquire) ==
+        tail.load(std::memory_order_relaxed))
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(writerSleepMilliseconds));
+    drain();
+  }
+}
+
+// Writes every committed record, then notes any records dropped meanwhile.
+// Committed ranges always end on a record boundary
+void RippleTraceWriter::drain() {
+  const uint64_t end = head.load(std::memory_order_acquire);
+  uint64_t position = tail.load(std::memory_order_relaxed);
+  while (position < end) {
+    const size_t start = position & mask;
+    const size_t bytes =
+        std::min<uint64_t>(end - position, ring.size() - start);
+    fwrite(ring.data() + start, 1, bytes, file);
+    position += bytes;
+  }
+  tail.store(position, std::memory_order_release);
+
+  const uint64_t dropped = droppedRecords.load(std::memory_order_relaxed);
+  if (dropped != reportedDrops) {
+    const uint8_t type = (uint8_t)TraceRecord::DROPPED;
+    const uint32_t bytes = sizeof(uint64_t);
+    const uint64_t count = dropped - reportedDrops;
+    fwrite(&type, sizeof(type), 1, file);
+    fwrite(&bytes, sizeof(bytes), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    reportedDrops = dropped;
+  }
+}
+
+bool RippleTraceReader::open(const std::string &path, std::string &error) {
+  file.open(path, std::ios::binary);
+  if (!file) {
+    error = "Cannot open " + path;
+    return false;
+  }
+
+  char magic[8];
+  uint32_t version = 0;
+  if (!file.read(magic, sizeof(magic)) ||
+      memcmp(magic, fileMagic, sizeof(magic)) != 0 ||
+      !file.read((char *)&version, sizeof(version))) {
+    error = path + " is not a ripple detector trace";
+    return false;
+  }
+  if (version != fileVersion) {
+    error = "Unsupported trace version in " + path;
+    return false;
+  }
+  return true;
+}
+
+bool RippleTraceReader::next(TraceRecord &type, std::string &error) {
+  uint8_t storedType;
+  uint32_t bytes;
+  if (!file.read((char *)&storedType, sizeof(storedType)))
+    return false;
+  if (!file.read((char *)&bytes, sizeof(bytes)) || bytes > maxPayloadBytes) {
+    error = "Damaged record header";
+    return false;
+  }
+  payload.resize(bytes);
+  if (bytes && !file.read((char *)payload.data(), bytes)) {
+    // A trace cut short by a crash still replays up to its last record
+    error = "Truncated record at the end of the trace";
+    return false;
+  }
+  type = (TraceRecord)storedType;
+  return true;
+}
+
+bool RippleTraceReader::readStream(RippleTraceStream &stream) const {
+  TraceDecoder in(payload);
+  int32_t fusionIndex = -1;
+  in(stream.streamId);
+  in(fusionIndex);
+  in(stream.sampleRate);
+  in.string(stream.name);
+  stream.fusionIndex = fusionIndex;
+  return in.finished();
+}
+
+bool RippleTraceReader::readProcess(RippleTraceProcess &process) const {
+  TraceDecoder in(payload);
+  uint8_t calibrate = 0;
+  in(process.wallClockMs);
+  in(calibrate);
+  process.calibrate = calibrate != 0;
+  return in.finished();
+}
+
+bool RippleTraceReader::readState(uint16_t &streamId,
+                                  RippleTraceState &state) const {
+  TraceDecoder in(payload);
+  in(streamId);
+  visitState(in, state);
+  return in.finished();
+}
+
+bool RippleTraceReader::readConfig(uint16_t &streamId,
+                                   RippleDetectorConfig &config,
+                                   std::string &cnnModelPath) const {
+  TraceDecoder in(payload);
+  in(streamId);
+  visitConfig(in, config);
+  in.string(cnnModelPath);
+  return in.finished();
+}
+
+bool RippleTraceReader::readFusion(RippleFusionConfig &config) const {
+  TraceDecoder in(payload);
+  visitFusion(in, config);
+  return in.finished();
+}
+
+bool RippleTraceReader::readBlock(RippleTraceBlock &block) const {
+  TraceDecoder in(payload);
+  uint32_t numSamples = 0;
+  uint16_t numChannels = 0;
+  in(block.streamId);
+  in(block.firstSampleNumber);
+  in(numSamples);
+  in(numChannels);
+  block.numSamples = numSamples;
+  block.channels.resize(numChannels);
+  for (int &channel : block.channels) {
+    int32_t stored = 0;
+    in(stored);
+    channel = stored;
+  }
+  if (!in.intact() ||
+      payload.size() - (sizeof(uint16_t) + sizeof(int64_t) +
+                        sizeof(uint32_t) + sizeof(uint16_t) +
+                        numChannels * sizeof(int32_t)) !=
+          (size_t)numChannels * numSamples * sizeof(float))
+    return false;
+  block.samples.resize((size_t)numChannels * numSamples);
+  in.read(block.samples.data(), block.samples.size() * sizeof(float));
+  return in.finished();
+}
+
+bool RippleTraceReader::readEvent(RippleTraceEvent &event) const {
+  TraceDecoder in(payload);
+  int32_t line = 0;
+  uint8_t state = 0;
+  in(event.streamId);
+  in(event.sampleNumber);
+  in(line);
+  in(state);
+  event.line = line;
+  event.state = state != 0;
+  return in.finished();
+}
+
+bool RippleTraceReader::readRandom(uint16_t &streamId, double &value) const {
+  TraceDecoder in(payload);
+  in(streamId);
+  in(value);
+  return in.finished();
+}
+
+bool RippleTraceReader::readDropped(uint64_t &count) const {
+  TraceDecoder in(payload);
+  in(count);
+  return in.finished();
+}
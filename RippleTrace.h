@@ -0,0 +1,205 @@
+#ifndef __RIPPLE_TRACE_H
+#define __RIPPLE_TRACE_H
+
+#include "RippleDetectorConfig.h"
+#include "RippleFusion.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+  Record types of a block trace.
+
+  A trace starts with the magic "RPLTRC01" and a uint32 version, followed by
+  records made of a uint8 type, a uint32 payload size and the payload, all
+  little-endian. Structs are stored field by field, and the version changes
+  whenever the fields of a record do. A record whose payload size does not
+  match the fields the reader expects is rejected.
+**/
+enum class TraceRecord : uint8_t {
+  STREAM = 1,  // Stream present when tracing started
+  PROCESS = 2, // Start of a process() call
+  STATE = 3,   // Detector state of a stream before its first traced block
+  CONFIG = 4,  // Parameter snapshot applied by a stream
+  FUSION = 5,  // Global fusion snapshot
+  BLOCK = 6,   // Input samples of one stream for one process() call
+  EVENT = 7,   // TTL event emitted by the detector
+  RANDOM = 8,  // Draw deciding whether a detection reaches the output line
+  DROPPED = 9  // Records lost because the writer fell behind
+};
+
+/** A stream of the processor */
+struct RippleTraceStream {
+  uint16_t streamId{0};
+  int fusionIndex{-1};
+  double sampleRate{0.0};
+  std::string name;
+};
+
+/** Start of a process() call */
+struct RippleTraceProcess {
+  int64_t wallClockMs{0}; // System clock, as used for the refractory period
+  bool calibrate{false};  // Calibration was requested for this call
+};
+
+/** Detector state of a stream, so a replay starts where the plugin was */
+struct RippleTraceState {
+  bool isCalibrating{true};
+  bool pluginEnabled{true};
+  bool onRefractoryTime{false};
+  bool rippleDetected{false};
+  bool flagTimeThreshold{false};
+  bool flagMovMinTimeUp{false};
+  bool flagMovMinTimeDown{false};
+  bool filterBankActive{false};
+  bool stateGateActive{false};
+  bool fusedTtlOn{false};
+  int pointsProcessed{0};
+  unsigned int counterAboveThresh{0};
+  unsigned int counterMovUpThresh{0};
+  unsigned int counterMovDownThresh{0};
+  unsigned int movChannelGeneration{0};
+  unsigned int calibrationGeneration{0};
+  int artefactHoldCounter{0};
+  int fusedTtlLine{0};
+  int64_t fusedTtlOffSample{0};
+  bool fusionOffsetSet{false};
+  double fusionOffset{0.0};       // Sample clock minus the wall clock (s)
+  int64_t refractoryTimeStart{0}; // ms
+  int64_t rippleStartTime{0};     // ms
+  double randomNumber{0.0};
+  double rmsMean{0.0}, rmsStdDev{0.0}, threshold{0.0};
+  double movRmsMean{0.0}, movRmsStdDev{0.0}, movThreshold{0.0};
+  double artefactMean{0.0}, artefactStdDev{0.0}, artefactThreshold{0.0};
+  double refRmsMean{0.0}, refRmsStdDev{0.0}, refThreshold{0.0};
+};
+
+/** Input samples of one stream for one process() call */
+struct RippleTraceBlock {
+  uint16_t streamId{0};
+  int64_t firstSampleNumber{0};
+  int numSamples{0};
+  std::vector<int> channels;  // Global channel indices
+  std::vector<float> samples; // Channel-major
+
+  /** Returns the samples of a global channel, or nullptr if not recorded */
+  const float *getChannel(int globalIndex) const;
+};
+
+/** TTL event emitted by the detector */
+struct RippleTraceEvent {
+  uint16_t streamId{0};
+  int64_t sampleNumber{0};
+  int line{0};
+  bool state{false};
+
+  bool operator==(const RippleTraceEvent &other) const {
+    return streamId == other.streamId && sampleNumber == other.sampleNumber &&
+           line == other.line && state == other.state;
+  }
+  bool operator!=(const RippleTraceEvent &other) const {
+    return !(*this == other);
+  }
+};
+
+/**
+  Streams a block trace to disk without blocking the audio thread.
+
+  Records are copied into a preallocated single-producer / single-consumer
+  ring buffer and a background thread writes them out. When the ring is
+  full, records are dropped rather than waited for, and the writer notes how
+  many in a DROPPED record. Only one thread may write records at a time:
+  the message thread before acquisition starts, then the audio thread.
+**/
+class RippleTraceWriter {
+public:
+  static constexpr size_t defaultBufferBytes = 64 << 20;
+
+  ~RippleTraceWriter() { close(); }
+
+  /** Creates the trace file and starts the writer thread */
+  bool open(const std::string &path, std::string &error,
+            size_t bufferBytes = defaultBufferBytes);
+
+  /** Writes out the buffered records and closes the file */
+  void close();
+
+  bool isOpen() const { return running.load(std::memory_order_acquire); }
+
+  /** Records lost so far */
+  uint64_t getDroppedRecords() const {
+    return droppedRecords.load(std::memory_order_relaxed);
+  }
+
+  void writeStream(const RippleTraceStream &stream);
+  void writeProcess(const RippleTraceProcess &process);
+  void writeState(uint16_t streamId, const RippleTraceState &state);
+  void writeConfig(uint16_t streamId, const RippleDetectorConfig &config,
+                   const std::string &cnnModelPath);
+  void writeFusion(const RippleFusionConfig &config);
+  void writeBlock(uint16_t streamId, int64_t firstSampleNumber,
+                  int numSamples, const int *channels,
+                  const float *const *data, int numChannels);
+  void writeEvent(const RippleTraceEvent &event);
+  void writeRandom(uint16_t streamId, double value);
+
+private:
+  /** Reserves space for a record. Returns false, and counts a dropped
+   * record, if the ring is full */
+  bool beginRecord(TraceRecord type, size_t payloadBytes);
+  void append(const void *data, size_t bytes);
+  template <typename T> void append(const T &value) {
+    append(&value, sizeof(T));
+  }
+  /** Hands the record over to the writer thread */
+  void commitRecord();
+
+  void run();
+  void drain();
+
+  std::vector<uint8_t> ring;
+  size_t mask{0};
+  std::atomic<uint64_t> head{0}; // Bytes committed by the producer
+  std::atomic<uint64_t> tail{0}; // Bytes written out by the writer thread
+  uint64_t writePosition{0};     // Producer position inside a record
+
+  std::atomic<uint64_t> droppedRecords{0};
+  uint64_t reportedDrops{0}; // Writer thread only
+
+  FILE *file{nullptr};
+  std::thread thread;
+  std::atomic<bool> running{false};
+};
+
+/** Reads a block trace record by record */
+class RippleTraceReader {
+public:
+  /** Opens a trace and checks its header */
+  bool open(const std::string &path, std::string &error);
+
+  /** Reads the next record. Returns false at the end of the trace, or with
+   * error set if the trace is damaged */
+  bool next(TraceRecord &type, std::string &error);
+
+  // Decode the record returned by next(); false if it is malformed
+  bool readStream(RippleTraceStream &stream) const;
+  bool readProcess(RippleTraceProcess &process) const;
+  bool readState(uint16_t &streamId, RippleTraceState &state) const;
+  bool readConfig(uint16_t &streamId, RippleDetectorConfig &config,
+                  std::string &cnnModelPath) const;
+  bool readFusion(RippleFusionConfig &config) const;
+  bool readBlock(RippleTraceBlock &block) const;
+  bool readEvent(RippleTraceEvent &event) const;
+  bool readRandom(uint16_t &streamId, double &value) const;
+  bool readDropped(uint64_t &count) const;
+
+private:
+  std::ifstream file;
+  std::vector<uint8_t> payload;
+};
+
+#endif
@@ -0,0 +1,73 @@
+"""Writes weights files for the ripple detector's CNN engine.
+
+A network is a stack of 1D convolutions over a single-channel window of
+``input_length`` samples at ``sample_rate``. The last layer must reduce the
+window to a single value, the logit of a ripple. Layer weights are indexed
+``[out_channel][kernel][in_channel]``; NumPy arrays or nested lists both work.
+
+Quantized layers store int8 weights with one scale per output channel, and
+quantize their input with ``input_scale``, the activation value of one int8
+step. Pick it from the largest activation seen on training data, e.g.
+``max(abs(activations)) / 127``.
+"""
+
+import struct
+
+MAGIC = b"RPLCNN01"
+VERSION = 1
+
+
+def _tolist(values):
+    return values.tolist() if hasattr(values, "tolist") else values
+
+
+def _flatten(weights):
+    flat = []
+    for kernel in weights:
+        for step in kernel:
+            flat.extend(float(w) for w in step)
+    return flat
+
+
+def conv(weights, bias, stride=1, relu=True, quantize=False, input_scale=1.0):
+    """Describes one convolution layer for write_model()."""
+    return {
+        "weights": [[list(s) for s in k] for k in _tolist(weights)],
+        "bias": [float(b) for b in _tolist(bias)],
+        "stride": int(stride),
+        "relu": bool(relu),
+        "quantize": bool(quantize),
+        "input_scale": float(input_scale),
+    }
+
+
+def write_model(path, sample_rate, input_length, layers, input_scale=1.0):
+    """Writes a network. ``input_scale`` multiplies the input microvolts."""
+    with open(path, "wb") as out:
+        out.write(MAGIC)
+        out.write(struct.pack("<IfIIfI", VERSION, sample_rate, input_length,
+                              1, input_scale, len(layers)))
+        for layer in layers:
+            weights = layer["weights"]
+            out_channels = len(weights)
+            kernel_size = len(weights[0])
+            out.write(struct.pack("<IIIIIf", int(layer["quantize"]),
+                                  out_channels, kernel_size, layer["stride"],
+                                  int(layer["relu"]), layer["input_scale"]))
+            out.write(struct.pack("<%df" % out_channels, *layer["bias"]))
+
+            if not layer["quantize"]:
+                flat = _flatten(weights)
+                out.write(struct.pack("<%df" % len(flat), *flat))
+                continue
+
+            # Symmetric per-output-channel quantization
+            scales, quantized = [], []
+            for kernel in weights:
+                flat = _flatten([kernel])
+                scale = max(abs(w) for w in flat) / 127.0 or 1.0
+                scales.append(scale)
+                quantized.extend(max(-127, min(127, round(w / scale)))
+                                 for w in flat)
+            out.write(struct.pack("<%df" % out_channels, *scales))
+            out.write(struct.pack("<%db" % len(quantized), *quantized))
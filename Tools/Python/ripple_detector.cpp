@@ -0,0 +1,465 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "../RippleReplay/ReplayDetector.h"
+#include "../RippleSidecar/SidecarParams.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Python bindings to the detector the replay and the sidecar run
+// (ReplayDetector), fed block by block with a clock taken from the sample
+// numbers. Recordings are read through the buffer protocol, so NumPy arrays
+// and np.memmap views of continuous.dat are processed in place, with the GIL
+// released.
+
+/** Sample formats accepted from the buffer protocol */
+enum class SampleFormat { INT16, FLOAT32, FLOAT64 };
+
+// Parse a buffer format string ("h", "<f", "=d", ...)
+static bool parseFormat(const char *format, SampleFormat &sampleFormat) {
+  if (!format)
+    format = "B";
+  if (*format == '@' || *format == '=' || *format == '<')
+    format++;
+  if (!strcmp(format, "h"))
+    sampleFormat = SampleFormat::INT16;
+  else if (!strcmp(format, "f"))
+    sampleFormat = SampleFormat::FLOAT32;
+  else if (!strcmp(format, "d"))
+    sampleFormat = SampleFormat::FLOAT64;
+  else
+    return false;
+  return true;
+}
+
+template <typename T>
+static inline float readSample(const char *row, Py_ssize_t offset) {
+  T value;
+  memcpy(&value, row + offset, sizeof(T));
+  return (float)value;
+}
+
+/** Recording, detector parameters and options of one call */
+struct BoundSession {
+  Py_buffer view{};
+  bool hasView{false};
+  SampleFormat format{SampleFormat::INT16};
+  RippleRingStream stream;
+  int blockSamples{1024};
+  double calibrationSeconds{10.0};
+
+  SidecarParams params;
+  RippleDetectorConfig config;
+  std::string cnnModelPath;
+  bool hasRmsMean{false}, hasRmsStdDev{false};
+  double rmsMean{0.0}, rmsStdDev{0.0};
+
+  ~BoundSession() {
+    if (hasView)
+      PyBuffer_Release(&view);
+  }
+};
+
+// Text of a parameter value, as SidecarParams takes it: booleans switch
+// ON/OFF parameters and sequences list channels
+static bool parameterText(PyObject *value, std::string &text) {
+  if (PyBool_Check(value)) {
+    text = value == Py_True ? "ON" : "OFF";
+    return true;
+  }
+  if (PyList_Check(value) || PyTuple_Check(value)) {
+    text.clear();
+    for (Py_ssize_t idx = 0; idx < PySequence_Fast_GET_SIZE(value); idx++) {
+      std::string item;
+      if (!parameterText(PySequence_Fast_GET_ITEM(value, idx), item))
+        return false;
+      text += (idx ? "," : "") + item;
+    }
+    return true;
+  }
+  PyObject *str = PyObject_Str(value);
+  if (!str)
+    return false;
+  const char *utf8 = PyUnicode_AsUTF8(str);
+  if (utf8)
+    text = utf8;
+  Py_DECREF(str);
+  return utf8 != nullptr;
+}
+
+// Set a plugin parameter. Returns false with a Python exception set if the
+// name is unknown or the value does not parse
+static bool setParameter(BoundSession &bound, const std::string &name,
+                         PyObject *value) {
+  std::string text, error;
+  if (!parameterText(value, text))
+    return false;
+  if (!bound.params.set(name + "=" + text, error)) {
+    PyErr_SetString(PyExc_ValueError, error.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Set one keyword argument: an option of the bindings, one of the older
+// aliases, or a plugin parameter
+static bool setKeyword(BoundSession &bound, const std::string &name,
+                       PyObject *value) {
+  if (name == "bit_volts") {
+    bound.stream.bitVolts = PyFloat_AsDouble(value);
+    return !PyErr_Occurred();
+  }
+  if (name == "block_samples") {
+    bound.blockSamples = (int)PyLong_AsLong(value);
+    return !PyErr_Occurred();
+  }
+  if (name == "calibration") {
+    bound.calibrationSeconds = PyFloat_AsDouble(value);
+    return !PyErr_Occurred();
+  }
+
+  // A baseline from the rig replaces the calibrated one once the calibration
+  // ends, as when it is typed into the plugin
+  if (name == "rms_mean" || name == "RMS_mean") {
+    bound.hasRmsMean = value != Py_None;
+    bound.rmsMean = bound.hasRmsMean ? PyFloat_AsDouble(value) : 0.0;
+    return !PyErr_Occurred();
+  }
+  if (name == "rms_std" || name == "RMS_std") {
+    bound.hasRmsStdDev = value != Py_None;
+    bound.rmsStdDev = bound.hasRmsStdDev ? PyFloat_AsDouble(value) : 0.0;
+    return !PyErr_Occurred();
+  }
+
+  if (name == "ripple_channel")
+    return setParameter(bound, "Ripple_Input", value);
+
+  // One movement channel is EMG, several are accelerometer axes
+  if (name == "movement_channels") {
+    if (value == Py_None)
+      return true;
+    PyObject *sequence = PySequence_Fast(
+        value, "movement_channels must be a sequence of channel indices");
+    if (!sequence)
+      return false;
+    const Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+    bool valid = true;
+    if (count == 1) {
+      PyObject *mode = PyUnicode_FromString("EMG");
+      valid = mode && setParameter(bound, "mov_detect", mode) &&
+              setParameter(bound, "mov_input", sequence);
+      Py_XDECREF(mode);
+    } else if (count > 1) {
+      PyObject *mode = PyUnicode_FromString("ACC");
+      valid = mode && setParameter(bound, "mov_detect", mode) &&
+              setParameter(bound, "aux_input", sequence);
+      Py_XDECREF(mode);
+    }
+    Py_DECREF(sequence);
+    return valid;
+  }
+
+  return setParameter(bound, name, value);
+}
+
+// Acquire the recording buffer and compile the keyword arguments into a
+// parameter snapshot. Returns false with a Python exception set on failure
+static bool bindSession(BoundSession &bound, PyObject *args,
+                        PyObject *kwargs) {
+
+  PyObject *data;
+  double sampleRate;
+  if (!PyArg_ParseTuple(args, "Od", &data, &sampleRate))
+    return false;
+  bound.stream.sampleRate = sampleRate;
+  bound.stream.bitVolts = 1.0;
+
+  if (PyObject_GetBuffer(data, &bound.view, PyBUF_STRIDED_RO | PyBUF_FORMAT))
+    return false;
+  bound.hasView = true;
+
+  if (bound.view.ndim != 1 && bound.view.ndim != 2) {
+    PyErr_SetString(PyExc_ValueError,
+                    "data must be 1-D (samples) or 2-D (samples, channels)");
+    return false;
+  }
+  if (!parseFormat(bound.view.format, bound.format)) {
+    PyErr_SetString(PyExc_TypeError,
+                    "data must hold int16, float32 or float64 samples");
+    return false;
+  }
+  bound.stream.numChannels =
+      (uint32_t)(bound.view.ndim == 2 ? bound.view.shape[1] : 1);
+
+  if (kwargs) {
+    PyObject *key, *value;
+    Py_ssize_t position = 0;
+    while (PyDict_Next(kwargs, &position, &key, &value)) {
+      const char *name = PyUnicode_AsUTF8(key);
+      if (!name || !setKeyword(bound, name, value))
+        return false;
+    }
+  }
+
+  if (bound.stream.sampleRate <= 0) {
+    PyErr_SetString(PyExc_ValueError, "sample_rate must be positive");
+    return false;
+  }
+  if (bound.blockSamples < 1) {
+    PyErr_SetString(PyExc_ValueError, "block_samples must be at least 1");
+    return false;
+  }
+  if (bound.calibrationSeconds < 0) {
+    PyErr_SetString(PyExc_ValueError, "calibration must not be negative");
+    return false;
+  }
+  bound.stream.maxSamples = (uint32_t)bound.blockSamples;
+
+  std::string error;
+  if (!bound.params.compile(bound.stream, bound.config, bound.cnnModelPath,
+                            error)) {
+    PyErr_SetString(PyExc_ValueError, error.c_str());
+    return false;
+  }
+  bound.config.calibrationPoints =
+      (int)std::ceil(bound.stream.sampleRate * bound.calibrationSeconds);
+  return true;
+}
+
+// Channels the detector reads, so blocks carry only those
+static std::vector<int> usedChannels(const RippleDetectorConfig &config) {
+  std::vector<int> channels = {config.rippleInputChannel,
+                               config.movementInputChannel,
+                               config.stateInputChannel};
+  channels.insert(channels.end(), config.auxChannelIndices.begin(),
+                  config.auxChannelIndices.end());
+  channels.insert(channels.end(), config.referenceChannels.begin(),
+                  config.referenceChannels.end());
+  channels.erase(std::remove(channels.begin(), channels.end(), -1),
+                 channels.end());
+  std::sort(channels.begin(), channels.end());
+  channels.erase(std::unique(channels.begin(), channels.end()),
+                 channels.end());
+  return channels;
+}
+
+// Feed the recording to the detector in blocks of block_samples, timed by
+// their sample numbers as ripple-sidecar --sample-clock does. Stops at the
+// end of the calibration if untilCalibrated
+template <typename T>
+static void runBlocks(BoundSession &bound, ReplayDetector &detector,
+                      bool untilCalibrated) {
+  const Py_buffer &view = bound.view;
+  const char *base = (const char *)view.buf;
+  const Py_ssize_t frameStride = view.strides[0];
+  const Py_ssize_t channelStride = view.ndim == 2 ? view.strides[1] : 0;
+  const float bitVolts = (float)bound.stream.bitVolts;
+  const bool replaceBaseline = bound.hasRmsMean || bound.hasRmsStdDev;
+
+  RippleTraceBlock block;
+  block.channels = usedChannels(bound.config);
+  block.samples.resize(block.channels.size() * bound.blockSamples);
+
+  bool calibrating = true;
+  for (Py_ssize_t first = 0; first < view.shape[0];
+       first += bound.blockSamples) {
+    const int count =
+        (int)std::min<Py_ssize_t>(bound.blockSamples, view.shape[0] - first);
+    for (size_t ch = 0; ch < block.channels.size(); ch++) {
+      float *dest = block.samples.data() + ch * count;
+      const char *src = base + first * frameStride +
+                        block.channels[ch] * channelStride;
+      for (int idx = 0; idx < count; idx++, src += frameStride)
+        dest[idx] = readSample<T>(src, 0) * bitVolts;
+    }
+    block.firstSampleNumber = first;
+    block.numSamples = count;
+
+    const int64_t wallClockMs =
+        (int64_t)(first * 1000 / bound.stream.sampleRate);
+    detector.processLive(block, wallClockMs, first == 0);
+
+    if (!calibrating || detector.isCalibrating(block.streamId))
+      continue;
+    calibrating = false;
+    if (untilCalibrated)
+      return;
+    if (replaceBaseline) {
+      const RippleTraceState *state = detector.getState(block.streamId);
+      bound.config.rmsMean = bound.hasRmsMean ? bound.rmsMean : state->rmsMean;
+      bound.config.rmsStdDev =
+          bound.hasRmsStdDev ? bound.rmsStdDev : state->rmsStdDev;
+      detector.updateConfig(block.streamId, bound.config, bound.cnnModelPath);
+    }
+  }
+}
+
+// Run the detector over the bound recording without the GIL. Returns false
+// with a Python exception set on failure
+static bool runDetector(BoundSession &bound, ReplayDetector &detector,
+                        ReplayResult &result, bool untilCalibrated) {
+  RippleTraceStream info;
+  info.sampleRate = bound.stream.sampleRate;
+  info.name = "python";
+
+  std::string error;
+  Py_BEGIN_ALLOW_THREADS;
+  try {
+    detector.beginLive(result, RippleFusionConfig());
+    detector.addStream(info, bound.config, bound.cnnModelPath);
+    switch (bound.format) {
+    case SampleFormat::INT16:
+      runBlocks<int16_t>(bound, detector, untilCalibrated);
+      break;
+    case SampleFormat::FLOAT32:
+      runBlocks<float>(bound, detector, untilCalibrated);
+      break;
+    case SampleFormat::FLOAT64:
+      runBlocks<double>(bound, detector, untilCalibrated);
+      break;
+    }
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+  Py_END_ALLOW_THREADS;
+
+  if (!error.empty()) {
+    PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    return false;
+  }
+  for (const std::string &warning : result.warnings)
+    if (PyErr_WarnEx(PyExc_RuntimeWarning, warning.c_str(), 1))
+      return false;
+  if (detector.isCalibrating(info.streamId)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "the recording is shorter than the calibration");
+    return false;
+  }
+  return true;
+}
+
+// Add the calibration statistics to a result dictionary
+static bool addCalibration(PyObject *result, const RippleTraceState &state) {
+  const std::pair<const char *, double> values[] = {
+      {"rms_mean", state.rmsMean},         {"rms_std", state.rmsStdDev},
+      {"mov_mean", state.movRmsMean},      {"mov_std", state.movRmsStdDev},
+      {"slope_mean", state.artefactMean},  {"slope_std", state.artefactStdDev},
+      {"ref_mean", state.refRmsMean},      {"ref_std", state.refRmsStdDev}};
+
+  for (const auto &value : values) {
+    PyObject *number = PyFloat_FromDouble(value.second);
+    if (!number || PyDict_SetItemString(result, value.first, number)) {
+      Py_XDECREF(number);
+      return false;
+    }
+    Py_DECREF(number);
+  }
+  return true;
+}
+
+static PyObject *calibrate(PyObject *, PyObject *args, PyObject *kwargs) {
+  BoundSession bound;
+  if (!bindSession(bound, args, kwargs))
+    return nullptr;
+
+  ReplayDetector detector;
+  ReplayResult replay;
+  if (!runDetector(bound, detector, replay, true))
+    return nullptr;
+
+  PyObject *result = PyDict_New();
+  if (!result || !addCalibration(result, *detector.getState(0))) {
+    Py_XDECREF(result);
+    return nullptr;
+  }
+  return result;
+}
+
+static PyObject *detect(PyObject *, PyObject *args, PyObject *kwargs) {
+  BoundSession bound;
+  if (!bindSession(bound, args, kwargs))
+    return nullptr;
+
+  ReplayDetector detector;
+  ReplayResult replay;
+  if (!runDetector(bound, detector, replay, false))
+    return nullptr;
+
+  const std::vector<ReplayDetection> &detections = replay.detections;
+  const std::vector<RippleTraceEvent> &events = replay.replayedEvents;
+  PyObject *samples = PyList_New(detections.size());
+  PyObject *blocked = PyList_New(detections.size());
+  PyObject *ttl = PyList_New(events.size());
+  PyObject *result = PyDict_New();
+  if (!samples || !blocked || !ttl || !result) {
+    Py_XDECREF(samples);
+    Py_XDECREF(blocked);
+    Py_XDECREF(ttl);
+    Py_XDECREF(result);
+    return nullptr;
+  }
+  for (size_t idx = 0; idx < detections.size(); idx++) {
+    PyList_SET_ITEM(samples, idx,
+                    PyLong_FromLongLong(detections[idx].sampleNumber));
+    PyList_SET_ITEM(blocked, idx, PyBool_FromLong(detections[idx].blocked));
+  }
+  for (size_t idx = 0; idx < events.size(); idx++)
+    PyList_SET_ITEM(ttl, idx,
+                    Py_BuildValue("(LiO)", (long long)events[idx].sampleNumber,
+                                  events[idx].line,
+                                  events[idx].state ? Py_True : Py_False));
+
+  const RippleTraceState &state = *detector.getState(0);
+  PyObject *threshold = PyFloat_FromDouble(state.threshold);
+  const bool failed = !threshold ||
+                      PyDict_SetItemString(result, "samples", samples) ||
+                      PyDict_SetItemString(result, "blocked", blocked) ||
+                      PyDict_SetItemString(result, "events", ttl) ||
+                      PyDict_SetItemString(result, "threshold", threshold) ||
+                      !addCalibration(result, state);
+  Py_DECREF(samples);
+  Py_DECREF(blocked);
+  Py_DECREF(ttl);
+  Py_XDECREF(threshold);
+  if (failed) {
+    Py_DECREF(result);
+    return nullptr;
+  }
+  return result;
+}
+
+static PyMethodDef methods[] = {
+    {"calibrate", (PyCFunction)(void (*)(void))calibrate,
+     METH_VARARGS | METH_KEYWORDS,
+     "calibrate(data, sample_rate, *, bit_volts=1.0, block_samples=1024, "
+     "calibration=10.0, ripple_channel=0, movement_channels=None, "
+     "**params)\n\n"
+     "Baseline statistics of the first `calibration` seconds, as computed by "
+     "the plugin's calibration step."},
+    {"detect", (PyCFunction)(void (*)(void))detect,
+     METH_VARARGS | METH_KEYWORDS,
+     "detect(data, sample_rate, *, bit_volts=1.0, block_samples=1024, "
+     "calibration=10.0, ripple_channel=0, movement_channels=None, "
+     "rms_mean=None, rms_std=None, **params)\n\n"
+     "Runs the detector over a recording and returns the detection samples, "
+     "whether movement blocked each one, the TTL events as (sample, line, "
+     "state) with zero-based lines, and the calibration statistics."},
+    {nullptr, nullptr, 0, nullptr}};
+
+static PyModuleDef moduleDef = {
+    PyModuleDef_HEAD_INIT, "ripple_detector",
+    "Offline ripple detector, running the detection logic of the Open Ephys "
+    "plugin.\n\n"
+    "data is any buffer (NumPy array, np.memmap of continuous.dat) of int16, "
+    "float32 or float64 samples, shaped (samples,) or (samples, channels). "
+    "It is read in place, in blocks of block_samples timed by their sample "
+    "numbers, and the GIL is released while processing. Other keyword "
+    "arguments are plugin parameters (ripple_std, refr_time, filter_bank, "
+    "ref_input, state_gate, detector, cnn_model, ...), with channels given "
+    "as indices into data.",
+    -1, methods};
+
+PyMODINIT_FUNC PyInit_ripple_detector() { return PyModule_Create(&moduleDef); }
@@ -0,0 +1,38 @@
+# Builds the ripple_detector Python module:
+#   pip install Tools/Python
+import sys
+
+from setuptools import Extension, setup
+
+if sys.platform == "win32":
+    compile_args = ["/std:c++17", "/O2"]
+    link_args = []
+else:
+    compile_args = ["-std=c++17", "-O3", "-pthread"]
+    link_args = ["-pthread"]
+
+setup(
+    name="ripple_detector",
+    version="0.1.0",
+    description="Offline Open Ephys ripple detector",
+    py_modules=["ripple_cnn"],
+    ext_modules=[
+        Extension(
+            "ripple_detector",
+            sources=[
+                "ripple_detector.cpp",
+                "../RippleReplay/ReplayDetector.cpp",
+                "../RippleSidecar/SidecarParams.cpp",
+                "../../RippleBrainState.cpp",
+                "../../RippleCnn.cpp",
+                "../../RippleDetectionCore.cpp",
+                "../../RippleFilterBank.cpp",
+                "../../RippleFusion.cpp",
+                "../../RippleTrace.cpp",
+            ],
+            extra_compile_args=compile_args,
+            extra_link_args=link_args,
+            language="c++",
+        )
+    ],
+)
@@ -0,0 +1,320 @@
+#include "ReplayDetector.h"
+
+#include <algorithm>
+
+// Hands what the detector does with a block over to the result
+class ReplayDetector::Listener : public RippleDetectionListener {
+public:
+  Listener(ReplayDetector &replay_, Stream &s_, const RippleTraceBlock &block_)
+      : replay(replay_), s(s_), block(block_) {}
+
+  void ttlEvent(int line, int64_t sampleNumber, bool state,
+                int /*sampleIndex*/) override {
+    replay.result->replayedEvents.push_back(
+        {s.info.streamId, sampleNumber, line, state});
+  }
+
+  // A detection the plugin did not make has no recorded draw
+  double drawPercent() override {
+    if (replay.live)
+      return replay.distribute(replay.generator);
+    if (s.draws.empty()) {
+      replay.result->missingDraws++;
+      return 0.0;
+    }
+    const double value = s.draws.front();
+    s.draws.pop_front();
+    return value;
+  }
+
+  void detection(const RippleWindowResult &window) override {
+    replay.result->detections.push_back(
+        {s.info.streamId,
+         block.firstSampleNumber + window.start + window.numSamples - 1,
+         window.blocked});
+  }
+
+  void calibrationFinished() override {
+    const int rmsSamples = std::min(s.config.rmsSamples, block.numSamples);
+    if (s.core.getNumCalibrationWindows() == 0 ||
+        (int64_t)s.core.getNumCalibrationWindows() * rmsSamples <
+            s.config.calibrationPoints)
+      replay.result->warnings.push_back(
+          "Stream " + std::to_string(s.info.streamId) +
+          ": calibration started before the trace, its statistics are "
+          "approximate");
+  }
+
+private:
+  ReplayDetector &replay;
+  Stream &s;
+  const RippleTraceBlock &block;
+};
+
+bool ReplayDetector::run(const std::string &path, ReplayResult &replay,
+                         std::string &error) {
+  RippleTraceReader reader;
+  if (!reader.open(path, error))
+    return false;
+
+  result = &replay;
+  live = false;
+  streams.clear();
+  fusionConfig = RippleFusionConfig();
+  currentCall = RippleTraceProcess();
+
+  // A block is processed once the events and draws that follow it in the
+  // trace, which the plugin emitted while processing it, have been read
+  RippleTraceBlock block;
+  Stream *blockStream = nullptr;
+  auto flushBlock = [&]() {
+    if (blockStream != nullptr)
+      processBlock(*blockStream, block);
+    blockStream = nullptr;
+  };
+
+  TraceRecord type;
+  int numFusionStreams = 0;
+  while (reader.next(type, error)) {
+    if (type != TraceRecord::EVENT && type != TraceRecord::RANDOM &&
+        type != TraceRecord::DROPPED)
+      flushBlock();
+
+    bool valid = true;
+    uint16_t streamId = 0;
+    switch (type) {
+    case TraceRecord::STREAM: {
+      RippleTraceStream info;
+      valid = reader.readStream(info);
+      if (!valid)
+        break;
+      Stream &s = streams[info.streamId];
+      s.info = info;
+      s.core.prepare(info.sampleRate, &rippleFusion, info.fusionIndex);
+      numFusionStreams = std::max(numFusionStreams, info.fusionIndex + 1);
+      rippleFusion.prepare(numFusionStreams);
+      replay.streams.push_back(info);
+      break;
+    }
+    case TraceRecord::PROCESS:
+      valid = reader.readProcess(currentCall);
+      replay.processCalls++;
+      break;
+    case TraceRecord::STATE: {
+      RippleTraceState state;
+      valid = reader.readState(streamId, state);
+      Stream *s = valid ? findStream(streamId, error) : nullptr;
+      if (s == nullptr)
+        break;
+      s->core.getState() = state;
+      s->restoring = true;
+      break;
+    }
+    case TraceRecord::CONFIG: {
+      RippleDetectorConfig config;
+      std::string cnnModelPath;
+      valid = reader.readConfig(streamId, config, cnnModelPath);
+      Stream *s = valid ? findStream(streamId, error) : nullptr;
+      if (s == nullptr)
+        break;
+      s->config = config;
+      loadCnnModel(*s, cnnModelPath);
+      applyConfig(*s);
+      break;
+    }
+    case TraceRecord::FUSION:
+      valid = reader.readFusion(fusionConfig);
+      break;
+    case TraceRecord::BLOCK: {
+      valid = reader.readBlock(block);
+      Stream *s = valid ? findStream(block.streamId, error) : nullptr;
+      if (s == nullptr)
+        break;
+      if (s->nextSampleNumber >= 0 &&
+          block.firstSampleNumber != s->nextSampleNumber)
+        replay.sampleGaps++;
+      s->nextSampleNumber = block.firstSampleNumber + block.numSamples;
+      s->draws.clear();
+      blockStream = s;
+      break;
+    }
+    case TraceRecord::EVENT: {
+      RippleTraceEvent event;
+      valid = reader.readEvent(event);
+      replay.recordedEvents.push_back(event);
+      break;
+    }
+    case TraceRecord::RANDOM: {
+      double value;
+      valid = reader.readRandom(streamId, value);
+      Stream *s = valid ? findStream(streamId, error) : nullptr;
+      if (s != nullptr)
+        s->draws.push_back(value);
+      break;
+    }
+    case TraceRecord::DROPPED: {
+      uint64_t count;
+      valid = reader.readDropped(count);
+      replay.droppedRecords += count;
+      break;
+    }
+    default:
+      // Newer record types carry nothing the replay needs
+      break;
+    }
+
+    if (!valid)
+      error = "Malformed record of type " + std::to_string((int)type);
+    if (!error.empty())
+      return false;
+  }
+  if (!error.empty())
+    return false;
+
+  flushBlock();
+  return true;
+}
+
+void ReplayDetector::beginLive(ReplayResult &replay,
+                               const RippleFusionConfig &fusion) {
+  result = &replay;
+  live = true;
+  streams.clear();
+  fusionConfig = fusion;
+  currentCall = RippleTraceProcess();
+}
+
+void ReplayDetector::addStream(const RippleTraceStream &info,
+                               const RippleDetectorConfig &config,
+                               const std::string &cnnModelPath) {
+  Stream &s = streams[info.streamId];
+  s.info = info;
+  s.core.prepare(info.sampleRate, &rippleFusion, info.fusionIndex);
+
+  int numFusionStreams = 0;
+  for (const auto &entry : streams)
+    numFusionStreams =
+        std::max(numFusionStreams, entry.second.info.fusionIndex + 1);
+  rippleFusion.prepare(numFusionStreams);
+  result->streams.push_back(info);
+
+  s.config = config;
+  loadCnnModel(s, cnnModelPath);
+  applyConfig(s);
+}
+
+bool ReplayDetector::updateConfig(uint16_t streamId,
+                                  const RippleDetectorConfig &config,
+                                  const std::string &cnnModelPath) {
+  auto it = streams.find(streamId);
+  if (it == streams.end())
+    return false;
+
+  it->second.config = config;
+  loadCnnModel(it->second, cnnModelPath);
+  applyConfig(it->second);
+  return true;
+}
+
+bool ReplayDetector::processLive(const RippleTraceBlock &block,
+                                 int64_t wallClockMs, bool calibrate) {
+  auto it = streams.find(block.streamId);
+  if (it == streams.end())
+    return false;
+
+  currentCall.wallClockMs = wallClockMs;
+  currentCall.calibrate = calibrate;
+  result->processCalls++;
+  it->second.nextSampleNumber = block.firstSampleNumber + block.numSamples;
+  processBlock(it->second, block);
+  return true;
+}
+
+bool ReplayDetector::isCalibrating(uint16_t streamId) const {
+  auto it = streams.find(streamId);
+  return it != streams.end() && it->second.core.getState().isCalibrating;
+}
+
+const RippleTraceState *ReplayDetector::getState(uint16_t streamId) const {
+  auto it = streams.find(streamId);
+  return it != streams.end() ? &it->second.core.getState() : nullptr;
+}
+
+ReplayDetector::Stream *ReplayDetector::findStream(uint16_t streamId,
+                                                   std::string &error) {
+  auto it = streams.find(streamId);
+  if (it != streams.end())
+    return &it->second;
+  error = "Record for undeclared stream " + std::to_string(streamId);
+  return nullptr;
+}
+
+// As RippleDetector::loadCnnModel, without the message boxes
+void ReplayDetector::loadCnnModel(Stream &s, const std::string &path) {
+  if (path == s.cnnModelPath)
+    return;
+  s.cnnModelPath = path;
+  s.cnnRunner.reset();
+
+  std::string cnnError;
+  std::shared_ptr<const RippleCnnModel> model;
+  if (!path.empty())
+    model = RippleCnnModel::load(path, cnnError);
+  if (model != nullptr) {
+    s.cnnRunner = std::make_unique<RippleCnn>();
+    if (!s.cnnRunner->prepare(model, s.info.sampleRate, cnnError))
+      s.cnnRunner.reset();
+  }
+  if (!cnnError.empty())
+    result->warnings.push_back("Stream " + std::to_string(s.info.streamId) +
+                               ": " + cnnError);
+}
+
+// The snapshot recorded right after STATE was already applied when the
+// state was taken, so only what the state does not hold is derived from it
+void ReplayDetector::applyConfig(Stream &s) {
+  s.core.applyConfig(s.config, s.cnnRunner.get(), s.restoring);
+  s.restoring = false;
+}
+
+void ReplayDetector::processBlock(Stream &s, const RippleTraceBlock &block) {
+  ReplayBlock listed;
+  listed.processCall = result->processCalls;
+  listed.wallClockMs = currentCall.wallClockMs;
+  listed.calibrate = currentCall.calibrate;
+  listed.streamId = block.streamId;
+  listed.firstSampleNumber = block.firstSampleNumber;
+  listed.numSamples = block.numSamples;
+
+  // The block's channels, by global index as in the plugin's buffer
+  s.channels.clear();
+  for (int channel : block.channels) {
+    if (channel < 0)
+      continue;
+    if ((size_t)channel >= s.channels.size())
+      s.channels.resize(channel + 1, nullptr);
+    s.channels[channel] = block.getChannel(channel);
+  }
+
+  RippleDetectionBlock detectionBlock;
+  detectionBlock.channels = s.channels.data();
+  detectionBlock.numChannels = (int)s.channels.size();
+  detectionBlock.firstSampleNumber = block.firstSampleNumber;
+  detectionBlock.numSamples = block.numSamples;
+  detectionBlock.wallClockMs = currentCall.wallClockMs;
+  detectionBlock.calibrate = currentCall.calibrate;
+  detectionBlock.fusionConfig = &fusionConfig;
+
+  if (s.config.rippleInputChannel >= 0 && block.numSamples > 0 &&
+      detectionBlock.getChannel(s.config.rippleInputChannel) == nullptr)
+    result->warnings.push_back("Block at sample " +
+                               std::to_string(block.firstSampleNumber) +
+                               " lacks the ripple channel");
+
+  Listener listener(*this, s, block);
+  s.core.process(detectionBlock, listener);
+
+  listed.calibrating = s.core.getState().isCalibrating;
+  if (!live)
+    result->blocks.push_back(listed);
+}
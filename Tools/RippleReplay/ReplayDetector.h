@@ -0,0 +1,131 @@
+#ifndef __RIPPLE_REPLAY_DETECTOR_H
+#define __RIPPLE_REPLAY_DETECTOR_H
+
+#include "../../RippleCnn.h"
+#include "../../RippleDetectionCore.h"
+#include "../../RippleFusion.h"
+#include "../../RippleTrace.h"
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+/** Block as seen by the replay, for the block listing */
+struct ReplayBlock {
+  int processCall{0};
+  int64_t wallClockMs{0};
+  bool calibrate{false};
+  uint16_t streamId{0};
+  int64_t firstSampleNumber{0};
+  int numSamples{0};
+  bool calibrating{false}; // Stream was calibrating after the block
+};
+
+/** Detection made by the replay, whether or not it reached the outputs */
+struct ReplayDetection {
+  uint16_t streamId{0};
+  int64_t sampleNumber{0}; // Last sample of the window it was made on
+  bool blocked{false};     // Movement had disabled the outputs
+};
+
+/** Outcome of a replay */
+struct ReplayResult {
+  std::vector<RippleTraceStream> streams;
+  std::vector<ReplayBlock> blocks;
+  std::vector<RippleTraceEvent> recordedEvents;
+  std::vector<RippleTraceEvent> replayedEvents;
+  std::vector<ReplayDetection> detections;
+  int processCalls{0};
+  uint64_t droppedRecords{0};  // Records the plugin could not write
+  int sampleGaps{0};           // Blocks not contiguous with the previous one
+  int missingDraws{0};         // Detections replayed without a recorded draw
+  std::vector<std::string> warnings;
+};
+
+/**
+  Feeds a block trace back through RippleDetectionCore, the detection logic
+  of RippleDetector::process(), block by block and as fast as the CPU allows.
+
+  Every block is processed with the parameter snapshot, calibration requests,
+  wall-clock time and ttl_percent draws the plugin recorded, starting from the
+  detector state it had when tracing began. The TTL events emitted here can
+  then be compared with the ones the plugin emitted.
+
+  Blocks can also be pushed live, without a trace, as the Python bindings
+  do. The caller then declares the streams, supplies the wall-clock time of
+  each block, and the ttl_percent draws are made here as in the plugin. The
+  spectral monitor, ripple-triggered averages, shadow detectors and health
+  counters do not affect detection and are not replayed.
+**/
+class ReplayDetector {
+public:
+  /** Replays a trace. Returns false and sets error if it cannot be read */
+  bool run(const std::string &path, ReplayResult &result, std::string &error);
+
+  /** Starts a live run. Events and detections go to result.replayedEvents
+   * and result.detections, which the caller may drain between blocks; blocks
+   * are not listed */
+  void beginLive(ReplayResult &result, const RippleFusionConfig &fusion);
+
+  /** Declares a stream of a live run, calibrating from its first block.
+   * cnnModelPath is loaded for the CNN detector, if not empty */
+  void addStream(const RippleTraceStream &info,
+                 const RippleDetectorConfig &config,
+                 const std::string &cnnModelPath);
+
+  /** Replaces the parameter snapshot of a stream of a live run, as a
+   * parameter change in the plugin. Returns false if the stream was not
+   * declared */
+  bool updateConfig(uint16_t streamId, const RippleDetectorConfig &config,
+                    const std::string &cnnModelPath);
+
+  /** Processes one block of a live run, as a process() call at the given
+   * wall-clock time. Returns false if its stream was not declared */
+  bool processLive(const RippleTraceBlock &block, int64_t wallClockMs,
+                   bool calibrate);
+
+  /** Whether a stream of a live run is still calibrating */
+  bool isCalibrating(uint16_t streamId) const;
+
+  /** Detector state of a stream, or nullptr if it was not declared */
+  const RippleTraceState *getState(uint16_t streamId) const;
+
+private:
+  /** A stream and its detector */
+  struct Stream {
+    RippleTraceStream info;
+    RippleDetectorConfig config;
+    RippleDetectionCore core;
+    bool restoring{false}; // The next snapshot is the one STATE was taken
+                           // with, and is already applied
+
+    std::string cnnModelPath;
+    std::unique_ptr<RippleCnn> cnnRunner; // Runner for cnnModelPath
+
+    int64_t nextSampleNumber{-1};
+    std::deque<double> draws; // Recorded ttl_percent draws of the block
+    std::vector<const float *> channels; // Block samples by global channel
+  };
+
+  class Listener;
+
+  Stream *findStream(uint16_t streamId, std::string &error);
+  void loadCnnModel(Stream &s, const std::string &path);
+  void applyConfig(Stream &s);
+  void processBlock(Stream &s, const RippleTraceBlock &block);
+
+  std::map<uint16_t, Stream> streams;
+  RippleFusionConfig fusionConfig;
+  RippleFusion rippleFusion;
+  RippleTraceProcess currentCall;
+  ReplayResult *result{nullptr};
+
+  // Live runs draw for ttl_percent as the plugin does
+  bool live{false};
+  std::mt19937 generator{std::random_device{}()};
+  std::uniform_int_distribution<uint_least32_t> distribute{1, 100};
+};
+
+#endif
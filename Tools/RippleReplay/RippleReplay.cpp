@@ -0,0 +1,146 @@
+#include "ReplayDetector.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+static void printUsage() {
+  printf(
+      "Usage: ripple-replay TRACE [options]\n"
+      "\n"
+      "Replays a block trace recorded by the ripple detector and checks that\n"
+      "it emits the TTL events the plugin emitted.\n"
+      "\n"
+      "  --events FILE   Recorded and replayed events as CSV\n"
+      "  --blocks FILE   One CSV row per replayed block\n"
+      "\n"
+      "Exits with 0 when the replay matches the recording, 2 when it\n"
+      "diverges and 1 on errors.\n");
+}
+
+static void printEvent(const char *label, const RippleTraceEvent &event) {
+  fprintf(stderr, "  %s: stream %u, sample %lld, line %d, %s\n", label,
+          (unsigned)event.streamId, (long long)event.sampleNumber,
+          event.line, event.state ? "on" : "off");
+}
+
+static void writeEvents(std::ostream &out, const char *source,
+                        const std::vector<RippleTraceEvent> &events) {
+  for (const RippleTraceEvent &event : events)
+    out << source << "," << event.streamId << "," << event.sampleNumber << ","
+        << event.line << "," << event.state << "\n";
+}
+
+int main(int argc, char **argv) {
+
+  std::string tracePath, eventsPath, blocksPath;
+
+  try {
+    for (int idx = 1; idx < argc; idx++) {
+      const std::string arg = argv[idx];
+      if (arg == "--help" || arg == "-h") {
+        printUsage();
+        return 0;
+      }
+      if (arg.compare(0, 2, "--") != 0) {
+        tracePath = arg;
+        continue;
+      }
+      if (idx + 1 >= argc)
+        throw std::runtime_error("Missing value for " + arg);
+      const std::string value = argv[++idx];
+
+      if (arg == "--events")
+        eventsPath = value;
+      else if (arg == "--blocks")
+        blocksPath = value;
+      else
+        throw std::runtime_error("Unknown option " + arg);
+    }
+
+    if (tracePath.empty()) {
+      printUsage();
+      return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ReplayDetector detector;
+    ReplayResult result;
+    std::string error;
+    if (!detector.run(tracePath, result, error))
+      throw std::runtime_error(tracePath + ": " + error);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    int64_t samples = 0;
+    for (const ReplayBlock &block : result.blocks)
+      samples += block.numSamples;
+    fprintf(stderr,
+            "Replayed %d process() calls, %zu blocks and %lld samples on %zu "
+            "streams in %.2f s\n",
+            result.processCalls, result.blocks.size(), (long long)samples,
+            result.streams.size(), elapsed.count() / 1000.0);
+
+    for (const std::string &warning : result.warnings)
+      fprintf(stderr, "Warning: %s\n", warning.c_str());
+    if (result.droppedRecords)
+      fprintf(stderr,
+              "Warning: the plugin dropped %llu records, the replay is not "
+              "exact after the first drop\n",
+              (unsigned long long)result.droppedRecords);
+    if (result.sampleGaps)
+      fprintf(stderr,
+              "Warning: %d blocks do not follow on their previous one\n",
+              result.sampleGaps);
+    if (result.missingDraws)
+      fprintf(stderr,
+              "Warning: %d detections had no recorded ttl_percent draw\n",
+              result.missingDraws);
+
+    if (!eventsPath.empty()) {
+      std::ofstream out(eventsPath);
+      if (!out)
+        throw std::runtime_error("Cannot write " + eventsPath);
+      out << "source,stream,sample_number,line,state\n";
+      writeEvents(out, "recorded", result.recordedEvents);
+      writeEvents(out, "replayed", result.replayedEvents);
+    }
+
+    if (!blocksPath.empty()) {
+      std::ofstream out(blocksPath);
+      if (!out)
+        throw std::runtime_error("Cannot write " + blocksPath);
+      out << "process_call,wall_clock_ms,calibrate,stream,first_sample,"
+             "num_samples,calibrating\n";
+      for (const ReplayBlock &block : result.blocks)
+        out << block.processCall << "," << block.wallClockMs << ","
+            << block.calibrate << "," << block.streamId << ","
+            << block.firstSampleNumber << "," << block.numSamples << ","
+            << block.calibrating << "\n";
+    }
+
+    // Report the first event on which the plugin and the replay disagree
+    const std::vector<RippleTraceEvent> &recorded = result.recordedEvents;
+    const std::vector<RippleTraceEvent> &replayed = result.replayedEvents;
+    size_t idx = 0;
+    while (idx < recorded.size() && idx < replayed.size() &&
+           recorded[idx] == replayed[idx])
+      idx++;
+    if (idx == recorded.size() && idx == replayed.size()) {
+      fprintf(stderr, "Match: %zu events\n", recorded.size());
+      return 0;
+    }
+
+    fprintf(stderr, "Divergence at event %zu (%zu recorded, %zu replayed)\n",
+            idx, recorded.size(), replayed.size());
+    if (idx < recorded.size())
+      printEvent("recorded", recorded[idx]);
+    if (idx < replayed.size())
+      printEvent("replayed", replayed[idx]);
+    return 2;
+  } catch (const std::exception &e) {
+    fprintf(stderr, "ripple-replay: %s\n", e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,318 @@
+#include "../RippleSidecar/SidecarParams.h"
+#include "ReplayDetector.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+// Round trip of a block trace: two streams are run through
+// RippleDetectionCore as RippleDetector::process() runs them, recording a
+// trace as the plugin does, and the trace is then replayed with
+// ReplayDetector. The replay must emit exactly the recorded TTL events.
+
+namespace {
+
+constexpr double sampleRate = 30000;
+constexpr double durationSeconds = 70;
+constexpr double traceStartSeconds = 15;   // After the first calibration
+constexpr double configChangeSeconds = 30; // New snapshot on the first stream
+constexpr double recalibrateSeconds = 40;  // Calibration request
+constexpr double pi = 3.14159265358979323846;
+constexpr int64_t startWallClockMs = 1700000000000LL;
+
+const uint16_t streamIds[] = {100, 101};
+constexpr int numStreams = 2;
+constexpr int numChannels = 2; // Ripple input and EMG
+
+const char *const streamParams[numStreams][5] = {
+    {"mov_detect=EMG", "mov_input=1", "ttl_percent=70", "refr_time=60",
+     "time_thresh=8"},
+    {"ttl_percent=100", "refr_time=60", "time_thresh=8", "ripple_std=4",
+     "Ripple_Out=5"},
+};
+const char *const changedParams[5] = {"mov_detect=EMG", "mov_input=1",
+                                     "ttl_percent=70", "refr_time=100",
+                                     "ripple_std=4"};
+
+// Noise with ripple bursts on the ripple input, shared between the streams
+// so the fusion stage sees coincident detections, and bouts of muscle
+// activity on the EMG
+void synthesize(int streamIndex, const std::vector<double> &rippleTimes,
+                std::vector<float> &lfp, std::vector<float> &emg) {
+  std::mt19937 generator(17 + streamIndex);
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+
+  const size_t numSamples = (size_t)(durationSeconds * sampleRate);
+  lfp.resize(numSamples);
+  emg.resize(numSamples);
+  for (size_t idx = 0; idx < numSamples; idx++) {
+    lfp[idx] = 20.0f * noise(generator);
+    const double time = idx / sampleRate;
+    const bool moving = std::fmod(time, 13.0) > 11.0;
+    emg[idx] = (moving ? 200.0f : 10.0f) * noise(generator);
+  }
+
+  const double lag = streamIndex * 0.002;
+  for (double rippleTime : rippleTimes) {
+    const double centre = rippleTime + lag;
+    const int64_t first = (int64_t)((centre - 0.05) * sampleRate);
+    const int64_t last = (int64_t)((centre + 0.05) * sampleRate);
+    for (int64_t idx = std::max<int64_t>(first, 0);
+         idx <= last && idx < (int64_t)numSamples; idx++) {
+      const double offset = idx / sampleRate - centre;
+      lfp[idx] += (float)(150.0 * std::exp(-0.5 * std::pow(offset / 0.015, 2)) *
+                          std::sin(2 * pi * 180.0 * offset));
+    }
+  }
+}
+
+// Records what the core does with a block, as RippleDetector's listener does
+class TraceListener : public RippleDetectionListener {
+public:
+  TraceListener(RippleTraceWriter &writer_, uint16_t streamId_,
+                std::mt19937 &generator_, int &numEvents_)
+      : writer(writer_), streamId(streamId_), generator(generator_),
+        numEvents(numEvents_) {}
+
+  void ttlEvent(int line, int64_t sampleNumber, bool state,
+                int /*sampleIndex*/) override {
+    if (writer.isOpen()) {
+      writer.writeEvent({streamId, sampleNumber, line, state});
+      numEvents++;
+    }
+  }
+
+  double drawPercent() override {
+    const double value = distribute(generator);
+    if (writer.isOpen())
+      writer.writeRandom(streamId, value);
+    return value;
+  }
+
+private:
+  RippleTraceWriter &writer;
+  uint16_t streamId;
+  std::mt19937 &generator;
+  std::uniform_int_distribution<uint_least32_t> distribute{1, 100};
+  int &numEvents;
+};
+
+struct Stream {
+  std::vector<float> lfp, emg;
+  std::unique_ptr<RippleDetectorConfig> config;
+  RippleDetectionCore detector;
+  bool tracePending{true};
+};
+
+std::unique_ptr<RippleDetectorConfig>
+compileConfig(const char *const *params, int numParams) {
+  SidecarParams sidecarParams;
+  std::string error, cnnModelPath;
+  for (int idx = 0; idx < numParams; idx++)
+    if (!sidecarParams.set(params[idx], error))
+      throw std::runtime_error(error);
+
+  RippleRingStream ringStream;
+  ringStream.numChannels = numChannels;
+  ringStream.sampleRate = sampleRate;
+  auto config = std::make_unique<RippleDetectorConfig>();
+  if (!sidecarParams.compile(ringStream, *config, cnnModelPath, error))
+    throw std::runtime_error(error);
+  return config;
+}
+
+// Runs the streams and records the trace. Returns the number of TTL events
+// recorded
+int record(const std::string &path) {
+  std::mt19937 generator(5);
+
+  std::vector<double> rippleTimes;
+  std::uniform_real_distribution<double> interval(0.4, 1.2);
+  for (double time = 1.0; time < durationSeconds - 1.0;
+       time += interval(generator))
+    rippleTimes.push_back(time);
+
+  RippleFusion fusion;
+  fusion.prepare(numStreams);
+  RippleFusionConfig fusionConfig;
+  fusionConfig.mode = FusionMode::COINCIDENT;
+  fusionConfig.outputChannel = 5;
+
+  Stream streams[numStreams];
+  for (int idx = 0; idx < numStreams; idx++) {
+    synthesize(idx, rippleTimes, streams[idx].lfp, streams[idx].emg);
+    streams[idx].config = compileConfig(streamParams[idx], 5);
+    streams[idx].detector.prepare(sampleRate, &fusion, idx);
+    streams[idx].detector.applyConfig(*streams[idx].config, nullptr);
+  }
+
+  RippleTraceWriter writer;
+  int numEvents = 0;
+  bool traceFusionPending = true;
+  bool configChanged[numStreams] = {};
+  bool calibrate = true; // As requested when acquisition starts
+  bool changePending = true;
+  bool recalibratePending = true;
+
+  // The GUI delivers blocks of varying sizes, and the clock the refractory
+  // period runs on jitters against the sample clock
+  std::uniform_int_distribution<int> blockSize(400, 1600);
+  std::uniform_int_distribution<int> jitter(0, 20);
+
+  const int64_t totalSamples = (int64_t)streams[0].lfp.size();
+  int64_t first = 0;
+  while (first < totalSamples) {
+    const int numSamples =
+        (int)std::min<int64_t>(blockSize(generator), totalSamples - first);
+    const double time = first / sampleRate;
+
+    if (!writer.isOpen() && time >= traceStartSeconds) {
+      std::string error;
+      if (!writer.open(path, error))
+        throw std::runtime_error(path + ": " + error);
+      for (int idx = 0; idx < numStreams; idx++)
+        writer.writeStream({streamIds[idx], idx, sampleRate,
+                            "Stream " + std::to_string(idx)});
+    }
+    if (changePending && time >= configChangeSeconds) {
+      streams[0].config = compileConfig(changedParams, 5);
+      configChanged[0] = true;
+      changePending = false;
+    }
+    if (recalibratePending && time >= recalibrateSeconds) {
+      calibrate = true;
+      recalibratePending = false;
+    }
+
+    const int64_t wallClockMs =
+        startWallClockMs + (int64_t)(time * 1000) + jitter(generator);
+    if (writer.isOpen()) {
+      writer.writeProcess({wallClockMs, calibrate});
+      if (traceFusionPending) {
+        writer.writeFusion(fusionConfig);
+        traceFusionPending = false;
+      }
+    }
+
+    for (int idx = 0; idx < numStreams; idx++) {
+      Stream &stream = streams[idx];
+      if (configChanged[idx])
+        stream.detector.applyConfig(*stream.config, nullptr);
+
+      const float *data[numChannels] = {stream.lfp.data() + first,
+                                        stream.emg.data() + first};
+      if (writer.isOpen()) {
+        if (stream.tracePending)
+          writer.writeState(streamIds[idx], stream.detector.getState());
+        if (configChanged[idx] || stream.tracePending)
+          writer.writeConfig(streamIds[idx], *stream.config, "");
+        stream.tracePending = false;
+        const int channels[numChannels] = {0, 1};
+        writer.writeBlock(streamIds[idx], first, numSamples, channels, data,
+                          numChannels);
+      }
+      configChanged[idx] = false;
+
+      RippleDetectionBlock block;
+      block.channels = data;
+      block.numChannels = numChannels;
+      block.firstSampleNumber = first;
+      block.numSamples = numSamples;
+      block.wallClockMs = wallClockMs;
+      block.calibrate = calibrate;
+      block.fusionConfig = &fusionConfig;
+
+      TraceListener listener(writer, streamIds[idx], generator, numEvents);
+      stream.detector.process(block, listener);
+    }
+
+    calibrate = false;
+    first += numSamples;
+  }
+
+  const uint64_t dropped = writer.getDroppedRecords();
+  writer.close();
+  if (dropped)
+    throw std::runtime_error("the trace writer dropped " +
+                             std::to_string(dropped) + " records");
+  return numEvents;
+}
+
+void printEvent(const char *label, const RippleTraceEvent &event) {
+  fprintf(stderr, "  %s: stream %u, sample %lld, line %d, %s\n", label,
+          (unsigned)event.streamId, (long long)event.sampleNumber,
+          event.line, event.state ? "on" : "off");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+    printf("Usage: ripple-roundtrip [TRACE]\n"
+           "\n"
+           "Records a block trace of synthetic streams, written to TRACE\n"
+           "(default roundtrip.trc), and checks that ripple-replay's\n"
+           "detector replays it to the recorded TTL events.\n"
+           "\n"
+           "Exits with 0 when the replay matches, 2 when it diverges and 1\n"
+           "on errors.\n");
+    return 1;
+  }
+  const std::string path = argc == 2 ? argv[1] : "roundtrip.trc";
+
+  try {
+    const int numEvents = record(path);
+
+    ReplayDetector detector;
+    ReplayResult result;
+    std::string error;
+    if (!detector.run(path, result, error))
+      throw std::runtime_error(path + ": " + error);
+
+    for (const std::string &warning : result.warnings)
+      fprintf(stderr, "Warning: %s\n", warning.c_str());
+
+    const std::vector<RippleTraceEvent> &recorded = result.recordedEvents;
+    const std::vector<RippleTraceEvent> &replayed = result.replayedEvents;
+
+    // A trace without detections on every line would not test much
+    bool lines[8] = {};
+    for (const RippleTraceEvent &event : recorded)
+      if (event.line >= 0 && event.line < 8)
+        lines[event.line] = true;
+    if ((int)recorded.size() != numEvents || !lines[0] || !lines[1] ||
+        !lines[2] || !lines[4] || !lines[5])
+      throw std::runtime_error("the trace holds " +
+                               std::to_string(recorded.size()) + " of " +
+                               std::to_string(numEvents) +
+                               " events, or misses a TTL line");
+
+    size_t idx = 0;
+    while (idx < recorded.size() && idx < replayed.size() &&
+           recorded[idx] == replayed[idx])
+      idx++;
+    if (idx == recorded.size() && idx == replayed.size() &&
+        result.warnings.empty() && !result.missingDraws) {
+      fprintf(stderr, "Match: %zu events over %zu blocks\n", recorded.size(),
+              result.blocks.size());
+      return 0;
+    }
+
+    fprintf(stderr, "Divergence at event %zu (%zu recorded, %zu replayed)\n",
+            idx, recorded.size(), replayed.size());
+    if (idx < recorded.size())
+      printEvent("recorded", recorded[idx]);
+    if (idx < replayed.size())
+      printEvent("replayed", replayed[idx]);
+    if (result.missingDraws)
+      fprintf(stderr, "%d detections had no recorded ttl_percent draw\n",
+              result.missingDraws);
+    return 2;
+  } catch (const std::exception &e) {
+    fprintf(stderr, "ripple-roundtrip: %s\n", e.what());
+    return 1;
+  }
+}
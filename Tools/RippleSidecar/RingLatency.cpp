@@ -0,0 +1,30 @@
+#include "RingLatency.h"
+#include <algorithm>
+#include <cstdio>
+
+void RingLatency::add(int64_t ns) {
+  const int64_t bin = std::max<int64_t>(0, ns / 1000);
+  bins[(size_t)std::min<int64_t>(bin, numBins)]++;
+  count++;
+  maxNs = std::max(maxNs, ns);
+}
+
+double RingLatency::percentileUs(double fraction) const {
+  if (count == 0)
+    return 0.0;
+  const uint64_t target = (uint64_t)(fraction * (count - 1)) + 1;
+  uint64_t seen = 0;
+  for (int bin = 0; bin < numBins; bin++) {
+    seen += bins[bin];
+    if (seen >= target)
+      return bin + 1.0; // Upper edge of the bin
+  }
+  return maxUs();
+}
+
+std::string RingLatency::summary() const {
+  char text[96];
+  snprintf(text, sizeof(text), "p50 %.0f us, p99 %.0f us, max %.0f us",
+           percentileUs(0.5), percentileUs(0.99), maxUs());
+  return text;
+}
@@ -0,0 +1,37 @@
+#ifndef __RIPPLE_RING_LATENCY_H
+#define __RIPPLE_RING_LATENCY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+  Latency histogram with 1 us bins up to 20 ms, so percentiles can be taken
+  over runs of any length without keeping every measurement.
+**/
+class RingLatency {
+public:
+  static constexpr int numBins = 20000;
+
+  RingLatency() : bins(numBins + 1, 0) {}
+
+  /** Adds one measurement in nanoseconds */
+  void add(int64_t ns);
+
+  uint64_t getCount() const { return count; }
+
+  /** Latency below which the given fraction of measurements fall (us) */
+  double percentileUs(double fraction) const;
+
+  double maxUs() const { return maxNs / 1000.0; }
+
+  /** "p50 x us, p99 y us, max z us" */
+  std::string summary() const;
+
+private:
+  std::vector<uint64_t> bins; // The last one holds everything above 20 ms
+  uint64_t count{0};
+  int64_t maxNs{0};
+};
+
+#endif
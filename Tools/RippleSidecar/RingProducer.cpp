@@ -0,0 +1,234 @@
+#include "RingLatency.h"
+#include "RippleShmRing.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) { stopRequested = 1; }
+
+static void printUsage() {
+  printf(
+      "Usage: ripple-ring-producer --dat continuous.dat --channels N\n"
+      "                            --rate HZ --ring NAME [options]\n"
+      "\n"
+      "Plays an Open Ephys continuous.dat file into the shared-memory ring\n"
+      "/NAME-blocks for ripple-sidecar, reads its events back from\n"
+      "/NAME-events, and reports throughput and latency.\n"
+      "\n"
+      "  --bit-volts V   Microvolts per raw sample (default 1)\n"
+      "  --block N       Samples per block (default 1024)\n"
+      "  --slots N       Slots in the block ring, a power of two "
+      "(default 64)\n"
+      "  --speed X       Playback speed relative to real time; 0 plays as\n"
+      "                  fast as the sidecar reads (default 1)\n"
+      "  --loops N       Times to play the file (default 1)\n"
+      "  --events FILE   Received events as CSV\n"
+      "  --wait SEC      Time to wait for the sidecar (default 10)\n"
+      "\n"
+      "In real time, blocks that find the ring full are dropped, as an\n"
+      "acquisition system would.\n");
+}
+
+int main(int argc, char **argv) {
+
+  std::string datPath, ringName, eventsPath;
+  RippleRingStream stream;
+  stream.bitVolts = 1.0;
+  stream.maxSamples = 1024;
+  uint32_t numSlots = 64;
+  double speed = 1.0, waitSeconds = 10.0;
+  int loops = 1;
+
+  try {
+    for (int idx = 1; idx < argc; idx++) {
+      const std::string arg = argv[idx];
+      if (arg == "--help" || arg == "-h") {
+        printUsage();
+        return 0;
+      }
+      if (idx + 1 >= argc)
+        throw std::runtime_error("Missing value for " + arg);
+      const std::string value = argv[++idx];
+
+      if (arg == "--dat")
+        datPath = value;
+      else if (arg == "--channels")
+        stream.numChannels = (uint32_t)std::stoul(value);
+      else if (arg == "--rate")
+        stream.sampleRate = std::stod(value);
+      else if (arg == "--ring")
+        ringName = value;
+      else if (arg == "--bit-volts")
+        stream.bitVolts = std::stod(value);
+      else if (arg == "--block")
+        stream.maxSamples = (uint32_t)std::stoul(value);
+      else if (arg == "--slots")
+        numSlots = (uint32_t)std::stoul(value);
+      else if (arg == "--speed")
+        speed = std::stod(value);
+      else if (arg == "--loops")
+        loops = std::stoi(value);
+      else if (arg == "--events")
+        eventsPath = value;
+      else if (arg == "--wait")
+        waitSeconds = std::stod(value);
+      else
+        throw std::runtime_error("Unknown option " + arg);
+    }
+
+    if (datPath.empty() || ringName.empty() || stream.numChannels == 0 ||
+        stream.sampleRate <= 0 || stream.maxSamples == 0) {
+      printUsage();
+      return 1;
+    }
+
+    std::ifstream file(datPath, std::ios::binary);
+    if (!file)
+      throw std::runtime_error("Cannot open " + datPath);
+
+    std::ofstream eventsOut;
+    if (!eventsPath.empty()) {
+      eventsOut.open(eventsPath);
+      if (!eventsOut)
+        throw std::runtime_error("Cannot write " + eventsPath);
+      eventsOut << "sample_number,line,state,latency_us\n";
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    RippleShmRing blocks, events;
+    std::string error;
+    if (!blocks.create("/" + ringName + "-blocks",
+                       RippleShmRing::blockSlotBytes(stream), numSlots, stream,
+                       error) ||
+        !events.create("/" + ringName + "-events", sizeof(RippleRingEvent),
+                       1024, RippleRingStream(), error))
+      throw std::runtime_error(error);
+
+    fprintf(stderr, "Waiting for ripple-sidecar --ring %s\n",
+            ringName.c_str());
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration<double>(waitSeconds);
+    while (!blocks.getHeader().consumerAttached.load(
+        std::memory_order_acquire)) {
+      if (stopRequested || std::chrono::steady_clock::now() > deadline)
+        throw std::runtime_error("No sidecar attached to " + ringName);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    RingLatency roundTrip, detection;
+    uint64_t numEvents = 0;
+    auto drainEvents = [&]() {
+      const RippleRingEvent *event;
+      while ((event = (const RippleRingEvent *)events.beginRead()) !=
+             nullptr) {
+        const int64_t latency = RippleShmRing::nowNs() - event->blockPublishNs;
+        roundTrip.add(latency);
+        detection.add(event->emitNs - event->blockPublishNs);
+        if (eventsOut.is_open())
+          eventsOut << event->sampleNumber << "," << event->line << ","
+                    << event->state << "," << latency / 1000 << "\n";
+        events.commitRead();
+        numEvents++;
+      }
+    };
+
+    const uint32_t numChannels = stream.numChannels;
+    std::vector<int16_t> raw((size_t)stream.maxSamples * numChannels);
+    uint64_t numBlocks = 0, overruns = 0;
+    int64_t sampleNumber = 0;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int loop = 0; loop < loops && !stopRequested; loop++) {
+      file.clear();
+      file.seekg(0);
+      while (!stopRequested) {
+        file.read((char *)raw.data(), raw.size() * sizeof(int16_t));
+        const int count =
+            (int)(file.gcount() / (sizeof(int16_t) * numChannels));
+        if (count == 0)
+          break;
+
+        // Paced by the sample clock, so a late block is not made up for by
+        // shortening the wait of the next ones. Events are collected while
+        // waiting, so their latency is measured when they arrive
+        if (speed > 0) {
+          const auto due =
+              start + std::chrono::duration_cast<
+                          std::chrono::steady_clock::duration>(
+                          std::chrono::duration<double>(
+                              sampleNumber / stream.sampleRate / speed));
+          while (std::chrono::steady_clock::now() < due && !stopRequested) {
+            drainEvents();
+            std::this_thread::yield();
+          }
+        }
+
+        RippleRingBlock *slot = (RippleRingBlock *)blocks.beginWrite();
+        while (slot == nullptr && speed <= 0 && !stopRequested) {
+          drainEvents();
+          std::this_thread::yield();
+          slot = (RippleRingBlock *)blocks.beginWrite();
+        }
+
+        if (slot != nullptr) {
+          float *dst = (float *)(slot + 1);
+          for (uint32_t ch = 0; ch < numChannels; ch++) {
+            float *channel = dst + (size_t)ch * stream.maxSamples;
+            for (int t = 0; t < count; t++)
+              channel[t] =
+                  raw[(size_t)t * numChannels + ch] * (float)stream.bitVolts;
+          }
+          slot->firstSampleNumber = sampleNumber;
+          slot->numSamples = count;
+          slot->publishNs = RippleShmRing::nowNs();
+          blocks.commitWrite();
+          numBlocks++;
+        } else {
+          overruns++;
+          blocks.getHeader().overruns.store(overruns,
+                                            std::memory_order_relaxed);
+        }
+        sampleNumber += count;
+        drainEvents();
+      }
+    }
+    blocks.getHeader().closed.store(1, std::memory_order_release);
+
+    // Collect the events of the last blocks
+    const auto closeDeadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!events.getHeader().closed.load(std::memory_order_acquire) &&
+           std::chrono::steady_clock::now() < closeDeadline) {
+      drainEvents();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    drainEvents();
+
+    const double elapsed = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    fprintf(stderr,
+            "Published %llu blocks and %lld samples in %.2f s (%.1fx real "
+            "time), %llu dropped with the ring full\n",
+            (unsigned long long)numBlocks, (long long)sampleNumber, elapsed,
+            sampleNumber / stream.sampleRate / std::max(elapsed, 1e-9),
+            (unsigned long long)overruns);
+    fprintf(stderr, "Received %llu events\n", (unsigned long long)numEvents);
+    fprintf(stderr, "Block to event published: %s\n",
+            detection.summary().c_str());
+    fprintf(stderr, "Block to event received: %s\n",
+            roundTrip.summary().c_str());
+    return 0;
+  } catch (const std::exception &e) {
+    fprintf(stderr, "ripple-ring-producer: %s\n", e.what());
+    return 1;
+  }
+}
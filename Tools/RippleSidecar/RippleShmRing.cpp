@@ -0,0 +1,198 @@
+#include "RippleShmRing.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char ringMagic[8] = {'R', 'P', 'L', 'R', 'I', 'N', 'G', '1'};
+static constexpr uint32_t ringVersion = 1;
+
+// Slots start on their own cache line after the header
+static size_t headerBytes() {
+  return (sizeof(RippleRingHeader) + 63) / 64 * 64;
+}
+
+// Removes the named ring if its producer marked it closed. A ring in use,
+// or any other shared memory of that name, is left alone
+static bool unlinkClosedRing(const std::string &name) {
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0600);
+  if (fd < 0)
+    return false;
+  struct stat info;
+  void *memory = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && (size_t)info.st_size >= headerBytes())
+    memory = mmap(nullptr, headerBytes(), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED)
+    return false;
+
+  const RippleRingHeader *mapped = (const RippleRingHeader *)memory;
+  const bool closed =
+      memcmp(mapped->magic, ringMagic, sizeof(ringMagic)) == 0 &&
+      mapped->closed.load(std::memory_order_acquire) != 0;
+  munmap(memory, headerBytes());
+  return closed && shm_unlink(name.c_str()) == 0;
+}
+
+bool RippleShmRing::create(const std::string &name, uint32_t slotBytes,
+                           uint32_t numSlots, const RippleRingStream &stream,
+                           std::string &error) {
+  close();
+  if (numSlots == 0 || (numSlots & (numSlots - 1)) != 0) {
+    error = "The number of slots must be a power of two";
+    return false;
+  }
+  slotBytes = (slotBytes + 63) / 64 * 64;
+  const size_t bytes = headerBytes() + (size_t)slotBytes * numSlots;
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0 && errno == EEXIST && unlinkClosedRing(name))
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    error = "Shared memory " + name +
+            " already exists and is not a closed ring. Another producer may "
+            "be using it; if one crashed, remove /dev/shm" +
+            name;
+    return false;
+  }
+  if (fd < 0) {
+    error = "Cannot create shared memory " + name + ": " + strerror(errno);
+    return false;
+  }
+  if (ftruncate(fd, (off_t)bytes) != 0) {
+    error = "Cannot size shared memory " + name + ": " + strerror(errno);
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void *memory =
+      mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    error = "Cannot map shared memory " + name + ": " + strerror(errno);
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // The magic is written last, so an attaching process never sees a
+  // half-initialised header
+  header = new (memory) RippleRingHeader();
+  header->version = ringVersion;
+  header->slotBytes = slotBytes;
+  header->numSlots = numSlots;
+  header->stream = stream;
+  header->writeIndex.store(0, std::memory_order_relaxed);
+  header->readIndex.store(0, std::memory_order_relaxed);
+  header->consumerAttached.store(0, std::memory_order_relaxed);
+  header->closed.store(0, std::memory_order_relaxed);
+  header->overruns.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, ringMagic, sizeof(ringMagic));
+
+  shmName = name;
+  owner = true;
+  mappedBytes = bytes;
+  localWrite = localRead = 0;
+  return true;
+}
+
+bool RippleShmRing::attach(const std::string &name, std::string &error) {
+  close();
+  const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    error = "Cannot open shared memory " + name + ": " + strerror(errno);
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < headerBytes()) {
+    error = "Shared memory " + name + " is not a ring";
+    ::close(fd);
+    return false;
+  }
+  void *memory = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    error = "Cannot map shared memory " + name + ": " + strerror(errno);
+    return false;
+  }
+
+  RippleRingHeader *mapped = (RippleRingHeader *)memory;
+  const bool initialised =
+      memcmp(mapped->magic, ringMagic, sizeof(ringMagic)) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!initialised || mapped->version != ringVersion ||
+      headerBytes() + (size_t)mapped->slotBytes * mapped->numSlots >
+          (size_t)info.st_size) {
+    error = "Shared memory " + name + " is not a ring of this version";
+    munmap(memory, (size_t)info.st_size);
+    return false;
+  }
+
+  header = mapped;
+  shmName = name;
+  owner = false;
+  mappedBytes = (size_t)info.st_size;
+  localWrite = header->writeIndex.load(std::memory_order_relaxed);
+  localRead = header->readIndex.load(std::memory_order_relaxed);
+  return true;
+}
+
+void RippleShmRing::close() {
+  if (header == nullptr)
+    return;
+  munmap(header, mappedBytes);
+  if (owner)
+    shm_unlink(shmName.c_str());
+  header = nullptr;
+  mappedBytes = 0;
+  owner = false;
+}
+
+void *RippleShmRing::beginWrite() {
+  const uint64_t read = header->readIndex.load(std::memory_order_acquire);
+  if (localWrite - read >= header->numSlots)
+    return nullptr;
+  return slot(localWrite);
+}
+
+void RippleShmRing::commitWrite() {
+  header->writeIndex.store(++localWrite, std::memory_order_release);
+}
+
+const void *RippleShmRing::beginRead() {
+  if (localRead == header->writeIndex.load(std::memory_order_acquire))
+    return nullptr;
+  return slot(localRead);
+}
+
+void RippleShmRing::commitRead() {
+  header->readIndex.store(++localRead, std::memory_order_release);
+}
+
+uint64_t RippleShmRing::getFill() const {
+  return header->writeIndex.load(std::memory_order_acquire) -
+         header->readIndex.load(std::memory_order_acquire);
+}
+
+int64_t RippleShmRing::nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t RippleShmRing::blockSlotBytes(const RippleRingStream &stream) {
+  return (uint32_t)(sizeof(RippleRingBlock) +
+                    sizeof(float) * (size_t)stream.numChannels *
+                        stream.maxSamples);
+}
+
+void *RippleShmRing::slot(uint64_t index) const {
+  return (char *)header + headerBytes() +
+         (size_t)header->slotBytes * (index & (header->numSlots - 1));
+}
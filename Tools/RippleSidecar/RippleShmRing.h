@@ -0,0 +1,120 @@
+#ifndef __RIPPLE_SHM_RING_H
+#define __RIPPLE_SHM_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The ring indices must be lock-free to be shared");
+
+/** Stream carried by a block ring */
+struct RippleRingStream {
+  uint32_t numChannels{0};
+  uint32_t maxSamples{0}; // Samples per channel in each slot
+  double sampleRate{0.0};
+  double bitVolts{0.0}; // Microvolts per raw ADC step, 0 if unknown
+};
+
+/** Shared header of a ring, followed by its slots */
+struct RippleRingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t slotBytes; // Bytes per slot
+  uint32_t numSlots;  // Power of two
+
+  RippleRingStream stream; // Empty for an event ring
+
+  alignas(64) std::atomic<uint64_t> writeIndex; // Slots published
+  alignas(64) std::atomic<uint64_t> readIndex;  // Slots consumed
+  alignas(64) std::atomic<uint32_t> consumerAttached;
+  std::atomic<uint32_t> closed; // The producer has published its last slot
+  std::atomic<uint64_t> overruns; // Slots the producer dropped, ring full
+};
+
+/** Block of samples in a block ring slot, followed by the samples */
+struct RippleRingBlock {
+  int64_t firstSampleNumber;
+  int32_t numSamples;
+  int32_t reserved;
+  int64_t publishNs; // Steady clock when the block was published
+  // float samples[numChannels][maxSamples], channel-major
+};
+
+/** TTL event in an event ring slot */
+struct RippleRingEvent {
+  int64_t sampleNumber;
+  int32_t line; // Zero-based TTL line
+  int32_t state;
+  int64_t blockPublishNs; // publishNs of the block that produced it
+  int64_t emitNs;         // Steady clock when the event was published
+};
+
+/**
+  Single-producer, single-consumer ring of fixed-size slots in POSIX shared
+  memory, for exchanging blocks and events with another local process.
+
+  The producer writes a slot and then publishes it by advancing writeIndex
+  with release ordering; the consumer reads it after an acquire load, and
+  frees it by advancing readIndex. Neither side takes a lock or makes a
+  system call per slot, so a consumer that polls picks up a slot as soon as
+  it is published. The process that creates a ring also removes its name.
+**/
+class RippleShmRing {
+public:
+  RippleShmRing() = default;
+  ~RippleShmRing() { close(); }
+
+  RippleShmRing(const RippleShmRing &) = delete;
+  RippleShmRing &operator=(const RippleShmRing &) = delete;
+
+  /** Creates the named ring. A ring of that name that its producer marked
+   * closed is replaced; any other shared memory of that name is an error.
+   * Returns false and sets error on failure */
+  bool create(const std::string &name, uint32_t slotBytes, uint32_t numSlots,
+              const RippleRingStream &stream, std::string &error);
+
+  /** Maps a ring created by another process */
+  bool attach(const std::string &name, std::string &error);
+
+  /** Unmaps the ring, and removes its name if this process created it */
+  void close();
+
+  bool isOpen() const { return header != nullptr; }
+  RippleRingHeader &getHeader() { return *header; }
+
+  /** Returns the next free slot, or nullptr if the ring is full. Producer */
+  void *beginWrite();
+
+  /** Publishes the slot returned by beginWrite(). Producer */
+  void commitWrite();
+
+  /** Returns the oldest published slot, or nullptr if there is none.
+   * Consumer */
+  const void *beginRead();
+
+  /** Frees the slot returned by beginRead(). Consumer */
+  void commitRead();
+
+  /** Slots published but not yet consumed */
+  uint64_t getFill() const;
+
+  /** Steady clock in nanoseconds, comparable across processes */
+  static int64_t nowNs();
+
+  /** Bytes of a block slot for the given stream layout */
+  static uint32_t blockSlotBytes(const RippleRingStream &stream);
+
+private:
+  void *slot(uint64_t index) const;
+
+  std::string shmName;
+  bool owner{false};
+  RippleRingHeader *header{nullptr};
+  size_t mappedBytes{0};
+  uint64_t localWrite{0}; // Producer copy of writeIndex
+  uint64_t localRead{0};  // Consumer copy of readIndex
+};
+
+#endif
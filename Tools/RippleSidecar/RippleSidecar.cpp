@@ -0,0 +1,266 @@
+#include "../../RippleDetectionCore.h"
+#include "RingLatency.h"
+#include "RippleShmRing.h"
+#include "SidecarParams.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) { stopRequested = 1; }
+
+static void printUsage() {
+  printf("Usage: ripple-sidecar --ring NAME [--param name=value ...] "
+         "[options]\n"
+         "\n"
+         "Runs the ripple detector on the blocks another process writes to\n"
+         "the shared-memory ring /NAME-blocks, and writes its TTL events to\n"
+         "/NAME-events. Both rings are created by the producer.\n"
+         "\n"
+         "  --param N=V     Detector parameter, repeatable (see below)\n"
+         "  --sample-clock  Time refractory periods and TTL durations by\n"
+         "                  sample numbers instead of the wall clock\n"
+         "  --spin N        Polls of an empty ring before sleeping\n"
+         "                  (default 20000)\n"
+         "  --sleep-us US   Sleep between polls after that (default 50)\n"
+         "  --wait SEC      Time to wait for the rings (default 10)\n"
+         "\n"
+         "Parameters:\n%s",
+         SidecarParams::describe().c_str());
+}
+
+// Writes the detector's TTL events to the event ring as they are made
+class RingListener : public RippleDetectionListener {
+public:
+  explicit RingListener(RippleShmRing &events_) : events(events_) {}
+
+  void ttlEvent(int line, int64_t sampleNumber, bool state,
+                int /*sampleIndex*/) override {
+    RippleRingEvent *out = (RippleRingEvent *)events.beginWrite();
+    if (out == nullptr) {
+      droppedEvents++;
+      return;
+    }
+    out->sampleNumber = sampleNumber;
+    out->line = line;
+    out->state = state;
+    out->blockPublishNs = blockPublishNs;
+    out->emitNs = RippleShmRing::nowNs();
+    events.commitWrite();
+    numEvents++;
+  }
+
+  // As the plugin draws for ttl_percent
+  double drawPercent() override { return distribute(generator); }
+
+  int64_t blockPublishNs{0};
+  uint64_t numEvents{0};
+  uint64_t droppedEvents{0};
+
+private:
+  RippleShmRing &events;
+  std::mt19937 generator{std::random_device{}()};
+  std::uniform_int_distribution<uint_least32_t> distribute{1, 100};
+};
+
+// Loads the CNN weights, as RippleDetector::loadCnnModel does, with a
+// warning instead of the message box. Returns nullptr without a model
+static std::unique_ptr<RippleCnn> loadCnnModel(const std::string &path,
+                                               double sampleRate) {
+  if (path.empty())
+    return nullptr;
+  std::string error;
+  std::shared_ptr<const RippleCnnModel> model =
+      RippleCnnModel::load(path, error);
+  auto runner = std::make_unique<RippleCnn>();
+  if (model != nullptr && runner->prepare(model, sampleRate, error))
+    return runner;
+  fprintf(stderr, "Warning: %s\n", error.c_str());
+  return nullptr;
+}
+
+// Attaches to a ring, retrying until the producer has created it
+static void attachRing(RippleShmRing &ring, const std::string &name,
+                       double waitSeconds) {
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration<double>(waitSeconds);
+  std::string error;
+  while (!ring.attach(name, error)) {
+    if (stopRequested || std::chrono::steady_clock::now() > deadline)
+      throw std::runtime_error(error);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+int main(int argc, char **argv) {
+
+  std::string ringName;
+  SidecarParams params;
+  bool sampleClock = false;
+  long spinLimit = 20000;
+  int sleepUs = 50;
+  double waitSeconds = 10.0;
+
+  try {
+    for (int idx = 1; idx < argc; idx++) {
+      const std::string arg = argv[idx];
+      if (arg == "--help" || arg == "-h") {
+        printUsage();
+        return 0;
+      }
+      if (arg == "--sample-clock") {
+        sampleClock = true;
+        continue;
+      }
+      if (idx + 1 >= argc)
+        throw std::runtime_error("Missing value for " + arg);
+      const std::string value = argv[++idx];
+
+      std::string error;
+      if (arg == "--ring")
+        ringName = value;
+      else if (arg == "--param") {
+        if (!params.set(value, error))
+          throw std::runtime_error(error);
+      } else if (arg == "--spin")
+        spinLimit = std::stol(value);
+      else if (arg == "--sleep-us")
+        sleepUs = std::stoi(value);
+      else if (arg == "--wait")
+        waitSeconds = std::stod(value);
+      else
+        throw std::runtime_error("Unknown option " + arg);
+    }
+
+    if (ringName.empty()) {
+      printUsage();
+      return 1;
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    RippleShmRing blocks, events;
+    attachRing(blocks, "/" + ringName + "-blocks", waitSeconds);
+    attachRing(events, "/" + ringName + "-events", waitSeconds);
+    const RippleRingStream stream = blocks.getHeader().stream;
+    if (stream.numChannels == 0 || stream.maxSamples == 0 ||
+        stream.sampleRate <= 0)
+      throw std::runtime_error("The block ring carries no stream");
+
+    RippleDetectorConfig config;
+    std::string cnnModelPath, error;
+    if (!params.compile(stream, config, cnnModelPath, error))
+      throw std::runtime_error(error);
+
+    // The detection core of the plugin, on a single stream that does not
+    // take part in fusion
+    std::unique_ptr<RippleCnn> cnnRunner =
+        loadCnnModel(cnnModelPath, stream.sampleRate);
+    RippleDetectionCore detector;
+    detector.prepare(stream.sampleRate, nullptr, -1);
+    detector.applyConfig(config, cnnRunner.get());
+    RingListener listener(events);
+
+    // Every ring channel is available to the detector, copied out of the
+    // ring so its slot is freed at once
+    std::vector<float> samples((size_t)stream.numChannels * stream.maxSamples);
+    std::vector<const float *> channels(stream.numChannels);
+    RippleDetectionBlock block;
+    block.channels = channels.data();
+    block.numChannels = (int)stream.numChannels;
+
+    fprintf(stderr, "Attached to %s: %u channels at %.0f Hz\n",
+            ringName.c_str(), stream.numChannels, stream.sampleRate);
+    blocks.getHeader().consumerAttached.store(1, std::memory_order_release);
+
+    RingLatency pickup, processing;
+    uint64_t numBlocks = 0;
+    int64_t numSamples = 0, nextSampleNumber = -1;
+    int sampleGaps = 0;
+    block.calibrate = true; // The first blocks calibrate
+    long idlePolls = 0;
+    const auto start = std::chrono::steady_clock::now();
+
+    while (!stopRequested) {
+      const RippleRingBlock *slot = (const RippleRingBlock *)blocks.beginRead();
+      if (slot == nullptr) {
+        if (blocks.getHeader().closed.load(std::memory_order_acquire) &&
+            blocks.getFill() == 0)
+          break;
+        // Spin first, so a block published soon is picked up at once
+        if (++idlePolls > spinLimit)
+          std::this_thread::sleep_for(std::chrono::microseconds(sleepUs));
+        continue;
+      }
+      idlePolls = 0;
+      const int64_t readNs = RippleShmRing::nowNs();
+      pickup.add(readNs - slot->publishNs);
+
+      // The slot is freed as soon as it is copied
+      const int count = std::min<int>(slot->numSamples, stream.maxSamples);
+      const float *src = (const float *)(slot + 1);
+      for (uint32_t ch = 0; ch < stream.numChannels; ch++) {
+        float *dest = samples.data() + (size_t)ch * count;
+        memcpy(dest, src + (size_t)ch * stream.maxSamples,
+               sizeof(float) * count);
+        channels[ch] = dest;
+      }
+      block.firstSampleNumber = slot->firstSampleNumber;
+      block.numSamples = count;
+      listener.blockPublishNs = slot->publishNs;
+      blocks.commitRead();
+
+      if (nextSampleNumber >= 0 && block.firstSampleNumber != nextSampleNumber)
+        sampleGaps++;
+      nextSampleNumber = block.firstSampleNumber + count;
+
+      block.wallClockMs =
+          sampleClock
+              ? (int64_t)(block.firstSampleNumber * 1000 / stream.sampleRate)
+              : std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count();
+      detector.process(block, listener);
+      block.calibrate = false;
+
+      processing.add(RippleShmRing::nowNs() - readNs);
+      numBlocks++;
+      numSamples += count;
+    }
+    events.getHeader().closed.store(1, std::memory_order_release);
+
+    const double elapsed = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    fprintf(stderr,
+            "Processed %llu blocks and %lld samples in %.2f s (%.1fx real "
+            "time), %llu events\n",
+            (unsigned long long)numBlocks, (long long)numSamples, elapsed,
+            numSamples / stream.sampleRate / std::max(elapsed, 1e-9),
+            (unsigned long long)listener.numEvents);
+    fprintf(stderr, "Pick-up latency: %s\n", pickup.summary().c_str());
+    fprintf(stderr, "Processing time: %s\n", processing.summary().c_str());
+    if (detector.getState().isCalibrating)
+      fprintf(stderr, "Warning: the stream ended during calibration\n");
+    if (sampleGaps)
+      fprintf(stderr,
+              "Warning: %d blocks do not follow on their previous one\n",
+              sampleGaps);
+    if (listener.droppedEvents)
+      fprintf(stderr, "Warning: %llu events were dropped, the event ring was "
+                      "full\n",
+              (unsigned long long)listener.droppedEvents);
+    return 0;
+  } catch (const std::exception &e) {
+    fprintf(stderr, "ripple-sidecar: %s\n", e.what());
+    return 1;
+  }
+}
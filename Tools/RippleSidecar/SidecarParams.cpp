@@ -0,0 +1,265 @@
+#include "SidecarParams.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+// As in RippleDetector.cpp
+constexpr double calibrationDurationSeconds = 10;
+constexpr double artefactHoldMilliseconds = 20;
+
+enum class Kind { NUMBER, CHOICE, CHANNELS, TEXT };
+
+struct ParamSpec {
+  const char *name;
+  Kind kind;
+  const char *defaultValue;
+  const char *choices; // Comma-separated, for CHOICE
+};
+
+// Plugin defaults, with the TTL lines as the plugin makes them unique
+const ParamSpec paramSpecs[] = {
+    {"Ripple_Input", Kind::CHANNELS, "0", nullptr},
+    {"Ripple_Out", Kind::NUMBER, "2", nullptr},
+    {"Ripple_save", Kind::NUMBER, "1", nullptr},
+    {"ripple_std", Kind::NUMBER, "5", nullptr},
+    {"time_thresh", Kind::NUMBER, "10", nullptr},
+    {"refr_time", Kind::NUMBER, "140", nullptr},
+    {"ttl_duration", Kind::NUMBER, "100", nullptr},
+    {"ttl_percent", Kind::NUMBER, "100", nullptr},
+    {"RMS_mean", Kind::NUMBER, "0", nullptr},
+    {"RMS_std", Kind::NUMBER, "0", nullptr},
+    {"rms_samples", Kind::NUMBER, "128", nullptr},
+    {"detector", Kind::CHOICE, "RMS", "RMS,CNN"},
+    {"cnn_model", Kind::TEXT, "", nullptr},
+    {"cnn_thresh", Kind::NUMBER, "0.5", nullptr},
+    {"filter_bank", Kind::CHOICE, "OFF", "OFF,ON"},
+    {"fr_ratio", Kind::NUMBER, "1.5", nullptr},
+    {"artefact_std", Kind::NUMBER, "10", nullptr},
+    {"state_gate", Kind::CHOICE, "OFF", "OFF,NON-THETA,NREM"},
+    {"state_input", Kind::CHANNELS, "", nullptr},
+    {"theta_ratio", Kind::NUMBER, "1", nullptr},
+    {"delta_frac", Kind::NUMBER, "0.5", nullptr},
+    {"ref_input", Kind::CHANNELS, "", nullptr},
+    {"ref_std", Kind::NUMBER, "5", nullptr},
+    {"mov_detect", Kind::CHOICE, "OFF", "OFF,ACC,EMG"},
+    {"mov_input", Kind::CHANNELS, "", nullptr},
+    {"aux_input", Kind::CHANNELS, "", nullptr},
+    {"mov_out", Kind::NUMBER, "3", nullptr},
+    {"mov_std", Kind::NUMBER, "5", nullptr},
+    {"min_time_st", Kind::NUMBER, "5000", nullptr},
+    {"min_time_mov", Kind::NUMBER, "10", nullptr},
+};
+
+const ParamSpec *findSpec(const std::string &name) {
+  for (const ParamSpec &spec : paramSpecs)
+    if (name == spec.name)
+      return &spec;
+  return nullptr;
+}
+
+// Case-insensitive, as the plugin compares categorical values
+bool sameText(const std::string &a, const std::string &b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t idx = 0; idx < a.size(); idx++)
+    if (toupper((unsigned char)a[idx]) != toupper((unsigned char)b[idx]))
+      return false;
+  return true;
+}
+
+} // namespace
+
+SidecarParams::SidecarParams() {
+  for (const ParamSpec &spec : paramSpecs)
+    values[spec.name] = spec.defaultValue;
+}
+
+bool SidecarParams::set(const std::string &assignment, std::string &error) {
+  const size_t equals = assignment.find('=');
+  if (equals == std::string::npos) {
+    error = "Expected name=value, got " + assignment;
+    return false;
+  }
+  const std::string name = assignment.substr(0, equals);
+  const std::string value = assignment.substr(equals + 1);
+
+  const ParamSpec *spec = findSpec(name);
+  if (spec == nullptr) {
+    error = "Unknown or unsupported parameter " + name;
+    return false;
+  }
+
+  switch (spec->kind) {
+  case Kind::NUMBER: {
+    char *end;
+    const double number = strtod(value.c_str(), &end);
+    if (value.empty() || *end || number < 0) {
+      error = "Invalid value for " + name + ": " + value;
+      return false;
+    }
+    break;
+  }
+  case Kind::CHOICE: {
+    std::stringstream choices(spec->choices);
+    std::string choice;
+    bool found = false;
+    while (std::getline(choices, choice, ','))
+      found = found || sameText(choice, value);
+    if (!found) {
+      error = name + " must be one of " + spec->choices;
+      return false;
+    }
+    break;
+  }
+  case Kind::CHANNELS:
+  case Kind::TEXT:
+    // Channels are checked against the ring in compile()
+    break;
+  }
+
+  values[name] = value;
+  return true;
+}
+
+double SidecarParams::number(const std::string &name) const {
+  return strtod(values.at(name).c_str(), nullptr);
+}
+
+bool SidecarParams::channels(const std::string &name, int numChannels,
+                             std::vector<int> &indices,
+                             std::string &error) const {
+  indices.clear();
+  std::stringstream fields(values.at(name));
+  std::string field;
+  while (std::getline(fields, field, ',')) {
+    char *end;
+    const long index = strtol(field.c_str(), &end, 10);
+    if (field.empty() || *end || index < 0 || index >= numChannels) {
+      error = name + ": no channel " + field + " in a ring of " +
+              std::to_string(numChannels) + " channels";
+      return false;
+    }
+    indices.push_back((int)index);
+  }
+  return true;
+}
+
+bool SidecarParams::compile(const RippleRingStream &stream,
+                            RippleDetectorConfig &config,
+                            std::string &cnnModelPath,
+                            std::string &error) const {
+  const int numChannels = (int)stream.numChannels;
+  const double sampleRate = stream.sampleRate;
+  config = RippleDetectorConfig();
+
+  std::vector<int> indices;
+  if (!channels("Ripple_Input", numChannels, indices, error))
+    return false;
+  config.rippleInputChannel = indices.empty() ? -1 : indices.front();
+  if (!channels("mov_input", numChannels, indices, error))
+    return false;
+  config.movementInputChannel = indices.empty() ? -1 : indices.front();
+  if (!channels("aux_input", numChannels, config.auxChannelIndices, error))
+    return false;
+  if (!channels("ref_input", numChannels, indices, error))
+    return false;
+  if ((int)indices.size() > RippleDetectorConfig::maxReferenceChannels)
+    indices.resize(RippleDetectorConfig::maxReferenceChannels);
+  config.referenceChannels = indices;
+
+  // Samples within one step of the int16 range count as clipped
+  config.clipLevel = (float)(32766.0 * stream.bitVolts);
+
+  config.rippleOutputChannel = (int)number("Ripple_Out") - 1;
+  config.ttlReportChannel = (int)number("Ripple_save") - 1;
+  config.movementOutputChannel = (int)number("mov_out") - 1;
+  if (config.rippleOutputChannel < 0 || config.ttlReportChannel < 0 ||
+      config.movementOutputChannel < 0) {
+    error = "TTL lines start at 1";
+    return false;
+  }
+  if (config.rippleOutputChannel == config.ttlReportChannel ||
+      config.movementOutputChannel == config.rippleOutputChannel ||
+      config.movementOutputChannel == config.ttlReportChannel) {
+    error = "Ripple_Out, Ripple_save and mov_out must be different lines";
+    return false;
+  }
+
+  config.rippleSds = (float)number("ripple_std");
+  config.refractoryTime = (int)number("refr_time");
+  config.rmsSamples = std::max(1, (int)number("rms_samples"));
+  config.ttlDuration = number("ttl_duration");
+  config.ttlPercent = number("ttl_percent");
+  config.ttlDurationSamples = ceil(sampleRate * config.ttlDuration / 1000);
+  config.filterBankEnabled = sameText(values.at("filter_bank"), "ON");
+  config.detectorMode = sameText(values.at("detector"), "CNN")
+                            ? DetectorMode::CNN
+                            : DetectorMode::RMS;
+  cnnModelPath = values.at("cnn_model");
+  config.cnnThreshold = (float)number("cnn_thresh");
+  config.fastRippleRatio = (float)number("fr_ratio");
+  config.artefactSds = (float)number("artefact_std");
+  config.artefactHoldSamples =
+      ceil(sampleRate * artefactHoldMilliseconds / 1000);
+  config.refSds = (float)number("ref_std");
+
+  const std::string &stateGate = values.at("state_gate");
+  if (sameText(stateGate, "NON-THETA"))
+    config.stateGate = StateGateMode::NON_THETA;
+  else if (sameText(stateGate, "NREM"))
+    config.stateGate = StateGateMode::NREM;
+  else
+    config.stateGate = StateGateMode::OFF;
+  if (!channels("state_input", numChannels, indices, error))
+    return false;
+  config.stateInputChannel =
+      indices.empty() ? config.rippleInputChannel : indices.front();
+  config.thetaRatio = (float)number("theta_ratio");
+  config.deltaFraction = (float)number("delta_frac");
+
+  config.rmsMean = number("RMS_mean");
+  config.rmsStdDev = number("RMS_std");
+
+  const std::string &movSwitch = values.at("mov_detect");
+  if (sameText(movSwitch, "ACC"))
+    config.movementMode = MovementMode::ACC;
+  else if (sameText(movSwitch, "EMG"))
+    config.movementMode = MovementMode::EMG;
+  else
+    config.movementMode = MovementMode::OFF;
+  config.movSds = (float)number("mov_std");
+
+  config.sampleRate = sampleRate;
+  config.numSamplesTimeThreshold =
+      ceil(sampleRate * (int)number("time_thresh") / 1000);
+  config.minMovSamplesBelowThresh =
+      ceil(sampleRate * (int)number("min_time_st") / 1000);
+  config.minMovSamplesAboveThresh =
+      ceil(sampleRate * (int)number("min_time_mov") / 1000);
+  config.calibrationPoints = sampleRate * calibrationDurationSeconds;
+  config.threshold = config.rmsMean + config.rippleSds * config.rmsStdDev;
+  return true;
+}
+
+std::string SidecarParams::describe() {
+  std::string text;
+  for (const ParamSpec &spec : paramSpecs) {
+    text += "  ";
+    text += spec.name;
+    text += std::string(16 - std::min<size_t>(15, strlen(spec.name)), ' ');
+    if (spec.kind == Kind::CHOICE)
+      text += std::string(spec.choices) + " (default " + spec.defaultValue +
+              ")\n";
+    else if (spec.kind == Kind::CHANNELS)
+      text += std::string("channels (default ") +
+              (*spec.defaultValue ? spec.defaultValue : "none") + ")\n";
+    else
+      text += std::string("default ") +
+              (*spec.defaultValue ? spec.defaultValue : "\"\"") + "\n";
+  }
+  return text;
+}
@@ -0,0 +1,44 @@
+#ifndef __RIPPLE_SIDECAR_PARAMS_H
+#define __RIPPLE_SIDECAR_PARAMS_H
+
+#include "../../RippleDetectorConfig.h"
+#include "RippleShmRing.h"
+#include <map>
+#include <string>
+
+/**
+  Detection parameters of the sidecar, under their names in the plugin and
+  with the plugin's defaults.
+
+  Channel parameters (Ripple_Input, ref_input, mov_input, state_input) take
+  zero-based channel indices in the block ring, several of them separated by
+  commas; the ripple input defaults to channel 0. aux_input, which has no
+  plugin parameter, lists the accelerometer axes the plugin takes from the
+  stream's AUX channels. Parameters that only drive the editor or the
+  plugin's outputs are not accepted.
+**/
+class SidecarParams {
+public:
+  SidecarParams();
+
+  /** Sets a parameter from "name=value". Returns false and sets error if
+   * the name is unknown or the value does not parse */
+  bool set(const std::string &assignment, std::string &error);
+
+  /** Compiles the parameters into a snapshot for the ring's stream, as
+   * RippleDetector::publishConfig does */
+  bool compile(const RippleRingStream &stream, RippleDetectorConfig &config,
+               std::string &cnnModelPath, std::string &error) const;
+
+  /** Lists the accepted names with their defaults */
+  static std::string describe();
+
+private:
+  double number(const std::string &name) const;
+  bool channels(const std::string &name, int numChannels,
+                std::vector<int> &indices, std::string &error) const;
+
+  std::map<std::string, std::string> values;
+};
+
+#endif
@@ -0,0 +1,280 @@
+#include "../../RippleDetectorConfig.h"
+#include "SweepEngine.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+static void printUsage() {
+  printf(
+      "Usage: ripple-sweep --dat continuous.dat --channels N --rate HZ\n"
+      "                    --ripple-ch IDX [options] [grid]\n"
+      "\n"
+      "Session:\n"
+      "  --bit-volts V       Microvolts per raw sample (default 1)\n"
+      "  --mov-ch LIST       EMG channel, or the accelerometer axes\n"
+      "  --ref-ch LIST       Reference channels for the veto (ref_input)\n"
+      "  --filter-bank       Use the internal 150-250 Hz filter bank\n"
+      "  --calibration SEC   Calibration period (default 10)\n"
+      "  --block N           Samples per process() block (default 1024)\n"
+      "  --cache FILE        Memory-mapped RMS cache, built on first use\n"
+      "  --cache-strides L   Cache levels in samples (default 1,16,256)\n"
+      "  --labels FILE       CSV of labeled ripples, \"start[,end]\" seconds\n"
+      "  --tolerance MS      Label matching tolerance (default 50)\n"
+      "  --threads N         Worker threads (default: all cores)\n"
+      "  --out FILE          Results CSV (default: stdout)\n"
+      "\n"
+      "Grid (a list \"a,b,c\" or a range \"start:stop:step\"):\n"
+      "  --rms-samples  --ripple-std  --time-thresh  --refr-time\n"
+      "  --mov-std  --min-time-st  --min-time-mov  --fr-ratio  --artefact-std\n"
+      "  --ref-std\n"
+      "\n"
+      "Channel indices are zero-based. Unset grid parameters take the\n"
+      "plugin defaults. RMS windows are cut in every block, and refractory\n"
+      "periods are timed by the first sample of each block, as with\n"
+      "ripple-sidecar --sample-clock. The CNN detector, the brain-state\n"
+      "gate and ttl_percent are not modelled; use ripple-sidecar or the\n"
+      "Python bindings to check such settings.\n");
+}
+
+// Parse "a,b,c" or "start:stop:step"
+static std::vector<double> parseValues(const std::string &text) {
+  std::vector<double> values;
+
+  if (text.find(':') != std::string::npos) {
+    double start, stop, step;
+    if (sscanf(text.c_str(), "%lf:%lf:%lf", &start, &stop, &step) != 3 ||
+        step <= 0 || stop < start)
+      throw std::runtime_error("Invalid range: " + text);
+    // Tolerate rounding in the last step
+    const int count = (int)floor((stop - start) / step + 1e-9) + 1;
+    for (int idx = 0; idx < count; idx++)
+      values.push_back(start + idx * step);
+    return values;
+  }
+
+  std::stringstream fields(text);
+  std::string field;
+  while (std::getline(fields, field, ',')) {
+    char *end;
+    double value = strtod(field.c_str(), &end);
+    if (end == field.c_str() || *end)
+      throw std::runtime_error("Invalid value: " + field);
+    values.push_back(value);
+  }
+  if (values.empty())
+    throw std::runtime_error("Empty value list");
+  return values;
+}
+
+int main(int argc, char **argv) {
+
+  SweepSession session;
+  std::string labelsPath, outPath;
+  double toleranceMs = 50.0;
+  int numThreads = std::thread::hardware_concurrency();
+
+  // Plugin defaults
+  SweepParams defaults;
+  std::vector<double> rmsSamples{(double)defaults.rmsSamples},
+      rippleSds{defaults.rippleSds}, timeThreshold{defaults.timeThreshold},
+      refractoryTime{defaults.refractoryTime}, movSds{defaults.movSds},
+      minTimeSteady{defaults.minTimeSteady},
+      minTimeMovement{defaults.minTimeMovement},
+      fastRippleRatio{defaults.fastRippleRatio},
+      artefactSds{defaults.artefactSds}, refSds{defaults.refSds};
+
+  try {
+    for (int idx = 1; idx < argc; idx++) {
+      const std::string arg = argv[idx];
+      if (arg == "--help" || arg == "-h") {
+        printUsage();
+        return 0;
+      }
+      if (arg == "--filter-bank") {
+        session.filterBankEnabled = true;
+        continue;
+      }
+      if (idx + 1 >= argc)
+        throw std::runtime_error("Missing value for " + arg);
+      const std::string value = argv[++idx];
+
+      if (arg == "--dat")
+        session.datPath = value;
+      else if (arg == "--channels")
+        session.numChannels = std::stoi(value);
+      else if (arg == "--rate")
+        session.sampleRate = std::stod(value);
+      else if (arg == "--bit-volts")
+        session.bitVolts = std::stod(value);
+      else if (arg == "--ripple-ch")
+        session.rippleChannel = std::stoi(value);
+      else if (arg == "--mov-ch")
+        for (double channel : parseValues(value))
+          session.movementChannels.push_back((int)channel);
+      else if (arg == "--ref-ch")
+        for (double channel : parseValues(value))
+          session.referenceChannels.push_back((int)channel);
+      else if (arg == "--calibration")
+        session.calibrationSeconds = std::stod(value);
+      else if (arg == "--block")
+        session.blockSamples = std::stoi(value);
+      else if (arg == "--cache")
+        session.cachePath = value;
+      else if (arg == "--cache-strides") {
+        session.cacheStrides.clear();
+        for (double stride : parseValues(value))
+          session.cacheStrides.push_back((int)stride);
+      } else if (arg == "--labels")
+        labelsPath = value;
+      else if (arg == "--tolerance")
+        toleranceMs = std::stod(value);
+      else if (arg == "--threads")
+        numThreads = std::stoi(value);
+      else if (arg == "--out")
+        outPath = value;
+      else if (arg == "--rms-samples")
+        rmsSamples = parseValues(value);
+      else if (arg == "--ripple-std")
+        rippleSds = parseValues(value);
+      else if (arg == "--time-thresh")
+        timeThreshold = parseValues(value);
+      else if (arg == "--refr-time")
+        refractoryTime = parseValues(value);
+      else if (arg == "--mov-std")
+        movSds = parseValues(value);
+      else if (arg == "--min-time-st")
+        minTimeSteady = parseValues(value);
+      else if (arg == "--min-time-mov")
+        minTimeMovement = parseValues(value);
+      else if (arg == "--fr-ratio")
+        fastRippleRatio = parseValues(value);
+      else if (arg == "--artefact-std")
+        artefactSds = parseValues(value);
+      else if (arg == "--ref-std")
+        refSds = parseValues(value);
+      else
+        throw std::runtime_error("Unknown option " + arg);
+    }
+
+    if (session.datPath.empty() || session.numChannels <= 0 ||
+        session.sampleRate <= 0 || session.rippleChannel < 0 ||
+        session.rippleChannel >= session.numChannels) {
+      printUsage();
+      return 1;
+    }
+    for (int channel : session.movementChannels) {
+      if (channel < 0 || channel >= session.numChannels)
+        throw std::runtime_error("Movement channel out of range");
+    }
+    for (int channel : session.referenceChannels) {
+      if (channel < 0 || channel >= session.numChannels)
+        throw std::runtime_error("Reference channel out of range");
+    }
+    // As the plugin, which takes the first channels of ref_input
+    if ((int)session.referenceChannels.size() >
+        RippleDetectorConfig::maxReferenceChannels) {
+      fprintf(stderr, "Warning: only the first %d reference channels are "
+                      "used\n",
+              RippleDetectorConfig::maxReferenceChannels);
+      session.referenceChannels.resize(
+          RippleDetectorConfig::maxReferenceChannels);
+    }
+    if (session.blockSamples < 1)
+      throw std::runtime_error("The block must hold at least 1 sample");
+    for (double samples : rmsSamples) {
+      if (samples < 1)
+        throw std::runtime_error("rms_samples must be at least 1");
+    }
+
+    // Parameters without an effect on this session keep a single value
+    if (session.movementChannels.empty()) {
+      movSds.resize(1);
+      minTimeSteady.resize(1);
+      minTimeMovement.resize(1);
+    }
+    if (!session.filterBankEnabled) {
+      fastRippleRatio.resize(1);
+      artefactSds.resize(1);
+    }
+    if (session.referenceChannels.empty())
+      refSds.resize(1);
+
+    std::vector<SweepParams> grid;
+    for (double rs : rmsSamples)
+      for (double sd : rippleSds)
+        for (double tt : timeThreshold)
+          for (double rt : refractoryTime)
+            for (double ms : movSds)
+              for (double st : minTimeSteady)
+                for (double mm : minTimeMovement)
+                  for (double fr : fastRippleRatio)
+                    for (double as : artefactSds)
+                      for (double rf : refSds)
+                        grid.push_back(
+                            {(int)rs, sd, tt, rt, ms, st, mm, fr, as, rf});
+
+    std::vector<LabeledEvent> labels;
+    if (!labelsPath.empty())
+      labels = readLabels(labelsPath);
+
+    auto start = std::chrono::steady_clock::now();
+    SweepEngine engine(session, numThreads);
+    std::vector<SweepResult> results =
+        engine.run(grid, labels, toleranceMs / 1000.0);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    fprintf(stderr, "Evaluated %zu settings in %.1f s\n", results.size(),
+            elapsed.count() / 1000.0);
+
+    std::ofstream outFile;
+    if (!outPath.empty()) {
+      outFile.open(outPath);
+      if (!outFile)
+        throw std::runtime_error("Cannot write " + outPath);
+    }
+    std::ostream &out = outPath.empty() ? std::cout : outFile;
+
+    out << "rms_samples,ripple_std,time_thresh,refr_time,mov_std,"
+           "min_time_st,min_time_mov,fr_ratio,artefact_std,ref_std,"
+           "detections,blocked";
+    if (!labels.empty())
+      out << ",true_positives,false_positives,false_negatives,precision,"
+             "recall,f1";
+    out << "\n";
+
+    for (const SweepResult &r : results) {
+      const SweepParams &p = r.params;
+      out << p.rmsSamples << "," << p.rippleSds << "," << p.timeThreshold
+          << "," << p.refractoryTime << "," << p.movSds << ","
+          << p.minTimeSteady << "," << p.minTimeMovement << ","
+          << p.fastRippleRatio << "," << p.artefactSds << "," << p.refSds
+          << "," << r.detections << "," << r.blocked;
+      if (!labels.empty()) {
+        const double precision =
+            r.detections ? (double)(r.detections - r.falsePositives) /
+                               r.detections
+                         : 0.0;
+        const double recall = (double)r.truePositives / labels.size();
+        const double f1 = precision + recall > 0
+                              ? 2 * precision * recall / (precision + recall)
+                              : 0.0;
+        out << "," << r.truePositives << "," << r.falsePositives << ","
+            << r.falseNegatives << "," << precision << "," << recall << ","
+            << f1;
+      }
+      out << "\n";
+    }
+  } catch (const std::exception &e) {
+    fprintf(stderr, "ripple-sweep: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
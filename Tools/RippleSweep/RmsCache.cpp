@@ -0,0 +1,475 @@
+#include "RmsCache.h"
+#include "../../RippleFilterBank.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Frames read from the source at a time while building
+#define READ_CHUNK_FRAMES 65536
+
+static const char cacheMagic[8] = {'R', 'P', 'L', 'R', 'M', 'S', 'C', 'H'};
+static constexpr uint32_t cacheVersion = 2;
+
+struct RmsCache::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t numChannels;
+  uint64_t sourceSize;
+  int64_t sourceModified;
+  int64_t numSamples;
+  double sampleRate;
+  double bitVolts;
+  double rippleLow, rippleHigh; // Filter bank bands the cache was built with
+  double fastRippleLow, fastRippleHigh;
+  int32_t filterChannel;
+  int32_t numSeries;
+  int32_t numLevels;
+  int32_t reserved;
+  int32_t strides[maxLevels];
+  char sourcePath[1024];
+};
+
+struct RmsCache::SeriesEntry {
+  int32_t kind;
+  int32_t channel;
+  uint64_t offset[maxLevels]; // Byte offset of each level's array
+  uint64_t count[maxLevels];  // Entries in each level's array
+};
+
+static uint64_t align8(uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+static int64_t modificationTime(const std::string &path) {
+  return std::filesystem::last_write_time(path).time_since_epoch().count();
+}
+
+/* MappedFile */
+
+MappedFile::~MappedFile() { close(); }
+
+#ifdef _WIN32
+
+bool MappedFile::openRead(const std::string &path) {
+  close();
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+  if (handle == INVALID_HANDLE_VALUE)
+    return false;
+  fileHandle = handle;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0) {
+    close();
+    return false;
+  }
+  mappingHandle =
+      CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mappingHandle) {
+    close();
+    return false;
+  }
+  base = (uint8_t *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  if (!base) {
+    close();
+    return false;
+  }
+  length = fileSize.QuadPart;
+  return true;
+}
+
+bool MappedFile::create(const std::string &path, uint64_t size) {
+  close();
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                              nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+  if (handle == INVALID_HANDLE_VALUE)
+    return false;
+  fileHandle = handle;
+
+  // The mapping extends the file to the requested size
+  mappingHandle =
+      CreateFileMappingA(handle, nullptr, PAGE_READWRITE, (DWORD)(size >> 32),
+                         (DWORD)(size & 0xFFFFFFFF), nullptr);
+  if (!mappingHandle) {
+    close();
+    return false;
+  }
+  base = (uint8_t *)MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, 0);
+  if (!base) {
+    close();
+    return false;
+  }
+  length = size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (base)
+    UnmapViewOfFile(base);
+  if (mappingHandle)
+    CloseHandle(mappingHandle);
+  if (fileHandle)
+    CloseHandle(fileHandle);
+  base = nullptr;
+  mappingHandle = nullptr;
+  fileHandle = nullptr;
+  length = 0;
+}
+
+#else
+
+bool MappedFile::openRead(const std::string &path) {
+  close();
+  fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close();
+    return false;
+  }
+  void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    close();
+    return false;
+  }
+  base = (uint8_t *)mapping;
+  length = info.st_size;
+  return true;
+}
+
+bool MappedFile::create(const std::string &path, uint64_t size) {
+  close();
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  if (ftruncate(fd, size) != 0) {
+    close();
+    return false;
+  }
+  void *mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    close();
+    return false;
+  }
+  base = (uint8_t *)mapping;
+  length = size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (base)
+    munmap(base, length);
+  if (fd >= 0)
+    ::close(fd);
+  base = nullptr;
+  fd = -1;
+  length = 0;
+}
+
+#endif
+
+/* RmsCache */
+
+const RmsCache::Header *RmsCache::header() const {
+  return (const Header *)file.data();
+}
+
+const RmsCache::SeriesEntry *RmsCache::seriesEntry(int series) const {
+  return (const SeriesEntry *)(file.data() + align8(sizeof(Header))) + series;
+}
+
+void RmsCache::open(const std::string &path,
+                    const RmsCacheSettings &settings) {
+
+  if (file.openRead(path) && matches(settings))
+    return;
+
+  file.close();
+  fprintf(stderr, "Building RMS cache %s\n", path.c_str());
+  build(path, settings);
+
+  if (!file.openRead(path) || !matches(settings))
+    throw std::runtime_error("Cannot read back " + path);
+}
+
+bool RmsCache::matches(const RmsCacheSettings &settings) const {
+
+  if (file.size() < sizeof(Header))
+    return false;
+  const Header *h = header();
+  if (memcmp(h->magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+      h->version != cacheVersion)
+    return false;
+  if (file.size() <
+      align8(sizeof(Header)) + (uint64_t)h->numSeries * sizeof(SeriesEntry))
+    return false;
+
+  // The source must not have changed since the cache was built
+  std::error_code error;
+  const uint64_t sourceSize =
+      std::filesystem::file_size(settings.sourcePath, error);
+  if (error || sourceSize != h->sourceSize ||
+      modificationTime(settings.sourcePath) != h->sourceModified)
+    return false;
+
+  if ((int)h->numChannels != settings.numChannels ||
+      h->sampleRate != settings.sampleRate ||
+      h->bitVolts != settings.bitVolts ||
+      h->filterChannel != settings.filterChannel ||
+      h->rippleLow != RippleFilterBank::rippleLow ||
+      h->rippleHigh != RippleFilterBank::rippleHigh ||
+      h->fastRippleLow != RippleFilterBank::fastRippleLow ||
+      h->fastRippleHigh != RippleFilterBank::fastRippleHigh)
+    return false;
+
+  if (h->numLevels != (int)settings.strides.size())
+    return false;
+  for (int l = 0; l < h->numLevels; l++) {
+    if (h->strides[l] != settings.strides[l])
+      return false;
+  }
+
+  for (int channel : settings.channels) {
+    if (findSeries(CacheSeries::SQUARES, channel) < 0)
+      return false;
+  }
+  return true;
+}
+
+void RmsCache::build(const std::string &path,
+                     const RmsCacheSettings &settings) {
+
+  const std::vector<int> &strides = settings.strides;
+  const int numLevels = strides.size();
+  if (numLevels == 0 || numLevels > maxLevels)
+    throw std::runtime_error("The cache needs 1 to 8 levels");
+  for (int l = 0; l < numLevels; l++) {
+    if (strides[l] <= 0 || strides[l] % strides[0] != 0 ||
+        (l > 0 && strides[l] <= strides[l - 1]))
+      throw std::runtime_error("Cache strides must be increasing multiples "
+                               "of the first stride");
+  }
+  const int baseStride = strides[0];
+
+  std::ifstream source(settings.sourcePath, std::ios::binary);
+  if (!source)
+    throw std::runtime_error("Cannot open " + settings.sourcePath);
+  const uint64_t sourceSize = std::filesystem::file_size(settings.sourcePath);
+  const int64_t numSamples =
+      sourceSize / (sizeof(int16_t) * settings.numChannels);
+
+  // Series layout: squares of every channel, then the filter bank outputs
+  std::vector<std::pair<CacheSeries, int>> seriesList;
+  for (int channel : settings.channels)
+    seriesList.push_back({CacheSeries::SQUARES, channel});
+  if (settings.filterChannel >= 0) {
+    seriesList.push_back({CacheSeries::RIPPLE_SQUARES, settings.filterChannel});
+    seriesList.push_back(
+        {CacheSeries::FAST_RIPPLE_SQUARES, settings.filterChannel});
+    seriesList.push_back({CacheSeries::SLOPE_MAX, settings.filterChannel});
+  }
+  const int numSeries = seriesList.size();
+
+  std::vector<SeriesEntry> entries(numSeries);
+  uint64_t offset =
+      align8(align8(sizeof(Header)) + numSeries * sizeof(SeriesEntry));
+  for (int s = 0; s < numSeries; s++) {
+    memset(&entries[s], 0, sizeof(SeriesEntry));
+    entries[s].kind = (int32_t)seriesList[s].first;
+    entries[s].channel = seriesList[s].second;
+    for (int l = 0; l < numLevels; l++) {
+      // Prefix sums carry a leading zero; maxima hold one entry per block
+      entries[s].count[l] = numSamples / strides[l] +
+                            (seriesList[s].first != CacheSeries::SLOPE_MAX);
+      entries[s].offset[l] = offset;
+      offset += entries[s].count[l] * sizeof(double);
+    }
+  }
+
+  // Build next to the destination and swap in when complete
+  const std::string tempPath = path + ".tmp";
+  MappedFile out;
+  if (!out.create(tempPath, offset))
+    throw std::runtime_error("Cannot create " + tempPath);
+
+  Header *h = (Header *)out.data();
+  memset(h, 0, sizeof(Header));
+  memcpy(h->magic, cacheMagic, sizeof(cacheMagic));
+  h->version = cacheVersion;
+  h->numChannels = settings.numChannels;
+  h->sourceSize = sourceSize;
+  h->sourceModified = modificationTime(settings.sourcePath);
+  h->numSamples = numSamples;
+  h->sampleRate = settings.sampleRate;
+  h->bitVolts = settings.bitVolts;
+  h->rippleLow = RippleFilterBank::rippleLow;
+  h->rippleHigh = RippleFilterBank::rippleHigh;
+  h->fastRippleLow = RippleFilterBank::fastRippleLow;
+  h->fastRippleHigh = RippleFilterBank::fastRippleHigh;
+  h->filterChannel = settings.filterChannel;
+  h->numSeries = numSeries;
+  h->numLevels = numLevels;
+  for (int l = 0; l < numLevels; l++)
+    h->strides[l] = strides[l];
+  strncpy(h->sourcePath, settings.sourcePath.c_str(),
+          sizeof(h->sourcePath) - 1);
+  memcpy(out.data() + align8(sizeof(Header)), entries.data(),
+         numSeries * sizeof(SeriesEntry));
+
+  std::vector<std::vector<double *>> arrays(numSeries);
+  for (int s = 0; s < numSeries; s++) {
+    for (int l = 0; l < numLevels; l++) {
+      arrays[s].push_back((double *)(out.data() + entries[s].offset[l]));
+      if (seriesList[s].first != CacheSeries::SLOPE_MAX)
+        arrays[s][l][0] = 0.0;
+    }
+  }
+
+  RippleFilterBank filterBank;
+  filterBank.prepare(settings.sampleRate);
+  std::vector<float> block(baseStride);
+  std::vector<double> totals(numSeries, 0.0);
+  std::vector<double> blockSquares(numSeries, 0.0);
+  std::vector<double> levelMax(numLevels, 0.0);
+
+  std::vector<int16_t> chunk((size_t)READ_CHUNK_FRAMES * settings.numChannels);
+  int64_t sample = 0;
+  int blockFill = 0;
+
+  while (source && sample < numSamples) {
+    source.read((char *)chunk.data(), chunk.size() * sizeof(int16_t));
+    const int frames =
+        (int)(source.gcount() / (sizeof(int16_t) * settings.numChannels));
+
+    for (int frame = 0; frame < frames && sample < numSamples; frame++) {
+      const int16_t *samples = &chunk[(size_t)frame * settings.numChannels];
+      for (int s = 0; s < numSeries; s++) {
+        if (seriesList[s].first == CacheSeries::SQUARES) {
+          const double x = samples[seriesList[s].second] * settings.bitVolts;
+          blockSquares[s] += x * x;
+        }
+      }
+      if (settings.filterChannel >= 0)
+        block[blockFill] =
+            samples[settings.filterChannel] * settings.bitVolts;
+      blockFill++;
+      sample++;
+
+      if (blockFill < baseStride)
+        continue;
+      blockFill = 0;
+
+      // One base-stride block is complete
+      double slope = 0.0;
+      if (settings.filterChannel >= 0) {
+        RippleBandFeatures features =
+            filterBank.processWindow(block.data(), baseStride);
+        for (int s = 0; s < numSeries; s++) {
+          if (seriesList[s].first == CacheSeries::RIPPLE_SQUARES)
+            blockSquares[s] =
+                features.rippleRms * features.rippleRms * baseStride;
+          else if (seriesList[s].first == CacheSeries::FAST_RIPPLE_SQUARES)
+            blockSquares[s] =
+                features.fastRippleRms * features.fastRippleRms * baseStride;
+        }
+        slope = features.maxSlope;
+      }
+
+      for (int s = 0; s < numSeries; s++) {
+        totals[s] += blockSquares[s];
+        blockSquares[s] = 0.0;
+      }
+      for (int l = 0; l < numLevels; l++) {
+        levelMax[l] = std::max(levelMax[l], slope);
+        if (sample % strides[l] != 0)
+          continue;
+        const int64_t index = sample / strides[l];
+        for (int s = 0; s < numSeries; s++) {
+          if (seriesList[s].first == CacheSeries::SLOPE_MAX)
+            arrays[s][l][index - 1] = levelMax[l];
+          else
+            arrays[s][l][index] = totals[s];
+        }
+        levelMax[l] = 0.0;
+      }
+    }
+  }
+
+  if (sample < numSamples)
+    throw std::runtime_error("Short read from " + settings.sourcePath);
+
+  out.close();
+  std::filesystem::rename(tempPath, path);
+}
+
+int64_t RmsCache::numSamples() const { return header()->numSamples; }
+
+int RmsCache::findSeries(CacheSeries kind, int channel) const {
+  for (int s = 0; s < header()->numSeries; s++) {
+    if (seriesEntry(s)->kind == (int32_t)kind &&
+        seriesEntry(s)->channel == channel)
+      return s;
+  }
+  return -1;
+}
+
+bool RmsCache::supportsWindow(int windowSamples) const {
+  return coarsestLevel(0, windowSamples) >= 0;
+}
+
+int RmsCache::coarsestLevel(int64_t start, int64_t end) const {
+  for (int l = header()->numLevels - 1; l >= 0; l--) {
+    const int stride = header()->strides[l];
+    if (start % stride == 0 && end % stride == 0)
+      return l;
+  }
+  return -1;
+}
+
+bool RmsCache::sum(int series, int64_t start, int64_t end,
+                   double &value) const {
+  const int l = coarsestLevel(start, end);
+  if (l < 0 || end > numSamples())
+    return false;
+
+  const int stride = header()->strides[l];
+  const double *prefix =
+      (const double *)(file.data() + seriesEntry(series)->offset[l]);
+  value = prefix[end / stride] - prefix[start / stride];
+  return true;
+}
+
+bool RmsCache::max(int series, int64_t start, int64_t end,
+                   double &value) const {
+  const int l = coarsestLevel(start, end);
+  if (l < 0 || end > numSamples())
+    return false;
+
+  const int stride = header()->strides[l];
+  const double *maxima =
+      (const double *)(file.data() + seriesEntry(series)->offset[l]);
+  value = 0.0;
+  for (int64_t idx = start / stride; idx < end / stride; idx++)
+    value = std::max(value, maxima[idx]);
+  return true;
+}
@@ -0,0 +1,112 @@
+#ifndef __RIPPLE_RMS_CACHE_H
+#define __RIPPLE_RMS_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** Quantity held by one cached series */
+enum class CacheSeries : int32_t {
+  SQUARES = 0,             // Squared samples (prefix sums)
+  RIPPLE_SQUARES = 1,      // Squared 150-250 Hz filter bank output
+  FAST_RIPPLE_SQUARES = 2, // Squared 250-500 Hz filter bank output
+  SLOPE_MAX = 3            // Largest sample-to-sample step (block maxima)
+};
+
+/** What a cache has to hold to be reused */
+struct RmsCacheSettings {
+  std::string sourcePath; // continuous.dat
+  int numChannels{0};     // Interleaved int16 channels in the source
+  double sampleRate{0.0};
+  double bitVolts{1.0};
+  std::vector<int> channels; // Channels with a SQUARES series
+  int filterChannel{-1};     // Channel run through the filter bank, or -1
+  std::vector<int> strides{1, 16, 256}; // Samples per entry, per level
+};
+
+/** Read-only or read-write memory mapping of a whole file */
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /** Maps an existing file read-only. Returns false on failure */
+  bool openRead(const std::string &path);
+
+  /** Creates (or truncates) a file of the given size and maps it
+   * read-write. Returns false on failure */
+  bool create(const std::string &path, uint64_t size);
+
+  void close();
+
+  uint8_t *data() const { return base; }
+  uint64_t size() const { return length; }
+
+private:
+  uint8_t *base{nullptr};
+  uint64_t length{0};
+#ifdef _WIN32
+  void *fileHandle{nullptr};
+  void *mappingHandle{nullptr};
+#else
+  int fd{-1};
+#endif
+};
+
+/**
+  Persistent, memory-mapped feature cache for one recording.
+
+  For every cached channel the file holds prefix sums of the squared signal
+  at several strides ("levels"), plus the ripple and fast-ripple band
+  energies and the slope maxima of the filter bank channel. The sum of
+  squares of any window whose edges fall on a level's stride is then a
+  single subtraction, so RMS envelopes for any window length are O(1) per
+  window. Coarser levels let long windows touch proportionally fewer pages.
+
+  A header records the source file (path, size, modification time), its
+  sample rate and scaling, and the filter bank settings; a cache that no
+  longer matches is rebuilt from the source.
+**/
+class RmsCache {
+public:
+  static constexpr int maxLevels = 8;
+
+  /** Maps the cache at path, rebuilding it first if it is missing or does
+   * not match the settings. Throws std::runtime_error on I/O errors */
+  void open(const std::string &path, const RmsCacheSettings &settings);
+
+  /** Number of samples per channel in the source */
+  int64_t numSamples() const;
+
+  /** Index of a series, or -1 if the cache does not hold it */
+  int findSeries(CacheSeries kind, int channel) const;
+
+  /** True if every window of this length, tiled from sample 0, can be
+   * answered from a level */
+  bool supportsWindow(int windowSamples) const;
+
+  /** Sum of series values over samples [start, end). Returns false if no
+   * level is aligned with both edges */
+  bool sum(int series, int64_t start, int64_t end, double &value) const;
+
+  /** Maximum of a SLOPE_MAX series over samples [start, end). Returns false
+   * if no level is aligned with both edges */
+  bool max(int series, int64_t start, int64_t end, double &value) const;
+
+private:
+  struct Header;
+  struct SeriesEntry;
+
+  bool matches(const RmsCacheSettings &settings) const;
+  void build(const std::string &path, const RmsCacheSettings &settings);
+  int coarsestLevel(int64_t start, int64_t end) const;
+
+  const Header *header() const;
+  const SeriesEntry *seriesEntry(int series) const;
+
+  MappedFile file;
+};
+
+#endif
@@ -0,0 +1,501 @@
+#include "SweepEngine.h"
+#include "../../RippleDetectionCore.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// Frames read from the file at a time
+#define READ_CHUNK_FRAMES 65536
+
+// Run fn(0..count) on up to numThreads threads
+template <typename Fn>
+static void parallelFor(int count, int numThreads, const Fn &fn) {
+  std::atomic<int> next{0};
+  auto worker = [&]() {
+    for (int idx = next++; idx < count; idx = next++)
+      fn(idx);
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 1; t < std::min(numThreads, count); t++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+}
+
+// Mean and sample standard deviation of values[0..count)
+static void calibrationStats(const std::vector<float> &values, int count,
+                             double &mean, double &stdDev) {
+  mean = 0.0;
+  stdDev = 0.0;
+  if (count <= 0)
+    return;
+  for (int idx = 0; idx < count; idx++)
+    mean += values[idx];
+  mean /= count;
+  if (count < 2)
+    return;
+  for (int idx = 0; idx < count; idx++)
+    stdDev += pow(values[idx] - mean, 2.0);
+  stdDev = sqrt(stdDev / (count - 1.0));
+}
+
+SweepEngine::SweepEngine(const SweepSession &session_, int numThreads_)
+    : session(session_), numThreads(std::max(1, numThreads_)) {}
+
+void SweepFeatures::setLayout(int windowSamples_, int blockSamples_) {
+  windowSamples = windowSamples_;
+  blockSamples = blockSamples_;
+  const int length = std::min(windowSamples, blockSamples);
+  windowsPerBlock = (blockSamples + length - 1) / length;
+}
+
+FeatureBuilder::FeatureBuilder(SweepFeatures &features_, double sampleRate,
+                               bool filterBankEnabled_, bool hasMovement_,
+                               int numRefChannels_)
+    : features(features_), filterBankEnabled(filterBankEnabled_),
+      hasMovement(hasMovement_), numRefChannels(numRefChannels_),
+      window(features_.windowLength(0)) {
+  if (filterBankEnabled)
+    filterBank.prepare(sampleRate);
+}
+
+void FeatureBuilder::finishWindow() {
+  const int windowSamples = windowFill;
+
+  if (filterBankEnabled) {
+    RippleBandFeatures band =
+        filterBank.processWindow(window.data(), windowSamples);
+    features.rms.push_back(band.rippleRms);
+    features.fastRippleRms.push_back(band.fastRippleRms);
+    features.maxSlope.push_back(band.maxSlope);
+  } else {
+    features.rms.push_back(sqrt(rippleSumSquares / windowSamples));
+  }
+  if (hasMovement)
+    features.movRms.push_back(sqrt(movSumSquares / windowSamples));
+  if (numRefChannels > 0)
+    features.refRms.push_back(
+        sqrt(refSumSquares / ((double)windowSamples * numRefChannels)));
+
+  windowFill = 0;
+  rippleSumSquares = 0.0;
+  movSumSquares = 0.0;
+  refSumSquares = 0.0;
+}
+
+SweepFeatures SweepEngine::extractFeatures(int windowSamples) const {
+
+  SweepFeatures features;
+  features.setLayout(windowSamples, session.blockSamples);
+
+  // Every window edge is a multiple of both the window and the block sizes
+  if (cache && cache->supportsWindow(
+                   std::gcd(features.windowLength(0), session.blockSamples)))
+    readCachedFeatures(features);
+  else
+    streamFeatures(features);
+
+  calibrate(features);
+  return features;
+}
+
+void SweepEngine::calibrate(SweepFeatures &features) const {
+
+  // As in process(), the calibration takes whole blocks until it has seen
+  // the calibration period, and detection starts on the next block
+  const long long calibrationSamples =
+      (long long)(session.sampleRate * session.calibrationSeconds);
+  const long long numBlocks = features.rms.size() / features.windowsPerBlock;
+  features.firstDetectionBlock = std::min(
+      numBlocks,
+      std::max(1LL, (calibrationSamples + features.blockSamples - 1) /
+                        features.blockSamples));
+
+  const int n = features.firstDetectionBlock * features.windowsPerBlock;
+  calibrationStats(features.rms, n, features.rmsMean, features.rmsStdDev);
+  if (!session.movementChannels.empty())
+    calibrationStats(features.movRms, n, features.movRmsMean,
+                     features.movRmsStdDev);
+  if (session.filterBankEnabled)
+    calibrationStats(features.maxSlope, n, features.slopeMean,
+                     features.slopeStdDev);
+  if (!session.referenceChannels.empty())
+    calibrationStats(features.refRms, n, features.refRmsMean,
+                     features.refRmsStdDev);
+}
+
+void SweepEngine::streamFeatures(SweepFeatures &features) const {
+
+  std::ifstream file(session.datPath, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Cannot open " + session.datPath);
+
+  FeatureBuilder builder(features, session.sampleRate,
+                         session.filterBankEnabled,
+                         !session.movementChannels.empty(),
+                         (int)session.referenceChannels.size());
+  std::vector<int16_t> chunk((size_t)READ_CHUNK_FRAMES * session.numChannels);
+  long long numFrames = 0;
+
+  while (file) {
+    file.read((char *)chunk.data(), chunk.size() * sizeof(int16_t));
+    const int frames =
+        (int)(file.gcount() / (sizeof(int16_t) * session.numChannels));
+
+    for (int frame = 0; frame < frames; frame++) {
+      const int16_t *samples = &chunk[(size_t)frame * session.numChannels];
+
+      // The RMS of the accelerometer magnitude only needs the summed
+      // squares of its axes
+      double movSquares = 0.0;
+      for (int channel : session.movementChannels) {
+        const double m = samples[channel] * session.bitVolts;
+        movSquares += m * m;
+      }
+      double refSquares = 0.0;
+      for (int channel : session.referenceChannels) {
+        const double r = samples[channel] * session.bitVolts;
+        refSquares += r * r;
+      }
+      builder.addSample(samples[session.rippleChannel] * session.bitVolts,
+                        movSquares, refSquares);
+    }
+    numFrames += frames;
+  }
+
+  // The windows of a trailing partial block are dropped
+  const size_t numWindows =
+      (size_t)(numFrames / features.blockSamples) * features.windowsPerBlock;
+  for (std::vector<float> *series :
+       {&features.rms, &features.fastRippleRms, &features.maxSlope,
+        &features.movRms, &features.refRms})
+    if (!series->empty())
+      series->resize(numWindows);
+}
+
+// O(1) lookups per window instead of a pass over the raw samples
+void SweepEngine::readCachedFeatures(SweepFeatures &features) const {
+
+  const long long numBlocks = cache->numSamples() / features.blockSamples;
+  const long long numWindows = numBlocks * features.windowsPerBlock;
+
+  int rmsSeries, fastRippleSeries = -1, slopeSeries = -1;
+  if (session.filterBankEnabled) {
+    rmsSeries =
+        cache->findSeries(CacheSeries::RIPPLE_SQUARES, session.rippleChannel);
+    fastRippleSeries = cache->findSeries(CacheSeries::FAST_RIPPLE_SQUARES,
+                                         session.rippleChannel);
+    slopeSeries =
+        cache->findSeries(CacheSeries::SLOPE_MAX, session.rippleChannel);
+  } else {
+    rmsSeries = cache->findSeries(CacheSeries::SQUARES, session.rippleChannel);
+  }
+  std::vector<int> movSeries, refSeries;
+  for (int channel : session.movementChannels)
+    movSeries.push_back(cache->findSeries(CacheSeries::SQUARES, channel));
+  for (int channel : session.referenceChannels)
+    refSeries.push_back(cache->findSeries(CacheSeries::SQUARES, channel));
+
+  features.rms.resize(numWindows);
+  if (session.filterBankEnabled) {
+    features.fastRippleRms.resize(numWindows);
+    features.maxSlope.resize(numWindows);
+  }
+  if (!movSeries.empty())
+    features.movRms.resize(numWindows);
+  if (!refSeries.empty())
+    features.refRms.resize(numWindows);
+
+  for (long long w = 0; w < numWindows; w++) {
+    const int index = w % features.windowsPerBlock;
+    const int windowSamples = features.windowLength(index);
+    const long long start = (w / features.windowsPerBlock) *
+                                features.blockSamples +
+                            (long long)index * features.windowLength(0);
+    const long long end = start + windowSamples;
+    double value;
+
+    cache->sum(rmsSeries, start, end, value);
+    features.rms[w] = sqrt(value / windowSamples);
+
+    if (session.filterBankEnabled) {
+      cache->sum(fastRippleSeries, start, end, value);
+      features.fastRippleRms[w] = sqrt(value / windowSamples);
+      cache->max(slopeSeries, start, end, value);
+      features.maxSlope[w] = value;
+    }
+
+    if (!movSeries.empty()) {
+      double movSumSquares = 0.0;
+      for (int series : movSeries) {
+        cache->sum(series, start, end, value);
+        movSumSquares += value;
+      }
+      features.movRms[w] = sqrt(movSumSquares / windowSamples);
+    }
+
+    if (!refSeries.empty()) {
+      double refSumSquares = 0.0;
+      for (int series : refSeries) {
+        cache->sum(series, start, end, value);
+        refSumSquares += value;
+      }
+      features.refRms[w] = sqrt(
+          refSumSquares / ((double)windowSamples * refSeries.size()));
+    }
+  }
+}
+
+// Counts the detections of a grid point and matches them against the labels
+class SweepListener : public RippleDetectionListener {
+public:
+  SweepListener(SweepResult &result_, const std::vector<LabeledEvent> &labels_,
+                double toleranceSeconds_, double sampleRate_,
+                std::vector<SweepDetection> *detections_)
+      : result(result_), labels(labels_), toleranceSeconds(toleranceSeconds_),
+        sampleRate(sampleRate_), detections(detections_),
+        labelHit(labels_.size(), 0) {}
+
+  void ttlEvent(int /*line*/, int64_t /*sampleNumber*/, bool /*state*/,
+                int /*sampleIndex*/) override {}
+
+  // ttl_percent is not modelled, every detection reaches the output
+  double drawPercent() override { return 1.0; }
+
+  void detection(const RippleWindowResult &window) override {
+    // The detection becomes known at the end of the window
+    const long long windowEnd = blockStart + window.start + window.numSamples;
+    if (detections)
+      detections->push_back({windowEnd - 1, window.blocked});
+
+    if (window.blocked) {
+      result.blocked++;
+      return;
+    }
+    result.detections++;
+
+    // Match against the labels, which are sorted by start time
+    const double time = windowEnd / sampleRate;
+    while (firstLabel < labels.size() &&
+           labels[firstLabel].end + toleranceSeconds < time)
+      firstLabel++;
+    bool hit = false;
+    for (size_t l = firstLabel;
+         l < labels.size() && labels[l].start - toleranceSeconds <= time;
+         l++) {
+      if (time <= labels[l].end + toleranceSeconds) {
+        labelHit[l] = 1;
+        hit = true;
+      }
+    }
+    if (!hit)
+      result.falsePositives++;
+  }
+
+  void finish() {
+    for (char hit : labelHit)
+      result.truePositives += hit;
+    result.falseNegatives = labels.size() - result.truePositives;
+  }
+
+  long long blockStart{0};
+
+private:
+  SweepResult &result;
+  const std::vector<LabeledEvent> &labels;
+  double toleranceSeconds;
+  double sampleRate;
+  std::vector<SweepDetection> *detections;
+  std::vector<char> labelHit;
+  size_t firstLabel{0};
+};
+
+// The snapshot RippleDetector::publishConfig() compiles for a grid point.
+// The detector reads the features instead of the channels, which only need
+// to be set
+RippleDetectorConfig SweepEngine::makeConfig(const SweepFeatures &features,
+                                             const SweepParams &params) const {
+  const double rate = session.sampleRate;
+  RippleDetectorConfig config;
+  config.rippleInputChannel = 0;
+  if (!features.movRms.empty()) {
+    config.movementMode = MovementMode::EMG;
+    config.movementInputChannel = 0;
+  }
+  config.sampleRate = rate;
+  config.rmsSamples = params.rmsSamples;
+  config.rippleSds = (float)params.rippleSds;
+  config.refractoryTime = (int)params.refractoryTime;
+  config.numSamplesTimeThreshold = ceil(rate * params.timeThreshold / 1000);
+  config.movSds = (float)params.movSds;
+  config.minMovSamplesBelowThresh = ceil(rate * params.minTimeSteady / 1000);
+  config.minMovSamplesAboveThresh =
+      ceil(rate * params.minTimeMovement / 1000);
+  config.filterBankEnabled = session.filterBankEnabled;
+  config.fastRippleRatio = (float)params.fastRippleRatio;
+  config.artefactSds = (float)params.artefactSds;
+  config.artefactHoldSamples = ceil(rate * artefactHoldMilliseconds / 1000);
+  config.refSds = (float)params.refSds;
+
+  // The baseline is the calibration of the features, set on the detector
+  config.baselineCurrent = false;
+  return config;
+}
+
+SweepResult
+SweepEngine::evaluate(const SweepFeatures &features, const SweepParams &params,
+                      const std::vector<LabeledEvent> &labels,
+                      double toleranceSeconds,
+                      std::vector<SweepDetection> *detections) const {
+
+  SweepResult result;
+  result.params = params;
+
+  const int windowsPerBlock = features.windowsPerBlock;
+  const bool hasMovement = !features.movRms.empty();
+  const bool hasReference = !features.refRms.empty();
+
+  // The plugin's detector, taking over once the calibration has ended
+  const RippleDetectorConfig config = makeConfig(features, params);
+  RippleDetectionCore detector;
+  detector.prepare(session.sampleRate, nullptr, -1);
+  RippleTraceState &state = detector.getState();
+  state.isCalibrating = false;
+  state.rmsMean = features.rmsMean;
+  state.rmsStdDev = features.rmsStdDev;
+  state.movRmsMean = features.movRmsMean;
+  state.movRmsStdDev = features.movRmsStdDev;
+  state.artefactMean = features.slopeMean;
+  state.artefactStdDev = features.slopeStdDev;
+  state.refRmsMean = features.refRmsMean;
+  state.refRmsStdDev = features.refRmsStdDev;
+  detector.applyConfig(config, nullptr);
+
+  SweepListener listener(result, labels, toleranceSeconds, session.sampleRate,
+                         detections);
+  RippleWindowFeatures &windows = detector.getWindows();
+  RippleDetectionBlock block;
+  block.numSamples = features.blockSamples;
+
+  const long long numBlocks = features.rms.size() / windowsPerBlock;
+  for (long long b = features.firstDetectionBlock; b < numBlocks; b++) {
+    const long long blockStart = b * features.blockSamples;
+    const size_t firstWindow = (size_t)b * windowsPerBlock;
+
+    // The block's windows, as the detector would have computed them
+    windows.clear();
+    for (int idx = 0; idx < windowsPerBlock; idx++) {
+      const size_t w = firstWindow + idx;
+      windows.numSamples.push_back(features.windowLength(idx));
+      windows.rms.push_back(features.rms[w]);
+      if (hasMovement)
+        windows.movRms.push_back(features.movRms[w]);
+      if (hasReference)
+        windows.refRms.push_back(features.refRms[w]);
+      if (session.filterBankEnabled)
+        windows.classes.push_back(
+            detector.classifyWindow({features.rms[w],
+                                     features.fastRippleRms[w],
+                                     features.maxSlope[w]}));
+    }
+
+    block.firstSampleNumber = blockStart;
+    block.wallClockMs = (int64_t)(blockStart * 1000 / session.sampleRate);
+    listener.blockStart = blockStart;
+    detector.processFeatures(block, listener);
+  }
+
+  listener.finish();
+  return result;
+}
+
+std::vector<SweepResult>
+SweepEngine::run(const std::vector<SweepParams> &grid,
+                 const std::vector<LabeledEvent> &labels,
+                 double toleranceSeconds) {
+
+  // Distinct window sizes, each streamed from the file once
+  std::map<int, int> featureIndex;
+  std::vector<int> windowSizes;
+  for (const SweepParams &params : grid) {
+    if (featureIndex.emplace(params.rmsSamples, windowSizes.size()).second)
+      windowSizes.push_back(params.rmsSamples);
+  }
+
+  if (!session.cachePath.empty()) {
+    RmsCacheSettings cacheSettings;
+    cacheSettings.sourcePath = session.datPath;
+    cacheSettings.numChannels = session.numChannels;
+    cacheSettings.sampleRate = session.sampleRate;
+    cacheSettings.bitVolts = session.bitVolts;
+    cacheSettings.channels = session.movementChannels;
+    cacheSettings.channels.insert(cacheSettings.channels.end(),
+                                  session.referenceChannels.begin(),
+                                  session.referenceChannels.end());
+    cacheSettings.channels.push_back(session.rippleChannel);
+    if (session.filterBankEnabled)
+      cacheSettings.filterChannel = session.rippleChannel;
+    cacheSettings.strides = session.cacheStrides;
+
+    cache = std::make_unique<RmsCache>();
+    cache->open(session.cachePath, cacheSettings);
+  }
+
+  std::vector<SweepFeatures> features(windowSizes.size());
+  std::vector<std::string> errors(windowSizes.size());
+  parallelFor(windowSizes.size(), numThreads, [&](int idx) {
+    try {
+      features[idx] = extractFeatures(windowSizes[idx]);
+    } catch (const std::exception &e) {
+      errors[idx] = e.what();
+    }
+  });
+  for (const std::string &error : errors) {
+    if (!error.empty())
+      throw std::runtime_error(error);
+  }
+
+  std::vector<SweepResult> results(grid.size());
+  parallelFor(grid.size(), numThreads, [&](int idx) {
+    results[idx] =
+        evaluate(features[featureIndex.at(grid[idx].rmsSamples)], grid[idx],
+                 labels, toleranceSeconds);
+  });
+
+  return results;
+}
+
+std::vector<LabeledEvent> readLabels(const std::string &path) {
+
+  std::ifstream file(path);
+  if (!file)
+    throw std::runtime_error("Cannot open " + path);
+
+  std::vector<LabeledEvent> labels;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    LabeledEvent event;
+    if (!(fields >> event.start))
+      continue;
+    if (!(fields >> event.end))
+      event.end = event.start;
+    labels.push_back(event);
+  }
+
+  std::sort(labels.begin(), labels.end(),
+            [](const LabeledEvent &a, const LabeledEvent &b) {
+              return a.start < b.start;
+            });
+  return labels;
+}
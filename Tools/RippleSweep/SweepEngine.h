@@ -0,0 +1,201 @@
+#ifndef __RIPPLE_SWEEP_ENGINE_H
+#define __RIPPLE_SWEEP_ENGINE_H
+
+#include "../../RippleDetectorConfig.h"
+#include "../../RippleFilterBank.h"
+#include "RmsCache.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** Recording to sweep over: an Open Ephys binary continuous.dat file */
+struct SweepSession {
+  std::string datPath;
+  int numChannels{0};   // Interleaved int16 channels in the file
+  double sampleRate{0.0};
+  double bitVolts{1.0}; // Scale from raw samples to microvolts
+  int rippleChannel{-1};
+  std::vector<int> movementChannels;  // One EMG channel, or the ACC axes
+  std::vector<int> referenceChannels; // ref_input, pooled for the veto
+  bool filterBankEnabled{false};
+  double calibrationSeconds{10.0};
+  int blockSamples{1024}; // Samples per process() block
+
+  // Feature cache next to the recording (optional)
+  std::string cachePath;
+  std::vector<int> cacheStrides{1, 16, 256};
+};
+
+/** Window features of a whole session for one RMS window size. Windows are
+ * cut in every block as in the plugin, the last one of a block being shorter
+ * when the window size does not divide the block */
+struct SweepFeatures {
+  int windowSamples{0};
+  int blockSamples{0};
+  int windowsPerBlock{0};
+  long long firstDetectionBlock{0}; // First block after the calibration
+
+  std::vector<float> rms; // Ripple-band RMS when the filter bank is enabled
+  std::vector<float> fastRippleRms;
+  std::vector<float> maxSlope;
+  std::vector<float> movRms;
+  std::vector<float> refRms;
+
+  // Calibration statistics (mean and sample standard deviation)
+  double rmsMean{0.0}, rmsStdDev{0.0};
+  double movRmsMean{0.0}, movRmsStdDev{0.0};
+  double slopeMean{0.0}, slopeStdDev{0.0};
+  double refRmsMean{0.0}, refRmsStdDev{0.0};
+
+  /** Sets the window layout of blocks of blockSamples */
+  void setLayout(int windowSamples, int blockSamples);
+
+  /** Samples in the window at index within its block */
+  int windowLength(int index) const {
+    const int length = std::min(windowSamples, blockSamples);
+    return std::min(length, blockSamples - index * length);
+  }
+};
+
+/** One point of the parameter grid, in the units of the plugin parameters */
+struct SweepParams {
+  int rmsSamples{128};
+  double rippleSds{5.0};
+  double timeThreshold{10.0};   // ms
+  double refractoryTime{140.0}; // ms
+  double movSds{5.0};
+  double minTimeSteady{5000.0}; // ms
+  double minTimeMovement{10.0}; // ms
+  double fastRippleRatio{1.5};
+  double artefactSds{10.0};
+  double refSds{5.0};
+};
+
+/** Detection reported by SweepEngine::evaluate() */
+struct SweepDetection {
+  long long sample; // Last sample of the window that triggered it
+  bool blocked;     // True if movement blocked the output TTL
+};
+
+/** Labeled ripple, in seconds from the start of the file */
+struct LabeledEvent {
+  double start{0.0};
+  double end{0.0};
+};
+
+/** Outcome of one grid point */
+struct SweepResult {
+  SweepParams params;
+  int detections{0}; // Detections that would have raised the output TTL
+  int blocked{0};    // Detections blocked by movement
+
+  // Scores against the labeled events, if any were given
+  int truePositives{0};  // Labels hit by at least one detection
+  int falsePositives{0}; // Detections outside every label
+  int falseNegatives{0}; // Labels without a detection
+};
+
+/**
+  Accumulates the window features of one window size from a stream of
+  samples, in the same windows and with the same filter bank as the plugin.
+  The layout of features must be set.
+**/
+class FeatureBuilder {
+public:
+  FeatureBuilder(SweepFeatures &features, double sampleRate,
+                 bool filterBankEnabled, bool hasMovement,
+                 int numRefChannels);
+
+  /** Adds one sample of the ripple channel, with the summed squares of the
+   * movement and reference channels at the same instant */
+  inline void addSample(float ripple, double movSquares, double refSquares) {
+    window[windowFill++] = ripple;
+    rippleSumSquares += (double)ripple * ripple;
+    movSumSquares += movSquares;
+    refSumSquares += refSquares;
+    if (++blockFill == features.blockSamples) {
+      blockFill = 0;
+      finishWindow();
+    } else if (windowFill == (int)window.size()) {
+      finishWindow();
+    }
+  }
+
+private:
+  void finishWindow();
+
+  SweepFeatures &features;
+  bool filterBankEnabled;
+  bool hasMovement;
+  int numRefChannels;
+  RippleFilterBank filterBank;
+  std::vector<float> window;
+  int windowFill{0};
+  int blockFill{0};
+  double rippleSumSquares{0.0};
+  double movSumSquares{0.0};
+  double refSumSquares{0.0};
+};
+
+/**
+  Offline replay of the ripple detector over a recorded session.
+
+  The expensive part of the detector, the RMS (and filter bank) features, only
+  depends on the window size, so it is computed once per distinct rms_samples
+  value. Every grid point then runs RippleDetectionCore, the plugin's
+  threshold, time, reference veto, refractory and movement state machine,
+  over those features instead of the samples. Both stages run on a pool of
+  threads.
+
+  The session is cut into blocks of blockSamples, and windows within each
+  block, as the GUI and process() do; a trailing partial block is ignored.
+  Refractory periods run on a clock that advances once per block, from the
+  sample number of its first sample, as with ripple-sidecar --sample-clock,
+  so a sweep makes the detections ripple-sidecar makes on the same blocks.
+  The CNN detector, the brain-state gate and ttl_percent are not modelled.
+**/
+class SweepEngine {
+public:
+  SweepEngine(const SweepSession &session, int numThreads);
+
+  /** Evaluates every grid point. Throws std::runtime_error if the session
+   * cannot be read */
+  std::vector<SweepResult> run(const std::vector<SweepParams> &grid,
+                               const std::vector<LabeledEvent> &labels,
+                               double toleranceSeconds);
+
+  /** Computes the features for one window size, from the cache when it has
+   * an aligned level, otherwise by streaming the session once */
+  SweepFeatures extractFeatures(int windowSamples) const;
+
+  /** Fills in the calibration statistics of features, from the windows in
+   * the calibration period at the start of the session */
+  void calibrate(SweepFeatures &features) const;
+
+  /** Runs the plugin's detection core over the features for one grid point,
+   * optionally listing every detection */
+  SweepResult evaluate(const SweepFeatures &features,
+                       const SweepParams &params,
+                       const std::vector<LabeledEvent> &labels,
+                       double toleranceSeconds,
+                       std::vector<SweepDetection> *detections = nullptr) const;
+
+  static constexpr double artefactHoldMilliseconds = 20.0;
+
+private:
+  RippleDetectorConfig makeConfig(const SweepFeatures &features,
+                                  const SweepParams &params) const;
+  void streamFeatures(SweepFeatures &features) const;
+  void readCachedFeatures(SweepFeatures &features) const;
+
+  SweepSession session;
+  int numThreads;
+  std::unique_ptr<RmsCache> cache;
+};
+
+/** Reads labeled events from a CSV file with one "start[,end]" row (seconds)
+ * per event. Lines that do not start with a number are skipped */
+std::vector<LabeledEvent> readLabels(const std::string &path);
+
+#endif